@@ -0,0 +1,312 @@
+/**
+ * @file fanout_bench.c
+ * @brief Benchmark for the recipient scan of a broadcast
+ *
+ * Every broadcast scans the whole client list for the clients it should
+ * reach. This benchmark times that scan over three layouts of the same
+ * clients: walking the registry's Client records through its dense
+ * pointer array, scanning an array with one record per client (the
+ * layout the client snapshot used before it was split into columns),
+ * and the current column-wise client snapshot.
+ *
+ * The registry is churned before measuring, releasing and reacquiring
+ * half of the clients, so its dense array is in the scattered order a
+ * long-running server ends up with. Nine clients in ten have a
+ * nickname, and each scan skips unnamed clients and one nickname, as a
+ * chat message broadcast does.
+ *
+ * @author Jeremiah Hughes & Anthony Patton
+ * @date April 2025
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "server/chat_handler.h"
+#include "server/client_registry.h"
+#include "server/client_snapshot.h"
+
+#define BENCH_DEFAULT_MAX_CLIENTS 65536
+#define BENCH_DEFAULT_VISITS 50000000L
+#define BENCH_MIN_CLIENTS 1024
+
+/**
+ * @brief One client in the record-per-client layout
+ */
+typedef struct {
+    int id;
+    int socket;
+    int shard;
+    int protocol_version;
+    int has_nickname;
+    int presence_subscribed;
+    char nickname[MAX_USERNAME_LEN];
+} RecordEntry;
+
+static volatile long sink = 0;
+
+/**
+ * @brief Returns the current monotonic time
+ *
+ * @return Time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Fills in the registry fields of a freshly acquired client
+ *
+ * @param client The client
+ * @param seed Random state
+ */
+static void setup_client(Client *client, unsigned int *seed) {
+    client->socket = 1000 + client->slot;
+    client->protocol_version = PROTOCOL_VERSION_COMPACT;
+    client->presence_subscribed = 0;
+    client->has_nickname = rand_r(seed) % 10 != 0;
+    memset(client->nickname, 0, sizeof(client->nickname));
+    if (client->has_nickname) {
+        snprintf(client->nickname, sizeof(client->nickname), "user-%d", client->slot);
+    }
+}
+
+/**
+ * @brief Fills the registry with clients in a churned order
+ *
+ * @param clients Number of clients
+ * @return 0 on success, -1 on failure
+ */
+static int populate_registry(const int clients) {
+    unsigned int seed = 42;
+
+    if (client_registry_init(clients) != 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < clients; i++) {
+        Client *client = client_registry_acquire();
+        if (!client) {
+            return -1;
+        }
+        setup_client(client, &seed);
+    }
+
+    for (int i = 0; i < clients / 2; i++) {
+        client_registry_release(client_registry_at(rand_r(&seed) % client_registry_count()));
+    }
+
+    while (client_registry_count() < clients) {
+        setup_client(client_registry_acquire(), &seed);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Scans the registry's Client records
+ *
+ * @param exclude_nickname Nickname to skip
+ * @param indices Receives the dense index of every match
+ * @return Number of matches
+ */
+static int scan_registry(const char *exclude_nickname, int *indices) {
+    int count = 0;
+
+    for (int i = 0; i < client_registry_count(); i++) {
+        const Client *client = client_registry_at(i);
+        if (!client->has_nickname || client->presence_subscribed) {
+            continue;
+        }
+        if (strcmp(client->nickname, exclude_nickname) == 0) {
+            continue;
+        }
+        if (client->socket == -1) {
+            continue;
+        }
+        indices[count++] = i;
+    }
+
+    return count;
+}
+
+/**
+ * @brief Scans the record-per-client layout
+ *
+ * @param entries The records
+ * @param entry_count Number of records
+ * @param exclude_nickname Nickname to skip
+ * @param indices Receives the index of every match
+ * @return Number of matches
+ */
+static int scan_records(const RecordEntry *entries, const int entry_count, const char *exclude_nickname,
+                        int *indices) {
+    int count = 0;
+
+    for (int i = 0; i < entry_count; i++) {
+        const RecordEntry *entry = &entries[i];
+        if (!entry->has_nickname || entry->presence_subscribed) {
+            continue;
+        }
+        if (strcmp(entry->nickname, exclude_nickname) == 0) {
+            continue;
+        }
+        if (entry->socket == -1) {
+            continue;
+        }
+        indices[count++] = i;
+    }
+
+    return count;
+}
+
+/**
+ * @brief Times one layout
+ *
+ * @param layout 0 for the registry, 1 for records, 2 for the snapshot
+ * @param entries The record-per-client copy of the clients
+ * @param snapshot The snapshot copy of the clients
+ * @param clients Number of clients
+ * @param rounds Number of scans
+ * @param indices Scratch space for the matches
+ * @return Nanoseconds per client visited
+ */
+static double time_scan(const int layout, const RecordEntry *entries, const ClientSnapshot *snapshot,
+                        const int clients, const int rounds, int *indices) {
+    const char *exclude = "user-7";
+    long matches = 0;
+
+    const double start = now();
+    for (int round = 0; round < rounds; round++) {
+        switch (layout) {
+            case 0:
+                matches += scan_registry(exclude, indices);
+                break;
+            case 1:
+                matches += scan_records(entries, clients, exclude, indices);
+                break;
+            default:
+                matches += client_snapshot_select(snapshot, CLIENT_SNAPSHOT_NAMED, CLIENT_SNAPSHOT_SUBSCRIBED,
+                                                  exclude, -1, indices);
+                break;
+        }
+    }
+    const double elapsed = now() - start;
+
+    sink += matches;
+    return elapsed * 1e9 / ((double) rounds * clients);
+}
+
+/**
+ * @brief Runs the benchmark with a given number of clients
+ *
+ * @param clients Number of clients
+ * @param visits Number of client visits per layout
+ * @return 0 on success, -1 on failure
+ */
+static int run(const int clients, const long visits) {
+    if (populate_registry(clients) != 0) {
+        fprintf(stderr, "Failed to set up %d clients\n", clients);
+        client_registry_destroy();
+        return -1;
+    }
+
+    RecordEntry *entries = malloc(clients * sizeof(RecordEntry));
+    ClientSnapshot *snapshot = client_snapshot_alloc(clients);
+    int *indices = malloc(clients * sizeof(int));
+    if (!entries || !snapshot || !indices) {
+        fprintf(stderr, "Failed to allocate memory for %d clients\n", clients);
+        free(entries);
+        free(snapshot);
+        free(indices);
+        client_registry_destroy();
+        return -1;
+    }
+
+    for (int i = 0; i < clients; i++) {
+        const Client *client = client_registry_at(i);
+        RecordEntry *entry = &entries[i];
+
+        entry->id = client->id;
+        entry->socket = client->socket;
+        entry->shard = 0;
+        entry->protocol_version = client->protocol_version;
+        entry->has_nickname = client->has_nickname;
+        entry->presence_subscribed = client->presence_subscribed;
+        memcpy(entry->nickname, client->nickname, sizeof(entry->nickname));
+
+        client_snapshot_add(snapshot, client->id, client->socket, 0, client->protocol_version,
+                            client->has_nickname ? CLIENT_SNAPSHOT_NAMED : 0, client->nickname);
+    }
+
+    const int rounds = visits / clients > 0 ? (int) (visits / clients) : 1;
+    const double registry = time_scan(0, entries, snapshot, clients, rounds, indices);
+    const double records = time_scan(1, entries, snapshot, clients, rounds, indices);
+    const double columns = time_scan(2, entries, snapshot, clients, rounds, indices);
+
+    printf("%8d %12.2f %12.2f %12.2f %9.2fx\n", clients, registry, records, columns,
+           columns > 0.0 ? records / columns : 0.0);
+
+    free(entries);
+    free(snapshot);
+    free(indices);
+    client_registry_destroy();
+    return 0;
+}
+
+/**
+ * @brief Prints the command-line usage
+ *
+ * @param program Name of the executable
+ */
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-n max_clients] [-v visits_per_layout]\n", program);
+}
+
+/**
+ * @brief Entry point of the benchmark
+ *
+ * @param argc Number of arguments
+ * @param argv Argument values
+ * @return 0 on success, 1 on failure
+ */
+int main(const int argc, char *argv[]) {
+    int max_clients = BENCH_DEFAULT_MAX_CLIENTS;
+    long visits = BENCH_DEFAULT_VISITS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:v:")) != -1) {
+        switch (opt) {
+            case 'n':
+                max_clients = atoi(optarg);
+                break;
+            case 'v':
+                visits = atol(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (max_clients < BENCH_MIN_CLIENTS || max_clients > CLIENT_REGISTRY_MAX_CAPACITY || visits <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("Recipient scan cost in ns per client, %ld client visits per layout\n", visits);
+    printf("%8s %12s %12s %12s %10s\n", "clients", "registry", "records", "snapshot", "speedup");
+
+    for (int clients = BENCH_MIN_CLIENTS; clients <= max_clients; clients *= 4) {
+        if (run(clients, visits) != 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
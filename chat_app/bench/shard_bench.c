@@ -0,0 +1,375 @@
+/**
+ * @file shard_bench.c
+ * @brief Throughput benchmark for sharded room fan-out
+ *
+ * Runs the server's event loops, shard queues and per-shard room
+ * registries without any sockets. Every shard publishes messages to
+ * randomly chosen rooms; each message travels to the room's owning shard,
+ * which forwards one delivery to every shard holding members of the room,
+ * just as the chat handler does. The benchmark is repeated for 1, 2, 4, ...
+ * shards and reports messages and member deliveries per second.
+ *
+ * Every shard publishes the same number of messages, so the total work
+ * grows with the shard count and perfect scaling keeps the time constant.
+ *
+ * @author Jeremiah Hughes & Anthony Patton
+ * @date April 2025
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "server/event_loop.h"
+#include "server/room_registry.h"
+#include "server/shard.h"
+
+#define BENCH_DEFAULT_ROOMS 256
+#define BENCH_DEFAULT_MEMBERS 32
+#define BENCH_DEFAULT_MESSAGES 200000
+#define BENCH_BATCH 256
+
+typedef enum {
+    BENCH_PUBLISH,
+    BENCH_DELIVER
+} BenchOp;
+
+typedef struct {
+    BenchOp op;
+    int room;
+    int count;
+} BenchMessage;
+
+typedef struct {
+    _Alignas(64) atomic_ullong published;
+    atomic_ullong handled;
+    atomic_ullong forwarded;
+    atomic_ullong received;
+    atomic_ullong delivered;
+    unsigned int seed;
+    int remaining;
+} ShardCounters;
+
+static ShardCounters *counters = NULL;
+static int room_count = BENCH_DEFAULT_ROOMS;
+static int members_per_room = BENCH_DEFAULT_MEMBERS;
+static int messages_per_shard = BENCH_DEFAULT_MESSAGES;
+
+/**
+ * @brief Formats the name of a benchmark room
+ *
+ * @param index Index of the room
+ * @param name Buffer of MAX_ROOM_NAME_LEN bytes receiving the name
+ */
+static void room_name(const int index, char *name) {
+    snprintf(name, MAX_ROOM_NAME_LEN, "room-%d", index);
+}
+
+/**
+ * @brief Adds a relaxed increment to a counter owned by one shard
+ *
+ * @param counter The counter
+ * @param amount Amount to add
+ */
+static void count(atomic_ullong *counter, const unsigned long long amount) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + amount,
+                          memory_order_relaxed);
+}
+
+/**
+ * @brief Allocates a benchmark message, exiting on failure
+ *
+ * @return The message
+ */
+static BenchMessage *new_message(void) {
+    BenchMessage *message = malloc(sizeof(BenchMessage));
+    if (!message) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    return message;
+}
+
+/**
+ * @brief Sends a message to a shard, exiting on failure
+ *
+ * @param shard The target shard
+ * @param message The message
+ */
+static void send_or_die(const int shard, BenchMessage *message) {
+    if (shard_send(shard, message) != 0) {
+        fprintf(stderr, "shard_send() failed\n");
+        exit(1);
+    }
+}
+
+/**
+ * @brief Fans a published message out to the shards holding its room's members
+ *
+ * Runs on the room's owning shard and mirrors the chat handler: members
+ * on this shard are counted directly and every other shard with members
+ * gets one delivery.
+ *
+ * @param shard The owning shard
+ * @param room_index Index of the room
+ */
+static void fan_out(const int shard, const int room_index) {
+    char name[MAX_ROOM_NAME_LEN];
+    room_name(room_index, name);
+
+    const Room *room = room_registry_find(shard, name);
+    if (!room) {
+        return;
+    }
+
+    const int shards = shard_count();
+    int per_shard[shards];
+    memset(per_shard, 0, sizeof(per_shard));
+
+    for (int i = 0; i < room->member_count; i++) {
+        per_shard[room->members[i].shard]++;
+    }
+
+    for (int target = 0; target < shards; target++) {
+        if (per_shard[target] == 0) {
+            continue;
+        }
+
+        if (target == shard) {
+            count(&counters[shard].delivered, per_shard[target]);
+            continue;
+        }
+
+        BenchMessage *delivery = new_message();
+        delivery->op = BENCH_DELIVER;
+        delivery->room = room_index;
+        delivery->count = per_shard[target];
+        count(&counters[shard].forwarded, 1);
+        send_or_die(target, delivery);
+    }
+}
+
+/**
+ * @brief Shard handler of the benchmark
+ *
+ * @param shard The shard running the handler
+ * @param message The BenchMessage
+ */
+static void handle_message(const int shard, void *message) {
+    const BenchMessage *bench = message;
+
+    if (bench->op == BENCH_PUBLISH) {
+        fan_out(shard, bench->room);
+        count(&counters[shard].handled, 1);
+    } else {
+        count(&counters[shard].delivered, bench->count);
+        count(&counters[shard].received, 1);
+    }
+
+    free(message);
+}
+
+/**
+ * @brief Notify callback that publishes one batch of messages
+ *
+ * The loop notifies itself again until its quota is used up, so other
+ * shards' messages are handled in between batches.
+ *
+ * @param loop The publishing event loop
+ * @param token Unused
+ */
+static void publish_batch(EventLoop *loop, const int token) {
+    (void) token;
+    const int shard = event_loop_index(loop);
+    ShardCounters *own = &counters[shard];
+    const int batch = own->remaining < BENCH_BATCH ? own->remaining : BENCH_BATCH;
+
+    for (int i = 0; i < batch; i++) {
+        BenchMessage *message = new_message();
+        char name[MAX_ROOM_NAME_LEN];
+
+        message->op = BENCH_PUBLISH;
+        message->room = rand_r(&own->seed) % room_count;
+        message->count = 0;
+        room_name(message->room, name);
+        send_or_die(shard_for_key(name, MAX_ROOM_NAME_LEN), message);
+    }
+
+    own->remaining -= batch;
+    count(&own->published, batch);
+
+    if (own->remaining > 0) {
+        event_loop_notify(loop, 0);
+    }
+}
+
+/**
+ * @brief Returns a monotonic timestamp in seconds
+ *
+ * @return The current time
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Checks whether every published message has been fully handled
+ *
+ * @param shards Number of shards
+ * @return 1 when the run is complete, 0 otherwise
+ */
+static int run_complete(const int shards) {
+    unsigned long long published = 0, handled = 0, forwarded = 0, received = 0;
+
+    for (int i = 0; i < shards; i++) {
+        published += atomic_load_explicit(&counters[i].published, memory_order_relaxed);
+        handled += atomic_load_explicit(&counters[i].handled, memory_order_relaxed);
+        forwarded += atomic_load_explicit(&counters[i].forwarded, memory_order_relaxed);
+        received += atomic_load_explicit(&counters[i].received, memory_order_relaxed);
+    }
+
+    return published == (unsigned long long) messages_per_shard * shards &&
+           handled == published && received == forwarded;
+}
+
+/**
+ * @brief Runs the benchmark with a given number of shards
+ *
+ * @param shards Number of shards
+ * @param elapsed Receives the run time in seconds
+ * @param delivered Receives the number of member deliveries
+ * @return 0 on success, -1 on failure
+ */
+static int run(const int shards, double *elapsed, unsigned long long *delivered) {
+    counters = calloc(shards, sizeof(ShardCounters));
+    if (!counters || event_loop_pool_start(shards) != 0 || room_registry_init(shards) != 0 ||
+        shard_init(shards, handle_message, free) != 0) {
+        fprintf(stderr, "Failed to set up %d shards\n", shards);
+        return -1;
+    }
+
+    /* The loops are idle, so the rooms can be filled from this thread;
+     * the notifications below publish the tables to the loops. */
+    int member_id = 1;
+    for (int i = 0; i < room_count; i++) {
+        char name[MAX_ROOM_NAME_LEN];
+        room_name(i, name);
+        const int owner = shard_for_key(name, MAX_ROOM_NAME_LEN);
+
+        for (int j = 0; j < members_per_room; j++) {
+            const RoomMember member = {
+                .client_id = member_id++,
+                .shard = member_id % shards,
+                .protocol_version = 0
+            };
+            room_registry_join(owner, name, &member);
+        }
+    }
+
+    for (int i = 0; i < shards; i++) {
+        counters[i].seed = (unsigned int) i + 1;
+        counters[i].remaining = messages_per_shard;
+    }
+
+    event_loop_set_notify_callback(publish_batch);
+
+    const double start = now();
+    for (int i = 0; i < shards; i++) {
+        event_loop_notify(event_loop_pool_get(i), 0);
+    }
+
+    while (!run_complete(shards)) {
+        usleep(1000);
+    }
+    *elapsed = now() - start;
+
+    event_loop_pool_stop();
+    shard_destroy();
+    room_registry_destroy();
+
+    *delivered = 0;
+    for (int i = 0; i < shards; i++) {
+        *delivered += atomic_load(&counters[i].delivered);
+    }
+
+    free(counters);
+    counters = NULL;
+    return 0;
+}
+
+/**
+ * @brief Prints the command-line usage
+ *
+ * @param program Name of the executable
+ */
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-s max_shards] [-r rooms] [-m members_per_room] [-n messages_per_shard]\n",
+            program);
+}
+
+/**
+ * @brief Entry point of the benchmark
+ *
+ * @param argc Number of arguments
+ * @param argv Argument values
+ * @return 0 on success, 1 on failure
+ */
+int main(const int argc, char *argv[]) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_shards = cores > 0 ? (int) cores : 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:r:m:n:")) != -1) {
+        switch (opt) {
+            case 's':
+                max_shards = atoi(optarg);
+                break;
+            case 'r':
+                room_count = atoi(optarg);
+                break;
+            case 'm':
+                members_per_room = atoi(optarg);
+                break;
+            case 'n':
+                messages_per_shard = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (max_shards <= 0 || room_count <= 0 || members_per_room <= 0 || messages_per_shard <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("%d rooms, %d members per room, %d messages per shard\n",
+           room_count, members_per_room, messages_per_shard);
+    printf("%8s %14s %16s %9s\n", "shards", "messages/s", "deliveries/s", "speedup");
+
+    double baseline = 0.0;
+    for (int shards = 1; shards <= max_shards; shards *= 2) {
+        double elapsed = 0.0;
+        unsigned long long delivered = 0;
+
+        if (run(shards, &elapsed, &delivered) != 0) {
+            return 1;
+        }
+
+        const double rate = (double) messages_per_shard * shards / elapsed;
+        if (shards == 1) {
+            baseline = rate;
+        }
+
+        printf("%8d %14.0f %16.0f %8.2fx\n", shards, rate, (double) delivered / elapsed, rate / baseline);
+    }
+
+    return 0;
+}
@@ -15,12 +15,12 @@ int init_client(const int argc, char **argv) {
 
     logger_log(LOG_INFO, "Chat client starting up");
 
-    logger_log(LOG_DEBUG, "Protocol structure sizes (client):");
-    logger_log(LOG_DEBUG, "  MessageHeader:      %zu bytes", sizeof(MessageHeader));
-    logger_log(LOG_DEBUG, "  NicknameRequest:    %zu bytes", sizeof(NicknameRequest));
-    logger_log(LOG_DEBUG, "  NicknameResponse:   %zu bytes", sizeof(NicknameResponse));
-    logger_log(LOG_DEBUG, "  ChatMessage:        %zu bytes", sizeof(ChatMessage));
-    logger_log(LOG_DEBUG, "  UserNotification:   %zu bytes", sizeof(UserNotification));
+    LOGGER_DEBUG("Protocol structure sizes (client):");
+    LOGGER_DEBUG("  MessageHeader:      %d bytes", PROTOCOL_HEADER_SIZE);
+    LOGGER_DEBUG("  NicknameRequest:    %zu bytes", sizeof(NicknameRequest));
+    LOGGER_DEBUG("  NicknameResponse:   %zu bytes", sizeof(NicknameResponse));
+    LOGGER_DEBUG("  ChatMessage:        %zu bytes", sizeof(ChatMessage));
+    LOGGER_DEBUG("  UserNotification:   %zu bytes", sizeof(UserNotification));
 
     if (net_handler_init() != 0) {
         logger_log(LOG_ERROR, "Failed to initialize network handler");
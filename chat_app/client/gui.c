@@ -330,7 +330,7 @@ void gui_update_user_list(const char *user_list, const int length) {
         const char *p = user_list;
     
         if (p && *p) {
-        logger_log(LOG_DEBUG, "User list header: %s", p);
+        LOGGER_DEBUG("User list header: %s", p);
         
                 const size_t header_len = strlen(p);
         if (header_len + 1 >= length) {
@@ -356,7 +356,7 @@ void gui_update_user_list(const char *user_list, const int length) {
                 break;
             }
             
-                        logger_log(LOG_DEBUG, "Adding user to list: %s", p);
+                        LOGGER_DEBUG("Adding user to list: %s", p);
             GtkTreeIter iter;
             gtk_list_store_append(user_list_store, &iter);
             gtk_list_store_set(user_list_store, &iter, 0, p, -1);
@@ -654,12 +654,12 @@ static void on_user_list(const char *user_list, const int length) {
         return;
     }
     
-    if (length <= 0 || length > MAX_MESSAGE_LEN) {
+    if (length <= 0) {
         logger_log(LOG_WARNING, "Received invalid user list length: %d", length);
         return;
     }
     
-        logger_log(LOG_DEBUG, "Processing user list message of length %d", length);
+        LOGGER_DEBUG("Processing user list message of length %d", length);
     
     gui_update_user_list(user_list, length);
 }
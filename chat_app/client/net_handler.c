@@ -8,15 +8,24 @@
 #include <time.h>
 #include <errno.h>
 #include "net_handler.h"
+#include "../common/frame_decoder.h"
 #include "../common/logger.h"
 #include "../common/protocol.h"
 
+#define NET_RX_RING_SIZE 16384
+
 static int socket_fd = -1;
 static int connected = 0;
 static int has_nickname = 0;
 static char nickname[MAX_USERNAME_LEN];
 static pthread_t receive_thread;
 static int receiving = 0;
+static int protocol_version = PROTOCOL_VERSION_LEGACY;
+static uint32_t roster_version = 0;
+static int roster_resync_pending = 0;
+static char *user_list_pages = NULL;
+static size_t user_list_length = 0;
+static int user_list_next_page = 0;
 
 static NicknameResponseCallback nickname_callback = NULL;
 static ChatMessageCallback chat_callback = NULL;
@@ -24,15 +33,24 @@ static UserJoinCallback user_join_callback = NULL;
 static UserLeaveCallback user_leave_callback = NULL;
 static UserListCallback user_list_callback = NULL;
 static DisconnectCallback disconnect_callback = NULL;
+static RoomEventCallback room_event_callback = NULL;
+static RoomMessageCallback room_message_callback = NULL;
 
 static pthread_mutex_t net_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+static void reset_user_list_pages(void) {
+    free(user_list_pages);
+    user_list_pages = NULL;
+    user_list_length = 0;
+    user_list_next_page = 0;
+}
+
 static void __attribute__((destructor)) net_handler_cleanup(void) {
         net_handler_disconnect();
     
         pthread_mutex_destroy(&net_mutex);
     
-    logger_log(LOG_DEBUG, "Network handler resources cleaned up");
+    LOGGER_DEBUG("Network handler resources cleaned up");
 }
 
 int net_handler_init(void) {
@@ -41,6 +59,9 @@ int net_handler_init(void) {
     has_nickname = 0;
     memset(nickname, 0, sizeof(nickname));
     receiving = 0;
+    protocol_version = PROTOCOL_VERSION_LEGACY;
+    roster_version = 0;
+    roster_resync_pending = 0;
     
     return 0;
 }
@@ -57,6 +78,28 @@ static void log_connection_error(const char *message) {
     }
 }
 
+static int negotiate_protocol(const int sock) {
+    const uint8_t requested = PROTOCOL_VERSION_MAX;
+    if (send_message(sock, MSG_HELLO, &requested, sizeof(requested)) <= 0) {
+        logger_log(LOG_WARNING, "Failed to send protocol negotiation, using the legacy format");
+        return PROTOCOL_VERSION_LEGACY;
+    }
+
+    MessageType type;
+    uint8_t buffer[COMPACT_MAX_PAYLOAD];
+    uint32_t length;
+    const int result = receive_message(sock, &type, buffer, &length);
+
+    if (result > 0 && type == MSG_HELLO && length >= 1 &&
+        buffer[0] >= PROTOCOL_VERSION_LEGACY && buffer[0] <= PROTOCOL_VERSION_MAX) {
+        logger_log(LOG_INFO, "Negotiated protocol version %d", buffer[0]);
+        return buffer[0];
+    }
+
+    logger_log(LOG_INFO, "Server did not negotiate a protocol version, using the legacy format");
+    return PROTOCOL_VERSION_LEGACY;
+}
+
 int net_handler_connect(const char *server_ip) {
     pthread_mutex_lock(&net_mutex);
     
@@ -102,7 +145,11 @@ int net_handler_connect(const char *server_ip) {
         return -1;
     }
     
-        connected = 1;
+        protocol_version = negotiate_protocol(socket_fd);
+    roster_version = 0;
+    roster_resync_pending = 0;
+    reset_user_list_pages();
+    connected = 1;
     
     pthread_mutex_unlock(&net_mutex);
     
@@ -118,13 +165,7 @@ void net_handler_disconnect(void) {
     
     if (connected && socket_fd != -1) {
                         if (connected) {
-                        uint8_t buffer[sizeof(MessageHeader)];
-            memset(buffer, 0, sizeof(buffer));
-            MessageHeader *header = (MessageHeader *)buffer;
-            header->type = MSG_DISCONNECT;
-            header->length = 0;
-            
-                        send(socket_fd, buffer, sizeof(buffer), 0);
+                        protocol_send(socket_fd, protocol_version, MSG_DISCONNECT, NULL, 0);
         }
         
                 shutdown(socket_fd, SHUT_RDWR);
@@ -139,185 +180,380 @@ void net_handler_disconnect(void) {
     logger_log(LOG_INFO, "Disconnected from server");
 }
 
-static void *receive_thread_func(void *arg) {
-    while (receiving) {
-        MessageType type;
-        uint8_t buffer[8192];         uint32_t length;
-        
-        pthread_mutex_lock(&net_mutex);
-        const int is_connected = connected;
-        const int sock = socket_fd;
-        pthread_mutex_unlock(&net_mutex);
-        
-        if (!is_connected || sock == -1) {
-            log_connection_error("Connection lost: Socket closed or not connected");
-            break;
-        }
-        
-        const int result = receive_message(sock, &type, buffer, &length);
-        
-        if (result == 0) {
-                        pthread_mutex_lock(&net_mutex);
-            connected = 0;
-            has_nickname = 0;
-            close(socket_fd);
-            socket_fd = -1;
-            pthread_mutex_unlock(&net_mutex);
-            
-            log_connection_error("Connection closed by server");
-            
-                        if (disconnect_callback) {
-                disconnect_callback();
-            }
-            
-            break;
-        } else if (result < 0) {
-                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                                if (!receiving) {
-                                        break;
-                }
-                
-                                continue;
-            }
-            
-                        pthread_mutex_lock(&net_mutex);
-            connected = 0;
-            has_nickname = 0;
-            close(socket_fd);
-            socket_fd = -1;
-            pthread_mutex_unlock(&net_mutex);
-            
-            log_connection_error("Connection error: Failed to receive data from server");
-            
-                        if (disconnect_callback) {
-                disconnect_callback();
-            }
-            
-            break;
+static void connection_lost(const char *message) {
+    pthread_mutex_lock(&net_mutex);
+    connected = 0;
+    has_nickname = 0;
+    if (socket_fd != -1) {
+        close(socket_fd);
+        socket_fd = -1;
+    }
+    pthread_mutex_unlock(&net_mutex);
+
+    log_connection_error(message);
+
+    if (disconnect_callback) {
+        disconnect_callback();
+    }
+}
+
+/* Puts a paged user list back together. A page headed "Users" is a whole
+ * list on its own; pages headed "Users <page>/<pages>" are collected until
+ * the last one arrives. Returns 1 with the complete list in list and
+ * list_length, 0 while pages are still missing, -1 on a malformed page. */
+static int collect_user_list_page(const char *page, const uint32_t length, const char **list, int *list_length) {
+    const size_t header_length = strnlen(page, length);
+    if (header_length == length) {
+        return -1;
+    }
+
+    if (strcmp(page, USER_LIST_HEADER) == 0) {
+        reset_user_list_pages();
+        *list = page;
+        *list_length = (int) length;
+        return 1;
+    }
+
+    int index = 0;
+    int total = 0;
+    if (sscanf(page, USER_LIST_HEADER " %d/%d", &index, &total) != 2 || index < 1 || index > total) {
+        return -1;
+    }
+
+    if (index == 1) {
+        reset_user_list_pages();
+        user_list_pages = malloc(sizeof(USER_LIST_HEADER));
+        if (!user_list_pages) {
+            return -1;
         }
-        
-                switch (type) {
-            case MSG_NICKNAME_RESPONSE: {
-                NicknameResponse *resp = (NicknameResponse *)buffer;
-                logger_log(LOG_INFO, "Received nickname response: %s", resp->message);
+        memcpy(user_list_pages, USER_LIST_HEADER, sizeof(USER_LIST_HEADER));
+        user_list_length = sizeof(USER_LIST_HEADER);
+        user_list_next_page = 1;
+    }
+
+    if (index != user_list_next_page) {
+        logger_log(LOG_WARNING, "Received user list page %d out of order, expected %d", index, user_list_next_page);
+        reset_user_list_pages();
+        return -1;
+    }
+
+    const size_t names_length = length - header_length - 1;
+    char *grown = realloc(user_list_pages, user_list_length + names_length);
+    if (!grown) {
+        reset_user_list_pages();
+        return -1;
+    }
+    memcpy(grown + user_list_length, page + header_length + 1, names_length);
+    user_list_pages = grown;
+    user_list_length += names_length;
+    user_list_next_page++;
+
+    if (index < total) {
+        return 0;
+    }
+
+    *list = user_list_pages;
+    *list_length = (int) user_list_length;
+    user_list_next_page = 0;
+    return 1;
+}
+
+static int dispatch_message(const MessageType type, uint8_t *buffer, const size_t buffer_size, const uint32_t length) {
+    switch (type) {
+        case MSG_NICKNAME_RESPONSE: {
+            NicknameResponse *resp = (NicknameResponse *)buffer;
+            logger_log(LOG_INFO, "Received nickname response: %s", resp->message);
                 
-                if (resp->status == STATUS_SUCCESS) {
-                    pthread_mutex_lock(&net_mutex);
-                    has_nickname = 1;
-                    pthread_mutex_unlock(&net_mutex);
-                } else {
-                                        logger_log(LOG_WARNING, "Nickname rejected by server: %s", resp->message);
+            if (resp->status == STATUS_SUCCESS) {
+                pthread_mutex_lock(&net_mutex);
+                has_nickname = 1;
+                pthread_mutex_unlock(&net_mutex);
+            } else {
+                                    logger_log(LOG_WARNING, "Nickname rejected by server: %s", resp->message);
                     
-                                        char error_msg[MAX_MESSAGE_LEN];
-                                                            snprintf(error_msg, sizeof(error_msg), "Connection rejected: %.980s", 
-                             resp->message);                     log_connection_error(error_msg);
+                                    char error_msg[MAX_MESSAGE_LEN];
+                                                        snprintf(error_msg, sizeof(error_msg), "Connection rejected: %.980s", 
+                         resp->message);                     log_connection_error(error_msg);
                     
-                                        if (nickname_callback) {
-                        nickname_callback(resp);
-                    }
+                                    if (nickname_callback) {
+                    nickname_callback(resp);
+                }
                     
-                                        pthread_mutex_lock(&net_mutex);
-                    connected = 0;
-                    has_nickname = 0;
-                    close(socket_fd);
-                    socket_fd = -1;
-                    pthread_mutex_unlock(&net_mutex);
+                                    pthread_mutex_lock(&net_mutex);
+                connected = 0;
+                has_nickname = 0;
+                close(socket_fd);
+                socket_fd = -1;
+                pthread_mutex_unlock(&net_mutex);
                     
-                                        if (disconnect_callback) {
-                        disconnect_callback();
-                    }
+                                    if (disconnect_callback) {
+                    disconnect_callback();
+                }
                     
-                    receiving = 0;
-                    return NULL;                 }
+                receiving = 0;
+                return -1;                 }
                 
-                if (nickname_callback) {
-                    nickname_callback(resp);
-                }
-                break;
+            if (nickname_callback) {
+                nickname_callback(resp);
             }
+
+            net_handler_sync_roster();
+            break;
+        }
             
-            case MSG_CHAT: {
-                ChatMessage *msg = (ChatMessage *)buffer;
-                logger_log(LOG_INFO, "Received chat message from %s: %s", msg->username, msg->message);
+        case MSG_CHAT: {
+            ChatMessage *msg = (ChatMessage *)buffer;
+            logger_log(LOG_INFO, "Received chat message from %s: %s", msg->username, msg->message);
                 
-                if (chat_callback) {
-                    chat_callback(msg);
-                }
-                break;
+            if (chat_callback) {
+                chat_callback(msg);
             }
+            break;
+        }
             
-            case MSG_USER_JOIN: {
-                UserNotification *notify = (UserNotification *)buffer;
-                logger_log(LOG_INFO, "User joined: %s", notify->username);
+        case MSG_USER_JOIN: {
+            UserNotification *notify = (UserNotification *)buffer;
+            logger_log(LOG_INFO, "User joined: %s", notify->username);
                 
-                if (user_join_callback) {
-                    user_join_callback(notify);
-                }
-                break;
+            if (user_join_callback) {
+                user_join_callback(notify);
             }
+            break;
+        }
             
-            case MSG_USER_LEAVE: {
-                UserNotification *notify = (UserNotification *)buffer;
-                logger_log(LOG_INFO, "User left: %s", notify->username);
+        case MSG_USER_LEAVE: {
+            UserNotification *notify = (UserNotification *)buffer;
+            logger_log(LOG_INFO, "User left: %s", notify->username);
                 
-                if (user_leave_callback) {
-                    user_leave_callback(notify);
-                }
+            if (user_leave_callback) {
+                user_leave_callback(notify);
+            }
+            break;
+        }
+          case MSG_USER_LIST: {
+            logger_log(LOG_INFO, "Received user list of length %u", length);
+                
+                            if (length < 6) {                     logger_log(LOG_WARNING, "Received invalid user list (too short: %u bytes)", length);
                 break;
             }
-              case MSG_USER_LIST: {
-                logger_log(LOG_INFO, "Received user list of length %u", length);
                 
-                                if (length < 6) {                     logger_log(LOG_WARNING, "Received invalid user list (too short: %u bytes)", length);
+                            if (buffer[length-1] != '\0') {
+                logger_log(LOG_WARNING, "Received improperly terminated user list");
+                                    if (length < buffer_size) {
+                    buffer[length] = '\0';
+                } else {
+                    buffer[buffer_size - 1] = '\0';
+                    logger_log(LOG_ERROR, "User list buffer size exceeded");
                     break;
                 }
+            }
                 
-                                if (buffer[length-1] != '\0') {
-                    logger_log(LOG_WARNING, "Received improperly terminated user list");
-                                        if (length < sizeof(buffer)) {
-                        buffer[length] = '\0';
-                    } else {
-                        buffer[sizeof(buffer) - 1] = '\0';
-                        logger_log(LOG_ERROR, "User list buffer size exceeded");
-                        break;
-                    }
-                }
-                
-                                if (strcmp((const char *)buffer, "Users") != 0) {
-                    logger_log(LOG_WARNING, "Invalid user list format: missing 'Users' header");
-                }
-                
-                if (user_list_callback) {
-                    user_list_callback((const char *)buffer, length);
-                }
+            const char *list = NULL;
+            int list_length = 0;
+            const int collected = collect_user_list_page((const char *)buffer, length, &list, &list_length);
+            if (collected < 0) {
+                logger_log(LOG_WARNING, "Invalid user list format: missing 'Users' header");
                 break;
             }
+
+            if (collected > 0 && user_list_callback) {
+                user_list_callback(list, list_length);
+            }
+            break;
+        }
             
-            case MSG_DISCONNECT: {
-                logger_log(LOG_INFO, "Received disconnect message from server");
-                
-                pthread_mutex_lock(&net_mutex);
-                connected = 0;
-                has_nickname = 0;
-                close(socket_fd);
-                socket_fd = -1;
-                pthread_mutex_unlock(&net_mutex);
-                
-                if (disconnect_callback) {
-                    disconnect_callback();
+        case MSG_ROSTER: {
+            const Roster *roster = (const Roster *)buffer;
+            if (length <= sizeof(roster->version)) {
+                logger_log(LOG_WARNING, "Received invalid roster (too short: %u bytes)", length);
+                break;
+            }
+
+            const char *list = NULL;
+            int list_length = 0;
+            const int collected = collect_user_list_page(roster->users, length - sizeof(roster->version),
+                                                         &list, &list_length);
+            if (collected < 0) {
+                logger_log(LOG_WARNING, "Received invalid roster page");
+                break;
+            }
+            if (collected == 0) {
+                break;
+            }
+
+            pthread_mutex_lock(&net_mutex);
+            roster_version = roster->version;
+            roster_resync_pending = 0;
+            pthread_mutex_unlock(&net_mutex);
+
+            logger_log(LOG_INFO, "Received roster version %u", roster->version);
+
+            if (user_list_callback) {
+                user_list_callback(list, list_length);
+            }
+            break;
+        }
+
+        case MSG_ROSTER_DELTA: {
+            const RosterDelta *delta = (const RosterDelta *)buffer;
+            int apply = 0;
+            int resync = 0;
+
+            pthread_mutex_lock(&net_mutex);
+            if (delta->version == roster_version + 1) {
+                roster_version = delta->version;
+                roster_resync_pending = 0;
+                apply = 1;
+            } else if (delta->version > roster_version + 1 && !roster_resync_pending) {
+                roster_resync_pending = 1;
+                resync = 1;
+            }
+            const uint32_t current = roster_version;
+            pthread_mutex_unlock(&net_mutex);
+
+            if (resync) {
+                logger_log(LOG_WARNING, "Missed roster changes (have version %u, got %u), resyncing",
+                           current, delta->version);
+                net_handler_sync_roster();
+            }
+
+            if (!apply) {
+                break;
+            }
+
+            UserNotification notify;
+            memset(&notify, 0, sizeof(notify));
+            memcpy(notify.username, delta->username, sizeof(notify.username));
+
+            if (delta->action == ROSTER_DELTA_JOIN) {
+                logger_log(LOG_INFO, "User joined: %s (roster version %u)", notify.username, delta->version);
+                if (user_join_callback) {
+                    user_join_callback(&notify);
                 }
+            } else {
+                logger_log(LOG_INFO, "User left: %s (roster version %u)", notify.username, delta->version);
+                if (user_leave_callback) {
+                    user_leave_callback(&notify);
+                }
+            }
+            break;
+        }
+
+        case MSG_ROOM_JOIN:
+        case MSG_ROOM_LEAVE: {
+            RoomEvent *event = (RoomEvent *)buffer;
+            logger_log(LOG_INFO, "%s %s room %s", event->username,
+                       type == MSG_ROOM_JOIN ? "joined" : "left", event->room);
+
+            if (room_event_callback) {
+                room_event_callback(type, event);
+            }
+            break;
+        }
+
+        case MSG_ROOM_MESSAGE: {
+            RoomMessage *msg = (RoomMessage *)buffer;
+            logger_log(LOG_INFO, "Received message in room %s from %s: %s", msg->room, msg->username, msg->message);
+
+            if (room_message_callback) {
+                room_message_callback(msg);
+            }
+            break;
+        }
+
+        case MSG_DISCONNECT: {
+            logger_log(LOG_INFO, "Received disconnect message from server");
                 
-                receiving = 0;
-                break;
+            pthread_mutex_lock(&net_mutex);
+            connected = 0;
+            has_nickname = 0;
+            close(socket_fd);
+            socket_fd = -1;
+            pthread_mutex_unlock(&net_mutex);
+                
+            if (disconnect_callback) {
+                disconnect_callback();
             }
+                
+            receiving = 0;
+            break;
+        }
             
-            default: {
-                logger_log(LOG_WARNING, "Received unknown message type: %d", type);
-                break;
+        default: {
+            logger_log(LOG_WARNING, "Received unknown message type: %d", type);
+            break;
+        }
+    }
+    
+    return receiving ? 0 : -1;
+}
+
+static void *receive_thread_func(void *arg) {
+    FrameDecoder decoder;
+    if (frame_decoder_init(&decoder, NET_RX_RING_SIZE, COMPACT_MAX_PAYLOAD) != 0) {
+        log_connection_error("Failed to allocate receive buffer");
+        return NULL;
+    }
+
+    while (receiving) {
+        pthread_mutex_lock(&net_mutex);
+        const int is_connected = connected;
+        const int sock = socket_fd;
+        pthread_mutex_unlock(&net_mutex);
+        
+        if (!is_connected || sock == -1) {
+            log_connection_error("Connection lost: Socket closed or not connected");
+            break;
+        }
+        
+        const ssize_t received = frame_decoder_fill(&decoder, sock, 0);
+        
+        if (received == 0) {
+            connection_lost("Connection closed by server");
+            break;
+        }
+
+        if (received < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                continue;
+            }
+
+            connection_lost("Connection error: Failed to receive data from server");
+            break;
+        }
+
+        DecodedFrame frame;
+        int status = 0;
+        int stop = 0;
+
+        while (!stop && (status = frame_decoder_next(&decoder, &frame)) > 0) {
+            uint8_t buffer[COMPACT_MAX_PAYLOAD] = {0};
+            uint32_t length = 0;
+
+            if (frame.oversized || frame.header.version != protocol_version ||
+                (frame.header.flags & ~FRAME_FLAGS_SUPPORTED) ||
+                protocol_decode_payload(protocol_version, frame.header.type, frame.payload, frame.header.length,
+                                        buffer, sizeof(buffer), &length) != 0) {
+                logger_log(LOG_WARNING, "Dropping invalid message from server (type=%d, length=%u)",
+                           frame.header.type, frame.header.length);
+                continue;
             }
+
+            stop = dispatch_message(frame.header.type, buffer, sizeof(buffer), length) != 0;
+        }
+
+        if (stop) {
+            break;
+        }
+
+        if (status < 0) {
+            connection_lost("Connection error: Received an invalid message header");
+            break;
         }
     }
     
+    frame_decoder_destroy(&decoder);
+
     logger_log(LOG_INFO, "Receive thread stopped");
     
     return NULL;
@@ -411,13 +647,13 @@ int net_handler_set_nickname(const char *nickname_str) {
         strncpy(req.nickname, nickname_str, MAX_USERNAME_LEN - 1);
     req.nickname[MAX_USERNAME_LEN - 1] = '\0';
     
-    logger_log(LOG_DEBUG, "Setting nickname to '%s' (length: %zu, struct size: %zu)", 
+    LOGGER_DEBUG("Setting nickname to '%s' (length: %zu, struct size: %zu)", 
               req.nickname, strlen(req.nickname), sizeof(NicknameRequest));
     
         const int sock = socket_fd;
     pthread_mutex_unlock(&net_mutex);
 
-        const int result = send_message(sock, MSG_NICKNAME, &req, sizeof(req));
+        const int result = protocol_send(sock, protocol_version, MSG_NICKNAME, &req, sizeof(req));
     
     if (result <= 0) {
         logger_log(LOG_ERROR, "Failed to send nickname request");
@@ -470,13 +706,13 @@ int net_handler_send_message(const char *message) {
         strncpy(msg->message, message, MAX_MESSAGE_LEN - 1);
     msg->message[MAX_MESSAGE_LEN - 1] = '\0';
     
-        logger_log(LOG_DEBUG, "Sending chat message: '%s', content size: %zu bytes, struct size: %zu bytes", 
+        LOGGER_DEBUG("Sending chat message: '%s', content size: %zu bytes, struct size: %zu bytes", 
               message, message_len, sizeof(ChatMessage));
 
         const int sock = socket_fd;
     pthread_mutex_unlock(&net_mutex);
 
-        const int result = send_message(sock, MSG_CHAT, msg, sizeof(ChatMessage));
+        const int result = protocol_send(sock, protocol_version, MSG_CHAT, msg, sizeof(ChatMessage));
     
         free(msg);
     
@@ -488,6 +724,96 @@ int net_handler_send_message(const char *message) {
     return 0;
 }
 
+static int send_room_request(const MessageType type, const char *room, const char *message) {
+    if (!room || room[0] == '\0' || strlen(room) >= MAX_ROOM_NAME_LEN) {
+        logger_log(LOG_ERROR, "Invalid room name (must be 1-%d characters)", MAX_ROOM_NAME_LEN - 1);
+        return -1;
+    }
+
+    pthread_mutex_lock(&net_mutex);
+
+    if (!connected || socket_fd == -1 || !has_nickname) {
+        pthread_mutex_unlock(&net_mutex);
+        logger_log(LOG_WARNING, "Not connected or no nickname set");
+        return -1;
+    }
+
+    const int sock = socket_fd;
+    pthread_mutex_unlock(&net_mutex);
+
+    int result;
+    if (type == MSG_ROOM_MESSAGE) {
+        RoomMessage *msg = calloc(1, sizeof(RoomMessage));
+        if (!msg) {
+            logger_log(LOG_ERROR, "Failed to allocate memory for room message");
+            return -1;
+        }
+        strncpy(msg->room, room, MAX_ROOM_NAME_LEN - 1);
+        strncpy(msg->message, message, MAX_MESSAGE_LEN - 1);
+        result = protocol_send(sock, protocol_version, type, msg, sizeof(RoomMessage));
+        free(msg);
+    } else {
+        RoomEvent event;
+        memset(&event, 0, sizeof(event));
+        strncpy(event.room, room, MAX_ROOM_NAME_LEN - 1);
+        result = protocol_send(sock, protocol_version, type, &event, sizeof(event));
+    }
+
+    if (result <= 0) {
+        logger_log(LOG_ERROR, "Failed to send room request (type=%d)", type);
+        return -1;
+    }
+
+    return 0;
+}
+
+int net_handler_sync_roster(void) {
+    pthread_mutex_lock(&net_mutex);
+
+    if (!connected || socket_fd == -1) {
+        pthread_mutex_unlock(&net_mutex);
+        logger_log(LOG_WARNING, "Cannot sync roster - not connected to server");
+        return -1;
+    }
+
+    const int sock = socket_fd;
+    RosterSync sync;
+    memset(&sync, 0, sizeof(sync));
+    sync.version = roster_version;
+    pthread_mutex_unlock(&net_mutex);
+
+    if (protocol_send(sock, protocol_version, MSG_ROSTER_SYNC, &sync, sizeof(sync)) <= 0) {
+        logger_log(LOG_ERROR, "Failed to send roster sync request");
+        return -1;
+    }
+
+    return 0;
+}
+
+uint32_t net_handler_roster_version(void) {
+    pthread_mutex_lock(&net_mutex);
+    const uint32_t version = roster_version;
+    pthread_mutex_unlock(&net_mutex);
+    return version;
+}
+
+int net_handler_join_room(const char *room) {
+    return send_room_request(MSG_ROOM_JOIN, room, NULL);
+}
+
+int net_handler_leave_room(const char *room) {
+    return send_room_request(MSG_ROOM_LEAVE, room, NULL);
+}
+
+int net_handler_send_room_message(const char *room, const char *message) {
+    if (!message) {
+        logger_log(LOG_ERROR, "Cannot send NULL message");
+        return -1;
+    }
+
+    return send_room_request(MSG_ROOM_MESSAGE, room, message);
+}
+
 void net_handler_set_nickname_callback(const NicknameResponseCallback callback) {
     nickname_callback = callback;
 }
@@ -512,6 +838,14 @@ void net_handler_set_disconnect_callback(const DisconnectCallback callback) {
     disconnect_callback = callback;
 }
 
+void net_handler_set_room_event_callback(const RoomEventCallback callback) {
+    room_event_callback = callback;
+}
+
+void net_handler_set_room_message_callback(const RoomMessageCallback callback) {
+    room_message_callback = callback;
+}
+
 int net_handler_is_connected(void) {
     pthread_mutex_lock(&net_mutex);
     const int result = connected;
@@ -10,6 +10,8 @@ typedef void (*UserJoinCallback)(UserNotification *notification);
 typedef void (*UserLeaveCallback)(UserNotification *notification);
 typedef void (*UserListCallback)(const char *user_list, int length);
 typedef void (*DisconnectCallback)(void);
+typedef void (*RoomEventCallback)(MessageType type, const RoomEvent *event);
+typedef void (*RoomMessageCallback)(const RoomMessage *message);
 
 int net_handler_init(void);
 int net_handler_connect(const char *server_ip);
@@ -19,6 +21,11 @@ int net_handler_start_receiving(void);
 void net_handler_stop_receiving(void);
 int net_handler_set_nickname(const char *nickname);
 int net_handler_send_message(const char *message);
+int net_handler_join_room(const char *room);
+int net_handler_leave_room(const char *room);
+int net_handler_send_room_message(const char *room, const char *message);
+int net_handler_sync_roster(void);
+uint32_t net_handler_roster_version(void);
 
 void net_handler_set_nickname_callback(NicknameResponseCallback callback);
 void net_handler_set_chat_callback(ChatMessageCallback callback);
@@ -26,6 +33,8 @@ void net_handler_set_user_join_callback(UserJoinCallback callback);
 void net_handler_set_user_leave_callback(UserLeaveCallback callback);
 void net_handler_set_user_list_callback(UserListCallback callback);
 void net_handler_set_disconnect_callback(DisconnectCallback callback);
+void net_handler_set_room_event_callback(RoomEventCallback callback);
+void net_handler_set_room_message_callback(RoomMessageCallback callback);
 
 int net_handler_is_connected(void);
 int net_handler_has_nickname(void);
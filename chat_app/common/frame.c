@@ -0,0 +1,258 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "frame.h"
+#include "logger.h"
+
+#define FRAME_CLASS_NONE 0xFF
+#define FRAME_MAX(a, b) ((a) > (b) ? (a) : (b))
+
+typedef struct {
+    Frame *free_list[FRAME_POOL_CLASSES];
+    uint32_t cached[FRAME_POOL_CLASSES];
+    int registered;
+} FrameCache;
+
+typedef struct {
+    pthread_mutex_t lock;
+    Frame *free_list;
+    uint32_t cached;
+} FrameDepot;
+
+static const uint32_t class_capacity[FRAME_POOL_CLASSES] = {
+    128,
+    PROTOCOL_HEADER_SIZE + sizeof(NicknameResponse),
+    PROTOCOL_HEADER_SIZE + FRAME_MAX(sizeof(ChatMessage), sizeof(RoomMessage)),
+    PROTOCOL_HEADER_SIZE + sizeof(Roster),
+    64 * 1024
+};
+
+static _Thread_local FrameCache cache;
+static FrameDepot depots[FRAME_POOL_CLASSES] = {
+    {PTHREAD_MUTEX_INITIALIZER, NULL, 0},
+    {PTHREAD_MUTEX_INITIALIZER, NULL, 0},
+    {PTHREAD_MUTEX_INITIALIZER, NULL, 0},
+    {PTHREAD_MUTEX_INITIALIZER, NULL, 0},
+    {PTHREAD_MUTEX_INITIALIZER, NULL, 0}
+};
+static pthread_key_t cache_key;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+static atomic_uint_fast64_t stat_hits = 0;
+static atomic_uint_fast64_t stat_misses = 0;
+static atomic_uint_fast64_t stat_outstanding = 0;
+
+static Frame *next_free(const Frame *frame) {
+    Frame *next;
+    memcpy(&next, frame->data, sizeof(next));
+    return next;
+}
+
+static void set_next_free(Frame *frame, Frame *next) {
+    memcpy(frame->data, &next, sizeof(next));
+}
+
+static void depot_put(const int index) {
+    Frame *head = cache.free_list[index];
+    Frame *tail = head;
+    uint32_t moved = 1;
+
+    while (moved < FRAME_POOL_BATCH && next_free(tail) != NULL) {
+        tail = next_free(tail);
+        moved++;
+    }
+
+    cache.free_list[index] = next_free(tail);
+    cache.cached[index] -= moved;
+
+    FrameDepot *depot = &depots[index];
+    pthread_mutex_lock(&depot->lock);
+    if (depot->cached < FRAME_POOL_MAX_DEPOT) {
+        set_next_free(tail, depot->free_list);
+        depot->free_list = head;
+        depot->cached += moved;
+        head = NULL;
+    }
+    pthread_mutex_unlock(&depot->lock);
+
+    while (head != NULL) {
+        Frame *next = head == tail ? NULL : next_free(head);
+        free(head);
+        head = next;
+    }
+}
+
+static void depot_take(const int index) {
+    FrameDepot *depot = &depots[index];
+
+    pthread_mutex_lock(&depot->lock);
+    while (depot->free_list != NULL && cache.cached[index] < FRAME_POOL_BATCH) {
+        Frame *frame = depot->free_list;
+        depot->free_list = next_free(frame);
+        depot->cached--;
+        set_next_free(frame, cache.free_list[index]);
+        cache.free_list[index] = frame;
+        cache.cached[index]++;
+    }
+    pthread_mutex_unlock(&depot->lock);
+}
+
+static void cache_release(void *arg) {
+    FrameCache *thread_cache = arg;
+
+    for (int i = 0; i < FRAME_POOL_CLASSES; i++) {
+        Frame *frame = thread_cache->free_list[i];
+        while (frame != NULL) {
+            Frame *next = next_free(frame);
+            free(frame);
+            frame = next;
+        }
+        thread_cache->free_list[i] = NULL;
+        thread_cache->cached[i] = 0;
+    }
+}
+
+static void cache_key_create(void) {
+    pthread_key_create(&cache_key, cache_release);
+}
+
+static int size_class(const size_t capacity) {
+    for (int i = 0; i < FRAME_POOL_CLASSES; i++) {
+        if (capacity <= class_capacity[i]) {
+            return i;
+        }
+    }
+
+    return FRAME_CLASS_NONE;
+}
+
+static Frame *frame_alloc(const size_t capacity) {
+    const int index = size_class(capacity);
+    Frame *frame = NULL;
+
+    if (index != FRAME_CLASS_NONE && cache.free_list[index] == NULL) {
+        depot_take(index);
+    }
+
+    if (index != FRAME_CLASS_NONE && cache.free_list[index] != NULL) {
+        frame = cache.free_list[index];
+        cache.free_list[index] = next_free(frame);
+        cache.cached[index]--;
+        atomic_fetch_add_explicit(&stat_hits, 1, memory_order_relaxed);
+    } else {
+        frame = malloc(sizeof(Frame) + (index != FRAME_CLASS_NONE ? class_capacity[index] : capacity));
+        if (frame == NULL) {
+            return NULL;
+        }
+        atomic_fetch_add_explicit(&stat_misses, 1, memory_order_relaxed);
+    }
+
+    frame->size_class = (uint8_t) index;
+    atomic_fetch_add_explicit(&stat_outstanding, 1, memory_order_relaxed);
+    return frame;
+}
+
+static void frame_free(Frame *frame) {
+    const int index = frame->size_class;
+    atomic_fetch_sub_explicit(&stat_outstanding, 1, memory_order_relaxed);
+
+    if (index == FRAME_CLASS_NONE) {
+        free(frame);
+        return;
+    }
+
+    if (!cache.registered) {
+        pthread_once(&cache_once, cache_key_create);
+        pthread_setspecific(cache_key, &cache);
+        cache.registered = 1;
+    }
+
+    set_next_free(frame, cache.free_list[index]);
+    cache.free_list[index] = frame;
+    cache.cached[index]++;
+
+    if (cache.cached[index] > FRAME_POOL_MAX_CACHED) {
+        depot_put(index);
+    }
+}
+
+Frame *frame_encode(const int version, const MessageType type, const void *data, const uint32_t data_length) {
+    Frame *frame = frame_alloc(protocol_encoded_size(version, type, data, data_length));
+    if (frame == NULL) {
+        logger_log(LOG_ERROR, "frame_encode: Failed to allocate memory for frame");
+        return NULL;
+    }
+
+    const int total_length = protocol_encode(version, frame->data, type, data, data_length);
+    if (total_length < 0) {
+        logger_log(LOG_ERROR, "frame_encode: Failed to serialize message (type=%d)", type);
+        frame_free(frame);
+        return NULL;
+    }
+
+    atomic_init(&frame->refcount, 1);
+    frame->length = (uint32_t) total_length;
+    frame->type = (uint8_t) type;
+    frame->page = 0;
+    frame->snapshot = 0;
+
+    return frame;
+}
+
+Frame *frame_ref(Frame *frame) {
+    if (frame != NULL) {
+        atomic_fetch_add_explicit(&frame->refcount, 1, memory_order_relaxed);
+    }
+    return frame;
+}
+
+void frame_unref(Frame *frame) {
+    if (frame != NULL && atomic_fetch_sub_explicit(&frame->refcount, 1, memory_order_acq_rel) == 1) {
+        frame_free(frame);
+    }
+}
+
+int frame_send(const int socket, const Frame *frame) {
+    size_t sent = 0;
+
+    while (sent < frame->length) {
+        const ssize_t result = send(socket, frame->data + sent, frame->length - sent, MSG_NOSIGNAL);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            logger_log(LOG_ERROR, "frame_send: send() failed: %s", strerror(errno));
+            return -1;
+        }
+        sent += (size_t) result;
+    }
+
+    return (int) sent;
+}
+
+void frame_pool_stats(FramePoolStats *stats) {
+    stats->hits = atomic_load_explicit(&stat_hits, memory_order_relaxed);
+    stats->misses = atomic_load_explicit(&stat_misses, memory_order_relaxed);
+    stats->outstanding = atomic_load_explicit(&stat_outstanding, memory_order_relaxed);
+}
+
+void frame_pool_shutdown(void) {
+    cache_release(&cache);
+
+    for (int i = 0; i < FRAME_POOL_CLASSES; i++) {
+        FrameDepot *depot = &depots[i];
+
+        pthread_mutex_lock(&depot->lock);
+        Frame *frame = depot->free_list;
+        depot->free_list = NULL;
+        depot->cached = 0;
+        pthread_mutex_unlock(&depot->lock);
+
+        while (frame != NULL) {
+            Frame *next = next_free(frame);
+            free(frame);
+            frame = next;
+        }
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+
+#ifndef FRAME_POOL_MAX_CACHED
+#define FRAME_POOL_MAX_CACHED 64
+#endif
+
+#ifndef FRAME_POOL_BATCH
+#define FRAME_POOL_BATCH 32
+#endif
+
+#ifndef FRAME_POOL_MAX_DEPOT
+#define FRAME_POOL_MAX_DEPOT 4096
+#endif
+
+#define FRAME_POOL_CLASSES 5
+
+typedef struct {
+    atomic_uint refcount;
+    uint32_t length;
+    uint8_t type;
+    uint8_t size_class;
+    uint16_t page;
+    uint32_t snapshot;
+    _Alignas(max_align_t) uint8_t data[];
+} Frame;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t outstanding;
+} FramePoolStats;
+
+Frame *frame_encode(int version, MessageType type, const void *data, uint32_t data_length);
+Frame *frame_ref(Frame *frame);
+void frame_unref(Frame *frame);
+int frame_send(int socket, const Frame *frame);
+void frame_pool_stats(FramePoolStats *stats);
+void frame_pool_shutdown(void);
+
+#endif
@@ -0,0 +1,222 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "frame_decoder.h"
+#include "logger.h"
+
+static void *default_acquire(const size_t size) {
+    return malloc(size);
+}
+
+static void default_release(void *buffer, const size_t size) {
+    (void) size;
+    free(buffer);
+}
+
+static FrameDecoderAcquire acquire_ring = default_acquire;
+static FrameDecoderRelease release_ring = default_release;
+
+void frame_decoder_set_allocator(const FrameDecoderAcquire acquire, const FrameDecoderRelease release) {
+    acquire_ring = acquire ? acquire : default_acquire;
+    release_ring = release ? release : default_release;
+}
+
+int frame_decoder_init(FrameDecoder *decoder, const size_t capacity, const uint32_t max_payload) {
+    memset(decoder, 0, sizeof(*decoder));
+
+    size_t ring_capacity = 64;
+    while (ring_capacity < capacity || ring_capacity < PROTOCOL_HEADER_SIZE + (size_t) max_payload) {
+        ring_capacity <<= 1;
+    }
+
+    decoder->capacity = ring_capacity;
+    decoder->max_payload = max_payload;
+    return 0;
+}
+
+void frame_decoder_destroy(FrameDecoder *decoder) {
+    if (decoder->ring != NULL) {
+        release_ring(decoder->ring, decoder->capacity);
+    }
+    free(decoder->scratch);
+    memset(decoder, 0, sizeof(*decoder));
+}
+
+static int attach_ring(FrameDecoder *decoder) {
+    if (decoder->ring != NULL) {
+        return 0;
+    }
+
+    decoder->ring = acquire_ring(decoder->capacity);
+    if (decoder->ring == NULL) {
+        logger_log(LOG_ERROR, "frame_decoder: Failed to allocate %zu byte receive ring", decoder->capacity);
+        return -1;
+    }
+
+    decoder->head = 0;
+    return 0;
+}
+
+size_t frame_decoder_trim(FrameDecoder *decoder) {
+    if (decoder->length > 0) {
+        return 0;
+    }
+
+    size_t released = 0;
+    if (decoder->ring != NULL) {
+        release_ring(decoder->ring, decoder->capacity);
+        decoder->ring = NULL;
+        decoder->head = 0;
+        released += decoder->capacity;
+    }
+    if (decoder->scratch != NULL) {
+        free(decoder->scratch);
+        decoder->scratch = NULL;
+        released += decoder->max_payload;
+    }
+
+    return released;
+}
+
+size_t frame_decoder_footprint(const FrameDecoder *decoder) {
+    return (decoder->ring != NULL ? decoder->capacity : 0) + (decoder->scratch != NULL ? decoder->max_payload : 0);
+}
+
+void frame_decoder_reset(FrameDecoder *decoder) {
+    decoder->head = 0;
+    decoder->length = 0;
+    decoder->discard = 0;
+}
+
+static void consume(FrameDecoder *decoder, const size_t count) {
+    decoder->head = (decoder->head + count) & (decoder->capacity - 1);
+    decoder->length -= count;
+
+    if (decoder->length == 0) {
+        decoder->head = 0;
+    }
+}
+
+static void copy_out(const FrameDecoder *decoder, const size_t offset, uint8_t *dest, const size_t count) {
+    const size_t start = (decoder->head + offset) & (decoder->capacity - 1);
+    const size_t first = count < decoder->capacity - start ? count : decoder->capacity - start;
+
+    memcpy(dest, decoder->ring + start, first);
+    memcpy(dest + first, decoder->ring, count - first);
+}
+
+ssize_t frame_decoder_fill(FrameDecoder *decoder, const int socket, const int flags) {
+    if (attach_ring(decoder) != 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    const size_t space = decoder->capacity - decoder->length;
+    if (space == 0) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    const size_t tail = (decoder->head + decoder->length) & (decoder->capacity - 1);
+    const size_t first = space < decoder->capacity - tail ? space : decoder->capacity - tail;
+
+    struct iovec iov[2];
+    iov[0].iov_base = decoder->ring + tail;
+    iov[0].iov_len = first;
+    iov[1].iov_base = decoder->ring;
+    iov[1].iov_len = space - first;
+
+    struct msghdr msg = {0};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iov[1].iov_len > 0 ? 2 : 1;
+
+    const ssize_t received = recvmsg(socket, &msg, flags);
+    if (received > 0) {
+        decoder->length += (size_t) received;
+    }
+
+    return received;
+}
+
+size_t frame_decoder_push(FrameDecoder *decoder, const uint8_t *data, const size_t length) {
+    if (length == 0 || attach_ring(decoder) != 0) {
+        return 0;
+    }
+
+    const size_t space = decoder->capacity - decoder->length;
+    const size_t count = length < space ? length : space;
+    const size_t tail = (decoder->head + decoder->length) & (decoder->capacity - 1);
+    const size_t first = count < decoder->capacity - tail ? count : decoder->capacity - tail;
+
+    memcpy(decoder->ring + tail, data, first);
+    memcpy(decoder->ring, data + first, count - first);
+    decoder->length += count;
+
+    return count;
+}
+
+int frame_decoder_next(FrameDecoder *decoder, DecodedFrame *frame) {
+    if (decoder->discard > 0) {
+        const size_t skip = decoder->length < decoder->discard ? decoder->length : decoder->discard;
+        consume(decoder, skip);
+        decoder->discard -= (uint32_t) skip;
+        if (decoder->discard > 0) {
+            return 0;
+        }
+    }
+
+    if (decoder->length < PROTOCOL_HEADER_SIZE) {
+        return 0;
+    }
+
+    uint8_t header_bytes[PROTOCOL_HEADER_SIZE];
+    const uint8_t *header = decoder->ring + decoder->head;
+    if (decoder->head + PROTOCOL_HEADER_SIZE > decoder->capacity) {
+        copy_out(decoder, 0, header_bytes, PROTOCOL_HEADER_SIZE);
+        header = header_bytes;
+    }
+
+    if (protocol_read_header(header, &frame->header) != 0) {
+        logger_log(LOG_WARNING, "frame_decoder_next: Invalid frame header");
+        return -1;
+    }
+
+    const uint32_t length = frame->header.length;
+
+    if (length > decoder->max_payload) {
+        consume(decoder, PROTOCOL_HEADER_SIZE);
+        decoder->discard = length;
+        frame->payload = NULL;
+        frame->oversized = 1;
+
+        const size_t skip = decoder->length < decoder->discard ? decoder->length : decoder->discard;
+        consume(decoder, skip);
+        decoder->discard -= (uint32_t) skip;
+        return 1;
+    }
+
+    if (decoder->length < PROTOCOL_HEADER_SIZE + (size_t) length) {
+        return 0;
+    }
+
+    const size_t start = (decoder->head + PROTOCOL_HEADER_SIZE) & (decoder->capacity - 1);
+    if (start + length <= decoder->capacity) {
+        frame->payload = decoder->ring + start;
+    } else {
+        if (decoder->scratch == NULL) {
+            decoder->scratch = malloc(decoder->max_payload);
+            if (decoder->scratch == NULL) {
+                logger_log(LOG_ERROR, "frame_decoder_next: Failed to allocate scratch buffer");
+                return -1;
+            }
+        }
+        copy_out(decoder, PROTOCOL_HEADER_SIZE, decoder->scratch, length);
+        frame->payload = decoder->scratch;
+    }
+
+    frame->oversized = 0;
+    consume(decoder, PROTOCOL_HEADER_SIZE + length);
+    return 1;
+}
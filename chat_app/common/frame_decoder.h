@@ -0,0 +1,38 @@
+#ifndef FRAME_DECODER_H
+#define FRAME_DECODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "protocol.h"
+
+typedef struct {
+    uint8_t *ring;
+    size_t capacity;
+    size_t head;
+    size_t length;
+    uint32_t max_payload;
+    uint32_t discard;
+    uint8_t *scratch;
+} FrameDecoder;
+
+typedef void *(*FrameDecoderAcquire)(size_t size);
+typedef void (*FrameDecoderRelease)(void *buffer, size_t size);
+
+typedef struct {
+    MessageHeader header;
+    const uint8_t *payload;
+    int oversized;
+} DecodedFrame;
+
+void frame_decoder_set_allocator(FrameDecoderAcquire acquire, FrameDecoderRelease release);
+int frame_decoder_init(FrameDecoder *decoder, size_t capacity, uint32_t max_payload);
+void frame_decoder_destroy(FrameDecoder *decoder);
+void frame_decoder_reset(FrameDecoder *decoder);
+size_t frame_decoder_trim(FrameDecoder *decoder);
+size_t frame_decoder_footprint(const FrameDecoder *decoder);
+ssize_t frame_decoder_fill(FrameDecoder *decoder, int socket, int flags);
+size_t frame_decoder_push(FrameDecoder *decoder, const uint8_t *data, size_t length);
+int frame_decoder_next(FrameDecoder *decoder, DecodedFrame *frame);
+
+#endif
@@ -0,0 +1,101 @@
+#include <string.h>
+#include "log_format.h"
+
+static int parse_spec(const char *format, size_t *pos, LogFormatSpec *spec) {
+    size_t i = *pos + 1;
+    int long_count = 0;
+
+    spec->stars = 0;
+
+    while (format[i] != '\0' && strchr("-+ #0'", format[i]) != NULL) {
+        i++;
+    }
+
+    if (format[i] == '*') {
+        spec->stars++;
+        i++;
+    } else {
+        while (format[i] >= '0' && format[i] <= '9') {
+            i++;
+        }
+    }
+
+    if (format[i] == '.') {
+        i++;
+        if (format[i] == '*') {
+            spec->stars++;
+            i++;
+        } else {
+            while (format[i] >= '0' && format[i] <= '9') {
+                i++;
+            }
+        }
+    }
+
+    for (;; i++) {
+        if (format[i] == 'l') {
+            long_count++;
+        } else if (format[i] == 'z' || format[i] == 'j' || format[i] == 't') {
+            long_count = 2;
+        } else if (format[i] != 'h') {
+            break;
+        }
+    }
+
+    switch (format[i]) {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+            spec->type = long_count > 0 ? LOG_ARG_LONG : LOG_ARG_INT;
+            break;
+        case 'c':
+            if (long_count > 0) {
+                return -1;
+            }
+            spec->type = LOG_ARG_INT;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            spec->type = LOG_ARG_DOUBLE;
+            break;
+        case 's':
+            if (long_count > 0) {
+                return -1;
+            }
+            spec->type = LOG_ARG_STRING;
+            break;
+        case 'p':
+            spec->type = LOG_ARG_POINTER;
+            break;
+        case '%':
+            spec->type = LOG_ARG_NONE;
+            break;
+        default:
+            return -1;
+    }
+
+    spec->start = (uint16_t) *pos;
+    spec->end = (uint16_t) (i + 1);
+    *pos = i + 1;
+    return 0;
+}
+
+int log_format_parse(const char *format, LogFormatSpec *specs, const int max_specs) {
+    int count = 0;
+    size_t pos = 0;
+
+    while (format[pos] != '\0') {
+        if (format[pos] != '%') {
+            pos++;
+            continue;
+        }
+
+        if (count == max_specs || pos > UINT16_MAX - 16) {
+            return -1;
+        }
+
+        if (parse_spec(format, &pos, &specs[count]) != 0) {
+            return -1;
+        }
+        count++;
+    }
+
+    return count;
+}
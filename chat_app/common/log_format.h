@@ -0,0 +1,40 @@
+#ifndef LOG_FORMAT_H
+#define LOG_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LOG_FORMAT_MAX_SPECS 16
+#define LOG_FORMAT_MAX_IDS 1024
+#define LOG_FORMAT_TEXT_ID 0
+
+#define LOG_FILE_MAGIC "CHATLOG\x01"
+#define LOG_FILE_MAGIC_SIZE 8
+
+#define LOG_RECORD_HEADER_SIZE 3
+#define LOG_EVENT_HEADER_SIZE (LOG_RECORD_HEADER_SIZE + 4 + 1 + 8)
+
+typedef enum {
+    LOG_RECORD_DEFINITION = 1,
+    LOG_RECORD_EVENT = 2
+} LogRecordKind;
+
+typedef enum {
+    LOG_ARG_NONE = 0,
+    LOG_ARG_INT,
+    LOG_ARG_LONG,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_POINTER,
+    LOG_ARG_STRING
+} LogArgType;
+
+typedef struct {
+    uint16_t start;
+    uint16_t end;
+    uint8_t type;
+    uint8_t stars;
+} LogFormatSpec;
+
+int log_format_parse(const char *format, LogFormatSpec *specs, int max_specs);
+
+#endif
@@ -1,28 +1,493 @@
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdarg.h>
 #include <time.h>
+#include "log_format.h"
 #include "logger.h"
 
+typedef struct {
+    atomic_size_t sequence;
+    uint32_t length;
+    char text[LOGGER_RECORD_SIZE];
+} LogRecord;
+
+typedef struct {
+    _Atomic(const char *) format;
+    atomic_int state;
+    int spec_count;
+    LogFormatSpec specs[LOG_FORMAT_MAX_SPECS];
+} LogFormatEntry;
+
+enum {
+    FORMAT_PENDING = 0,
+    FORMAT_READY = 1,
+    FORMAT_UNSUPPORTED = -1
+};
+
+atomic_int logger_threshold = 1;
+
 static FILE *log_file = NULL;
+static int level_overridden = 0;
+static LoggerFormat output_format = LOGGER_FORMAT_TEXT;
+static LogRecord *ring = NULL;
+static atomic_size_t enqueue_pos = 0;
+static size_t dequeue_pos = 0;
+static atomic_uint_fast64_t dropped_records = 0;
+static uint64_t reported_dropped = 0;
+
+static LogFormatEntry formats[LOG_FORMAT_MAX_IDS];
+static uint8_t defined_formats[LOG_FORMAT_MAX_IDS];
+
+static atomic_int accepting = 0;
+static atomic_int stopping = 0;
+static atomic_int writer_sleeping = 0;
+static pthread_t writer_thread;
+static pthread_mutex_t wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+
+static __thread time_t cached_second = -1;
+static __thread char cached_time[20];
+
+static const char *current_time_str(void) {
+    const time_t now = time(NULL);
+    if (now != cached_second) {
+        struct tm tm_info;
+        localtime_r(&now, &tm_info);
+        strftime(cached_time, sizeof(cached_time), "%Y-%m-%d %H:%M:%S", &tm_info);
+        cached_second = now;
+    }
+    return cached_time;
+}
+
+static uint64_t current_time_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+static void put_record_header(char *record, const LogRecordKind kind, const size_t length) {
+    const uint16_t body_length = (uint16_t) (length - LOG_RECORD_HEADER_SIZE);
+    record[0] = (char) kind;
+    memcpy(record + 1, &body_length, sizeof(body_length));
+}
+
+static size_t put_event_header(char *record, const uint32_t id, const LogType type, const uint64_t timestamp) {
+    const uint8_t level = (uint8_t) type;
+    memcpy(record + LOG_RECORD_HEADER_SIZE, &id, sizeof(id));
+    memcpy(record + LOG_RECORD_HEADER_SIZE + 4, &level, sizeof(level));
+    memcpy(record + LOG_RECORD_HEADER_SIZE + 5, &timestamp, sizeof(timestamp));
+    return LOG_EVENT_HEADER_SIZE;
+}
+
+static size_t put_text_event(char *record, const size_t capacity, const LogType type,
+                             const uint64_t timestamp, const char *text, size_t text_length) {
+    size_t length = put_event_header(record, LOG_FORMAT_TEXT_ID, type, timestamp);
+
+    if (text_length > capacity - length - sizeof(uint16_t)) {
+        text_length = capacity - length - sizeof(uint16_t);
+    }
+
+    const uint16_t string_length = (uint16_t) text_length;
+    memcpy(record + length, &string_length, sizeof(string_length));
+    memcpy(record + length + sizeof(string_length), text, text_length);
+    length += sizeof(string_length) + text_length;
+
+    put_record_header(record, LOG_RECORD_EVENT, length);
+    return length;
+}
+
+static size_t format_hash(const char *format) {
+    const uint64_t key = (uint64_t) (uintptr_t) format >> 3;
+    return (size_t) ((key * 0x9E3779B97F4A7C15ULL) >> 32) & (LOG_FORMAT_MAX_IDS - 1);
+}
+
+static int lookup_format(const char *format) {
+    const size_t start = format_hash(format);
+
+    for (size_t probe = 0; probe < LOG_FORMAT_MAX_IDS; probe++) {
+        const size_t slot = (start + probe) & (LOG_FORMAT_MAX_IDS - 1);
+        if (slot == LOG_FORMAT_TEXT_ID) {
+            continue;
+        }
+
+        LogFormatEntry *entry = &formats[slot];
+        const char *current = atomic_load_explicit(&entry->format, memory_order_acquire);
+
+        if (current == NULL) {
+            if (!atomic_compare_exchange_strong(&entry->format, &current, format)) {
+                if (current != format) {
+                    continue;
+                }
+            } else {
+                const int count = log_format_parse(format, entry->specs, LOG_FORMAT_MAX_SPECS);
+                entry->spec_count = count;
+                atomic_store_explicit(&entry->state, count < 0 ? FORMAT_UNSUPPORTED : FORMAT_READY,
+                                      memory_order_release);
+                return count < 0 ? -1 : (int) slot;
+            }
+        } else if (current != format) {
+            continue;
+        }
+
+        int state;
+        while ((state = atomic_load_explicit(&entry->state, memory_order_acquire)) == FORMAT_PENDING) {
+        }
+        return state == FORMAT_READY ? (int) slot : -1;
+    }
+
+    return -1;
+}
+
+static int put_args(char *record, size_t *length, const size_t capacity,
+                    const LogFormatEntry *entry, va_list args) {
+    size_t used = *length;
+
+    for (int i = 0; i < entry->spec_count; i++) {
+        const LogFormatSpec *spec = &entry->specs[i];
+
+        for (int star = 0; star < spec->stars; star++) {
+            const int value = va_arg(args, int);
+            if (used + sizeof(value) > capacity) {
+                return -1;
+            }
+            memcpy(record + used, &value, sizeof(value));
+            used += sizeof(value);
+        }
+
+        switch (spec->type) {
+            case LOG_ARG_INT: {
+                const int value = va_arg(args, int);
+                if (used + sizeof(value) > capacity) {
+                    return -1;
+                }
+                memcpy(record + used, &value, sizeof(value));
+                used += sizeof(value);
+                break;
+            }
+            case LOG_ARG_LONG: {
+                const long long value = va_arg(args, long long);
+                if (used + sizeof(value) > capacity) {
+                    return -1;
+                }
+                memcpy(record + used, &value, sizeof(value));
+                used += sizeof(value);
+                break;
+            }
+            case LOG_ARG_DOUBLE: {
+                const double value = va_arg(args, double);
+                if (used + sizeof(value) > capacity) {
+                    return -1;
+                }
+                memcpy(record + used, &value, sizeof(value));
+                used += sizeof(value);
+                break;
+            }
+            case LOG_ARG_POINTER: {
+                const uint64_t value = (uint64_t) (uintptr_t) va_arg(args, void *);
+                if (used + sizeof(value) > capacity) {
+                    return -1;
+                }
+                memcpy(record + used, &value, sizeof(value));
+                used += sizeof(value);
+                break;
+            }
+            case LOG_ARG_STRING: {
+                const char *value = va_arg(args, const char *);
+                if (value == NULL) {
+                    value = "(null)";
+                }
+                if (used + sizeof(uint16_t) > capacity) {
+                    return -1;
+                }
+                const uint16_t string_length = (uint16_t) strnlen(value, capacity - used - sizeof(uint16_t));
+                memcpy(record + used, &string_length, sizeof(string_length));
+                memcpy(record + used + sizeof(string_length), value, string_length);
+                used += sizeof(string_length) + string_length;
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    *length = used;
+    return 0;
+}
+
+static uint32_t encode_text(char *record, const LogType type, const char *format, va_list args) {
+    int length = snprintf(record, LOGGER_RECORD_SIZE, "[%s] [%s] ", current_time_str(), log_type_str(type));
+
+    const int message_length = vsnprintf(record + length, LOGGER_RECORD_SIZE - length, format, args);
+    if (message_length > 0) {
+        length += message_length;
+    }
+    if (length > LOGGER_RECORD_SIZE - 2) {
+        length = LOGGER_RECORD_SIZE - 2;
+    }
+    record[length++] = '\n';
+    record[length] = '\0';
+
+    return (uint32_t) length;
+}
+
+static uint32_t encode_binary(char *record, const LogType type, const char *format, va_list args) {
+    const uint64_t timestamp = current_time_ns();
+    const int id = lookup_format(format);
+
+    if (id >= 0) {
+        va_list copy;
+        va_copy(copy, args);
+        size_t length = put_event_header(record, (uint32_t) id, type, timestamp);
+        const int status = put_args(record, &length, LOGGER_RECORD_SIZE, &formats[id], copy);
+        va_end(copy);
+
+        if (status == 0) {
+            put_record_header(record, LOG_RECORD_EVENT, length);
+            return (uint32_t) length;
+        }
+    }
+
+    char text[LOGGER_RECORD_SIZE];
+    const int text_length = vsnprintf(text, sizeof(text), format, args);
+    const size_t clamped = text_length < 0 ? 0 : (size_t) text_length >= sizeof(text) ? sizeof(text) - 1 : (size_t) text_length;
+    return (uint32_t) put_text_event(record, LOGGER_RECORD_SIZE, type, timestamp, text, clamped);
+}
+
+static int record_ready(void) {
+    const LogRecord *record = &ring[dequeue_pos & (LOGGER_RING_CAPACITY - 1)];
+    return atomic_load_explicit(&record->sequence, memory_order_acquire) == dequeue_pos + 1;
+}
+
+static void write_batch(const char *batch, const size_t length) {
+    if (length == 0) {
+        return;
+    }
+
+    fwrite(batch, 1, length, log_file);
+    fflush(log_file);
+
+    if (output_format == LOGGER_FORMAT_TEXT) {
+        fwrite(batch, 1, length, stdout);
+        fflush(stdout);
+    }
+}
+
+static size_t reserve(char *batch, size_t used, const size_t needed) {
+    if (used + needed > LOGGER_BATCH_BYTES) {
+        write_batch(batch, used);
+        used = 0;
+    }
+    return used;
+}
+
+static size_t put_definition(char *batch, size_t used, const uint32_t id) {
+    const char *format = atomic_load_explicit(&formats[id].format, memory_order_acquire);
+    const size_t format_length = strnlen(format, LOGGER_RECORD_SIZE);
+    const size_t length = LOG_RECORD_HEADER_SIZE + sizeof(id) + format_length;
+
+    used = reserve(batch, used, length);
+    put_record_header(batch + used, LOG_RECORD_DEFINITION, length);
+    memcpy(batch + used + LOG_RECORD_HEADER_SIZE, &id, sizeof(id));
+    memcpy(batch + used + LOG_RECORD_HEADER_SIZE + sizeof(id), format, format_length);
+    defined_formats[id] = 1;
+
+    return used + length;
+}
+
+static size_t drain(char *batch) {
+    size_t used = 0;
+    size_t drained = 0;
+
+    while (record_ready()) {
+        LogRecord *record = &ring[dequeue_pos & (LOGGER_RING_CAPACITY - 1)];
+
+        if (output_format == LOGGER_FORMAT_BINARY) {
+            uint32_t id;
+            memcpy(&id, record->text + LOG_RECORD_HEADER_SIZE, sizeof(id));
+            if (id != LOG_FORMAT_TEXT_ID && !defined_formats[id]) {
+                used = put_definition(batch, used, id);
+            }
+        }
+
+        used = reserve(batch, used, record->length);
+        memcpy(batch + used, record->text, record->length);
+        used += record->length;
+
+        atomic_store_explicit(&record->sequence, dequeue_pos + LOGGER_RING_CAPACITY, memory_order_release);
+        dequeue_pos++;
+        drained++;
+    }
+
+    const uint64_t dropped = atomic_load_explicit(&dropped_records, memory_order_relaxed);
+    if (dropped != reported_dropped) {
+        char text[128];
+        const int text_length = snprintf(text, sizeof(text), "Logger queue full, %llu records dropped so far",
+                                         (unsigned long long) dropped);
+
+        used = reserve(batch, used, LOGGER_RECORD_SIZE);
+        if (output_format == LOGGER_FORMAT_BINARY) {
+            used += put_text_event(batch + used, LOGGER_RECORD_SIZE, LOG_WARNING, current_time_ns(),
+                                   text, (size_t) text_length);
+        } else {
+            used += (size_t) snprintf(batch + used, LOGGER_RECORD_SIZE, "[%s] [%s] %s\n",
+                                      current_time_str(), log_type_str(LOG_WARNING), text);
+        }
+        reported_dropped = dropped;
+    }
+
+    write_batch(batch, used);
+    return drained;
+}
+
+static void *writer_main(void *arg) {
+    char *batch = arg;
+
+    for (;;) {
+        if (drain(batch) > 0) {
+            continue;
+        }
+
+        if (atomic_load(&stopping)) {
+            break;
+        }
+
+        atomic_store(&writer_sleeping, 1);
+        pthread_mutex_lock(&wake_lock);
+        if (!record_ready() && !atomic_load(&stopping)) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += 100 * 1000 * 1000;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&wake_cond, &wake_lock, &deadline);
+        }
+        pthread_mutex_unlock(&wake_lock);
+        atomic_store(&writer_sleeping, 0);
+    }
+
+    drain(batch);
+    free(batch);
+    return NULL;
+}
+
+int logger_parse_level(const char *name, LogType *level) {
+    static const LogType levels[] = { LOG_DEBUG, LOG_INFO, LOG_WARNING, LOG_ERROR };
+
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        if (strcasecmp(name, log_type_str(levels[i])) == 0) {
+            *level = levels[i];
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+void logger_set_level(const LogType level) {
+    atomic_store_explicit(&logger_threshold, log_severity(level), memory_order_relaxed);
+    level_overridden = 1;
+}
+
+void logger_set_format(const LoggerFormat format) {
+    if (log_file == NULL) {
+        output_format = format;
+    }
+}
+
+LoggerFormat logger_format(void) {
+    return output_format;
+}
+
+static void reset_formats(void) {
+    for (size_t i = 0; i < LOG_FORMAT_MAX_IDS; i++) {
+        atomic_init(&formats[i].format, NULL);
+        atomic_init(&formats[i].state, FORMAT_PENDING);
+        formats[i].spec_count = 0;
+        defined_formats[i] = 0;
+    }
+
+    atomic_init(&formats[LOG_FORMAT_TEXT_ID].format, "%s");
+    formats[LOG_FORMAT_TEXT_ID].spec_count = log_format_parse("%s", formats[LOG_FORMAT_TEXT_ID].specs,
+                                                              LOG_FORMAT_MAX_SPECS);
+    atomic_init(&formats[LOG_FORMAT_TEXT_ID].state, FORMAT_READY);
+}
 
 int logger_init(const char *filename) {
     if (log_file != NULL) {
         return 0;
     }
+
+    const char *env_level = getenv(LOGGER_LEVEL_ENV);
+    LogType level;
+    if (!level_overridden && env_level != NULL && logger_parse_level(env_level, &level) == 0) {
+        atomic_store_explicit(&logger_threshold, log_severity(level), memory_order_relaxed);
+    }
     
     log_file = fopen(filename, "a");
     if (log_file == NULL) {
         perror("Failed to open log file");
         return -1;
     }
-    
+
+    ring = malloc(LOGGER_RING_CAPACITY * sizeof(LogRecord));
+    char *batch = malloc(LOGGER_BATCH_BYTES);
+    if (ring == NULL || batch == NULL) {
+        perror("Failed to allocate log buffers");
+        free(ring);
+        free(batch);
+        ring = NULL;
+        fclose(log_file);
+        log_file = NULL;
+        return -1;
+    }
+
+    for (size_t i = 0; i < LOGGER_RING_CAPACITY; i++) {
+        atomic_init(&ring[i].sequence, i);
+    }
+    atomic_store(&enqueue_pos, 0);
+    dequeue_pos = 0;
+    atomic_store(&dropped_records, 0);
+    reported_dropped = 0;
+    atomic_store(&stopping, 0);
+
+    if (output_format == LOGGER_FORMAT_BINARY) {
+        reset_formats();
+        fwrite(LOG_FILE_MAGIC, 1, LOG_FILE_MAGIC_SIZE, log_file);
+        fflush(log_file);
+    }
+
+    if (pthread_create(&writer_thread, NULL, writer_main, batch) != 0) {
+        perror("Failed to start log writer thread");
+        free(ring);
+        free(batch);
+        ring = NULL;
+        fclose(log_file);
+        log_file = NULL;
+        return -1;
+    }
+
+    atomic_store_explicit(&accepting, 1, memory_order_release);
     return 0;
 }
 
 void logger_close(void) {
     if (log_file != NULL) {
+        atomic_store(&accepting, 0);
+        atomic_store(&stopping, 1);
+
+        pthread_mutex_lock(&wake_lock);
+        pthread_cond_signal(&wake_cond);
+        pthread_mutex_unlock(&wake_lock);
+        pthread_join(writer_thread, NULL);
+
+        free(ring);
+        ring = NULL;
         fclose(log_file);
         log_file = NULL;
     }
@@ -38,32 +503,58 @@ const char *log_type_str(const LogType type) {
     }
 }
 
+uint64_t logger_dropped_records(void) {
+    return atomic_load_explicit(&dropped_records, memory_order_relaxed);
+}
+
+static LogRecord *claim_record(size_t *position) {
+    size_t pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+
+    for (;;) {
+        LogRecord *record = &ring[pos & (LOGGER_RING_CAPACITY - 1)];
+        const size_t sequence = atomic_load_explicit(&record->sequence, memory_order_acquire);
+        const intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                *position = pos;
+                return record;
+            }
+        } else if (diff < 0) {
+            return NULL;
+        } else {
+            pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
 void logger_log(const LogType type, const char *format, ...) {
-    if (log_file == NULL) {
+    if (!logger_enabled(type) || !atomic_load_explicit(&accepting, memory_order_acquire)) {
         return;
     }
-    
-    const time_t now = time(NULL);
-    const struct tm *tm_info = localtime(&now);
-    char time_str[20];
-    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", tm_info);
-    
-    fprintf(log_file, "[%s] [%s] ", time_str, log_type_str(type));
-    
+
+    size_t position;
+    LogRecord *record = claim_record(&position);
+    if (record == NULL) {
+        atomic_fetch_add_explicit(&dropped_records, 1, memory_order_relaxed);
+        return;
+    }
+
     va_list args;
     va_start(args, format);
-    vfprintf(log_file, format, args);
-    va_end(args);
-    
-    fprintf(log_file, "\n");
-    fflush(log_file);
-    
-    fprintf(stdout, "[%s] [%s] ", time_str, log_type_str(type));
-    
-    va_start(args, format);
-    vfprintf(stdout, format, args);
+    if (output_format == LOGGER_FORMAT_BINARY) {
+        record->length = encode_binary(record->text, type, format, args);
+    } else {
+        record->length = encode_text(record->text, type, format, args);
+    }
     va_end(args);
-    
-    fprintf(stdout, "\n");
-    fflush(stdout);
-}
\ No newline at end of file
+
+    atomic_store_explicit(&record->sequence, position + 1, memory_order_release);
+
+    if (atomic_load(&writer_sleeping)) {
+        pthread_mutex_lock(&wake_lock);
+        pthread_cond_signal(&wake_cond);
+        pthread_mutex_unlock(&wake_lock);
+    }
+}
@@ -1,8 +1,30 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 
+#ifndef LOGGER_RING_CAPACITY
+#define LOGGER_RING_CAPACITY 4096
+#endif
+
+#ifndef LOGGER_RECORD_SIZE
+#define LOGGER_RECORD_SIZE 512
+#endif
+
+#define LOGGER_BATCH_BYTES (64 * 1024)
+
+#define LOGGER_LEVEL_ENV "CHAT_LOG_LEVEL"
+
+#ifndef LOGGER_ENABLE_DEBUG
+#ifdef NDEBUG
+#define LOGGER_ENABLE_DEBUG 0
+#else
+#define LOGGER_ENABLE_DEBUG 1
+#endif
+#endif
+
 typedef enum {
     LOG_INFO,
     LOG_WARNING,
@@ -10,9 +32,53 @@ typedef enum {
     LOG_DEBUG
 } LogType;
 
+typedef enum {
+    LOGGER_FORMAT_TEXT = 0,
+    LOGGER_FORMAT_BINARY
+} LoggerFormat;
+
+extern atomic_int logger_threshold;
+
+static inline int log_severity(const LogType type) {
+    switch (type) {
+        case LOG_DEBUG:   return 0;
+        case LOG_INFO:    return 1;
+        case LOG_WARNING: return 2;
+        case LOG_ERROR:   return 3;
+        default:          return 3;
+    }
+}
+
+static inline int logger_enabled(const LogType type) {
+    return log_severity(type) >= atomic_load_explicit(&logger_threshold, memory_order_relaxed);
+}
+
+#define LOGGER_LOG(type, ...) \
+    do { \
+        if (logger_enabled(type)) { \
+            logger_log((type), __VA_ARGS__); \
+        } \
+    } while (0)
+
+#if LOGGER_ENABLE_DEBUG
+#define LOGGER_DEBUG(...) LOGGER_LOG(LOG_DEBUG, __VA_ARGS__)
+#else
+#define LOGGER_DEBUG(...) \
+    do { \
+        if (0) { \
+            logger_log(LOG_DEBUG, __VA_ARGS__); \
+        } \
+    } while (0)
+#endif
+
 int logger_init(const char *filename);
 void logger_close(void);
 void logger_log(LogType type, const char *format, ...);
 const char *log_type_str(LogType type);
+int logger_parse_level(const char *name, LogType *level);
+void logger_set_level(LogType level);
+void logger_set_format(LoggerFormat format);
+LoggerFormat logger_format(void);
+uint64_t logger_dropped_records(void);
 
-#endif
\ No newline at end of file
+#endif
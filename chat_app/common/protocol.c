@@ -13,58 +13,66 @@
 #include "logger.h"
 
 static void __attribute__((constructor)) log_protocol_sizes(void) {
-    logger_log(LOG_DEBUG, "Protocol structure sizes:");
-    logger_log(LOG_DEBUG, "  MessageHeader:      %zu bytes", sizeof(MessageHeader));
-    logger_log(LOG_DEBUG, "  NicknameRequest:    %zu bytes", sizeof(NicknameRequest));
-    logger_log(LOG_DEBUG, "  NicknameResponse:   %zu bytes", sizeof(NicknameResponse));
-    logger_log(LOG_DEBUG, "  ChatMessage:        %zu bytes", sizeof(ChatMessage));
-    logger_log(LOG_DEBUG, "  UserNotification:   %zu bytes", sizeof(UserNotification));
-    logger_log(LOG_DEBUG, "  RegisterRequest:    %zu bytes", sizeof(RegisterRequest));
-    logger_log(LOG_DEBUG, "  RegisterResponse:   %zu bytes", sizeof(RegisterResponse));
-    logger_log(LOG_DEBUG, "  LoginRequest:       %zu bytes", sizeof(LoginRequest));
-    logger_log(LOG_DEBUG, "  LoginResponse:      %zu bytes", sizeof(LoginResponse));
+    LOGGER_DEBUG("Protocol structure sizes:");
+    LOGGER_DEBUG("  MessageHeader:      %d bytes", PROTOCOL_HEADER_SIZE);
+    LOGGER_DEBUG("  NicknameRequest:    %zu bytes", sizeof(NicknameRequest));
+    LOGGER_DEBUG("  NicknameResponse:   %zu bytes", sizeof(NicknameResponse));
+    LOGGER_DEBUG("  ChatMessage:        %zu bytes", sizeof(ChatMessage));
+    LOGGER_DEBUG("  UserNotification:   %zu bytes", sizeof(UserNotification));
+    LOGGER_DEBUG("  RosterDelta:        %zu bytes", sizeof(RosterDelta));
+    LOGGER_DEBUG("  RegisterRequest:    %zu bytes", sizeof(RegisterRequest));
+    LOGGER_DEBUG("  RegisterResponse:   %zu bytes", sizeof(RegisterResponse));
+    LOGGER_DEBUG("  LoginRequest:       %zu bytes", sizeof(LoginRequest));
+    LOGGER_DEBUG("  LoginResponse:      %zu bytes", sizeof(LoginResponse));
 }
 
+static int is_roster_message(MessageType type);
+static int encode_roster(int version, void *buffer, MessageType type, const void *data, uint32_t data_length);
+static int decode_roster(int version, MessageType type, const uint8_t *payload, uint32_t payload_length,
+                         void *data, uint32_t data_size, uint32_t *data_length);
+
 int serialize_message(void *buffer, const MessageType type, const void *data, const __uint32_t data_length) {
     if (!buffer) {
         return -1;
     }
 
-    memset(buffer, 0, sizeof(MessageHeader) + data_length);
+    if (is_roster_message(type) && data != NULL) {
+        return encode_roster(PROTOCOL_VERSION_LEGACY, buffer, type, data, data_length);
+    }
+
+    memset(buffer, 0, PROTOCOL_HEADER_SIZE + data_length);
 
-    MessageHeader *header = (MessageHeader *) buffer;
-    header->type = type;
-    header->length = htonl(data_length);
+    protocol_write_header(buffer, PROTOCOL_VERSION_LEGACY, type, 0, data_length);
 
     if (type == MSG_NICKNAME_RESPONSE) {
-        NicknameResponse *resp = (NicknameResponse *) ((uint8_t *) buffer + sizeof(MessageHeader));
+        NicknameResponse *resp = (NicknameResponse *) ((uint8_t *) buffer + PROTOCOL_HEADER_SIZE);
         const NicknameResponse *orig = (NicknameResponse *) data;
 
         resp->status = orig->status;
         strncpy(resp->message, orig->message, MAX_MESSAGE_LEN);
         resp->message[MAX_MESSAGE_LEN - 1] = '\0';
 
-        logger_log(LOG_DEBUG, "serialize_message: MSG_NICKNAME_RESPONSE, status=%d, message='%s', data_length=%u",
+        LOGGER_DEBUG("serialize_message: MSG_NICKNAME_RESPONSE, status=%d, message='%s', data_length=%u",
                    orig->status, orig->message, data_length);
 
-        return sizeof(MessageHeader) + data_length;
+        return PROTOCOL_HEADER_SIZE + data_length;
     }
 
     if (type == MSG_NICKNAME && data != NULL) {
-        NicknameRequest *dest = (NicknameRequest *) ((uint8_t *) buffer + sizeof(MessageHeader));
+        NicknameRequest *dest = (NicknameRequest *) ((uint8_t *) buffer + PROTOCOL_HEADER_SIZE);
         const NicknameRequest *src = (const NicknameRequest *) data;
 
         strncpy(dest->nickname, src->nickname, MAX_USERNAME_LEN - 1);
         dest->nickname[MAX_USERNAME_LEN - 1] = '\0';
 
-        logger_log(LOG_DEBUG, "serialize_message: MSG_NICKNAME, nickname='%s', length=%zu, data_length=%u",
+        LOGGER_DEBUG("serialize_message: MSG_NICKNAME, nickname='%s', length=%zu, data_length=%u",
                    dest->nickname, strlen(dest->nickname), data_length);
 
-        return sizeof(MessageHeader) + data_length;
+        return PROTOCOL_HEADER_SIZE + data_length;
     }
 
     if (type == MSG_CHAT && data != NULL) {
-        ChatMessage *dest = (ChatMessage *) ((uint8_t *) buffer + sizeof(MessageHeader));
+        ChatMessage *dest = (ChatMessage *) ((uint8_t *) buffer + PROTOCOL_HEADER_SIZE);
         const ChatMessage *src = (const ChatMessage *) data;
 
         strncpy(dest->username, src->username, MAX_USERNAME_LEN - 1);
@@ -73,19 +81,19 @@ int serialize_message(void *buffer, const MessageType type, const void *data, co
         strncpy(dest->message, src->message, MAX_MESSAGE_LEN - 1);
         dest->message[MAX_MESSAGE_LEN - 1] = '\0';
 
-        logger_log(LOG_DEBUG, "serialize_message: MSG_CHAT from '%s', message='%s', data_length=%u",
+        LOGGER_DEBUG("serialize_message: MSG_CHAT from '%s', message='%s', data_length=%u",
                    dest->username, dest->message, data_length);
 
-        return sizeof(MessageHeader) + sizeof(ChatMessage);
+        return PROTOCOL_HEADER_SIZE + sizeof(ChatMessage);
     }
 
     if (data && data_length > 0) {
-        memcpy((uint8_t *) buffer + sizeof(MessageHeader), data, data_length);
+        memcpy((uint8_t *) buffer + PROTOCOL_HEADER_SIZE, data, data_length);
     }
 
-    logger_log(LOG_DEBUG, "serialize_message: type=%d, data_length=%u", type, data_length);
+    LOGGER_DEBUG("serialize_message: type=%d, data_length=%u", type, data_length);
 
-    return sizeof(MessageHeader) + data_length;
+    return PROTOCOL_HEADER_SIZE + data_length;
 }
 
 int deserialize_message(const void *buffer, MessageType *type, void *data, uint32_t *data_length) {
@@ -93,47 +101,584 @@ int deserialize_message(const void *buffer, MessageType *type, void *data, uint3
         return -1;
     }
 
-    const MessageHeader *header = (const MessageHeader *) buffer;
-    *type = header->type;
-    *data_length = ntohl(header->length);
+    MessageHeader header;
+    if (protocol_read_header(buffer, &header) != 0) {
+        logger_log(LOG_ERROR, "deserialize_message: Invalid message header");
+        return -1;
+    }
+    *type = header.type;
+    *data_length = header.length;
 
-    logger_log(LOG_DEBUG, "deserialize_message: received type=%d, data_length=%u", *type, *data_length);
+    LOGGER_DEBUG("deserialize_message: received type=%d, data_length=%u", *type, *data_length);
 
     if (data && *data_length > 0) {
         if (*type == MSG_NICKNAME_RESPONSE) {
-            const NicknameResponse *src = (NicknameResponse *) ((uint8_t *) buffer + sizeof(MessageHeader));
+            const NicknameResponse *src = (NicknameResponse *) ((uint8_t *) buffer + PROTOCOL_HEADER_SIZE);
             NicknameResponse *dest = (NicknameResponse *) data;
 
             dest->status = src->status;
             strncpy(dest->message, src->message, MAX_MESSAGE_LEN);
             dest->message[MAX_MESSAGE_LEN - 1] = '\0';
 
-            logger_log(LOG_DEBUG, "deserialize_message: MSG_NICKNAME_RESPONSE, status=%d, message='%s'",
+            LOGGER_DEBUG("deserialize_message: MSG_NICKNAME_RESPONSE, status=%d, message='%s'",
                        dest->status, dest->message);
         } else if (*type == MSG_NICKNAME) {
-            const NicknameRequest *src = (NicknameRequest *) ((uint8_t *) buffer + sizeof(MessageHeader));
+            const NicknameRequest *src = (NicknameRequest *) ((uint8_t *) buffer + PROTOCOL_HEADER_SIZE);
             NicknameRequest *dest = (NicknameRequest *) data;
 
             strncpy(dest->nickname, src->nickname, MAX_USERNAME_LEN);
             dest->nickname[MAX_USERNAME_LEN - 1] = '\0';
 
-            logger_log(LOG_DEBUG, "deserialize_message: MSG_NICKNAME, nickname='%s', length=%zu",
+            LOGGER_DEBUG("deserialize_message: MSG_NICKNAME, nickname='%s', length=%zu",
                        dest->nickname, strlen(dest->nickname));
+        } else if (is_roster_message(*type)) {
+            const uint32_t data_size = *type == MSG_ROSTER_SYNC ? sizeof(RosterSync)
+                                       : *type == MSG_ROSTER ? sizeof(Roster) : sizeof(RosterDelta);
+            if (decode_roster(PROTOCOL_VERSION_LEGACY, *type, (const uint8_t *) buffer + PROTOCOL_HEADER_SIZE,
+                              header.length, data, data_size, data_length) != 0) {
+                logger_log(LOG_ERROR, "deserialize_message: Malformed roster message (type=%d)", *type);
+                return -1;
+            }
         } else {
-            memcpy(data, (uint8_t *) buffer + sizeof(MessageHeader), *data_length);
+            memcpy(data, (uint8_t *) buffer + PROTOCOL_HEADER_SIZE, *data_length);
+        }
+    }
+
+    return PROTOCOL_HEADER_SIZE + header.length;
+}
+
+static size_t bounded_length(const char *text, const size_t max_length) {
+    return strnlen(text, max_length - 1);
+}
+
+static uint8_t *write_string8(uint8_t *out, const char *text, const size_t max_length) {
+    const size_t length = bounded_length(text, max_length);
+    *out++ = (uint8_t) length;
+    memcpy(out, text, length);
+    return out + length;
+}
+
+static uint8_t *write_string16(uint8_t *out, const char *text, const size_t max_length) {
+    const size_t length = bounded_length(text, max_length);
+    *out++ = (uint8_t) (length >> 8);
+    *out++ = (uint8_t) length;
+    memcpy(out, text, length);
+    return out + length;
+}
+
+static uint8_t *write_u32(uint8_t *out, const uint32_t value) {
+    *out++ = (uint8_t) (value >> 24);
+    *out++ = (uint8_t) (value >> 16);
+    *out++ = (uint8_t) (value >> 8);
+    *out++ = (uint8_t) value;
+    return out;
+}
+
+static int read_u32(const uint8_t **cursor, const uint8_t *end, uint32_t *value) {
+    if (end - *cursor < 4) {
+        return -1;
+    }
+
+    const uint8_t *in = *cursor;
+    *value = (uint32_t) in[0] << 24 | (uint32_t) in[1] << 16 | (uint32_t) in[2] << 8 | (uint32_t) in[3];
+    *cursor += 4;
+    return 0;
+}
+
+static int read_string(const uint8_t **cursor, const uint8_t *end, const int length_bytes,
+                       char *dest, const size_t dest_size) {
+    if (end - *cursor < length_bytes) {
+        return -1;
+    }
+
+    size_t length = (*cursor)[0];
+    if (length_bytes == 2) {
+        length = (length << 8) | (*cursor)[1];
+    }
+    *cursor += length_bytes;
+
+    if ((size_t) (end - *cursor) < length || length >= dest_size) {
+        return -1;
+    }
+
+    memset(dest, 0, dest_size);
+    memcpy(dest, *cursor, length);
+    *cursor += length;
+    return 0;
+}
+
+static uint8_t *write_fixed_string(uint8_t *out, const char *text, const size_t max_length) {
+    const size_t length = bounded_length(text, max_length);
+    memcpy(out, text, length);
+    memset(out + length, 0, max_length - length);
+    return out + max_length;
+}
+
+static int is_roster_message(const MessageType type) {
+    return type == MSG_ROSTER_SYNC || type == MSG_ROSTER || type == MSG_ROSTER_DELTA;
+}
+
+static uint32_t roster_payload_size(const int version, const MessageType type, const void *data,
+                                    const uint32_t data_length) {
+    switch (type) {
+        case MSG_ROSTER_SYNC:
+            return 4;
+        case MSG_ROSTER_DELTA:
+            if (version == PROTOCOL_VERSION_COMPACT) {
+                return 4 + 1 + 1 + bounded_length(((const RosterDelta *) data)->username, MAX_USERNAME_LEN);
+            }
+            return 4 + 1 + MAX_USERNAME_LEN;
+        default:
+            return data_length;
+    }
+}
+
+static int encode_roster(const int version, void *buffer, const MessageType type, const void *data,
+                         const uint32_t data_length) {
+    const uint32_t payload_length = roster_payload_size(version, type, data, data_length);
+    uint8_t *out = buffer;
+
+    switch (type) {
+        case MSG_ROSTER_SYNC:
+            protocol_write_header(out, version, type, 0, payload_length);
+            out = write_u32(out + PROTOCOL_HEADER_SIZE, ((const RosterSync *) data)->version);
+            break;
+        case MSG_ROSTER: {
+            const Roster *roster = data;
+            if (data_length < sizeof(roster->version) || data_length > sizeof(Roster)) {
+                return -1;
+            }
+            protocol_write_header(out, version, type, 0, payload_length);
+            out = write_u32(out + PROTOCOL_HEADER_SIZE, roster->version);
+            memcpy(out, roster->users, data_length - sizeof(roster->version));
+            out += data_length - sizeof(roster->version);
+            break;
+        }
+        default: {
+            const RosterDelta *delta = data;
+            protocol_write_header(out, version, type, 0, payload_length);
+            out = write_u32(out + PROTOCOL_HEADER_SIZE, delta->version);
+            *out++ = delta->action;
+            if (version == PROTOCOL_VERSION_COMPACT) {
+                out = write_string8(out, delta->username, MAX_USERNAME_LEN);
+            } else {
+                out = write_fixed_string(out, delta->username, MAX_USERNAME_LEN);
+            }
+            break;
+        }
+    }
+
+    return (int) (out - (uint8_t *) buffer);
+}
+
+static int decode_roster(const int version, const MessageType type, const uint8_t *payload,
+                         const uint32_t payload_length, void *data, const uint32_t data_size,
+                         uint32_t *data_length) {
+    const uint8_t *cursor = payload;
+    const uint8_t *end = payload + payload_length;
+
+    switch (type) {
+        case MSG_ROSTER_SYNC: {
+            if (data_size < sizeof(RosterSync)) {
+                return -1;
+            }
+            RosterSync *sync = data;
+            if (read_u32(&cursor, end, &sync->version) != 0) {
+                return -1;
+            }
+            *data_length = sizeof(RosterSync);
+            break;
+        }
+        case MSG_ROSTER: {
+            if (data_size < sizeof(Roster)) {
+                return -1;
+            }
+            Roster *roster = data;
+            if (read_u32(&cursor, end, &roster->version) != 0 ||
+                (size_t) (end - cursor) > sizeof(roster->users)) {
+                return -1;
+            }
+            memset(roster->users, 0, sizeof(roster->users));
+            memcpy(roster->users, cursor, end - cursor);
+            *data_length = sizeof(roster->version) + (uint32_t) (end - cursor);
+            cursor = end;
+            break;
+        }
+        default: {
+            if (data_size < sizeof(RosterDelta)) {
+                return -1;
+            }
+            RosterDelta *delta = data;
+            memset(delta, 0, sizeof(*delta));
+            if (read_u32(&cursor, end, &delta->version) != 0 || cursor == end) {
+                return -1;
+            }
+            delta->action = *cursor++;
+            if (version == PROTOCOL_VERSION_COMPACT) {
+                if (read_string(&cursor, end, 1, delta->username, sizeof(delta->username)) != 0) {
+                    return -1;
+                }
+            } else {
+                if (end - cursor < MAX_USERNAME_LEN) {
+                    return -1;
+                }
+                memcpy(delta->username, cursor, MAX_USERNAME_LEN);
+                delta->username[MAX_USERNAME_LEN - 1] = '\0';
+                cursor += MAX_USERNAME_LEN;
+            }
+            *data_length = sizeof(RosterDelta);
+            break;
+        }
+    }
+
+    if (version == PROTOCOL_VERSION_COMPACT && cursor != end) {
+        logger_log(LOG_WARNING, "protocol_decode_compact: %td trailing bytes in message type %d",
+                   end - cursor, type);
+        return -1;
+    }
+
+    return 0;
+}
+
+void protocol_write_header(uint8_t *buffer, const int version, const MessageType type, const uint8_t flags,
+                           const uint32_t length) {
+    if (version == PROTOCOL_VERSION_LEGACY) {
+        buffer[0] = (uint8_t) type;
+        buffer[1] = 0;
+        buffer[2] = 0;
+        buffer[3] = 0;
+    } else {
+        buffer[0] = PROTOCOL_MAGIC;
+        buffer[1] = (uint8_t) version;
+        buffer[2] = (uint8_t) type;
+        buffer[3] = flags;
+    }
+
+    buffer[4] = (uint8_t) (length >> 24);
+    buffer[5] = (uint8_t) (length >> 16);
+    buffer[6] = (uint8_t) (length >> 8);
+    buffer[7] = (uint8_t) length;
+}
+
+int protocol_read_header(const uint8_t *buffer, MessageHeader *header) {
+    if (!buffer || !header) {
+        return -1;
+    }
+
+    if (buffer[0] == PROTOCOL_MAGIC) {
+        header->version = buffer[1];
+        header->type = buffer[2];
+        header->flags = buffer[3];
+
+        if (header->version <= PROTOCOL_VERSION_LEGACY || header->version > PROTOCOL_VERSION_MAX) {
+            logger_log(LOG_WARNING, "protocol_read_header: Unsupported protocol version %d", header->version);
+            return -1;
+        }
+    } else {
+        header->version = PROTOCOL_VERSION_LEGACY;
+        header->type = buffer[0];
+        header->flags = 0;
+    }
+
+    header->length = (uint32_t) buffer[4] << 24 | (uint32_t) buffer[5] << 16 |
+                     (uint32_t) buffer[6] << 8 | (uint32_t) buffer[7];
+    return 0;
+}
+
+static uint32_t compact_payload_size(const MessageType type, const void *data, const uint32_t data_length) {
+    if (!data) {
+        return data_length;
+    }
+
+    switch (type) {
+        case MSG_NICKNAME:
+            return 1 + bounded_length(((const NicknameRequest *) data)->nickname, MAX_USERNAME_LEN);
+        case MSG_NICKNAME_RESPONSE:
+        case MSG_REGISTER_RESPONSE:
+        case MSG_LOGIN_RESPONSE:
+            return 1 + 2 + bounded_length(((const NicknameResponse *) data)->message, MAX_MESSAGE_LEN);
+        case MSG_CHAT: {
+            const ChatMessage *msg = data;
+            return 1 + bounded_length(msg->username, MAX_USERNAME_LEN) +
+                   2 + bounded_length(msg->message, MAX_MESSAGE_LEN);
+        }
+        case MSG_USER_JOIN:
+        case MSG_USER_LEAVE:
+            return 1 + bounded_length(((const UserNotification *) data)->username, MAX_USERNAME_LEN);
+        case MSG_ROOM_JOIN:
+        case MSG_ROOM_LEAVE: {
+            const RoomEvent *event = data;
+            return 1 + bounded_length(event->room, MAX_ROOM_NAME_LEN) +
+                   1 + bounded_length(event->username, MAX_USERNAME_LEN);
+        }
+        case MSG_ROOM_MESSAGE: {
+            const RoomMessage *msg = data;
+            return 1 + bounded_length(msg->room, MAX_ROOM_NAME_LEN) +
+                   1 + bounded_length(msg->username, MAX_USERNAME_LEN) +
+                   2 + bounded_length(msg->message, MAX_MESSAGE_LEN);
+        }
+        case MSG_ROSTER_SYNC:
+        case MSG_ROSTER:
+        case MSG_ROSTER_DELTA:
+            return roster_payload_size(PROTOCOL_VERSION_COMPACT, type, data, data_length);
+        default:
+            return data_length;
+    }
+}
+
+int protocol_encoded_size(const int version, const MessageType type, const void *data, const uint32_t data_length) {
+    if (version == PROTOCOL_VERSION_COMPACT) {
+        return PROTOCOL_HEADER_SIZE + (int) compact_payload_size(type, data, data_length);
+    }
+
+    if (data && is_roster_message(type)) {
+        return PROTOCOL_HEADER_SIZE + (int) roster_payload_size(version, type, data, data_length);
+    }
+
+    return PROTOCOL_HEADER_SIZE + data_length;
+}
+
+int protocol_encode(const int version, void *buffer, const MessageType type, const void *data,
+                    const uint32_t data_length) {
+    if (version != PROTOCOL_VERSION_COMPACT) {
+        return serialize_message(buffer, type, data, data_length);
+    }
+
+    if (!buffer) {
+        return -1;
+    }
+
+    if (is_roster_message(type) && data != NULL) {
+        return encode_roster(version, buffer, type, data, data_length);
+    }
+
+    const uint32_t payload_length = compact_payload_size(type, data, data_length);
+    uint8_t *out = buffer;
+    protocol_write_header(out, version, type, 0, payload_length);
+    out += PROTOCOL_HEADER_SIZE;
+
+    if (!data) {
+        return PROTOCOL_HEADER_SIZE;
+    }
+
+    switch (type) {
+        case MSG_NICKNAME:
+            out = write_string8(out, ((const NicknameRequest *) data)->nickname, MAX_USERNAME_LEN);
+            break;
+        case MSG_NICKNAME_RESPONSE:
+        case MSG_REGISTER_RESPONSE:
+        case MSG_LOGIN_RESPONSE: {
+            const NicknameResponse *resp = data;
+            *out++ = resp->status;
+            out = write_string16(out, resp->message, MAX_MESSAGE_LEN);
+            break;
+        }
+        case MSG_CHAT: {
+            const ChatMessage *msg = data;
+            out = write_string8(out, msg->username, MAX_USERNAME_LEN);
+            out = write_string16(out, msg->message, MAX_MESSAGE_LEN);
+            break;
+        }
+        case MSG_USER_JOIN:
+        case MSG_USER_LEAVE:
+            out = write_string8(out, ((const UserNotification *) data)->username, MAX_USERNAME_LEN);
+            break;
+        case MSG_ROOM_JOIN:
+        case MSG_ROOM_LEAVE: {
+            const RoomEvent *event = data;
+            out = write_string8(out, event->room, MAX_ROOM_NAME_LEN);
+            out = write_string8(out, event->username, MAX_USERNAME_LEN);
+            break;
+        }
+        case MSG_ROOM_MESSAGE: {
+            const RoomMessage *msg = data;
+            out = write_string8(out, msg->room, MAX_ROOM_NAME_LEN);
+            out = write_string8(out, msg->username, MAX_USERNAME_LEN);
+            out = write_string16(out, msg->message, MAX_MESSAGE_LEN);
+            break;
         }
+        default:
+            memcpy(out, data, data_length);
+            out += data_length;
+            break;
     }
 
-    return sizeof(MessageHeader) + *data_length;
+    LOGGER_DEBUG("protocol_encode: compact type=%d, payload_length=%u", type, payload_length);
+
+    return (int) (out - (uint8_t *) buffer);
 }
 
-int send_message(int socket, MessageType type, const void *data, uint32_t data_length) {
+int protocol_decode_compact(const MessageType type, const uint8_t *payload, const uint32_t payload_length,
+                            void *data, const uint32_t data_size, uint32_t *data_length) {
+    if (!data || !data_length || (payload_length > 0 && !payload)) {
+        return -1;
+    }
+
+    const uint8_t *cursor = payload;
+    const uint8_t *end = payload + payload_length;
+
+    switch (type) {
+        case MSG_NICKNAME: {
+            if (data_size < sizeof(NicknameRequest)) {
+                return -1;
+            }
+            NicknameRequest *req = data;
+            if (read_string(&cursor, end, 1, req->nickname, sizeof(req->nickname)) != 0) {
+                return -1;
+            }
+            *data_length = sizeof(NicknameRequest);
+            break;
+        }
+        case MSG_NICKNAME_RESPONSE:
+        case MSG_REGISTER_RESPONSE:
+        case MSG_LOGIN_RESPONSE: {
+            if (data_size < sizeof(NicknameResponse) || cursor == end) {
+                return -1;
+            }
+            NicknameResponse *resp = data;
+            resp->status = *cursor++;
+            if (read_string(&cursor, end, 2, resp->message, sizeof(resp->message)) != 0) {
+                return -1;
+            }
+            *data_length = sizeof(NicknameResponse);
+            break;
+        }
+        case MSG_CHAT: {
+            if (data_size < sizeof(ChatMessage)) {
+                return -1;
+            }
+            ChatMessage *msg = data;
+            if (read_string(&cursor, end, 1, msg->username, sizeof(msg->username)) != 0 ||
+                read_string(&cursor, end, 2, msg->message, sizeof(msg->message)) != 0) {
+                return -1;
+            }
+            *data_length = sizeof(ChatMessage);
+            break;
+        }
+        case MSG_USER_JOIN:
+        case MSG_USER_LEAVE: {
+            if (data_size < sizeof(UserNotification)) {
+                return -1;
+            }
+            UserNotification *notify = data;
+            if (read_string(&cursor, end, 1, notify->username, sizeof(notify->username)) != 0) {
+                return -1;
+            }
+            *data_length = sizeof(UserNotification);
+            break;
+        }
+        case MSG_ROOM_JOIN:
+        case MSG_ROOM_LEAVE: {
+            if (data_size < sizeof(RoomEvent)) {
+                return -1;
+            }
+            RoomEvent *event = data;
+            if (read_string(&cursor, end, 1, event->room, sizeof(event->room)) != 0 ||
+                read_string(&cursor, end, 1, event->username, sizeof(event->username)) != 0) {
+                return -1;
+            }
+            *data_length = sizeof(RoomEvent);
+            break;
+        }
+        case MSG_ROOM_MESSAGE: {
+            if (data_size < sizeof(RoomMessage)) {
+                return -1;
+            }
+            RoomMessage *msg = data;
+            if (read_string(&cursor, end, 1, msg->room, sizeof(msg->room)) != 0 ||
+                read_string(&cursor, end, 1, msg->username, sizeof(msg->username)) != 0 ||
+                read_string(&cursor, end, 2, msg->message, sizeof(msg->message)) != 0) {
+                return -1;
+            }
+            *data_length = sizeof(RoomMessage);
+            break;
+        }
+        case MSG_ROSTER_SYNC:
+        case MSG_ROSTER:
+        case MSG_ROSTER_DELTA:
+            return decode_roster(PROTOCOL_VERSION_COMPACT, type, payload, payload_length, data, data_size,
+                                 data_length);
+        default:
+            if (payload_length > data_size) {
+                return -1;
+            }
+            if (payload_length > 0) {
+                memcpy(data, payload, payload_length);
+            }
+            *data_length = payload_length;
+            return 0;
+    }
+
+    if (cursor != end) {
+        logger_log(LOG_WARNING, "protocol_decode_compact: %td trailing bytes in message type %d",
+                   end - cursor, type);
+        return -1;
+    }
+
+    return 0;
+}
+
+int protocol_decode_payload(const int version, const MessageType type, const uint8_t *payload,
+                            const uint32_t payload_length, void *data, const uint32_t data_size,
+                            uint32_t *data_length) {
+    if (version == PROTOCOL_VERSION_COMPACT) {
+        return protocol_decode_compact(type, payload, payload_length, data, data_size, data_length);
+    }
+
+    if (!data || !data_length || (payload_length > 0 && !payload)) {
+        return -1;
+    }
+
+    if (is_roster_message(type)) {
+        return decode_roster(PROTOCOL_VERSION_LEGACY, type, payload, payload_length, data, data_size, data_length);
+    }
+
+    if (payload_length > data_size) {
+        return -1;
+    }
+
+    if (payload_length > 0) {
+        memcpy(data, payload, payload_length);
+    }
+    *data_length = payload_length;
+
+    if (type == MSG_CHAT && payload_length >= sizeof(ChatMessage)) {
+        ChatMessage *msg = (ChatMessage *) data;
+        msg->username[MAX_USERNAME_LEN - 1] = '\0';
+        msg->message[MAX_MESSAGE_LEN - 1] = '\0';
+    } else if (type == MSG_NICKNAME && payload_length >= sizeof(NicknameRequest)) {
+        NicknameRequest *req = (NicknameRequest *) data;
+        req->nickname[MAX_USERNAME_LEN - 1] = '\0';
+    } else if ((type == MSG_ROOM_JOIN || type == MSG_ROOM_LEAVE) && payload_length >= sizeof(RoomEvent)) {
+        RoomEvent *event = (RoomEvent *) data;
+        event->room[MAX_ROOM_NAME_LEN - 1] = '\0';
+        event->username[MAX_USERNAME_LEN - 1] = '\0';
+    } else if (type == MSG_ROOM_MESSAGE && payload_length >= sizeof(RoomMessage)) {
+        RoomMessage *msg = (RoomMessage *) data;
+        msg->room[MAX_ROOM_NAME_LEN - 1] = '\0';
+        msg->username[MAX_USERNAME_LEN - 1] = '\0';
+        msg->message[MAX_MESSAGE_LEN - 1] = '\0';
+    }
+
+    return 0;
+}
+
+int send_message(const int socket, const MessageType type, const void *data, const uint32_t data_length) {
+    return protocol_send(socket, PROTOCOL_VERSION_LEGACY, type, data, data_length);
+}
+
+int receive_message(const int socket, MessageType *type, void *data, uint32_t *data_length) {
+    return protocol_receive(socket, PROTOCOL_VERSION_LEGACY, type, data, data_length);
+}
+
+int protocol_send(const int socket, const int version, const MessageType type, const void *data,
+                  const uint32_t data_length) {
     if (socket < 0) {
         logger_log(LOG_ERROR, "send_message: Invalid socket (%d)", socket);
         return -1;
     }
 
-    if (type <= 0 || type > MSG_LOGIN_RESPONSE) {
+    if (type <= 0 || type > MSG_TYPE_LAST) {
         logger_log(LOG_ERROR, "send_message: Invalid message type (%d)", type);
         return -1;
     }
@@ -149,44 +694,50 @@ int send_message(int socket, MessageType type, const void *data, uint32_t data_l
         return -1;
     }
 
-    uint8_t *buffer = malloc(sizeof(MessageHeader) + data_length);
+    const int buffer_size = protocol_encoded_size(version, type, data, data_length);
+    uint8_t stack_buffer[PROTOCOL_SEND_STACK_BUFFER];
+    uint8_t *buffer = buffer_size <= (int) sizeof(stack_buffer) ? stack_buffer : malloc(buffer_size);
     if (buffer == NULL) {
         logger_log(LOG_ERROR, "send_message: Failed to allocate memory for message buffer");
         return -1;
     }
 
-    memset(buffer, 0, sizeof(MessageHeader) + data_length);
+    memset(buffer, 0, buffer_size);
 
     switch (type) {
         case MSG_NICKNAME:
             if (data != NULL) {
                 const NicknameRequest *req = (const NicknameRequest *) data;
-                logger_log(LOG_DEBUG, "send_message: Sending MSG_NICKNAME, nickname='%s', length=%zu, data_length=%u",
+                LOGGER_DEBUG("send_message: Sending MSG_NICKNAME, nickname='%s', length=%zu, data_length=%u",
                            req->nickname, strlen(req->nickname), data_length);
             }
             break;
         case MSG_NICKNAME_RESPONSE:
             if (data != NULL) {
                 const NicknameResponse *resp = (const NicknameResponse *) data;
-                logger_log(LOG_DEBUG, "send_message: Sending MSG_NICKNAME_RESPONSE, status=%d, message='%s'",
+                LOGGER_DEBUG("send_message: Sending MSG_NICKNAME_RESPONSE, status=%d, message='%s'",
                            resp->status, resp->message);
             }
             break;
         default:
-            logger_log(LOG_DEBUG, "send_message: Sending message type=%d, data_length=%u", type, data_length);
+            LOGGER_DEBUG("send_message: Sending message type=%d, data_length=%u", type, data_length);
             break;
     }
 
-    const int total_length = serialize_message(buffer, type, data, data_length);
+    const int total_length = protocol_encode(version, buffer, type, data, data_length);
     if (total_length < 0) {
         logger_log(LOG_ERROR, "send_message: Failed to serialize message (type=%d)", type);
-        free(buffer);
+        if (buffer != stack_buffer) {
+            free(buffer);
+        }
         return -1;
     }
 
     const ssize_t bytes_sent = send(socket, buffer, total_length, 0);
 
-    free(buffer);
+    if (buffer != stack_buffer) {
+        free(buffer);
+    }
 
     if (bytes_sent < 0) {
         logger_log(LOG_ERROR, "send_message: send() failed: %s", strerror(errno));
@@ -200,7 +751,7 @@ int send_message(int socket, MessageType type, const void *data, uint32_t data_l
     return bytes_sent;
 }
 
-int receive_message(const int socket, MessageType *type, void *data, uint32_t *data_length) {
+int protocol_receive(const int socket, const int version, MessageType *type, void *data, uint32_t *data_length) {
     if (socket < 0 || !type || !data || !data_length) {
         return -1;
     }
@@ -214,11 +765,12 @@ int receive_message(const int socket, MessageType *type, void *data, uint32_t *d
 
     bool is_nonblocking = sock_flags & O_NONBLOCK;
 
-    MessageHeader header;
+    uint8_t header[PROTOCOL_HEADER_SIZE];
+    const size_t header_size = PROTOCOL_HEADER_SIZE;
     ssize_t bytes_received;
 
     // Try to receive the header
-    bytes_received = recv(socket, &header, sizeof(header), is_nonblocking ? 0 : MSG_WAITALL);
+    bytes_received = recv(socket, header, header_size, is_nonblocking ? 0 : MSG_WAITALL);
 
     if (bytes_received == 0) {
         logger_log(LOG_INFO, "receive_message: Connection closed by peer");
@@ -228,7 +780,7 @@ int receive_message(const int socket, MessageType *type, void *data, uint32_t *d
     if (bytes_received < 0) {
         // Handle non-blocking socket case
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            logger_log(LOG_DEBUG, "receive_message: No data available to read (EAGAIN/EWOULDBLOCK)");
+            LOGGER_DEBUG("receive_message: No data available to read (EAGAIN/EWOULDBLOCK)");
             return -2; // Special return code for "no data available"
         }
         logger_log(LOG_ERROR, "receive_message: recv() failed: %s", strerror(errno));
@@ -236,25 +788,46 @@ int receive_message(const int socket, MessageType *type, void *data, uint32_t *d
     }
 
     // If we only received partial header data (in non-blocking mode)
-    if (bytes_received < sizeof(header)) {
+    if ((size_t) bytes_received < header_size) {
         logger_log(LOG_ERROR, "receive_message: Received incomplete header (%zd of %zu bytes)",
-                   bytes_received, sizeof(header));
+                   bytes_received, header_size);
         return -1;
     }
 
-    *type = header.type;
-    *data_length = ntohl(header.length);
+    MessageHeader decoded;
+    if (protocol_read_header(header, &decoded) != 0 || decoded.version != version) {
+        logger_log(LOG_ERROR, "receive_message: Unexpected message header (expected protocol version %d)", version);
+        return -1;
+    }
 
-    const uint32_t MAX_ALLOWED_SIZE = 1024 * 1024;
+    if (decoded.flags & ~FRAME_FLAGS_SUPPORTED) {
+        logger_log(LOG_ERROR, "receive_message: Unsupported frame flags 0x%02X", decoded.flags);
+        return -1;
+    }
+
+    *type = decoded.type;
+    *data_length = decoded.length;
+
+    const uint32_t MAX_ALLOWED_SIZE = version == PROTOCOL_VERSION_COMPACT ? COMPACT_MAX_PAYLOAD : 1024 * 1024;
     if (*data_length > MAX_ALLOWED_SIZE) {
         logger_log(LOG_ERROR, "receive_message: Message too large (%u bytes)", *data_length);
         return -1;
     }
 
-    logger_log(LOG_DEBUG, "receive_message: Received header with type=%d, length=%u", *type, *data_length);
+    LOGGER_DEBUG("receive_message: Received header with type=%d, length=%u", *type, *data_length);
+
+    const uint32_t wire_length = *data_length;
+    uint8_t payload[COMPACT_MAX_PAYLOAD];
+    const int decode = version == PROTOCOL_VERSION_COMPACT || is_roster_message(*type);
+    void *target = decode ? payload : data;
+
+    if (decode && *data_length > sizeof(payload)) {
+        logger_log(LOG_ERROR, "receive_message: Message too large (%u bytes)", *data_length);
+        return -1;
+    }
 
     if (*data_length > 0) {
-        bytes_received = recv(socket, data, *data_length, is_nonblocking ? 0 : MSG_WAITALL);
+        bytes_received = recv(socket, target, *data_length, is_nonblocking ? 0 : MSG_WAITALL);
 
         if (bytes_received == 0) {
             logger_log(LOG_INFO, "receive_message: Connection closed by peer while receiving data");
@@ -263,7 +836,7 @@ int receive_message(const int socket, MessageType *type, void *data, uint32_t *d
 
         if (bytes_received < 0) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                logger_log(LOG_DEBUG, "receive_message: No message data available yet (EAGAIN/EWOULDBLOCK)");
+                LOGGER_DEBUG("receive_message: No message data available yet (EAGAIN/EWOULDBLOCK)");
                 return -2; // Special return code for "no data available"
             }
             logger_log(LOG_ERROR, "receive_message: recv() failed while receiving data: %s", strerror(errno));
@@ -272,24 +845,32 @@ int receive_message(const int socket, MessageType *type, void *data, uint32_t *d
 
         // If we're in non-blocking mode and got partial data
         if ((uint32_t) bytes_received != *data_length) {
-            logger_log(LOG_DEBUG, "receive_message: Received incomplete data (%zd of %u bytes)",
+            LOGGER_DEBUG("receive_message: Received incomplete data (%zd of %u bytes)",
                        bytes_received, *data_length);
             return -2; // Indicate need to retry
         }
 
-        logger_log(LOG_DEBUG, "receive_message: Received %zd bytes of data", bytes_received);
+        LOGGER_DEBUG("receive_message: Received %zd bytes of data", bytes_received);
+    }
 
+    if (decode) {
+        if (protocol_decode_payload(version, *type, payload, wire_length, data, sizeof(payload), data_length) != 0) {
+            logger_log(LOG_ERROR, "receive_message: Malformed message (type=%d, length=%u)",
+                       *type, wire_length);
+            return -1;
+        }
+    } else if (*data_length > 0) {
         if (*type == MSG_CHAT) {
             ChatMessage *msg = (ChatMessage *) data;
             msg->username[MAX_USERNAME_LEN - 1] = '\0';
             msg->message[MAX_MESSAGE_LEN - 1] = '\0';
-            logger_log(LOG_DEBUG, "receive_message: Chat message from '%s': '%s'", msg->username, msg->message);
+            LOGGER_DEBUG("receive_message: Chat message from '%s': '%s'", msg->username, msg->message);
         } else if (*type == MSG_NICKNAME) {
             NicknameRequest *req = (NicknameRequest *) data;
             req->nickname[MAX_USERNAME_LEN - 1] = '\0';
-            logger_log(LOG_DEBUG, "receive_message: Nickname request: '%s'", req->nickname);
+            LOGGER_DEBUG("receive_message: Nickname request: '%s'", req->nickname);
         }
     }
 
-    return sizeof(header) + *data_length;
+    return (int) (header_size + wire_length);
 }
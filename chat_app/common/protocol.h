@@ -15,10 +15,34 @@
 #define MAX_MESSAGE_LEN 1024
 #endif
 
+#ifndef MAX_ROOM_NAME_LEN
+#define MAX_ROOM_NAME_LEN 32
+#endif
+
 #ifndef MAX_PASSWORD_LEN
 #define MAX_PASSWORD_LEN 64
 #endif
 
+#define PROTOCOL_VERSION_LEGACY 1
+#define PROTOCOL_VERSION_COMPACT 2
+#define PROTOCOL_VERSION_MAX PROTOCOL_VERSION_COMPACT
+
+#define PROTOCOL_HEADER_SIZE 8
+#define PROTOCOL_MAGIC 0xC7
+
+#define FRAME_FLAG_COMPRESSED 0x01
+#define FRAME_FLAG_BATCH 0x02
+#define FRAME_FLAGS_SUPPORTED 0x00
+
+#define COMPACT_MAX_PAYLOAD 8192
+
+#ifndef PROTOCOL_SEND_STACK_BUFFER
+#define PROTOCOL_SEND_STACK_BUFFER 2048
+#endif
+
+#define USER_LIST_HEADER "Users"
+#define USER_LIST_PAGE_SIZE 4096
+
 typedef enum {
     MSG_NICKNAME = 1,
     MSG_NICKNAME_RESPONSE,
@@ -30,9 +54,21 @@ typedef enum {
     MSG_REGISTER,
     MSG_REGISTER_RESPONSE,
     MSG_LOGIN,
-    MSG_LOGIN_RESPONSE
+    MSG_LOGIN_RESPONSE,
+    MSG_HELLO,
+    MSG_ROOM_JOIN,
+    MSG_ROOM_LEAVE,
+    MSG_ROOM_MESSAGE,
+    MSG_ROSTER_SYNC,
+    MSG_ROSTER,
+    MSG_ROSTER_DELTA
 } MessageType;
 
+#define MSG_TYPE_LAST MSG_ROSTER_DELTA
+
+#define ROSTER_DELTA_JOIN 0
+#define ROSTER_DELTA_LEAVE 1
+
 typedef enum {
     STATUS_SUCCESS = 0,
     STATUS_ERROR,
@@ -43,7 +79,9 @@ typedef enum {
 } StatusCode;
 
 typedef struct {
+    uint8_t version;
     uint8_t type;
+    uint8_t flags;
     uint32_t length;
 } MessageHeader;
 
@@ -65,6 +103,32 @@ typedef struct {
     char username[MAX_USERNAME_LEN];
 } UserNotification;
 
+typedef struct {
+    uint32_t version;
+} RosterSync;
+
+typedef struct {
+    uint32_t version;
+    char users[USER_LIST_PAGE_SIZE];
+} Roster;
+
+typedef struct {
+    uint32_t version;
+    uint8_t action;
+    char username[MAX_USERNAME_LEN];
+} RosterDelta;
+
+typedef struct {
+    char room[MAX_ROOM_NAME_LEN];
+    char username[MAX_USERNAME_LEN];
+} RoomEvent;
+
+typedef struct {
+    char room[MAX_ROOM_NAME_LEN];
+    char username[MAX_USERNAME_LEN];
+    char message[MAX_MESSAGE_LEN];
+} RoomMessage;
+
 typedef struct {
     char username[MAX_USERNAME_LEN];
     char password[MAX_PASSWORD_LEN];
@@ -90,4 +154,15 @@ int deserialize_message(const void *buffer, MessageType *type, void *data, uint3
 int send_message(int socket, MessageType type, const void *data, uint32_t data_length);
 int receive_message(int socket, MessageType *type, void *data, uint32_t *data_length);
 
+void protocol_write_header(uint8_t *buffer, int version, MessageType type, uint8_t flags, uint32_t length);
+int protocol_read_header(const uint8_t *buffer, MessageHeader *header);
+int protocol_encoded_size(int version, MessageType type, const void *data, uint32_t data_length);
+int protocol_encode(int version, void *buffer, MessageType type, const void *data, uint32_t data_length);
+int protocol_decode_compact(MessageType type, const uint8_t *payload, uint32_t payload_length,
+                            void *data, uint32_t data_size, uint32_t *data_length);
+int protocol_decode_payload(int version, MessageType type, const uint8_t *payload, uint32_t payload_length,
+                            void *data, uint32_t data_size, uint32_t *data_length);
+int protocol_send(int socket, int version, MessageType type, const void *data, uint32_t data_length);
+int protocol_receive(int socket, int version, MessageType *type, void *data, uint32_t *data_length);
+
 #endif
\ No newline at end of file
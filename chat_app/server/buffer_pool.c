@@ -0,0 +1,141 @@
+/**
+ * @file buffer_pool.c
+ * @brief Shared pool of connection receive buffers
+ *
+ * Connections borrow their receive buffer from this pool when data
+ * arrives and give it back once they have been idle for a while, so a
+ * mostly idle connection holds no buffer at all. Returned buffers are
+ * kept on a free list, up to a limit, and handed to the next connection
+ * that needs one. Requests for any other size go straight to malloc().
+ *
+ * @author Jeremiah Hughes & Anthony Patton
+ * @date April 2025
+ */
+
+#include "buffer_pool.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+typedef struct PoolBuffer {
+    struct PoolBuffer *next;
+} PoolBuffer;
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static PoolBuffer *free_list = NULL;
+static size_t pool_buffer_size = 0;
+static size_t pool_max_cached = BUFFER_POOL_MAX_CACHED;
+static size_t cached_count = 0;
+static size_t in_use_count = 0;
+
+/**
+ * @brief Sets the size of pooled buffers and how many are kept spare
+ *
+ * Must be called before any buffer is acquired.
+ *
+ * @param buffer_size Size of the buffers the pool serves
+ * @param max_cached Maximum number of returned buffers kept for reuse
+ */
+void buffer_pool_configure(const size_t buffer_size, const size_t max_cached) {
+    pthread_mutex_lock(&pool_mutex);
+    pool_buffer_size = buffer_size < sizeof(PoolBuffer) ? sizeof(PoolBuffer) : buffer_size;
+    pool_max_cached = max_cached;
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+/**
+ * @brief Borrows a buffer
+ *
+ * @param size Requested size in bytes
+ * @return The buffer, or NULL on allocation failure
+ */
+void *buffer_pool_acquire(const size_t size) {
+    pthread_mutex_lock(&pool_mutex);
+
+    if (size != pool_buffer_size) {
+        pthread_mutex_unlock(&pool_mutex);
+        return malloc(size);
+    }
+
+    PoolBuffer *buffer = free_list;
+    if (buffer) {
+        free_list = buffer->next;
+        cached_count--;
+    }
+    in_use_count++;
+
+    pthread_mutex_unlock(&pool_mutex);
+
+    if (!buffer) {
+        buffer = malloc(size);
+        if (!buffer) {
+            pthread_mutex_lock(&pool_mutex);
+            in_use_count--;
+            pthread_mutex_unlock(&pool_mutex);
+        }
+    }
+
+    return buffer;
+}
+
+/**
+ * @brief Returns a buffer obtained from buffer_pool_acquire()
+ *
+ * @param buffer The buffer
+ * @param size The size it was acquired with
+ */
+void buffer_pool_release(void *buffer, const size_t size) {
+    if (!buffer) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool_mutex);
+
+    if (size != pool_buffer_size) {
+        pthread_mutex_unlock(&pool_mutex);
+        free(buffer);
+        return;
+    }
+
+    in_use_count--;
+    if (cached_count < pool_max_cached) {
+        PoolBuffer *entry = buffer;
+        entry->next = free_list;
+        free_list = entry;
+        cached_count++;
+        buffer = NULL;
+    }
+
+    pthread_mutex_unlock(&pool_mutex);
+
+    free(buffer);
+}
+
+/**
+ * @brief Frees every spare buffer
+ */
+void buffer_pool_destroy(void) {
+    pthread_mutex_lock(&pool_mutex);
+
+    while (free_list) {
+        PoolBuffer *next = free_list->next;
+        free(free_list);
+        free_list = next;
+    }
+    cached_count = 0;
+
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+/**
+ * @brief Reports how many pooled buffers are lent out and kept spare
+ *
+ * @param stats Receives the pool statistics
+ */
+void buffer_pool_stats(BufferPoolStats *stats) {
+    pthread_mutex_lock(&pool_mutex);
+    stats->buffer_size = pool_buffer_size;
+    stats->in_use = in_use_count;
+    stats->cached = cached_count;
+    pthread_mutex_unlock(&pool_mutex);
+}
@@ -0,0 +1,22 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+
+#ifndef BUFFER_POOL_MAX_CACHED
+#define BUFFER_POOL_MAX_CACHED 1024
+#endif
+
+typedef struct {
+    size_t buffer_size;
+    size_t in_use;
+    size_t cached;
+} BufferPoolStats;
+
+void buffer_pool_configure(size_t buffer_size, size_t max_cached);
+void *buffer_pool_acquire(size_t size);
+void buffer_pool_release(void *buffer, size_t size);
+void buffer_pool_destroy(void);
+void buffer_pool_stats(BufferPoolStats *stats);
+
+#endif
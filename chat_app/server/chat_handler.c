@@ -5,12 +5,47 @@
  * This file implements client connection handling, message routing,
  * user tracking, and broadcasting messages to connected clients.
  *
+ * Outgoing messages are encoded once per protocol version into a
+ * reference-counted frame and pushed onto the outbound queue of every
+ * recipient. Each queue is then
+ * flushed by the event loop that owns the client.
+ *
+ * Rooms are sharded across the event loops: each room is owned by the
+ * loop its name hashes to, and only that loop touches its member list.
+ * Joins, leaves and room messages travel from the sender's loop to the
+ * owner, and the owner sends the encoded frames on to each loop that has
+ * members, all through the lock-free queues of the shard module. Room
+ * traffic never takes clients_mutex.
+ *
+ * Broadcasts work the same way, except that the recipients come from an
+ * immutable snapshot of the client list that is replaced whenever a
+ * client connects, disconnects or changes its nickname, so readers never
+ * take clients_mutex either.
+ *
+ * Presence is owned by one shard as well. Nobody is sent the full user
+ * list again after their own join; instead, joins and leaves reach
+ * older clients as MSG_USER_JOIN/MSG_USER_LEAVE, and clients that
+ * subscribe with MSG_ROSTER_SYNC get versioned roster deltas from the
+ * presence shard and can catch up from the version they last saw.
+ *
+ * The last few chat messages, and the last few messages of every room,
+ * are kept as their encoded frames and replayed to clients as they set
+ * their nickname or join the room. Chat messages are also appended to the
+ * durable message log, when one is configured, and the lobby history is
+ * refilled from it on startup.
+ *
+ * Receive rings come from a shared buffer pool and are attached on the
+ * first read. Every few seconds each loop hands the rings and outbound
+ * frame arrays of its idle, fully drained clients back, so thousands of
+ * quiet connections cost little more than their Client records.
+ *
  * @author Jeremiah Hughes & Anthony Patton
  * @date April 2025
  */
 
 #include "chat_handler.h"
 
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,636 +54,2485 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <time.h>
-#include <signal.h>
+#include "buffer_pool.h"
+#include "client_registry.h"
+#include "client_snapshot.h"
+#include "history.h"
+#include "message_log.h"
+#include "nickname_index.h"
+#include "presence.h"
+#include "room_registry.h"
+#include "shard.h"
+#include "user_list.h"
+#include "../common/frame.h"
 #include "../common/logger.h"
 #include "../common/protocol.h"
 #include <errno.h>
 #include <netinet/in.h>
 
 
-#define MAX_CLIENTS 100
+#define FAN_OUT_NAMED_ONLY 0x01
+#define FAN_OUT_SKIP_SUBSCRIBERS 0x02
+#define FAN_OUT_MIN_DELIVERY 16
+
+#define PRESENCE_SHARD 0
+
+/* Notify token asking a loop to trim its idle clients; client IDs are never negative. */
+#define TRIM_IDLE_TOKEN (-1)
 
+/**
+ * @brief A loop's clients, from the least to the most recently active
+ *
+ * Only the owning loop touches its list, so it needs no lock.
+ */
+typedef struct {
+    Client *oldest;
+    Client *newest;
+    int count;
+} IdleList;
 
-Client *clients[MAX_CLIENTS] = {NULL};
+/**
+ * @brief A message split into pages, encoded once per protocol version
+ */
+typedef struct {
+    int page_count;
+    Frame **frames[PROTOCOL_VERSION_MAX + 1];
+} PagedFrames;
 
+static int named_count = 0;
 
-static int client_count = 0;
+static atomic_int idle_timeout_ms = CHAT_HANDLER_DEFAULT_IDLE_MS;
+static IdleList *idle_lists = NULL;
 
+/* Bumped after every snapshot that changes the set of nicknames. */
+static atomic_ulong roster_generation = 0;
 
-static int next_client_id = 1;
+/* Identifies each encoded paged message to the outbound queues; never 0. */
+static atomic_uint paged_sequence = 0;
 
+/* Shard deliveries allocated or grown rather than reused. */
+static atomic_uint_fast64_t delivery_allocations = 0;
 
-pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t user_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+static PagedFrames user_list_cache;
+static unsigned long user_list_generation = 0;
+static int user_list_valid = 0;
 
+static pthread_mutex_t history_mutex = PTHREAD_MUTEX_INITIALIZER;
+static HistoryRing lobby_history;
 
-static pthread_t client_threads[MAX_CLIENTS] = {0};
-static int thread_count = 0;
-static pthread_mutex_t thread_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Only touched on the presence shard. */
+static PagedFrames roster_cache;
+static uint32_t roster_cache_version = 0;
+static int roster_cache_valid = 0;
 
-static pthread_t current_joining_thread = 0;
-static volatile sig_atomic_t alarm_fired = 0;
 
-static void alarm_handler(int sig) {
-    alarm_fired = 1;
-    if (current_joining_thread != 0) {
-        pthread_cancel(current_joining_thread);
-    }
-}
+pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int chat_handler_client_receive(void *ctx);
+static int chat_handler_client_writable(void *ctx);
+static void chat_handler_client_closed(void *ctx, EventCloseReason reason, int error);
+static void chat_handler_flush_client(EventLoop *loop, int client_id);
+static void release_pages(PagedFrames *paged);
+static void restore_lobby_history(void);
 
 /**
  * @brief Initializes the chat handler module
  *
  * This function initializes the client tracking structures.
  *
+ * @param max_clients Maximum number of simultaneously connected clients
  * @return 0 on success, -1 on failure
  */
-int chat_handler_init(void) {
+int chat_handler_init(const int max_clients) {
     pthread_mutex_lock(&clients_mutex);
-    memset(clients, 0, sizeof(clients));
-    client_count = 0;
-    next_client_id = 1;
+    named_count = 0;
+    const int result = client_registry_init(max_clients);
     pthread_mutex_unlock(&clients_mutex);
 
-    pthread_mutex_lock(&thread_mutex);
-    memset(client_threads, 0, sizeof(client_threads));
-    thread_count = 0;
-    pthread_mutex_unlock(&thread_mutex);
+    pthread_mutex_lock(&history_mutex);
+    history_init(&lobby_history);
+    pthread_mutex_unlock(&history_mutex);
+
+    if (result != 0 || nickname_index_init(max_clients) != 0) {
+        return -1;
+    }
+
+    if (message_log_open() != 0) {
+        return -1;
+    }
+    restore_lobby_history();
+
+    buffer_pool_configure(CLIENT_RX_RING_SIZE, BUFFER_POOL_MAX_CACHED);
+    frame_decoder_set_allocator(buffer_pool_acquire, buffer_pool_release);
+
+    event_loop_set_notify_callback(chat_handler_flush_client);
 
-    logger_log(LOG_DEBUG, "Structure sizes - NicknameRequest: %zu, ChatMessage: %zu, UserNotification: %zu",
+    LOGGER_DEBUG("Structure sizes - NicknameRequest: %zu, ChatMessage: %zu, UserNotification: %zu",
                sizeof(NicknameRequest), sizeof(ChatMessage), sizeof(UserNotification));
 
     return 0;
 }
 
+static void handle_shard_message(int shard, void *message);
+static void release_shard_message(void *message);
+static int fan_out_scratch_init(int shards);
+static void fan_out_scratch_destroy(void);
+
+/**
+ * @brief Sets up room sharding, presence and the client snapshot over the running event loops
+ *
+ * Must be called after the event-loop pool has started and before any
+ * client connects.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int chat_handler_start_shards(void) {
+    const int shards = event_loop_pool_size();
+
+    idle_lists = calloc(shards, sizeof(IdleList));
+    if (!idle_lists) {
+        logger_log(LOG_ERROR, "Failed to allocate memory for idle client lists");
+        return -1;
+    }
+
+    if (fan_out_scratch_init(shards) != 0) {
+        free(idle_lists);
+        idle_lists = NULL;
+        return -1;
+    }
+
+    if (room_registry_init(shards) != 0) {
+        fan_out_scratch_destroy();
+        free(idle_lists);
+        idle_lists = NULL;
+        return -1;
+    }
+
+    if (client_snapshot_init(shards) != 0) {
+        room_registry_destroy();
+        fan_out_scratch_destroy();
+        free(idle_lists);
+        idle_lists = NULL;
+        return -1;
+    }
+
+    if (presence_init(client_registry_capacity()) != 0) {
+        client_snapshot_destroy();
+        room_registry_destroy();
+        fan_out_scratch_destroy();
+        free(idle_lists);
+        idle_lists = NULL;
+        return -1;
+    }
+
+    if (shard_init(shards, handle_shard_message, release_shard_message) != 0) {
+        presence_destroy();
+        client_snapshot_destroy();
+        room_registry_destroy();
+        fan_out_scratch_destroy();
+        free(idle_lists);
+        idle_lists = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
 /**
  * @brief Cleans up the chat handler module
  *
  * This function frees resources used by the chat handler module,
  * including closing client sockets and freeing client structures.
+ * The event loops must already be stopped.
  */
 void chat_handler_cleanup(void) {
-    pthread_mutex_lock(&thread_mutex);
+    pthread_mutex_lock(&clients_mutex);
+
+    for (int i = 0; i < client_registry_count(); i++) {
+        Client *client = client_registry_at(i);
+        close(client->socket);
+        frame_decoder_destroy(&client->rx);
+        outbound_queue_destroy(&client->tx);
+    }
 
-    struct sigaction sa;
-    struct sigaction old_sa;
-    memset(&sa, 0, sizeof(sa));
-    sa.sa_handler = alarm_handler;
-    sigaction(SIGALRM, &sa, &old_sa);
+    client_registry_destroy();
+    nickname_index_destroy();
+    shard_destroy();
+    room_registry_destroy();
+    presence_destroy();
+    client_snapshot_destroy();
+    logger_log(LOG_INFO, "Fan-out: %llu shard deliveries allocated, the rest reused",
+               (unsigned long long) atomic_load(&delivery_allocations));
+    fan_out_scratch_destroy();
+    named_count = 0;
 
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (client_threads[i] != 0) {
-            alarm_fired = 0;
-            current_joining_thread = client_threads[i];
+    free(idle_lists);
+    idle_lists = NULL;
 
-            alarm(2);
+    pthread_mutex_unlock(&clients_mutex);
 
-            const int join_result = pthread_join(current_joining_thread, NULL);
+    pthread_mutex_lock(&user_list_mutex);
+    release_pages(&user_list_cache);
+    user_list_valid = 0;
+    pthread_mutex_unlock(&user_list_mutex);
 
-            alarm(0);
+    release_pages(&roster_cache);
+    roster_cache_valid = 0;
 
-            if (join_result != 0 || alarm_fired) {
-                logger_log(LOG_WARNING, "Thread %lu was %s during cleanup",
-                           (unsigned long) current_joining_thread,
-                           alarm_fired ? "timed out and cancelled" : "not joinable");
+    pthread_mutex_lock(&history_mutex);
+    history_clear(&lobby_history);
+    pthread_mutex_unlock(&history_mutex);
 
-                if (alarm_fired) {
-                    usleep(10000);
-                    pthread_join(current_joining_thread, NULL);
-                }
-            }
+    message_log_close();
 
-            current_joining_thread = 0;
-            client_threads[i] = 0;
-        }
+    frame_decoder_set_allocator(NULL, NULL);
+    buffer_pool_destroy();
+
+    pthread_mutex_destroy(&clients_mutex);
+}
+
+/**
+ * @brief Sets how long a client must be quiet before its buffers are trimmed
+ *
+ * @param idle_ms Idle time in milliseconds, or 0 to never trim
+ */
+void chat_handler_set_idle_timeout(const int idle_ms) {
+    atomic_store(&idle_timeout_ms, idle_ms > 0 ? idle_ms : 0);
+}
+
+/**
+ * @brief Returns the monotonic clock in milliseconds
+ *
+ * @return Milliseconds since an arbitrary starting point
+ */
+static uint64_t monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return (uint64_t) now.tv_sec * 1000 + (uint64_t) now.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Asks every event loop to trim the buffers of its idle clients
+ *
+ * Each loop trims only its own clients, so no buffer is released while
+ * its loop may be using it.
+ */
+void chat_handler_trim_idle(void) {
+    if (atomic_load(&idle_timeout_ms) == 0) {
+        return;
+    }
+
+    for (int i = 0; i < event_loop_pool_size(); i++) {
+        event_loop_notify(event_loop_pool_get(i), TRIM_IDLE_TOKEN);
     }
-    thread_count = 0;
-    pthread_mutex_unlock(&thread_mutex);
+}
 
-    sigaction(SIGALRM, &old_sa, NULL);
+/**
+ * @brief Checks whether a client is in its loop's list
+ *
+ * @param list The loop's list
+ * @param client The client
+ * @return 1 if the client is in the list, 0 otherwise
+ */
+static int in_idle_list(const IdleList *list, const Client *client) {
+    return client->idle_prev != NULL || list->oldest == client;
+}
 
-    pthread_mutex_lock(&clients_mutex);
+/**
+ * @brief Moves a client to the most recently active end of its loop's list
+ *
+ * Runs on the client's loop. A client not yet in the list is added.
+ *
+ * @param client The client
+ */
+static void touch_idle_list(Client *client) {
+    IdleList *list = &idle_lists[event_loop_index(client->loop)];
 
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i]) {
-            close(clients[i]->socket);
-            free(clients[i]);
-            clients[i] = NULL;
+    if (in_idle_list(list, client)) {
+        if (list->newest == client) {
+            return;
+        }
+        if (client->idle_prev) {
+            client->idle_prev->idle_next = client->idle_next;
+        } else {
+            list->oldest = client->idle_next;
         }
+        client->idle_next->idle_prev = client->idle_prev;
+    } else {
+        list->count++;
+    }
+
+    client->idle_prev = list->newest;
+    client->idle_next = NULL;
+    if (list->newest) {
+        list->newest->idle_next = client;
+    } else {
+        list->oldest = client;
     }
+    list->newest = client;
+}
 
-    client_count = 0;
+/**
+ * @brief Takes a client out of its loop's list
+ *
+ * Runs on the client's loop. Does nothing if the client is not in it.
+ *
+ * @param client The client
+ */
+static void unlink_idle_list(Client *client) {
+    IdleList *list = &idle_lists[event_loop_index(client->loop)];
+    if (!in_idle_list(list, client)) {
+        return;
+    }
 
-    pthread_mutex_unlock(&clients_mutex);
+    if (client->idle_prev) {
+        client->idle_prev->idle_next = client->idle_next;
+    } else {
+        list->oldest = client->idle_next;
+    }
+    if (client->idle_next) {
+        client->idle_next->idle_prev = client->idle_prev;
+    } else {
+        list->newest = client->idle_prev;
+    }
 
-    pthread_mutex_destroy(&clients_mutex);
-    pthread_mutex_destroy(&thread_mutex);
+    client->idle_prev = NULL;
+    client->idle_next = NULL;
+    list->count--;
 }
 
 /**
- * @brief Adds a client to the active client list
+ * @brief Releases the buffers of a loop's clients that have gone quiet
  *
- * This function creates a new client structure for the connected client
- * and adds it to the active client list.
+ * Runs on the loop itself. Idle means the client has sent nothing for a
+ * while; a client keeps its buffers while it still has buffered input or
+ * queued output. The loop's own list keeps its clients in the order they
+ * were last active, so the walk stops at the first client that is not
+ * idle and never takes clients_mutex.
  *
- * @param client_socket Socket for the connected client
- * @return The client ID on success, -1 on failure
+ * @param loop The event loop running the trim
+ */
+static void trim_idle_clients(EventLoop *loop) {
+    const int idle_ms = atomic_load(&idle_timeout_ms);
+    if (idle_ms == 0) {
+        return;
+    }
+
+    const IdleList *list = &idle_lists[event_loop_index(loop)];
+    const uint64_t now = monotonic_ms();
+    int trimmed = 0;
+    size_t released = 0;
+
+    for (Client *client = list->oldest; client; client = client->idle_next) {
+        if (now - client->last_active_ms < (uint64_t) idle_ms) {
+            break;
+        }
+
+        const size_t bytes = frame_decoder_trim(&client->rx) + outbound_queue_trim(&client->tx);
+        if (bytes > 0) {
+            trimmed++;
+            released += bytes;
+        }
+    }
+
+    if (trimmed > 0) {
+        LOGGER_DEBUG("Loop %d trimmed %d idle client%s of %d, releasing %zu bytes",
+                     event_loop_index(loop), trimmed, trimmed == 1 ? "" : "s", list->count, released);
+    }
+}
+
+/**
+ * @brief Measures the memory held by the connected clients
+ *
+ * Counts each Client record with its receive ring, decode scratch space
+ * and outbound frame array, but not the frames queued for it. The event
+ * loops should be stopped, since their buffers are read without them.
+ *
+ * @param connections Set to the number of connected clients
+ * @param bytes Set to the total bytes they hold
  */
-int chat_handler_add_client(const int client_socket) {
+void chat_handler_footprint(size_t *connections, size_t *bytes) {
+    size_t total = 0;
+
     pthread_mutex_lock(&clients_mutex);
 
-    if (client_count >= MAX_CLIENTS) {
-        pthread_mutex_unlock(&clients_mutex);
-        logger_log(LOG_WARNING, "Maximum number of clients reached");
-        return -1;
+    const int count = client_registry_count();
+    for (int i = 0; i < count; i++) {
+        Client *client = client_registry_at(i);
+        total += sizeof(Client) + frame_decoder_footprint(&client->rx) + outbound_queue_footprint(&client->tx);
     }
 
-    int slot = -1;
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (!clients[i]) {
-            slot = i;
-            break;
+    pthread_mutex_unlock(&clients_mutex);
+
+    *connections = (size_t) count;
+    *bytes = total;
+}
+
+/**
+ * @brief Publishes a new snapshot of the clients with nicknames
+ *
+ * Every broadcast reads the snapshot and reaches named clients only, so
+ * clients without a nickname are left out and their connects, version
+ * negotiations and disconnects publish nothing. A rebuild still walks
+ * the registry, and is called when a nickname is set or cleared and
+ * when a named client subscribes to presence or negotiates a version.
+ * clients_mutex must be held by the caller.
+ */
+static void publish_client_snapshot(void) {
+    ClientSnapshot *snapshot = client_snapshot_alloc(named_count);
+    if (!snapshot) {
+        logger_log(LOG_ERROR, "Failed to allocate memory for client snapshot");
+        return;
+    }
+
+    for (int i = 0; i < client_registry_count(); i++) {
+        const Client *client = client_registry_at(i);
+        if (!client->has_nickname) {
+            continue;
         }
+        const int flags = CLIENT_SNAPSHOT_NAMED | (client->presence_subscribed ? CLIENT_SNAPSHOT_SUBSCRIBED : 0);
+
+        client_snapshot_add(snapshot, client->id, client->socket, event_loop_index(client->loop),
+                            client->protocol_version, flags, client->nickname);
     }
 
-    if (slot == -1) {
-        pthread_mutex_unlock(&clients_mutex);
-        logger_log(LOG_ERROR, "Failed to find an empty slot for client");
-        return -1;
+    if (client_snapshot_publish(snapshot) != 0) {
+        free(snapshot);
     }
+}
+
+/**
+ * @brief Adds a client to the active client list
+ *
+ * This function creates a new client structure for the connected client,
+ * adds it to the active client list and registers its socket with an
+ * event loop.
+ *
+ * @param loop Event loop that will own the connection, or NULL to pick one
+ * @param client_socket Socket for the connected client
+ * @return The client ID on success, -1 on failure
+ */
+int chat_handler_add_client(EventLoop *loop, const int client_socket) {
+    pthread_mutex_lock(&clients_mutex);
 
-    Client *client = (Client *) malloc(sizeof(Client));
+    Client *client = client_registry_acquire();
     if (!client) {
         pthread_mutex_unlock(&clients_mutex);
-        logger_log(LOG_ERROR, "Failed to allocate memory for client");
+        logger_log(LOG_WARNING, "Maximum number of clients reached");
         return -1;
     }
 
     client->socket = client_socket;
-    client->id = next_client_id++;
     client->has_nickname = 0;
     memset(client->nickname, 0, sizeof(client->nickname));
+    client->loop = loop ? loop : event_loop_pool_next();
+    client->protocol_version = PROTOCOL_VERSION_LEGACY;
+    client->room_count = 0;
+    client->presence_subscribed = 0;
+    client->last_active_ms = monotonic_ms();
+    client->idle_prev = NULL;
+    client->idle_next = NULL;
 
     const int client_id = client->id;
+    const int slot = client->slot;
 
-    if (pthread_create(&client->thread, NULL, chat_handler_client_thread, client) != 0) {
-        free(client);
+    if (frame_decoder_init(&client->rx, CLIENT_RX_RING_SIZE, CLIENT_RX_MAX_PAYLOAD) != 0) {
+        client_registry_release(client);
         pthread_mutex_unlock(&clients_mutex);
-        logger_log(LOG_ERROR, "Failed to create client thread");
         return -1;
     }
 
-    clients[slot] = client;
-    client_count++;
+    if (outbound_queue_init(&client->tx) != 0) {
+        frame_decoder_destroy(&client->rx);
+        client_registry_release(client);
+        pthread_mutex_unlock(&clients_mutex);
+        return -1;
+    }
+    outbound_queue_enable_zerocopy(&client->tx, client_socket);
+
+    client->connection.socket = client_socket;
+    client->connection.rx = &client->rx;
+    client->connection.tx = &client->tx;
+    client->connection.on_receive = chat_handler_client_receive;
+    client->connection.on_writable = chat_handler_client_writable;
+    client->connection.on_close = chat_handler_client_closed;
+    client->connection.ctx = client;
+
+    if (event_loop_add_connection(client->loop, &client->connection) != 0) {
+        frame_decoder_destroy(&client->rx);
+        outbound_queue_destroy(&client->tx);
+        client_registry_release(client);
+        pthread_mutex_unlock(&clients_mutex);
+        logger_log(LOG_ERROR, "Failed to register client socket with event loop");
+        return -1;
+    }
 
-    pthread_mutex_lock(&thread_mutex);
-    int thread_slot = -1;
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (client_threads[i] == 0) {
-            thread_slot = i;
-            client_threads[i] = client->thread;
-            thread_count++;
-            break;
-        }
+    /* Otherwise the client joins its loop's list when it first sends. */
+    if (event_loop_current() == client->loop) {
+        touch_idle_list(client);
     }
-    pthread_mutex_unlock(&thread_mutex);
 
-    if (thread_slot == -1) {
-        logger_log(LOG_WARNING, "Failed to track client thread - thread array full");
-        clients[slot] = NULL;
-        client_count--;
+    pthread_mutex_unlock(&clients_mutex);
+
+    logger_log(LOG_INFO, "Added client %d to slot %d", client_id, slot);
+    return client_id;
+}
+
+/**
+ * @brief Queues a frame for a client
+ *
+ * The owning event loop is notified if the client's queue was not
+ * already waiting to be flushed. The caller must hold clients_mutex or be
+ * running on the client's own event loop, so the client cannot be
+ * removed underneath it.
+ *
+ * @param client The recipient
+ * @param frame The encoded frame; the queue takes its own reference
+ * @return 0 on success, -1 on failure
+ */
+static int enqueue_frame(Client *client, Frame *frame) {
+    const int result = outbound_queue_push(&client->tx, frame);
+    if (result < 0) {
+        logger_log(LOG_WARNING, "Failed to queue message for client %d", client->id);
+        return -1;
+    }
 
-        pthread_cancel(client->thread);
-        pthread_join(client->thread, NULL);
+    if (result > 0) {
+        event_loop_notify(client->loop, client->id);
+    }
 
-        free(client);
+    return 0;
+}
 
-        pthread_mutex_unlock(&clients_mutex);
-        logger_log(LOG_ERROR, "Client cleanup due to thread tracking failure");
+/**
+ * @brief Encodes a message and queues it for a client on its own event loop
+ *
+ * The message is encoded in the protocol version negotiated by the client.
+ *
+ * @param client The recipient, owned by the calling event loop
+ * @param type The message type
+ * @param data The message data
+ * @param data_length The length of the message data
+ * @return 0 on success, -1 on failure
+ */
+static int reply_to_client(Client *client, const MessageType type, const void *data, const uint32_t data_length) {
+    Frame *frame = frame_encode(client->protocol_version, type, data, data_length);
+    if (!frame) {
         return -1;
     }
 
+    const int result = enqueue_frame(client, frame);
+    frame_unref(frame);
+    return result;
+}
+
+/**
+ * @brief Encodes a message and queues it for a client looked up by ID
+ *
+ * @param client_id ID of the recipient
+ * @param type The message type
+ * @param data The message data
+ * @param data_length The length of the message data
+ * @return 0 on success, -1 if the client is gone or the message could not be queued
+ */
+static int send_to_client(const int client_id, const MessageType type, const void *data,
+                          const uint32_t data_length) {
+    int result = -1;
+
+    pthread_mutex_lock(&clients_mutex);
+
+    Client *client = client_registry_lookup(client_id);
+    if (client) {
+        Frame *frame = frame_encode(client->protocol_version, type, data, data_length);
+        if (frame) {
+            result = enqueue_frame(client, frame);
+            frame_unref(frame);
+        }
+    }
 
     pthread_mutex_unlock(&clients_mutex);
 
-    logger_log(LOG_INFO, "Added client %d to slot %d", client_id, slot);
-    return client_id;
+    return result;
+}
+
+/**
+ * @brief Tells a client that one of its messages was rejected
+ *
+ * @param client The client, owned by the calling event loop
+ * @param error_msg Description of the problem
+ */
+static void reply_with_error(Client *client, const char *error_msg) {
+    NicknameResponse resp = {0};
+    resp.status = STATUS_ERROR;
+    strncpy(resp.message, error_msg, sizeof(resp.message) - 1);
+    reply_to_client(client, MSG_NICKNAME_RESPONSE, &resp, sizeof(resp));
 }
 
 /**
- * @brief Finds a client by ID
+ * @brief Queues one message for every matching client under clients_mutex
  *
- * This function finds a client by ID in the clients array.
- * The clients_mutex must be locked before calling this function.
+ * Used by threads that are not event loops and so cannot read the client
+ * snapshot without waiting or hand frames to other shards. The message
+ * is encoded at most once per protocol version in use.
  *
- * @param client_id ID of the client to find
- * @return Index of the client in the clients array, or -1 if not found
+ * @param frames Frames indexed by protocol version; missing versions are
+ *        encoded on demand and stored here for the caller to drop
+ * @param type The message type
+ * @param data The message data
+ * @param data_length The length of the message data
+ * @param filter FAN_OUT_* flags selecting the recipients
+ * @param exclude_nickname Nickname to leave out, or NULL
+ * @param exclude_socket Socket to leave out, or -1
+ * @return Number of clients the message was queued for
  */
-static int find_client_slot(const int client_id) {
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i] && clients[i]->id == client_id) {
-            return i;
+static int fan_out_message_locked(Frame **frames, const MessageType type, const void *data,
+                                  const uint32_t data_length, const int filter, const char *exclude_nickname,
+                                  const int exclude_socket) {
+    int recipients = 0;
+
+    pthread_mutex_lock(&clients_mutex);
+
+    for (int i = 0; i < client_registry_count(); i++) {
+        Client *client = client_registry_at(i);
+        if ((filter & FAN_OUT_NAMED_ONLY) && !client->has_nickname) {
+            continue;
+        }
+        if ((filter & FAN_OUT_SKIP_SUBSCRIBERS) && client->presence_subscribed) {
+            continue;
+        }
+        if (exclude_nickname && client->has_nickname && strcmp(client->nickname, exclude_nickname) == 0) {
+            continue;
+        }
+        if (client->socket == exclude_socket) {
+            continue;
+        }
+
+        const int version = client->protocol_version;
+        if (!frames[version]) {
+            frames[version] = frame_encode(version, type, data, data_length);
+            if (!frames[version]) {
+                continue;
+            }
+        }
+
+        if (enqueue_frame(client, frames[version]) == 0) {
+            recipients++;
         }
     }
 
-    return -1;
+    pthread_mutex_unlock(&clients_mutex);
+
+    return recipients;
 }
 
 /**
- * @brief Safely copies a nickname with proper null termination
+ * @brief Operations carried by messages between shards
+ */
+typedef enum {
+    SHARD_ROOM_JOIN,
+    SHARD_ROOM_LEAVE,
+    SHARD_ROOM_MESSAGE,
+    SHARD_PRESENCE_JOIN,
+    SHARD_PRESENCE_LEAVE,
+    SHARD_PRESENCE_SYNC,
+    SHARD_DELIVER,
+    SHARD_REPLAY
+} ShardOp;
+
+/**
+ * @brief A room operation sent from a client's shard to the room's owner
+ */
+typedef struct {
+    ShardOp op;
+    int client_id;
+    int client_shard;
+    int protocol_version;
+    int confirm;
+    RoomMessage body;
+} RoomRequest;
+
+/**
+ * @brief A presence change or roster sync sent to the presence shard
  *
- * @param dest Destination buffer
- * @param src Source string
- * @param size Size of the destination buffer
+ * A join carries the client's previous nickname, if it had one, so a
+ * rename is applied as a leave followed by a join. A leave also ends the
+ * client's subscription.
  */
-static void safe_nickname_copy(char *dest, const char *src, const size_t size) {
-    strncpy(dest, src, size - 1);
-    dest[size - 1] = '\0';
+typedef struct {
+    ShardOp op;
+    int client_id;
+    int client_shard;
+    int protocol_version;
+    uint32_t version;
+    char username[MAX_USERNAME_LEN];
+    char previous[MAX_USERNAME_LEN];
+} PresenceRequest;
+
+/**
+ * @brief Encoded frames for a shard to queue for some of its own clients
+ *
+ * Used by both room and broadcast fan-outs. Once handled, a delivery goes
+ * back to the shard that sent it to be reused.
+ */
+typedef struct ShardDelivery {
+    ShardOp op;
+    Frame *frames[PROTOCOL_VERSION_MAX + 1];
+    int origin;
+    int capacity;
+    struct ShardDelivery *next;
+    int count;
+    int client_ids[];
+} ShardDelivery;
+
+/**
+ * @brief Buffers a shard reuses for every fan-out it runs
+ *
+ * The recipient arrays hold one entry per registry slot and the
+ * per-target arrays one per shard, so a broadcast allocates nothing.
+ * Deliveries come back on the returned list from the shards that handled
+ * them, and only the owning shard takes from it.
+ */
+typedef struct {
+    RoomMember *recipients;
+    int *indices;
+    int *counts;
+    ShardDelivery **deliveries;
+    ShardDelivery *free_deliveries;
+    _Atomic(ShardDelivery *) returned;
+} FanOutScratch;
+
+static FanOutScratch *fan_out_scratch = NULL;
+static int fan_out_scratch_count = 0;
+
+/**
+ * @brief Frees the fan-out buffers of every shard
+ *
+ * The shards must no longer be exchanging messages.
+ */
+static void fan_out_scratch_destroy(void) {
+    for (int i = 0; i < fan_out_scratch_count; i++) {
+        FanOutScratch *scratch = &fan_out_scratch[i];
+        ShardDelivery *lists[] = {scratch->free_deliveries, atomic_load(&scratch->returned)};
+
+        for (size_t j = 0; j < sizeof(lists) / sizeof(lists[0]); j++) {
+            while (lists[j]) {
+                ShardDelivery *next = lists[j]->next;
+                free(lists[j]);
+                lists[j] = next;
+            }
+        }
+
+        free(scratch->recipients);
+        free(scratch->indices);
+        free(scratch->counts);
+        free(scratch->deliveries);
+    }
+
+    free(fan_out_scratch);
+    fan_out_scratch = NULL;
+    fan_out_scratch_count = 0;
+}
+
+/**
+ * @brief Allocates the fan-out buffers of every shard
+ *
+ * @param shards Number of shards
+ * @return 0 on success, -1 on failure
+ */
+static int fan_out_scratch_init(const int shards) {
+    const int capacity = client_registry_capacity() > 0 ? client_registry_capacity() : 1;
+
+    fan_out_scratch = calloc(shards, sizeof(FanOutScratch));
+    if (!fan_out_scratch) {
+        logger_log(LOG_ERROR, "Failed to allocate memory for fan-out buffers");
+        return -1;
+    }
+    fan_out_scratch_count = shards;
+
+    for (int i = 0; i < shards; i++) {
+        FanOutScratch *scratch = &fan_out_scratch[i];
+        scratch->recipients = malloc(capacity * sizeof(RoomMember));
+        scratch->indices = malloc(capacity * sizeof(int));
+        scratch->counts = malloc(shards * sizeof(int));
+        scratch->deliveries = malloc(shards * sizeof(ShardDelivery *));
+        atomic_init(&scratch->returned, NULL);
+
+        if (!scratch->recipients || !scratch->indices || !scratch->counts || !scratch->deliveries) {
+            logger_log(LOG_ERROR, "Failed to allocate memory for fan-out buffers");
+            fan_out_scratch_destroy();
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Takes a delivery with room for some recipients from a shard's cache
+ *
+ * A delivery is only allocated, or grown, when none is cached with
+ * enough room. Sizes are rounded up to a power of two, so cached
+ * deliveries quickly settle at the largest size the shard needs.
+ *
+ * @param shard The shard running the fan-out
+ * @param count Number of recipients
+ * @return The delivery, or NULL on allocation failure
+ */
+static ShardDelivery *alloc_delivery(const int shard, const int count) {
+    FanOutScratch *scratch = &fan_out_scratch[shard];
+
+    if (!scratch->free_deliveries) {
+        scratch->free_deliveries = atomic_exchange(&scratch->returned, NULL);
+    }
+
+    ShardDelivery *delivery = scratch->free_deliveries;
+    if (delivery && delivery->capacity >= count) {
+        scratch->free_deliveries = delivery->next;
+        return delivery;
+    }
+
+    int capacity = FAN_OUT_MIN_DELIVERY;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+
+    if (delivery) {
+        scratch->free_deliveries = delivery->next;
+        ShardDelivery *grown = realloc(delivery, sizeof(ShardDelivery) + capacity * sizeof(int));
+        if (!grown) {
+            free(delivery);
+            return NULL;
+        }
+        delivery = grown;
+    } else {
+        delivery = malloc(sizeof(ShardDelivery) + capacity * sizeof(int));
+        if (!delivery) {
+            return NULL;
+        }
+    }
+
+    atomic_fetch_add_explicit(&delivery_allocations, 1, memory_order_relaxed);
+    delivery->origin = shard;
+    delivery->capacity = capacity;
+    return delivery;
+}
+
+/**
+ * @brief Hands a delivery back to the shard that sent it
+ *
+ * May run on any shard; the frames must already have been released.
+ *
+ * @param delivery The delivery
+ */
+static void return_delivery(ShardDelivery *delivery) {
+    if (!fan_out_scratch || delivery->origin >= fan_out_scratch_count) {
+        free(delivery);
+        return;
+    }
+
+    FanOutScratch *scratch = &fan_out_scratch[delivery->origin];
+    ShardDelivery *head = atomic_load(&scratch->returned);
+    do {
+        delivery->next = head;
+    } while (!atomic_compare_exchange_weak(&scratch->returned, &head, delivery));
+}
+
+/**
+ * @brief Message history for a shard to queue for one of its own clients
+ *
+ * The frames are already in the client's protocol version.
+ */
+typedef struct {
+    ShardOp op;
+    int client_id;
+    int count;
+    Frame *frames[];
+} ShardReplay;
+
+/**
+ * @brief Queues a run of frames for a client
+ *
+ * The caller must hold clients_mutex or be running on the client's own
+ * event loop. The frames are queued back to back, so the next flush
+ * writes them together.
+ *
+ * @param client The recipient
+ * @param frames The frames, oldest first
+ * @param count Number of frames
+ */
+static void enqueue_frames(Client *client, Frame *const *frames, const int count) {
+    for (int i = 0; i < count; i++) {
+        if (enqueue_frame(client, frames[i]) != 0) {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Queues frames for clients owned by the calling event loop
+ *
+ * Each client gets the frame for the protocol version it speaks; clients
+ * that have disconnected since the frames were encoded are skipped.
+ *
+ * @param frames Encoded frames indexed by protocol version
+ * @param client_ids IDs of the recipients
+ * @param count Number of recipients
+ * @return Number of clients the frames were queued for
+ */
+static int deliver_to_own_clients(Frame *const *frames, const int *client_ids, const int count) {
+    int delivered = 0;
+
+    for (int i = 0; i < count; i++) {
+        Client *client = client_registry_lookup_owned(client_ids[i]);
+        if (!client || !frames[client->protocol_version]) {
+            continue;
+        }
+
+        if (enqueue_frame(client, frames[client->protocol_version]) == 0) {
+            delivered++;
+        }
+    }
+
+    return delivered;
+}
+
+/**
+ * @brief Queues encoded frames for recipients spread over the shards
+ *
+ * Runs on an event loop. Recipients on the calling shard get their frames
+ * directly, and every other shard with recipients gets one delivery
+ * listing them. Recipients whose protocol version has no frame are
+ * skipped.
+ *
+ * @param shard The shard running the fan-out
+ * @param members The recipients
+ * @param count Number of recipients
+ * @param frames Encoded frames indexed by protocol version
+ * @return Number of recipients the frames were queued or forwarded for
+ */
+static int fan_out_frames(const int shard, const RoomMember *members, const int count, Frame *const *frames) {
+    const int shards = shard_count();
+    int recipients = 0;
+
+    if (count == 0) {
+        return 0;
+    }
+
+    int *counts = fan_out_scratch[shard].counts;
+    ShardDelivery **deliveries = fan_out_scratch[shard].deliveries;
+    memset(counts, 0, shards * sizeof(int));
+    memset(deliveries, 0, shards * sizeof(ShardDelivery *));
+
+    for (int i = 0; i < count; i++) {
+        if (frames[members[i].protocol_version]) {
+            counts[members[i].shard]++;
+        }
+    }
+
+    for (int target = 0; target < shards; target++) {
+        if (target == shard || counts[target] == 0) {
+            continue;
+        }
+
+        deliveries[target] = alloc_delivery(shard, counts[target]);
+        if (!deliveries[target]) {
+            logger_log(LOG_ERROR, "Failed to allocate memory for shard delivery");
+            continue;
+        }
+
+        deliveries[target]->op = SHARD_DELIVER;
+        deliveries[target]->count = 0;
+        for (int version = 0; version <= PROTOCOL_VERSION_MAX; version++) {
+            deliveries[target]->frames[version] = frames[version] ? frame_ref(frames[version]) : NULL;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        const RoomMember *member = &members[i];
+        if (!frames[member->protocol_version]) {
+            continue;
+        }
+
+        if (member->shard == shard) {
+            recipients += deliver_to_own_clients(frames, &member->client_id, 1);
+        } else if (deliveries[member->shard]) {
+            ShardDelivery *delivery = deliveries[member->shard];
+            delivery->client_ids[delivery->count++] = member->client_id;
+        }
+    }
+
+    for (int target = 0; target < shards; target++) {
+        if (!deliveries[target]) {
+            continue;
+        }
+
+        const int delivery_count = deliveries[target]->count;
+        if (shard_send(target, deliveries[target]) != 0) {
+            logger_log(LOG_WARNING, "Failed to forward message to shard %d", target);
+            release_shard_message(deliveries[target]);
+            continue;
+        }
+        recipients += delivery_count;
+    }
+
+    return recipients;
+}
+
+/**
+ * @brief Queues one message for recipients spread over the shards
+ *
+ * Runs on an event loop. The message is encoded once per protocol version
+ * in use and handed to fan_out_frames().
+ *
+ * @param shard The shard running the fan-out
+ * @param members The recipients
+ * @param count Number of recipients
+ * @param type The message type
+ * @param data The message data
+ * @param data_length The length of the message data
+ * @return Number of recipients the message was queued or forwarded for
+ */
+static int fan_out_to_members(const int shard, const RoomMember *members, const int count,
+                              const MessageType type, const void *data, const uint32_t data_length) {
+    Frame *frames[PROTOCOL_VERSION_MAX + 1] = {NULL};
+
+    for (int i = 0; i < count; i++) {
+        const int version = members[i].protocol_version;
+        if (!frames[version]) {
+            frames[version] = frame_encode(version, type, data, data_length);
+        }
+    }
+
+    const int recipients = fan_out_frames(shard, members, count, frames);
+
+    for (int version = 0; version <= PROTOCOL_VERSION_MAX; version++) {
+        frame_unref(frames[version]);
+    }
+
+    return recipients;
+}
+
+/**
+ * @brief Queues one message for every member of a room
+ *
+ * Runs on the shard that owns the room.
+ *
+ * @param shard The shard running the fan-out
+ * @param room The room, or NULL to send to the extra recipient only
+ * @param type The message type
+ * @param data The message data
+ * @param data_length The length of the message data
+ * @param extra Recipient outside the room, or NULL
+ * @return Number of recipients the message was queued or forwarded for
+ */
+static int fan_out_to_room(const int shard, const Room *room, const MessageType type, const void *data,
+                           const uint32_t data_length, const RoomMember *extra) {
+    int recipients = 0;
+
+    if (room) {
+        recipients += fan_out_to_members(shard, room->members, room->member_count, type, data, data_length);
+    }
+
+    if (extra) {
+        recipients += fan_out_to_members(shard, extra, 1, type, data, data_length);
+    }
+
+    return recipients;
+}
+
+/**
+ * @brief Queues one message, reusing frames already encoded, for every matching client
+ *
+ * Recipients are taken from the client snapshot, so no lock is held and
+ * concurrent broadcasts do not contend. Each encoded frame is shared by
+ * all recipients speaking that version; recipients on other event loops
+ * get it through their shard.
+ *
+ * @param frames Frames indexed by protocol version; missing versions are
+ *        encoded on demand and stored here for the caller to drop
+ * @param type The message type
+ * @param data The message data
+ * @param data_length The length of the message data
+ * @param filter FAN_OUT_* flags selecting the recipients
+ * @param exclude_nickname Nickname to leave out, or NULL
+ * @param exclude_socket Socket to leave out, or -1
+ * @return Number of clients the message was queued for
+ */
+static int fan_out_encoded(Frame **frames, const MessageType type, const void *data, const uint32_t data_length,
+                           const int filter, const char *exclude_nickname, const int exclude_socket) {
+    const int shard = shard_current();
+    if (shard < 0) {
+        return fan_out_message_locked(frames, type, data, data_length, filter, exclude_nickname, exclude_socket);
+    }
+
+    const ClientSnapshot *snapshot = client_snapshot_acquire(shard);
+
+    /* The snapshot never lists more clients than the registry holds. */
+    RoomMember *recipients = fan_out_scratch[shard].recipients;
+    int *indices = fan_out_scratch[shard].indices;
+
+    const int required = (filter & FAN_OUT_NAMED_ONLY) ? CLIENT_SNAPSHOT_NAMED : 0;
+    const int rejected = (filter & FAN_OUT_SKIP_SUBSCRIBERS) ? CLIENT_SNAPSHOT_SUBSCRIBED : 0;
+    const int count = client_snapshot_select(snapshot, required, rejected, exclude_nickname, exclude_socket,
+                                             indices);
+
+    for (int i = 0; i < count; i++) {
+        const int index = indices[i];
+        recipients[i].client_id = snapshot->ids[index];
+        recipients[i].shard = snapshot->shards[index];
+        recipients[i].protocol_version = snapshot->protocol_versions[index];
+    }
+
+    client_snapshot_release(shard);
+
+    for (int i = 0; i < count; i++) {
+        const int version = recipients[i].protocol_version;
+        if (!frames[version]) {
+            frames[version] = frame_encode(version, type, data, data_length);
+        }
+    }
+
+    return fan_out_frames(shard, recipients, count, frames);
+}
+
+/**
+ * @brief Queues one message for every matching client
+ *
+ * The message is encoded at most once per protocol version in use.
+ *
+ * @param type The message type
+ * @param data The message data
+ * @param data_length The length of the message data
+ * @param filter FAN_OUT_* flags selecting the recipients
+ * @param exclude_nickname Nickname to leave out, or NULL
+ * @param exclude_socket Socket to leave out, or -1
+ * @return Number of clients the message was queued for
+ */
+static int fan_out_message(const MessageType type, const void *data, const uint32_t data_length,
+                           const int filter, const char *exclude_nickname, const int exclude_socket) {
+    Frame *frames[PROTOCOL_VERSION_MAX + 1] = {NULL};
+
+    const int result = fan_out_encoded(frames, type, data, data_length, filter, exclude_nickname, exclude_socket);
+
+    for (int version = 0; version <= PROTOCOL_VERSION_MAX; version++) {
+        frame_unref(frames[version]);
+    }
+
+    return result;
+}
+
+/**
+ * @brief Encodes a message in every protocol version
+ *
+ * @param frames Receives the frames, indexed by version; any already
+ *        encoded on failure are left for the caller to drop
+ * @param type The message type
+ * @param data The message data
+ * @param data_length The length of the message data
+ * @return 0 on success, -1 on failure
+ */
+static int encode_all_versions(Frame **frames, const MessageType type, const void *data, const uint32_t data_length) {
+    for (int version = PROTOCOL_VERSION_LEGACY; version <= PROTOCOL_VERSION_MAX; version++) {
+        frames[version] = frame_encode(version, type, data, data_length);
+        if (!frames[version]) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Adds a message to a room's history
+ *
+ * Runs on the shard that owns the room. The ring is allocated with the
+ * room's first message.
+ *
+ * @param room The room
+ * @param frames The message in every protocol version
+ */
+static void record_room_history(Room *room, Frame *const *frames) {
+    if (!room->history) {
+        room->history = malloc(sizeof(HistoryRing));
+        if (!room->history) {
+            logger_log(LOG_ERROR, "Failed to allocate memory for history of room %s", room->name);
+            return;
+        }
+        history_init(room->history);
+    }
+
+    history_append(room->history, frames);
+}
+
+/**
+ * @brief Replays a history ring to one recipient
+ *
+ * Runs on an event loop that owns the ring. A recipient on the calling
+ * shard gets the frames directly; any other gets them in one message
+ * through its shard.
+ *
+ * @param shard The shard running the replay
+ * @param member The recipient
+ * @param history The ring
+ */
+static void replay_history(const int shard, const RoomMember *member, const HistoryRing *history) {
+    Frame *frames[HISTORY_CAPACITY];
+    const int count = history_collect(history, member->protocol_version, frames);
+    if (count == 0) {
+        return;
+    }
+
+    if (member->shard == shard) {
+        Client *client = client_registry_lookup_owned(member->client_id);
+        if (client) {
+            enqueue_frames(client, frames, count);
+        }
+        for (int i = 0; i < count; i++) {
+            frame_unref(frames[i]);
+        }
+        return;
+    }
+
+    ShardReplay *replay = malloc(sizeof(ShardReplay) + count * sizeof(Frame *));
+    if (!replay) {
+        logger_log(LOG_ERROR, "Failed to allocate memory for history replay");
+        for (int i = 0; i < count; i++) {
+            frame_unref(frames[i]);
+        }
+        return;
+    }
+
+    replay->op = SHARD_REPLAY;
+    replay->client_id = member->client_id;
+    replay->count = count;
+    memcpy(replay->frames, frames, count * sizeof(Frame *));
+
+    if (shard_send(member->shard, replay) != 0) {
+        logger_log(LOG_WARNING, "Failed to forward history to shard %d", member->shard);
+        release_shard_message(replay);
+    }
+}
+
+/**
+ * @brief Applies a room operation on the shard that owns the room
+ *
+ * @param shard The owning shard
+ * @param request The operation
+ */
+static void handle_room_request(const int shard, const RoomRequest *request) {
+    const RoomMessage *body = &request->body;
+    const RoomMember member = {
+        .client_id = request->client_id,
+        .shard = request->client_shard,
+        .protocol_version = request->protocol_version
+    };
+
+    RoomEvent event = {0};
+    memcpy(event.room, body->room, sizeof(event.room));
+    memcpy(event.username, body->username, sizeof(event.username));
+
+    switch (request->op) {
+        case SHARD_ROOM_JOIN: {
+            const int result = room_registry_join(shard, body->room, &member);
+            if (result < 0) {
+                NicknameResponse resp = {0};
+                resp.status = STATUS_ERROR;
+                strncpy(resp.message, "Failed to join room", sizeof(resp.message) - 1);
+                fan_out_to_room(shard, NULL, MSG_NICKNAME_RESPONSE, &resp, sizeof(resp), &member);
+                return;
+            }
+
+            if (result == 0) {
+                const Room *room = room_registry_find(shard, body->room);
+                logger_log(LOG_INFO, "%s joined room %s", body->username, body->room);
+                if (room->history) {
+                    replay_history(shard, &member, room->history);
+                }
+                fan_out_to_room(shard, room, MSG_ROOM_JOIN, &event, sizeof(event), NULL);
+            }
+            return;
+        }
+
+        case SHARD_ROOM_LEAVE: {
+            if (room_registry_leave(shard, body->room, request->client_id) == 0) {
+                logger_log(LOG_INFO, "%s left room %s", body->username, body->room);
+            }
+
+            fan_out_to_room(shard, room_registry_find(shard, body->room), MSG_ROOM_LEAVE, &event, sizeof(event),
+                            request->confirm ? &member : NULL);
+            return;
+        }
+
+        case SHARD_ROOM_MESSAGE: {
+            Room *room = room_registry_find(shard, body->room);
+            if (room && room_registry_is_member(room, request->client_id)) {
+                Frame *frames[PROTOCOL_VERSION_MAX + 1] = {NULL};
+                if (encode_all_versions(frames, MSG_ROOM_MESSAGE, body, sizeof(*body)) == 0) {
+                    record_room_history(room, frames);
+                    fan_out_frames(shard, room->members, room->member_count, frames);
+                }
+                for (int version = 0; version <= PROTOCOL_VERSION_MAX; version++) {
+                    frame_unref(frames[version]);
+                }
+            }
+            return;
+        }
+
+        default:
+            return;
+    }
+}
+
+/**
+ * @brief Drops the frames of a paged message
+ *
+ * @param paged The paged message
+ */
+static void release_pages(PagedFrames *paged) {
+    for (int version = 0; version <= PROTOCOL_VERSION_MAX; version++) {
+        for (int i = 0; paged->frames[version] && i < paged->page_count; i++) {
+            frame_unref(paged->frames[version][i]);
+        }
+        free(paged->frames[version]);
+    }
+
+    memset(paged, 0, sizeof(*paged));
+}
+
+/**
+ * @brief Encodes every page of a message in every protocol version
+ *
+ * Each frame is tagged with an identifier shared by the message's pages
+ * and with its page index, so outbound queues can replace the message as
+ * a whole once a newer one is queued.
+ *
+ * @param paged Receives the frames
+ * @param type The message type
+ * @param pages The page payloads
+ * @return 0 on success, -1 on failure
+ */
+static int encode_pages(PagedFrames *paged, const MessageType type, const UserListPages *pages) {
+    memset(paged, 0, sizeof(*paged));
+    paged->page_count = pages->count;
+
+    unsigned int snapshot = atomic_fetch_add(&paged_sequence, 1) + 1;
+    if (snapshot == 0) {
+        snapshot = atomic_fetch_add(&paged_sequence, 1) + 1;
+    }
+
+    for (int version = PROTOCOL_VERSION_LEGACY; version <= PROTOCOL_VERSION_MAX; version++) {
+        paged->frames[version] = calloc(pages->count, sizeof(Frame *));
+        if (!paged->frames[version]) {
+            logger_log(LOG_ERROR, "Failed to allocate memory for paged frames");
+            release_pages(paged);
+            return -1;
+        }
+
+        for (int i = 0; i < pages->count; i++) {
+            paged->frames[version][i] = frame_encode(version, type, pages->pages[i], pages->lengths[i]);
+            if (!paged->frames[version][i]) {
+                release_pages(paged);
+                return -1;
+            }
+            paged->frames[version][i]->snapshot = snapshot;
+            paged->frames[version][i]->page = (uint16_t) i;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Rebuilds the cached roster pages from the presence roster
+ *
+ * Runs on the presence shard. Every page carries the roster version in
+ * front of the names, as in a Roster.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int rebuild_roster_cache(void) {
+    const int count = presence_count();
+    const char **names = malloc((count > 0 ? count : 1) * sizeof(char *));
+    if (!names) {
+        logger_log(LOG_ERROR, "Failed to allocate memory for roster");
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        names[i] = presence_name(i);
+    }
+
+    UserListPages pages;
+    const int result = user_list_paginate(names, count, sizeof(uint32_t), &pages);
+    free(names);
+    if (result != 0) {
+        return -1;
+    }
+
+    const uint32_t version = presence_version();
+    for (int i = 0; i < pages.count; i++) {
+        memcpy(pages.pages[i], &version, sizeof(version));
+    }
+
+    release_pages(&roster_cache);
+    roster_cache_valid = encode_pages(&roster_cache, MSG_ROSTER, &pages) == 0;
+    roster_cache_version = version;
+    user_list_free(&pages);
+
+    return roster_cache_valid ? 0 : -1;
+}
+
+/**
+ * @brief Sends a roster change to every presence subscriber
+ *
+ * Runs on the presence shard.
+ *
+ * @param shard The presence shard
+ * @param delta The change
+ */
+static void fan_out_roster_delta(const int shard, const RosterDelta *delta) {
+    int count;
+    const RoomMember *subscribers = presence_subscribers(&count);
+
+    fan_out_to_members(shard, subscribers, count, MSG_ROSTER_DELTA, delta, sizeof(*delta));
+}
+
+/**
+ * @brief Brings a subscriber up to date from the roster version it last saw
+ *
+ * Runs on the presence shard. The changes since that version are
+ * replayed if they are all still in the history; otherwise, or if the
+ * subscriber has no roster yet, it gets the full roster. The roster pages
+ * are encoded once per roster version and shared by every subscriber
+ * that needs them; in the subscriber's queue they replace any older
+ * roster and the deltas queued before them.
+ *
+ * @param shard The presence shard
+ * @param member The subscriber
+ * @param version Roster version the subscriber has, or 0 for none
+ */
+static void sync_roster(const int shard, const RoomMember *member, const uint32_t version) {
+    const uint32_t current = presence_version();
+
+    if (version > 0 && version <= current && (version == current || presence_delta(version + 1))) {
+        for (uint32_t next = version + 1; next <= current; next++) {
+            fan_out_to_members(shard, member, 1, MSG_ROSTER_DELTA, presence_delta(next), sizeof(RosterDelta));
+        }
+        return;
+    }
+
+    if ((!roster_cache_valid || roster_cache_version != current) && rebuild_roster_cache() != 0) {
+        logger_log(LOG_WARNING, "Failed to build roster for client %d", member->client_id);
+        return;
+    }
+
+    for (int i = 0; i < roster_cache.page_count; i++) {
+        Frame *frames[PROTOCOL_VERSION_MAX + 1] = {NULL};
+        for (int version = PROTOCOL_VERSION_LEGACY; version <= PROTOCOL_VERSION_MAX; version++) {
+            frames[version] = roster_cache.frames[version][i];
+        }
+        fan_out_frames(shard, member, 1, frames);
+    }
+}
+
+/**
+ * @brief Applies a presence change or roster sync on the presence shard
+ *
+ * @param shard The presence shard
+ * @param request The operation
+ */
+static void handle_presence_request(const int shard, const PresenceRequest *request) {
+    RosterDelta delta;
+
+    switch (request->op) {
+        case SHARD_PRESENCE_JOIN:
+            if (request->previous[0] != '\0' && presence_remove(request->previous, &delta) == 0) {
+                fan_out_roster_delta(shard, &delta);
+            }
+            if (presence_add(request->username, &delta) == 0) {
+                fan_out_roster_delta(shard, &delta);
+            }
+            return;
+
+        case SHARD_PRESENCE_LEAVE:
+            presence_unsubscribe(request->client_id);
+            if (request->username[0] != '\0' && presence_remove(request->username, &delta) == 0) {
+                fan_out_roster_delta(shard, &delta);
+            }
+            return;
+
+        case SHARD_PRESENCE_SYNC: {
+            const RoomMember member = {
+                .client_id = request->client_id,
+                .shard = request->client_shard,
+                .protocol_version = request->protocol_version
+            };
+
+            if (presence_subscribe(&member) < 0) {
+                logger_log(LOG_WARNING, "Failed to subscribe client %d to presence", request->client_id);
+                return;
+            }
+            sync_roster(shard, &member, request->version);
+            return;
+        }
+
+        default:
+            return;
+    }
+}
+
+/**
+ * @brief Handles a message sent to this shard
+ *
+ * This is the shard module's handler and runs on the target shard's
+ * event loop.
+ *
+ * @param shard The shard running the handler
+ * @param message A RoomRequest, PresenceRequest, ShardDelivery or ShardReplay
+ */
+static void handle_shard_message(const int shard, void *message) {
+    switch (*(ShardOp *) message) {
+        case SHARD_DELIVER: {
+            const ShardDelivery *delivery = message;
+            deliver_to_own_clients(delivery->frames, delivery->client_ids, delivery->count);
+            break;
+        }
+        case SHARD_REPLAY: {
+            const ShardReplay *replay = message;
+            Client *client = client_registry_lookup_owned(replay->client_id);
+            if (client) {
+                enqueue_frames(client, replay->frames, replay->count);
+            }
+            break;
+        }
+        case SHARD_PRESENCE_JOIN:
+        case SHARD_PRESENCE_LEAVE:
+        case SHARD_PRESENCE_SYNC:
+            handle_presence_request(shard, message);
+            break;
+        default:
+            handle_room_request(shard, message);
+            break;
+    }
+
+    release_shard_message(message);
+}
+
+/**
+ * @brief Frees a message sent between shards
+ *
+ * @param message A RoomRequest, PresenceRequest, ShardDelivery or ShardReplay
+ */
+static void release_shard_message(void *message) {
+    if (*(ShardOp *) message == SHARD_DELIVER) {
+        ShardDelivery *delivery = message;
+        for (int version = 0; version <= PROTOCOL_VERSION_MAX; version++) {
+            frame_unref(delivery->frames[version]);
+        }
+        return_delivery(delivery);
+        return;
+    }
+
+    if (*(ShardOp *) message == SHARD_REPLAY) {
+        ShardReplay *replay = message;
+        for (int i = 0; i < replay->count; i++) {
+            frame_unref(replay->frames[i]);
+        }
+    }
+
+    free(message);
+}
+
+/**
+ * @brief Creates a room operation on behalf of a client
+ *
+ * Must be called on the event loop that owns the client. The sender's
+ * name is taken from the client's nickname.
+ *
+ * @param client The client
+ * @param op The operation
+ * @param room The room name
+ * @return The request, or NULL on allocation failure
+ */
+static RoomRequest *new_room_request(const Client *client, const ShardOp op, const char *room) {
+    RoomRequest *request = calloc(1, sizeof(RoomRequest));
+    if (!request) {
+        logger_log(LOG_ERROR, "Failed to allocate memory for room request");
+        return NULL;
+    }
+
+    request->op = op;
+    request->client_id = client->id;
+    request->client_shard = event_loop_index(client->loop);
+    request->protocol_version = client->protocol_version;
+    strncpy(request->body.room, room, MAX_ROOM_NAME_LEN - 1);
+    strncpy(request->body.username, client->nickname, MAX_USERNAME_LEN - 1);
+
+    return request;
+}
+
+/**
+ * @brief Sends a room operation to the shard that owns the room
+ *
+ * @param request The operation; freed on failure
+ * @return 0 on success, -1 on failure
+ */
+static int send_room_request(RoomRequest *request) {
+    if (shard_send(shard_for_key(request->body.room, MAX_ROOM_NAME_LEN), request) != 0) {
+        logger_log(LOG_WARNING, "Failed to send room request for %s", request->body.room);
+        free(request);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Sends a presence change or roster sync to the presence shard
+ *
+ * Must be called on an event loop.
+ *
+ * @param op The operation
+ * @param client The client, or NULL to leave the subscriber fields unset
+ * @param client_id ID of the client the operation is about
+ * @param username The client's nickname, or NULL
+ * @param previous The client's previous nickname for a join, or NULL
+ * @param version Roster version the client has, for a sync
+ * @return 0 on success, -1 on failure
+ */
+static int send_presence_request(const ShardOp op, const Client *client, const int client_id, const char *username,
+                                 const char *previous, const uint32_t version) {
+    PresenceRequest *request = calloc(1, sizeof(PresenceRequest));
+    if (!request) {
+        logger_log(LOG_ERROR, "Failed to allocate memory for presence request");
+        return -1;
+    }
+
+    request->op = op;
+    request->client_id = client_id;
+    request->version = version;
+    if (client) {
+        request->client_shard = event_loop_index(client->loop);
+        request->protocol_version = client->protocol_version;
+    }
+    if (username) {
+        strncpy(request->username, username, MAX_USERNAME_LEN - 1);
+    }
+    if (previous) {
+        strncpy(request->previous, previous, MAX_USERNAME_LEN - 1);
+    }
+
+    if (shard_send(PRESENCE_SHARD, request) != 0) {
+        logger_log(LOG_WARNING, "Failed to send presence request for client %d", client_id);
+        free(request);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Finds a room in a client's own list of rooms
+ *
+ * @param client The client, owned by the calling event loop
+ * @param name The room name
+ * @return Index of the room in the client's list, or -1 if it is not there
+ */
+static int client_room_index(const Client *client, const char *name) {
+    for (int i = 0; i < client->room_count; i++) {
+        if (strncmp(client->rooms[i], name, MAX_ROOM_NAME_LEN) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Writes as much of a client's queue as its socket will accept
+ *
+ * Runs on the event loop that owns the client. A flush that cannot finish
+ * is resumed by the event loop once the socket drains; a client that failed or exceeded
+ * its outbound high-water mark under the disconnect policy must be
+ * removed by the caller.
+ *
+ * @param client The client to flush
+ * @return 0 to keep the connection open, -1 to close it
+ */
+static int chat_handler_write_client(Client *client) {
+    switch (event_loop_flush_connection(client->loop, &client->connection)) {
+        case OUTBOUND_FLUSH_DONE:
+        case OUTBOUND_FLUSH_BLOCKED:
+            return 0;
+        case OUTBOUND_FLUSH_OVERFLOW:
+            logger_log(LOG_WARNING, "Client %d is too slow to keep up (%zu bytes queued), disconnecting",
+                       client->id, outbound_queue_backlog_bytes(&client->tx));
+            return -1;
+        case OUTBOUND_FLUSH_ERROR:
+        default:
+            logger_log(LOG_WARNING, "Failed to send message to client %d", client->id);
+            return -1;
+    }
+}
+
+/**
+ * @brief Writes a client's queued frames to its socket
+ *
+ * This is the notify callback of the event loops and runs on the loop
+ * that owns the client, so the client cannot be removed while its queue
+ * is being flushed and is looked up without clients_mutex. A token for a
+ * client that has since gone, or whose slot now belongs to another
+ * loop's client, is ignored.
+ * TRIM_IDLE_TOKEN is delivered here too and trims the loop's idle clients.
+ *
+ * @param loop The event loop running the flush
+ * @param client_id ID of the client to flush
+ */
+static void chat_handler_flush_client(EventLoop *loop, const int client_id) {
+    if (client_id == TRIM_IDLE_TOKEN) {
+        trim_idle_clients(loop);
+        return;
+    }
+
+    Client *client = client_registry_lookup_owned(client_id);
+    if (!client || client->loop != loop) {
+        return;
+    }
+
+    if (chat_handler_write_client(client) != 0) {
+        chat_handler_remove_client(client_id);
+    }
+}
+
+/**
+ * @brief Safely copies a nickname with proper null termination
+ *
+ * @param dest Destination buffer
+ * @param src Source string
+ * @param size Size of the destination buffer
+ */
+static void safe_nickname_copy(char *dest, const char *src, const size_t size) {
+    strncpy(dest, src, size - 1);
+    dest[size - 1] = '\0';
+}
+
+/**
+ * @brief Removes a client from the active client list
+ *
+ * This function removes a client from the active client list and
+ * frees its resources. If the client has a nickname, it also notifies
+ * other clients that the user has left. Must run on the client's event
+ * loop, which owns its place in the loop's idle list.
+ *
+ * @param client_id ID of the client to remove
+ */
+void chat_handler_remove_client(const int client_id) {
+    pthread_mutex_lock(&clients_mutex);
+
+    char nickname[MAX_USERNAME_LEN] = {0};
+    int user_had_nickname = 0;
+    int presence_subscribed = 0;
+    RoomRequest *leaves[CLIENT_MAX_ROOMS];
+    int leave_count = 0;
+
+    Client *client = client_registry_lookup(client_id);
+    if (!client) {
+        pthread_mutex_unlock(&clients_mutex);
+        logger_log(LOG_WARNING, "Failed to remove client %d: not found", client_id);
+        return;
+    }
+
+    for (int i = 0; i < client->room_count; i++) {
+        leaves[leave_count] = new_room_request(client, SHARD_ROOM_LEAVE, client->rooms[i]);
+        if (leaves[leave_count]) {
+            leave_count++;
+        }
+    }
+    client->room_count = 0;
+    presence_subscribed = client->presence_subscribed;
+
+    if (client->has_nickname) {
+        user_had_nickname = 1;
+        strncpy(nickname, client->nickname, MAX_USERNAME_LEN);
+        nickname[MAX_USERNAME_LEN - 1] = '\0';
+        nickname_index_release(client->nickname, client_id);
+        named_count--;
+    }
+
+    logger_log(LOG_INFO, "Removing client %d: %s", client->id, client->nickname);
+
+    const int client_socket = client->socket;
+    if (client_socket >= 0) {
+        event_loop_remove_connection(client->loop, &client->connection);
+    }
+
+    unlink_idle_list(client);
+    frame_decoder_destroy(&client->rx);
+    outbound_queue_destroy(&client->tx);
+    client_registry_release(client);
+
+    if (user_had_nickname) {
+        publish_client_snapshot();
+        atomic_fetch_add(&roster_generation, 1);
+    }
+
+    pthread_mutex_unlock(&clients_mutex);
+
+    if (client_socket >= 0) {
+        const int result = close(client_socket);
+        if (result != 0) {
+            logger_log(LOG_WARNING, "Failed to close socket for client %d: %s",
+                       client_id, strerror(errno));
+        }
+    }
+
+    logger_log(LOG_INFO, "Removed client %d", client_id);
+
+    for (int i = 0; i < leave_count; i++) {
+        send_room_request(leaves[i]);
+    }
+
+    if (user_had_nickname || presence_subscribed) {
+        send_presence_request(SHARD_PRESENCE_LEAVE, NULL, client_id, user_had_nickname ? nickname : NULL, NULL, 0);
+    }
+
+    if (user_had_nickname) {
+        chat_handler_user_left(nickname);
+    }
+}
+
+/**
+ * @brief Adds a logged chat message to the lobby history
+ *
+ * @param offset Offset of the record
+ * @param type Message type of the record
+ * @param data The logged message, possibly without the tail of its text
+ * @param length Length of the logged message
+ * @param ctx Unused
+ */
+static void restore_chat_message(const uint64_t offset, const uint32_t type, const void *data, const uint32_t length,
+                                 void *ctx) {
+    ChatMessage msg;
+    Frame *frames[PROTOCOL_VERSION_MAX + 1] = {NULL};
+    (void) offset;
+    (void) ctx;
+
+    if (type != MSG_CHAT) {
+        return;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    memcpy(&msg, data, length < sizeof(msg) ? length : sizeof(msg));
+    msg.username[sizeof(msg.username) - 1] = '\0';
+    msg.message[sizeof(msg.message) - 1] = '\0';
+
+    if (encode_all_versions(frames, MSG_CHAT, &msg, sizeof(msg)) == 0) {
+        pthread_mutex_lock(&history_mutex);
+        history_append(&lobby_history, frames);
+        pthread_mutex_unlock(&history_mutex);
+    }
+
+    for (int version = 0; version <= PROTOCOL_VERSION_MAX; version++) {
+        frame_unref(frames[version]);
+    }
+}
+
+/**
+ * @brief Refills the lobby history from the tail of the message log
+ */
+static void restore_lobby_history(void) {
+    const uint64_t next = message_log_next_offset();
+    if (next == 0) {
+        return;
+    }
+
+    const uint64_t from = next > HISTORY_CAPACITY ? next - HISTORY_CAPACITY : 0;
+    if (message_log_replay(from, restore_chat_message, NULL) != 0) {
+        logger_log(LOG_WARNING, "Failed to restore the chat history from the message log");
+    }
+}
+
+/**
+ * @brief Replays the recent chat history to a client
+ *
+ * Runs on the event loop that owns the client. The frames come straight
+ * from the history ring and are queued together, so they go out in one
+ * write.
+ *
+ * @param client The client
+ */
+static void replay_lobby_history(Client *client) {
+    Frame *frames[HISTORY_CAPACITY];
+
+    pthread_mutex_lock(&history_mutex);
+    const int count = history_collect(&lobby_history, client->protocol_version, frames);
+    pthread_mutex_unlock(&history_mutex);
+
+    enqueue_frames(client, frames, count);
+
+    for (int i = 0; i < count; i++) {
+        frame_unref(frames[i]);
+    }
 }
 
 /**
- * @brief Removes a client from the active client list
+ * @brief Handles a complete message received from a client
  *
- * This function removes a client from the active client list and
- * frees its resources. If the client has a nickname, it also notifies
- * other clients that the user has left.
+ * This function runs on the event loop that owns the client and
+ * dispatches the message according to its type.
  *
- * @param client_id ID of the client to remove
+ * @param client The client that sent the message
+ * @param type The message type
+ * @param data The message payload
+ * @param length The payload length
+ * @return 0 to keep the connection open, -1 to close it
  */
-void chat_handler_remove_client(const int client_id) {
-    pthread_mutex_lock(&clients_mutex);
+static int chat_handler_handle_message(Client *client, const MessageType type, uint8_t *data, const uint32_t length) {
+    const int client_id = client->id;
 
-    int found = 0;
-    char nickname[MAX_USERNAME_LEN] = {0};
-    int user_had_nickname = 0;
+    LOGGER_DEBUG("Client %d: Received complete message. Type=%d, Length=%u", client_id, type, length);
 
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i] && clients[i]->id == client_id) {
-            Client *client = clients[i];
+    switch (type) {
+        case MSG_NICKNAME: {
+            NicknameRequest *req = (NicknameRequest *) data;
+            NicknameResponse resp = {0};
 
-            if (client->has_nickname) {
-                user_had_nickname = 1;
-                strncpy(nickname, client->nickname, MAX_USERNAME_LEN);
-                nickname[MAX_USERNAME_LEN - 1] = '\0';
-            }
+            req->nickname[MAX_USERNAME_LEN - 1] = '\0';
+
+            logger_log(LOG_INFO, "Nickname request from client %d, nickname: '%s', length: %zu, data size: %u",
+                       client_id, req->nickname, strlen(req->nickname), length);
+
+            if (strlen(req->nickname) < 2) {
+                logger_log(LOG_WARNING, "Nickname too short - first bytes: [%02X %02X %02X %02X]",
+                           (unsigned char) req->nickname[0],
+                           (unsigned char) req->nickname[1],
+                           (unsigned char) req->nickname[2],
+                           (unsigned char) req->nickname[3]);
+
+                resp.status = STATUS_ERROR;
+                strcpy(resp.message, "Nickname too short (minimum 2 characters)");
+                logger_log(LOG_WARNING, "Connection rejected: %s", resp.message);
 
-            logger_log(LOG_INFO, "Removing client %d: %s", client->id, client->nickname);
+                reply_to_client(client, MSG_NICKNAME_RESPONSE, &resp, sizeof(resp));
 
-            clients[i] = NULL;
-            client_count--;
+                return 0;
+            }
 
+            char previous[MAX_USERNAME_LEN] = {0};
+            pthread_mutex_lock(&clients_mutex);
+            if (client->has_nickname) {
+                safe_nickname_copy(previous, client->nickname, sizeof(previous));
+            }
             pthread_mutex_unlock(&clients_mutex);
 
-            if (client->socket >= 0) {
-                const int result = close(client->socket);
-                if (result != 0) {
-                    logger_log(LOG_WARNING, "Failed to close socket for client %d: %s",
-                               client->id, strerror(errno));
-                }
-                client->socket = -1;
+            const int set_result = chat_handler_set_nickname(client_id, req->nickname);
+            if (set_result == 1) {
+                resp.status = STATUS_NICKNAME_TAKEN;
+                strcpy(resp.message, "Nickname is already in use");
+                logger_log(LOG_WARNING, "Connection rejected: %s already in use", req->nickname);
+
+                reply_to_client(client, MSG_NICKNAME_RESPONSE, &resp, sizeof(resp));
+
+                return 0;
             }
 
-            const int detach_result = pthread_detach(client->thread);
-            if (detach_result != 0) {
-                logger_log(LOG_WARNING, "Failed to detach thread for client %d: %s",
-                           client->id, strerror(detach_result));
+            if (set_result != 0) {
+                resp.status = STATUS_ERROR;
+                strcpy(resp.message, "Failed to set nickname");
+                logger_log(LOG_ERROR, "Failed to set nickname %s for client %d", req->nickname, client_id);
+
+                reply_to_client(client, MSG_NICKNAME_RESPONSE, &resp, sizeof(resp));
+
+                return 0;
             }
 
-            free(client);
+            pthread_mutex_lock(&clients_mutex);
+            const int user_count = named_count - 1;
+            pthread_mutex_unlock(&clients_mutex);
 
-            found = 1;
-            break;
-        }
-    }
+            resp.status = STATUS_SUCCESS;
+            strcpy(resp.message, "Nickname set successfully");
+            reply_to_client(client, MSG_NICKNAME_RESPONSE, &resp, sizeof(resp));
 
-    if (!found) {
-        pthread_mutex_unlock(&clients_mutex);
-        logger_log(LOG_WARNING, "Failed to remove client %d: not found", client_id);
-        return;
-    }
+            char welcome_msg[MAX_MESSAGE_LEN];
+            snprintf(welcome_msg, sizeof(welcome_msg),
+                     "Welcome to the chat server, %s! You are now fully connected.", req->nickname);
+            chat_handler_send_message(client_id, welcome_msg);
 
-    logger_log(LOG_INFO, "Removed client %d", client_id);
+            if (user_count > 0) {
+                char users_msg[MAX_MESSAGE_LEN];
+                snprintf(users_msg, sizeof(users_msg), "There %s %d other user%s in the chat.",
+                         (user_count == 1) ? "is" : "are", user_count, (user_count == 1) ? "" : "s");
+                chat_handler_send_message(client_id, users_msg);
+            }
 
-    if (user_had_nickname) {
-        chat_handler_user_left(nickname);
-        return;
-    }
+            if (previous[0] != '\0') {
+                chat_handler_user_left(previous);
+            }
+            chat_handler_user_joined(req->nickname);
+            send_presence_request(SHARD_PRESENCE_JOIN, client, client_id, req->nickname, previous, 0);
 
-    int client_sockets[MAX_CLIENTS];
-    int socket_count = 0;
+            send_user_list(client_id);
 
-    pthread_mutex_lock(&clients_mutex);
+            if (previous[0] == '\0') {
+                replay_lobby_history(client);
+            }
 
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i] && clients[i]->has_nickname) {
-            client_sockets[socket_count++] = clients[i]->socket;
+            logger_log(LOG_INFO, "Client %d nickname set to %s", client_id, req->nickname);
+            return 0;
         }
-    }
 
-    pthread_mutex_unlock(&clients_mutex);
+        case MSG_CHAT: {
+            ChatMessage *msg = (ChatMessage *) data;
+            char nickname[MAX_USERNAME_LEN];
+
+            pthread_mutex_lock(&clients_mutex);
+            const int has_nickname = client->has_nickname;
+            if (has_nickname) {
+                safe_nickname_copy(nickname, client->nickname, sizeof(nickname));
+            }
+            pthread_mutex_unlock(&clients_mutex);
+
+            if (!has_nickname) {
+                logger_log(LOG_WARNING, "Client %d tried to send a message without setting a nickname",
+                           client_id);
+                chat_handler_send_message(client_id, "You must set a nickname before sending messages");
+                return 0;
+            }
+
+            msg->message[MAX_MESSAGE_LEN - 1] = '\0';
+
+            LOGGER_LOG(LOG_INFO, "Chat message from %s: %s",
+                       nickname, msg->message);
 
-    if (socket_count > 0) {
-        for (int i = 0; i < socket_count; i++) {
-            send_user_list(client_sockets[i]);
+            chat_handler_broadcast_message(nickname, msg->message);
+            return 0;
         }
-        logger_log(LOG_INFO, "Broadcast updated user list after client %d disconnected", client_id);
-    }
-}
 
-/**
- * @brief Thread function for handling a client connection
- *
- * This function runs in a separate thread for each connected client
- * and handles messages from the client.
- *
- * @param arg Pointer to the Client structure
- * @return NULL
- */
-void *chat_handler_client_thread(void *arg) {
-    const Client *client = arg;
-    const int client_id = client->id;
-    const int socket_fd = client->socket;
+        case MSG_ROOM_JOIN:
+        case MSG_ROOM_LEAVE: {
+            RoomEvent *event = (RoomEvent *) data;
+            event->room[MAX_ROOM_NAME_LEN - 1] = '\0';
 
-    logger_log(LOG_INFO, "Client thread started for client %d (socket %d)", client_id, socket_fd);
+            pthread_mutex_lock(&clients_mutex);
+            const int has_nickname = client->has_nickname;
+            safe_nickname_copy(event->username, client->nickname, sizeof(event->username));
+            pthread_mutex_unlock(&clients_mutex);
 
-    pthread_cleanup_push((void (*)(void *))chat_handler_remove_client, (void *)(intptr_t)client_id)
-        ;
+            if (!has_nickname) {
+                reply_with_error(client, "You must set a nickname before joining rooms");
+                return 0;
+            }
 
-        while (1) {
-            errno = 0;
-            logger_log(LOG_DEBUG, "Client Thread %d: Waiting to receive message...", client_id);
+            if (event->room[0] == '\0') {
+                reply_with_error(client, "Room name must not be empty");
+                return 0;
+            }
 
-            MessageHeader header;
-            const int header_res = recv(socket_fd, &header, sizeof(MessageHeader), 0);
+            const int index = client_room_index(client, event->room);
 
-            if (header_res <= 0) {
-                if (header_res == 0) {
-                    logger_log(LOG_INFO, "Client %d disconnected (header receive returned 0)", client_id);
-                } else {
-                    logger_log(LOG_WARNING, "Client %d header receive error (returned %d). Errno: %d (%s)",
-                               client_id, header_res, errno, strerror(errno));
+            if (type == MSG_ROOM_JOIN) {
+                if (index >= 0) {
+                    reply_with_error(client, "Already in that room");
+                    return 0;
                 }
-                break;
-            }
 
-            const MessageType type = header.type;
-            const uint32_t length = ntohl(header.length);
-
-            logger_log(LOG_DEBUG, "Client Thread %d: Received header. Type=%d, Length=%u", client_id, type, length);
-
-            size_t expected_size = 0;
-            size_t max_size = MAX_MESSAGE_LEN;
-            switch (type) {
-                case MSG_NICKNAME:
-                    expected_size = sizeof(NicknameRequest);
-                    max_size = sizeof(NicknameRequest) + 32;
-                    break;
-                case MSG_CHAT:
-                    expected_size = sizeof(ChatMessage);
-                    max_size = MAX_USERNAME_LEN + MAX_MESSAGE_LEN + 64;
-                    break;
-                case MSG_DISCONNECT:
-                    expected_size = 0;
-                    max_size = 8;
-                    break;
-                default:
-                    expected_size = 0;
-                    max_size = MAX_MESSAGE_LEN;
-            }
-
-            logger_log(LOG_DEBUG, "Message validation: type=%d, length=%u, expected_size=%zu, max_size=%zu",
-                       type, length, expected_size, max_size);
-
-            if ((expected_size > 0 && length < expected_size) || length > max_size) {
-                if (expected_size > 0 && length < expected_size) {
-                    logger_log(LOG_WARNING,
-                               "Client %d sent a message with insufficient size (%u bytes). Minimum expected size for message type %d is %zu bytes.",
-                               client_id, length, type, expected_size);
-                } else {
-                    logger_log(LOG_WARNING,
-                               "Client %d sent a message that's too large (%u bytes). Maximum allowed for type %d is %zu bytes.",
-                               client_id, length, type, max_size);
+                if (client->room_count == CLIENT_MAX_ROOMS) {
+                    reply_with_error(client, "Too many rooms joined");
+                    return 0;
                 }
 
-                char discard_buffer[1024];
-                size_t remaining = length;
-                while (remaining > 0) {
-                    const size_t to_read = remaining < sizeof(discard_buffer) ? remaining : sizeof(discard_buffer);
-                    const ssize_t read_bytes = recv(socket_fd, discard_buffer, to_read, 0);
-                    if (read_bytes <= 0) {
-                        break;
-                    }
-                    remaining -= read_bytes;
+                RoomRequest *request = new_room_request(client, SHARD_ROOM_JOIN, event->room);
+                if (!request || send_room_request(request) != 0) {
+                    reply_with_error(client, "Failed to join room");
+                    return 0;
                 }
 
-                NicknameResponse resp = {0};
-                resp.status = STATUS_ERROR;
-                strcpy(resp.message, expected_size > 0 && length < expected_size
-                                         ? "Message too small"
-                                         : "Message too large");
-                send_message(socket_fd, MSG_NICKNAME_RESPONSE, &resp, sizeof(resp));
+                memcpy(client->rooms[client->room_count++], event->room, MAX_ROOM_NAME_LEN);
+                return 0;
+            }
 
-                continue;
+            if (index < 0) {
+                reply_with_error(client, "Not in that room");
+                return 0;
             }
 
-            uint8_t data_buffer[MAX_MESSAGE_LEN] = {0};
-            if (length > 0) {
-                const int data_res = recv(socket_fd, data_buffer, length, 0);
-                if (data_res <= 0) {
-                    if (data_res == 0) {
-                        logger_log(LOG_INFO, "Client %d disconnected (data receive returned 0)", client_id);
-                    } else {
-                        logger_log(LOG_WARNING, "Client %d data receive error (returned %d). Errno: %d (%s)",
-                                   client_id, data_res, errno, strerror(errno));
-                    }
-                    break;
-                }
+            RoomRequest *request = new_room_request(client, SHARD_ROOM_LEAVE, event->room);
+            if (!request) {
+                reply_with_error(client, "Failed to leave room");
+                return 0;
+            }
+            request->confirm = 1;
 
-                if (data_res != length) {
-                    logger_log(LOG_WARNING, "Client %d: Partial data received (%d of %u bytes)",
-                               client_id, data_res, length);
-                    continue;
-                }
+            if (send_room_request(request) != 0) {
+                reply_with_error(client, "Failed to leave room");
+                return 0;
             }
 
-            logger_log(LOG_DEBUG, "Client Thread %d: Received complete message. Type=%d, Length=%u", client_id, type,
-                       length);
+            memmove(client->rooms[index], client->rooms[--client->room_count], MAX_ROOM_NAME_LEN);
+            return 0;
+        }
 
-            switch (type) {
-                case MSG_NICKNAME: {
-                    NicknameRequest *req = (NicknameRequest *) data_buffer;
-                    NicknameResponse resp = {0};
+        case MSG_ROOM_MESSAGE: {
+            RoomMessage *msg = (RoomMessage *) data;
+            msg->room[MAX_ROOM_NAME_LEN - 1] = '\0';
+            msg->message[MAX_MESSAGE_LEN - 1] = '\0';
 
-                    req->nickname[MAX_USERNAME_LEN - 1] = '\0';
+            if (client_room_index(client, msg->room) < 0) {
+                reply_with_error(client, "Not in that room");
+                return 0;
+            }
 
-                    logger_log(LOG_INFO, "Nickname request from client %d, nickname: '%s', length: %zu, data size: %u",
-                               client_id, req->nickname, strlen(req->nickname), length);
+            RoomRequest *request = new_room_request(client, SHARD_ROOM_MESSAGE, msg->room);
+            if (!request) {
+                reply_with_error(client, "Failed to send room message");
+                return 0;
+            }
+            memcpy(request->body.message, msg->message, MAX_MESSAGE_LEN);
 
-                    if (strlen(req->nickname) < 2) {
-                        logger_log(LOG_WARNING, "Nickname too short - first bytes: [%02X %02X %02X %02X]",
-                                   (unsigned char) req->nickname[0],
-                                   (unsigned char) req->nickname[1],
-                                   (unsigned char) req->nickname[2],
-                                   (unsigned char) req->nickname[3]);
+            LOGGER_LOG(LOG_INFO, "Room message from %s in %s: %s", request->body.username, msg->room, msg->message);
 
-                        resp.status = STATUS_ERROR;
-                        strcpy(resp.message, "Nickname too short (minimum 2 characters)");
-                        logger_log(LOG_WARNING, "Connection rejected: %s", resp.message);
+            if (send_room_request(request) != 0) {
+                reply_with_error(client, "Failed to send room message");
+            }
+            return 0;
+        }
 
-                        send_message(socket_fd, MSG_NICKNAME_RESPONSE, &resp, sizeof(resp));
+        case MSG_ROSTER_SYNC: {
+            const RosterSync *sync = (const RosterSync *) data;
 
-                        break;
-                    }
+            pthread_mutex_lock(&clients_mutex);
+            if (!client->presence_subscribed) {
+                client->presence_subscribed = 1;
+                if (client->has_nickname) {
+                    publish_client_snapshot();
+                }
+            }
+            pthread_mutex_unlock(&clients_mutex);
 
-                    if (chat_handler_is_nickname_taken(req->nickname)) {
-                        resp.status = STATUS_NICKNAME_TAKEN;
-                        strcpy(resp.message, "Nickname is already in use");
-                        logger_log(LOG_WARNING, "Connection rejected: %s already in use", req->nickname);
+            LOGGER_DEBUG("Client %d requested a roster sync from version %u", client_id, sync->version);
 
-                        send_message(socket_fd, MSG_NICKNAME_RESPONSE, &resp, sizeof(resp));
+            send_presence_request(SHARD_PRESENCE_SYNC, client, client_id, NULL, NULL, sync->version);
+            return 0;
+        }
 
-                        break;
-                    }
+        case MSG_DISCONNECT: {
+            logger_log(LOG_INFO, "Client %d requested disconnection", client_id);
+            return -1;
+        }
 
-                    pthread_mutex_lock(&clients_mutex);
-                    const int slot = find_client_slot(client_id);
-                    if (slot != -1) {
-                        safe_nickname_copy(clients[slot]->nickname, req->nickname, sizeof(clients[slot]->nickname));
-                        clients[slot]->has_nickname = 1;
-                    }
-                    pthread_mutex_unlock(&clients_mutex);
+        case MSG_HELLO: {
+            if (client->protocol_version != PROTOCOL_VERSION_LEGACY) {
+                logger_log(LOG_WARNING, "Client %d sent a second protocol negotiation, ignoring", client_id);
+                return 0;
+            }
 
-                    resp.status = STATUS_SUCCESS;
-                    strcpy(resp.message, "Nickname set successfully");
-                    send_message(socket_fd, MSG_NICKNAME_RESPONSE, &resp, sizeof(resp));
+            /* Room and presence owners record the version a member joined
+             * with, so it can only change while the client is in no room
+             * and not subscribed to presence. */
+            if (client->room_count > 0 || client->presence_subscribed) {
+                logger_log(LOG_WARNING, "Client %d negotiated a protocol after joining a room or presence, ignoring",
+                           client_id);
+                return 0;
+            }
 
-                    char welcome_msg[MAX_MESSAGE_LEN];
-                    snprintf(welcome_msg, sizeof(welcome_msg),
-                             "Welcome to the chat server, %s! You are now fully connected.", req->nickname);
-                    chat_handler_send_message(client_id, welcome_msg);
+            const uint8_t requested = length > 0 ? data[0] : PROTOCOL_VERSION_LEGACY;
+            uint8_t version = requested;
+            if (version > PROTOCOL_VERSION_MAX) {
+                version = PROTOCOL_VERSION_MAX;
+            } else if (version < PROTOCOL_VERSION_LEGACY) {
+                version = PROTOCOL_VERSION_LEGACY;
+            }
 
-                    int user_count = 0;
-                    pthread_mutex_lock(&clients_mutex);
-                    for (int i = 0; i < MAX_CLIENTS; i++) {
-                        if (clients[i] && clients[i]->has_nickname && clients[i]->id != client_id) {
-                            user_count++;
-                        }
-                    }
-                    pthread_mutex_unlock(&clients_mutex);
+            /* The reply and the switch happen under clients_mutex so no
+             * broadcast can slip an old-format frame in behind the reply. */
+            pthread_mutex_lock(&clients_mutex);
+            reply_to_client(client, MSG_HELLO, &version, sizeof(version));
+            client->protocol_version = version;
+            if (client->has_nickname) {
+                publish_client_snapshot();
+            }
+            pthread_mutex_unlock(&clients_mutex);
 
-                    if (user_count > 0) {
-                        char users_msg[MAX_MESSAGE_LEN];
-                        snprintf(users_msg, sizeof(users_msg), "There %s %d other user%s in the chat.",
-                                 (user_count == 1) ? "is" : "are", user_count, (user_count == 1) ? "" : "s");
-                        chat_handler_send_message(client_id, users_msg);
-                    }
+            logger_log(LOG_INFO, "Client %d negotiated protocol version %d (requested %d)",
+                       client_id, version, requested);
+            return 0;
+        }
 
-                    chat_handler_user_joined(req->nickname);
+        default: {
+            logger_log(LOG_WARNING, "Received unsupported message type %d from client %d",
+                       type, client_id);
+            return 0;
+        }
+    }
+}
 
-                    send_user_list(socket_fd);
+/**
+ * @brief Validates the size of an incoming message
+ *
+ * @param client_id ID of the client that sent the message
+ * @param version Protocol version the message was encoded with
+ * @param type The message type from the header
+ * @param length The payload length from the header
+ * @param error_msg Set to a description of the problem if the size is invalid
+ * @return 1 if the size is acceptable, 0 otherwise
+ */
+static int chat_handler_validate_length(const int client_id, const int version, const MessageType type,
+                                        const uint32_t length, const char **error_msg) {
+    size_t expected_size = 0;
+    size_t max_size = MAX_MESSAGE_LEN;
+    if (version == PROTOCOL_VERSION_COMPACT) {
+        switch (type) {
+            case MSG_NICKNAME:
+                expected_size = 1;
+                max_size = 1 + MAX_USERNAME_LEN;
+                break;
+            case MSG_CHAT:
+                expected_size = 1 + 2;
+                max_size = 1 + MAX_USERNAME_LEN + 2 + MAX_MESSAGE_LEN;
+                break;
+            case MSG_ROOM_JOIN:
+            case MSG_ROOM_LEAVE:
+                expected_size = 1 + 1;
+                max_size = 1 + MAX_ROOM_NAME_LEN + 1 + MAX_USERNAME_LEN;
+                break;
+            case MSG_ROOM_MESSAGE:
+                expected_size = 1 + 1 + 2;
+                max_size = 1 + MAX_ROOM_NAME_LEN + 1 + MAX_USERNAME_LEN + 2 + MAX_MESSAGE_LEN;
+                break;
+            case MSG_ROSTER_SYNC:
+                expected_size = 4;
+                max_size = 4;
+                break;
+            case MSG_DISCONNECT:
+            case MSG_HELLO:
+                max_size = 8;
+                break;
+            default:
+                break;
+        }
+    } else {
+        switch (type) {
+            case MSG_NICKNAME:
+                expected_size = sizeof(NicknameRequest);
+                max_size = sizeof(NicknameRequest) + 32;
+                break;
+            case MSG_CHAT:
+                expected_size = sizeof(ChatMessage);
+                max_size = MAX_USERNAME_LEN + MAX_MESSAGE_LEN + 64;
+                break;
+            case MSG_DISCONNECT:
+                expected_size = 0;
+                max_size = 8;
+                break;
+            case MSG_HELLO:
+                expected_size = 1;
+                max_size = 8;
+                break;
+            case MSG_ROOM_JOIN:
+            case MSG_ROOM_LEAVE:
+                expected_size = sizeof(RoomEvent);
+                max_size = sizeof(RoomEvent) + 32;
+                break;
+            case MSG_ROOM_MESSAGE:
+                expected_size = sizeof(RoomMessage);
+                max_size = sizeof(RoomMessage) + 32;
+                break;
+            case MSG_ROSTER_SYNC:
+                expected_size = sizeof(RosterSync);
+                max_size = sizeof(RosterSync) + 8;
+                break;
+            default:
+                expected_size = 0;
+                max_size = MAX_MESSAGE_LEN;
+        }
+    }
 
-                    logger_log(LOG_INFO, "Client %d nickname set to %s", client_id, req->nickname);
-                    continue;
-                }
+    LOGGER_DEBUG("Message validation: type=%d, length=%u, expected_size=%zu, max_size=%zu",
+               type, length, expected_size, max_size);
 
-                case MSG_CHAT: {
-                    ChatMessage *msg = (ChatMessage *) data_buffer;
-                    char nickname[MAX_USERNAME_LEN];
+    if (expected_size > 0 && length < expected_size) {
+        logger_log(LOG_WARNING,
+                   "Client %d sent a message with insufficient size (%u bytes). Minimum expected size for message type %d is %zu bytes.",
+                   client_id, length, type, expected_size);
+        *error_msg = "Message too small";
+        return 0;
+    }
 
-                    pthread_mutex_lock(&clients_mutex);
-                    const int has_nickname = client->has_nickname;
-                    if (has_nickname) {
-                        safe_nickname_copy(nickname, client->nickname, sizeof(nickname));
-                    }
-                    pthread_mutex_unlock(&clients_mutex);
+    if (length > max_size) {
+        logger_log(LOG_WARNING,
+                   "Client %d sent a message that's too large (%u bytes). Maximum allowed for type %d is %zu bytes.",
+                   client_id, length, type, max_size);
+        *error_msg = "Message too large";
+        return 0;
+    }
 
-                    if (!has_nickname) {
-                        logger_log(LOG_WARNING, "Client %d tried to send a message without setting a nickname",
-                                   client_id);
-                        chat_handler_send_message(client_id, "You must set a nickname before sending messages");
-                        continue;
-                    }
+    return 1;
+}
 
-                    msg->message[MAX_MESSAGE_LEN - 1] = '\0';
+/**
+ * @brief Handles every complete frame in a client's receive ring
+ *
+ * Incomplete frames stay in the ring until more data arrives. Frames
+ * that are oversized, undersized, malformed or carry unsupported flags
+ * are skipped and the client is told why.
+ *
+ * @param client The client whose frames should be processed
+ * @return 0 to keep the connection open, -1 to close it
+ */
+static int chat_handler_process_frames(Client *client) {
+    DecodedFrame frame;
+    int status;
+
+    while ((status = frame_decoder_next(&client->rx, &frame)) > 0) {
+        const int version = client->protocol_version;
+        const MessageType type = frame.header.type;
+        const uint32_t length = frame.header.length;
+
+        if (frame.header.version != version) {
+            logger_log(LOG_WARNING, "Client %d sent a header that does not match protocol version %d, closing",
+                       client->id, version);
+            return -1;
+        }
 
-                    logger_log(LOG_INFO, "Chat message from %s: %s",
-                               nickname, msg->message);
+        LOGGER_DEBUG("Client %d: Received header. Type=%d, Flags=0x%02X, Length=%u",
+                   client->id, type, frame.header.flags, length);
 
-                    chat_handler_broadcast_message(nickname, msg->message);
-                    break;
-                }
+        const char *error_msg = NULL;
+        if (frame.header.flags & ~FRAME_FLAGS_SUPPORTED) {
+            logger_log(LOG_WARNING, "Client %d sent unsupported frame flags 0x%02X", client->id, frame.header.flags);
+            error_msg = "Unsupported frame flags";
+        }
 
-                case MSG_DISCONNECT: {
-                    logger_log(LOG_INFO, "Client %d requested disconnection", client_id);
-                    pthread_exit(NULL);
-                }
+        if (error_msg || !chat_handler_validate_length(client->id, version, type, length, &error_msg)) {
+            reply_with_error(client, error_msg);
+            continue;
+        }
 
-                default: {
-                    logger_log(LOG_WARNING, "Received unsupported message type %d from client %d",
-                               type, client_id);
-                    break;
-                }
-            }
+        uint8_t data_buffer[MAX_MESSAGE_LEN + MAX_USERNAME_LEN + 64] = {0};
+        uint32_t data_length = 0;
+        if (frame.oversized || protocol_decode_payload(version, type, frame.payload, length, data_buffer,
+                                                       sizeof(data_buffer), &data_length) != 0) {
+            logger_log(LOG_WARNING, "Client %d sent a malformed message (type=%d, length=%u)",
+                       client->id, type, length);
+            reply_with_error(client, "Malformed message");
+            continue;
+        }
+
+        if (chat_handler_handle_message(client, type, data_buffer, data_length) != 0) {
+            return -1;
         }
+    }
+
+    if (status < 0) {
+        logger_log(LOG_WARNING, "Client %d sent an invalid frame header, closing", client->id);
+        return -1;
+    }
 
-    pthread_cleanup_pop(1);
-    return NULL;
+    return 0;
 }
 
 /**
- * @brief Checks if a nickname is already in use
+ * @brief Event loop callback for data received from a client
  *
- * This function checks if a nickname is already in use by another client.
+ * @param ctx Pointer to the Client structure
+ * @return 0 to keep the connection open, -1 to close it
+ */
+static int chat_handler_client_receive(void *ctx) {
+    Client *client = ctx;
+    client->last_active_ms = monotonic_ms();
+    touch_idle_list(client);
+    return chat_handler_process_frames(client);
+}
+
+/**
+ * @brief Event loop callback for a client whose pending flush can resume
  *
- * @param nickname The nickname to check
- * @return 1 if the nickname is already in use, 0 otherwise
+ * @param ctx Pointer to the Client structure
+ * @return 0 to keep the connection open, -1 to close it
  */
-int chat_handler_is_nickname_taken(const char *nickname) {
-    int taken = 0;
+static int chat_handler_client_writable(void *ctx) {
+    return chat_handler_write_client(ctx);
+}
 
-    pthread_mutex_lock(&clients_mutex);
+/**
+ * @brief Event loop callback for a client connection that is closing
+ *
+ * The client is removed when the peer disconnects, an error occurs or
+ * one of the other callbacks asked for the connection to be closed.
+ *
+ * @param ctx Pointer to the Client structure
+ * @param reason Why the connection is closing
+ * @param error errno value for EVENT_CLOSE_ERROR
+ */
+static void chat_handler_client_closed(void *ctx, const EventCloseReason reason, const int error) {
+    const Client *client = ctx;
+    const int client_id = client->id;
 
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i] && clients[i]->has_nickname &&
-            strcmp(clients[i]->nickname, nickname) == 0) {
-            taken = 1;
+    switch (reason) {
+        case EVENT_CLOSE_PEER:
+            logger_log(LOG_INFO, "Client %d disconnected", client_id);
+            break;
+        case EVENT_CLOSE_HANGUP:
+            logger_log(LOG_INFO, "Client %d connection hung up", client_id);
+            break;
+        case EVENT_CLOSE_ERROR:
+            logger_log(LOG_WARNING, "Client %d connection error. Errno: %d (%s)",
+                       client_id, error, strerror(error));
+            break;
+        case EVENT_CLOSE_REQUESTED:
+        default:
             break;
-        }
     }
 
-    pthread_mutex_unlock(&clients_mutex);
+    chat_handler_remove_client(client_id);
+}
 
-    return taken;
+/**
+ * @brief Checks if a nickname is already in use
+ *
+ * This function checks if a nickname is already in use by another client.
+ * The lookup goes through the nickname index and does not take clients_mutex.
+ *
+ * @param nickname The nickname to check
+ * @return 1 if the nickname is already in use, 0 otherwise
+ */
+int chat_handler_is_nickname_taken(const char *nickname) {
+    return nickname_index_lookup(nickname) != -1;
 }
 
 /**
  * @brief Broadcasts a message to all clients with nicknames
  *
  * This function sends a message to all clients with set nicknames.
+ * The message is encoded in every protocol version up front, so the
+ * same frames can be kept in the chat history. It is also appended to
+ * the message log without the unused tail of its text.
  *
  * @param sender Nickname of the message sender
  * @param message The message text
  */
 void chat_handler_broadcast_message(const char *sender, const char *message) {
     ChatMessage msg;
+    Frame *frames[PROTOCOL_VERSION_MAX + 1] = {NULL};
     safe_nickname_copy(msg.username, sender, sizeof(msg.username));
     strncpy(msg.message, message, sizeof(msg.message) - 1);
     msg.message[sizeof(msg.message) - 1] = '\0';
 
-    pthread_mutex_lock(&clients_mutex);
-
-    int client_sockets[MAX_CLIENTS];
-    int socket_count = 0;
+    message_log_append(MSG_CHAT, &msg, (uint32_t) (offsetof(ChatMessage, message) +
+                                                   strnlen(msg.message, sizeof(msg.message))));
 
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i] && clients[i]->has_nickname) {
-            client_sockets[socket_count++] = clients[i]->socket;
-        }
+    if (encode_all_versions(frames, MSG_CHAT, &msg, sizeof(msg)) == 0) {
+        pthread_mutex_lock(&history_mutex);
+        history_append(&lobby_history, frames);
+        pthread_mutex_unlock(&history_mutex);
     }
 
-    pthread_mutex_unlock(&clients_mutex);
+    fan_out_encoded(frames, MSG_CHAT, &msg, sizeof(msg), FAN_OUT_NAMED_ONLY, NULL, -1);
 
-    for (int i = 0; i < socket_count; i++) {
-        send_message(client_sockets[i], MSG_CHAT, &msg, sizeof(msg));
+    for (int version = 0; version <= PROTOCOL_VERSION_MAX; version++) {
+        frame_unref(frames[version]);
     }
 }
 
@@ -656,6 +2540,7 @@ void chat_handler_broadcast_message(const char *sender, const char *message) {
  * @brief Broadcasts a user join notification
  *
  * This function notifies all clients with nicknames that a user has joined.
+ * Presence subscribers are left out; they get a roster delta instead.
  *
  * @param nickname Nickname of the user who joined
  */
@@ -663,50 +2548,17 @@ void chat_handler_user_joined(const char *nickname) {
     UserNotification notify;
     safe_nickname_copy(notify.username, nickname, sizeof(notify.username));
 
-    pthread_mutex_lock(&clients_mutex);
-
-    int client_sockets[MAX_CLIENTS];
-    int socket_count = 0;
-
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i] && clients[i]->has_nickname &&
-            strcmp(clients[i]->nickname, nickname) != 0) {
-            client_sockets[socket_count++] = clients[i]->socket;
-        }
-    }
-
-    pthread_mutex_unlock(&clients_mutex);
-
-    for (int i = 0; i < socket_count; i++) {
-        send_message(client_sockets[i], MSG_USER_JOIN, &notify, sizeof(notify));
-    }
+    fan_out_message(MSG_USER_JOIN, &notify, sizeof(notify), FAN_OUT_NAMED_ONLY | FAN_OUT_SKIP_SUBSCRIBERS,
+                    nickname, -1);
 
     logger_log(LOG_INFO, "Broadcast user joined: %s", nickname);
-
-    pthread_mutex_lock(&clients_mutex);
-
-    memset(client_sockets, 0, sizeof(client_sockets));
-    socket_count = 0;
-
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i] && clients[i]->has_nickname) {
-            client_sockets[socket_count++] = clients[i]->socket;
-        }
-    }
-
-    pthread_mutex_unlock(&clients_mutex);
-
-    for (int i = 0; i < socket_count; i++) {
-        send_user_list(client_sockets[i]);
-    }
-
-    logger_log(LOG_INFO, "Broadcast updated user list after user joined: %s", nickname);
 }
 
 /**
  * @brief Broadcasts a user leave notification
  *
  * This function notifies all clients with nicknames that a user has left.
+ * Presence subscribers are left out; they get a roster delta instead.
  *
  * @param nickname Nickname of the user who left
  */
@@ -714,60 +2566,49 @@ void chat_handler_user_left(const char *nickname) {
     UserNotification notify;
     safe_nickname_copy(notify.username, nickname, sizeof(notify.username));
 
-    pthread_mutex_lock(&clients_mutex);
-
-    int client_sockets[MAX_CLIENTS];
-    int socket_count = 0;
-
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i] && clients[i]->has_nickname &&
-            strcmp(clients[i]->nickname, nickname) != 0) {
-            client_sockets[socket_count++] = clients[i]->socket;
-        }
-    }
-
-    pthread_mutex_unlock(&clients_mutex);
-
-    for (int i = 0; i < socket_count; i++) {
-        send_message(client_sockets[i], MSG_USER_LEAVE, &notify, sizeof(notify));
-    }
+    fan_out_message(MSG_USER_LEAVE, &notify, sizeof(notify), FAN_OUT_NAMED_ONLY | FAN_OUT_SKIP_SUBSCRIBERS,
+                    nickname, -1);
 
     logger_log(LOG_INFO, "Broadcast user left: %s", nickname);
-
-    if (socket_count > 0) {
-        for (int i = 0; i < socket_count; i++) {
-            send_user_list(client_sockets[i]);
-        }
-
-        logger_log(LOG_INFO, "Broadcast updated user list after user left: %s", nickname);
-    }
 }
 
 /**
  * @brief Sets the nickname for a client
  *
  * This function sets the nickname for a client identified by client_id.
+ * The nickname is claimed in the nickname index first, so checking and
+ * reserving it cannot race with another client asking for the same name.
  *
  * @param client_id ID of the client
  * @param nickname Nickname to set
  * @return 0 on success, 1 if nickname is already taken, -1 if client_id invalid
  */
 int chat_handler_set_nickname(const int client_id, const char *nickname) {
-    if (chat_handler_is_nickname_taken(nickname)) {
-        return 1;
+    const int claim_result = nickname_index_claim(nickname, client_id);
+    if (claim_result != 0) {
+        return claim_result;
     }
 
     pthread_mutex_lock(&clients_mutex);
 
-    const int slot = find_client_slot(client_id);
+    Client *client = client_registry_lookup(client_id);
 
-    if (slot == -1) {
+    if (!client) {
         pthread_mutex_unlock(&clients_mutex);
+        nickname_index_release(nickname, client_id);
         return -1;
     }
 
-    safe_nickname_copy(clients[slot]->nickname, nickname, sizeof(clients[slot]->nickname));
-    clients[slot]->has_nickname = 1;
+    if (client->has_nickname) {
+        nickname_index_release(client->nickname, client_id);
+    } else {
+        named_count++;
+    }
+    safe_nickname_copy(client->nickname, nickname, sizeof(client->nickname));
+    client->has_nickname = 1;
+
+    publish_client_snapshot();
+    atomic_fetch_add(&roster_generation, 1);
 
     pthread_mutex_unlock(&clients_mutex);
 
@@ -786,14 +2627,14 @@ int chat_handler_set_nickname(const int client_id, const char *nickname) {
 int chat_handler_get_nickname(const int client_id, char *nickname_buf) {
     pthread_mutex_lock(&clients_mutex);
 
-    const int slot = find_client_slot(client_id);
+    const Client *client = client_registry_lookup(client_id);
 
-    if (slot == -1 || !clients[slot]->has_nickname) {
+    if (!client || !client->has_nickname) {
         pthread_mutex_unlock(&clients_mutex);
         return -1;
     }
 
-    safe_nickname_copy(nickname_buf, clients[slot]->nickname, MAX_USERNAME_LEN);
+    safe_nickname_copy(nickname_buf, client->nickname, MAX_USERNAME_LEN);
 
     pthread_mutex_unlock(&clients_mutex);
 
@@ -810,32 +2651,14 @@ int chat_handler_get_nickname(const int client_id, char *nickname_buf) {
  * @return 0 on success, -1 on failure
  */
 int chat_handler_send_message(const int client_id, const char *message) {
-    int result = -1;
-    int client_socket = -1;
-
-    pthread_mutex_lock(&clients_mutex);
-
-    const int slot = find_client_slot(client_id);
-
-    if (slot != -1) {
-        client_socket = clients[slot]->socket;
-    }
-
-    pthread_mutex_unlock(&clients_mutex);
-
-    if (client_socket != -1) {
-        ChatMessage msg;
-        safe_nickname_copy(msg.username, "Server", sizeof(msg.username));
-        strncpy(msg.message, message, sizeof(msg.message) - 1);
-        msg.message[sizeof(msg.message) - 1] = '\0';
+    ChatMessage msg;
+    safe_nickname_copy(msg.username, "Server", sizeof(msg.username));
+    strncpy(msg.message, message, sizeof(msg.message) - 1);
+    msg.message[sizeof(msg.message) - 1] = '\0';
 
-        if (send_message(client_socket, MSG_CHAT, &msg, sizeof(msg)) > 0) {
-            result = 0;
-        } else {
-            logger_log(LOG_WARNING, "Failed to send message to client %d", client_id);
-        }
-    } else {
-        logger_log(LOG_WARNING, "Failed to send message: client %d not found", client_id);
+    const int result = send_to_client(client_id, MSG_CHAT, &msg, sizeof(msg));
+    if (result != 0) {
+        logger_log(LOG_WARNING, "Failed to send message to client %d", client_id);
     }
 
     return result;
@@ -846,12 +2669,14 @@ int chat_handler_send_message(const int client_id, const char *message) {
  *
  * This function builds a list of all users with nicknames and stores it in the provided buffer.
  * The format is "Users" followed by each username on a separate line (null-terminated).
+ * The names are read from the client snapshot without taking clients_mutex.
  *
  * @param buffer Buffer to store the user list
  * @param buffer_size Size of the buffer
  */
 void chat_handler_get_online_users(char *buffer, const size_t buffer_size) {
-    pthread_mutex_lock(&clients_mutex);
+    const int reader = shard_current();
+    const ClientSnapshot *snapshot = client_snapshot_acquire(reader);
 
     memset(buffer, 0, buffer_size);
 
@@ -861,11 +2686,12 @@ void chat_handler_get_online_users(char *buffer, const size_t buffer_size) {
     size_t offset = strlen(buffer) + 1;
     int count = 0;
 
-    for (int i = 0; i < MAX_CLIENTS && offset < buffer_size - 1; i++) {
-        if (clients[i] && clients[i]->has_nickname) {
-            const size_t nickname_len = strlen(clients[i]->nickname);
+    for (int i = 0; i < snapshot->count && offset < buffer_size - 1; i++) {
+        if (snapshot->flags[i] & CLIENT_SNAPSHOT_NAMED) {
+            const char *nickname = snapshot->nicknames[i];
+            const size_t nickname_len = strlen(nickname);
             if (offset + nickname_len + 1 < buffer_size) {
-                strncpy(buffer + offset, clients[i]->nickname, buffer_size - offset - 1);
+                strncpy(buffer + offset, nickname, buffer_size - offset - 1);
                 buffer[offset + nickname_len] = '\0';
                 offset += nickname_len + 1;
                 count++;
@@ -880,14 +2706,14 @@ void chat_handler_get_online_users(char *buffer, const size_t buffer_size) {
         buffer[offset + 8] = '\0';
     }
 
-    pthread_mutex_unlock(&clients_mutex);
+    client_snapshot_release(reader);
 }
 
 /**
- * @brief Broadcasts a message to all connected clients
+ * @brief Broadcasts a message to all clients with nicknames
  *
- * This function sends a message to all connected clients, except
- * the one specified by exclude_socket (if not -1).
+ * This function sends a message to every client that has set a nickname,
+ * except the one specified by exclude_socket (if not -1).
  *
  * @param type The message type
  * @param data The message data
@@ -895,55 +2721,96 @@ void chat_handler_get_online_users(char *buffer, const size_t buffer_size) {
  * @param exclude_socket Socket to exclude from broadcast, or -1 to broadcast to all
  */
 void broadcast_message(const MessageType type, const void *data, const uint32_t data_length, const int exclude_socket) {
-    pthread_mutex_lock(&clients_mutex);
+    fan_out_message(type, data, data_length, FAN_OUT_NAMED_ONLY, NULL, exclude_socket);
+}
 
-    int client_sockets[MAX_CLIENTS];
-    int socket_count = 0;
+/**
+ * @brief Rebuilds the cached user list from the client snapshot
+ *
+ * user_list_mutex must be held by the caller. The cache is tagged with the
+ * roster generation read before the snapshot, so it is never newer than
+ * its tag claims.
+ *
+ * @param generation Roster generation read before the rebuild
+ * @return 0 on success, -1 on failure
+ */
+static int rebuild_user_list_cache(const unsigned long generation) {
+    const int reader = shard_current();
+    const ClientSnapshot *snapshot = client_snapshot_acquire(reader);
+
+    const char **names = malloc((snapshot->count > 0 ? snapshot->count : 1) * sizeof(char *));
+    if (!names) {
+        client_snapshot_release(reader);
+        logger_log(LOG_ERROR, "Failed to allocate memory for user list");
+        return -1;
+    }
 
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i] && clients[i]->socket != exclude_socket) {
-            client_sockets[socket_count++] = clients[i]->socket;
+    int count = 0;
+    for (int i = 0; i < snapshot->count; i++) {
+        if (snapshot->flags[i] & CLIENT_SNAPSHOT_NAMED) {
+            names[count++] = snapshot->nicknames[i];
         }
     }
 
-    pthread_mutex_unlock(&clients_mutex);
+    UserListPages pages;
+    const int result = user_list_paginate(names, count, 0, &pages);
 
-    for (int i = 0; i < socket_count; i++) {
-        send_message(client_sockets[i], type, data, data_length);
+    client_snapshot_release(reader);
+    free(names);
+
+    if (result != 0) {
+        return -1;
     }
+
+    release_pages(&user_list_cache);
+    user_list_valid = encode_pages(&user_list_cache, MSG_USER_LIST, &pages) == 0;
+    user_list_generation = generation;
+    user_list_free(&pages);
+
+    LOGGER_DEBUG("Rebuilt user list: %d users in %d pages", count, user_list_cache.page_count);
+
+    return user_list_valid ? 0 : -1;
 }
 
 /**
  * @brief Sends the list of active users to a client
  *
- * This function creates a list of all users with nicknames and sends it
- * to the specified client.
+ * The list is kept as pre-encoded frames that every requester shares, and
+ * is only rebuilt after the set of nicknames has changed. All pages are
+ * queued together, so they go out in one write; they are exempt from the
+ * client's high-water mark and replace any older list still queued.
  *
- * @param client_socket Socket of the client to send the list to
+ * @param client_id ID of the client to send the list to
  */
-void send_user_list(const int client_socket) {
-    char buffer[MAX_MESSAGE_LEN] = {0};
+void send_user_list(const int client_id) {
+    int result = -1;
 
-    chat_handler_get_online_users(buffer, sizeof(buffer));
+    pthread_mutex_lock(&user_list_mutex);
 
-    size_t total_size = 0;
-    int count = 0;
-    size_t pos = 0;
+    const unsigned long generation = atomic_load(&roster_generation);
+    if (!user_list_valid || user_list_generation != generation) {
+        rebuild_user_list_cache(generation);
+    }
 
-    while (pos < sizeof(buffer) && count < MAX_CLIENTS + 2) {
-        const size_t len = strlen(buffer + pos);
-        if (len == 0) {
-            break;
+    if (user_list_valid) {
+        pthread_mutex_lock(&clients_mutex);
+
+        Client *client = client_registry_lookup(client_id);
+        if (client) {
+            result = 0;
+            for (int i = 0; i < user_list_cache.page_count; i++) {
+                if (enqueue_frame(client, user_list_cache.frames[client->protocol_version][i]) != 0) {
+                    result = -1;
+                }
+            }
         }
 
-        pos += len + 1;
-        count++;
-        total_size = pos;
+        pthread_mutex_unlock(&clients_mutex);
     }
 
-    if (total_size == 0) {
-        total_size = strlen(buffer) + 1;
-    }
+    pthread_mutex_unlock(&user_list_mutex);
 
-    send_message(client_socket, MSG_USER_LIST, buffer, total_size);
+    if (result != 0) {
+        logger_log(LOG_WARNING, "Failed to send user list to client %d", client_id);
+    }
 }
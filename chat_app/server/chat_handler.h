@@ -2,21 +2,63 @@
 #define CHAT_HANDLER_H
 
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "event_loop.h"
+#include "outbound_queue.h"
+#include "../common/frame_decoder.h"
 #include "../common/protocol.h"
 
-typedef struct {
+#define CLIENT_RX_MAX_PAYLOAD (MAX_USERNAME_LEN + MAX_MESSAGE_LEN + 64)
+#define CLIENT_RX_RING_SIZE 4096
+#define CLIENT_MAX_ROOMS 16
+#define CLIENT_CACHE_LINE 64
+
+#ifndef CHAT_HANDLER_DEFAULT_IDLE_MS
+#define CHAT_HANDLER_DEFAULT_IDLE_MS 30000
+#endif
+
+/*
+ * Fields are grouped by who touches them so that threads do not fight
+ * over cache lines: the identity fields are read by every thread that
+ * looks the client up, the receive state is written only by the owning
+ * loop, and the outbound queue is written by every thread that queues a
+ * frame. Nicknames and rooms are cold and go last.
+ */
+typedef struct Client {
+    atomic_int id;
     int socket;
-    int id;
-    char nickname[MAX_USERNAME_LEN];
+    EventLoop *loop;
+    int protocol_version;
     int has_nickname;
-    pthread_t thread;
+    int presence_subscribed;
+    int slot;
+    int generation;
+    int next_free;
+    int active_index;
+
+    _Alignas(CLIENT_CACHE_LINE) EventConnection connection;
+    FrameDecoder rx;
+    uint64_t last_active_ms;
+    struct Client *idle_prev;
+    struct Client *idle_next;
+
+    _Alignas(CLIENT_CACHE_LINE) OutboundQueue tx;
+
+    _Alignas(CLIENT_CACHE_LINE) char nickname[MAX_USERNAME_LEN];
+    char rooms[CLIENT_MAX_ROOMS][MAX_ROOM_NAME_LEN];
+    int room_count;
 } Client;
 
-int chat_handler_init(void);
+int chat_handler_init(int max_clients);
+int chat_handler_start_shards(void);
 void chat_handler_cleanup(void);
-int chat_handler_add_client(int client_socket);
+void chat_handler_set_idle_timeout(int idle_ms);
+void chat_handler_trim_idle(void);
+void chat_handler_footprint(size_t *connections, size_t *bytes);
+int chat_handler_add_client(EventLoop *loop, int client_socket);
 void chat_handler_remove_client(int client_id);
-void *chat_handler_client_thread(void *arg);
 int chat_handler_is_nickname_taken(const char *nickname);
 void chat_handler_broadcast_message(const char *sender, const char *message);
 void chat_handler_user_joined(const char *nickname);
@@ -27,6 +69,6 @@ int chat_handler_get_nickname(int client_id, char *nickname_buf);
 int chat_handler_send_message(int client_id, const char *message);
 void chat_handler_get_online_users(char *buffer, size_t buffer_size);
 void broadcast_message(MessageType type, const void *data, uint32_t data_length, int exclude_socket);
-void send_user_list(int client_socket);
+void send_user_list(int client_id);
 
 #endif 
\ No newline at end of file
@@ -0,0 +1,273 @@
+/**
+ * @file client_registry.c
+ * @brief Slab-backed registry of connected clients
+ *
+ * Client records live in fixed-size chunks that are allocated on demand,
+ * so records never move and the registry can grow to its configured
+ * capacity without a rebuild. A client ID encodes the record's slot and a
+ * generation counter, which makes lookups O(1) and lets stale IDs be
+ * detected after a slot is reused. Active records are also kept in a
+ * dense array for iteration. Chunks are cache-line aligned so that the
+ * groups of fields in a Client never straddle two records' lines.
+ *
+ * None of these functions lock; callers must hold clients_mutex, except
+ * for client_registry_lookup_owned(), which is safe on the event loop that
+ * owns the client because only that loop ever releases it.
+ *
+ * @author Jeremiah Hughes & Anthony Patton
+ * @date April 2025
+ */
+
+#include "client_registry.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "../common/logger.h"
+
+#define CLIENT_REGISTRY_SLOT_MASK (CLIENT_REGISTRY_MAX_CAPACITY - 1)
+#define CLIENT_REGISTRY_GENERATION_MASK (0x7FFFFFFF >> CLIENT_REGISTRY_SLOT_BITS)
+
+static Client **chunks = NULL;
+static int chunk_count = 0;
+static int allocated_chunks = 0;
+static int capacity = 0;
+
+static Client **active = NULL;
+static int active_count = 0;
+
+static int free_head = -1;
+
+/**
+ * @brief Returns the record stored in a slot
+ *
+ * @param slot The slot index
+ * @return The client record for the slot
+ */
+static Client *slot_client(const int slot) {
+    return &chunks[slot / CLIENT_REGISTRY_CHUNK_SIZE][slot % CLIENT_REGISTRY_CHUNK_SIZE];
+}
+
+/**
+ * @brief Allocates the next chunk of client records
+ *
+ * The new records are pushed onto the free list.
+ *
+ * @return 0 on success, -1 if the registry is full or memory is exhausted
+ */
+static int grow(void) {
+    if (allocated_chunks >= chunk_count) {
+        return -1;
+    }
+
+    Client *chunk = aligned_alloc(CLIENT_CACHE_LINE, CLIENT_REGISTRY_CHUNK_SIZE * sizeof(Client));
+    if (!chunk) {
+        logger_log(LOG_ERROR, "Failed to allocate memory for client registry chunk");
+        return -1;
+    }
+    memset(chunk, 0, CLIENT_REGISTRY_CHUNK_SIZE * sizeof(Client));
+
+    const int first_slot = allocated_chunks * CLIENT_REGISTRY_CHUNK_SIZE;
+    chunks[allocated_chunks++] = chunk;
+
+    for (int i = CLIENT_REGISTRY_CHUNK_SIZE - 1; i >= 0; i--) {
+        const int slot = first_slot + i;
+        if (slot >= capacity) {
+            continue;
+        }
+
+        Client *client = &chunk[i];
+        client->slot = slot;
+        client->generation = 0;
+        client->id = -1;
+        client->active_index = -1;
+        client->next_free = free_head;
+        free_head = slot;
+    }
+
+    LOGGER_DEBUG("Client registry grew to %d records", allocated_chunks * CLIENT_REGISTRY_CHUNK_SIZE);
+    return 0;
+}
+
+/**
+ * @brief Initializes the client registry
+ *
+ * @param max_clients Maximum number of simultaneously connected clients
+ * @return 0 on success, -1 on failure
+ */
+int client_registry_init(const int max_clients) {
+    if (max_clients <= 0 || max_clients > CLIENT_REGISTRY_MAX_CAPACITY) {
+        logger_log(LOG_ERROR, "Invalid client capacity %d (must be 1-%d)", max_clients,
+                   CLIENT_REGISTRY_MAX_CAPACITY);
+        return -1;
+    }
+
+    capacity = max_clients;
+    chunk_count = (max_clients + CLIENT_REGISTRY_CHUNK_SIZE - 1) / CLIENT_REGISTRY_CHUNK_SIZE;
+
+    chunks = calloc(chunk_count, sizeof(Client *));
+    active = calloc(max_clients, sizeof(Client *));
+    if (!chunks || !active) {
+        logger_log(LOG_ERROR, "Failed to allocate memory for client registry");
+        client_registry_destroy();
+        return -1;
+    }
+
+    allocated_chunks = 0;
+    active_count = 0;
+    free_head = -1;
+
+    logger_log(LOG_INFO, "Client registry initialized with capacity %d", max_clients);
+    return 0;
+}
+
+/**
+ * @brief Releases all memory held by the registry
+ *
+ * Client sockets are not closed; that is the caller's responsibility.
+ */
+void client_registry_destroy(void) {
+    for (int i = 0; i < allocated_chunks; i++) {
+        free(chunks[i]);
+    }
+
+    free(chunks);
+    free(active);
+    chunks = NULL;
+    active = NULL;
+    chunk_count = 0;
+    allocated_chunks = 0;
+    capacity = 0;
+    active_count = 0;
+    free_head = -1;
+}
+
+/**
+ * @brief Takes a free client record and assigns it a new ID
+ *
+ * Only the registry bookkeeping fields are initialized; the caller
+ * fills in the rest of the record.
+ *
+ * @return The client record, or NULL if the registry is full
+ */
+Client *client_registry_acquire(void) {
+    if (free_head == -1 && grow() != 0) {
+        return NULL;
+    }
+
+    Client *client = slot_client(free_head);
+    free_head = client->next_free;
+
+    client->generation = (client->generation + 1) & CLIENT_REGISTRY_GENERATION_MASK;
+    if (client->generation == 0) {
+        client->generation = 1;
+    }
+
+    client->id = (client->generation << CLIENT_REGISTRY_SLOT_BITS) | client->slot;
+    client->next_free = -1;
+    client->active_index = active_count;
+    active[active_count++] = client;
+
+    return client;
+}
+
+/**
+ * @brief Returns a client record to the free list
+ *
+ * @param client The record to release
+ */
+void client_registry_release(Client *client) {
+    if (!client || client->active_index < 0) {
+        return;
+    }
+
+    Client *last = active[--active_count];
+    active[client->active_index] = last;
+    last->active_index = client->active_index;
+    active[active_count] = NULL;
+
+    client->active_index = -1;
+    client->id = -1;
+    client->next_free = free_head;
+    free_head = client->slot;
+}
+
+/**
+ * @brief Finds a client by ID
+ *
+ * @param client_id ID of the client to find
+ * @return The client record, or NULL if no connected client has that ID
+ */
+Client *client_registry_lookup(const int client_id) {
+    if (client_id <= 0) {
+        return NULL;
+    }
+
+    const int slot = client_id & CLIENT_REGISTRY_SLOT_MASK;
+    if (slot >= allocated_chunks * CLIENT_REGISTRY_CHUNK_SIZE || slot >= capacity) {
+        return NULL;
+    }
+
+    Client *client = slot_client(slot);
+    return client->id == client_id ? client : NULL;
+}
+
+/**
+ * @brief Finds a client of the calling event loop by ID without locking
+ *
+ * The ID must have been handed out to a client accepted by the calling
+ * event loop, so its chunk is known to exist. Only that loop releases the
+ * client, which makes the result safe to use until the loop returns to
+ * epoll; a slot reused by another loop carries a different generation and
+ * is reported as gone.
+ *
+ * @param client_id ID of a client owned by the calling event loop
+ * @return The client record, or NULL if the client has disconnected
+ */
+Client *client_registry_lookup_owned(const int client_id) {
+    if (client_id <= 0) {
+        return NULL;
+    }
+
+    const int slot = client_id & CLIENT_REGISTRY_SLOT_MASK;
+    if (slot >= capacity) {
+        return NULL;
+    }
+
+    Client *client = slot_client(slot);
+    return client->id == client_id ? client : NULL;
+}
+
+/**
+ * @brief Returns the number of connected clients
+ *
+ * @return The number of records in use
+ */
+int client_registry_count(void) {
+    return active_count;
+}
+
+/**
+ * @brief Returns the configured capacity of the registry
+ *
+ * @return The maximum number of simultaneously connected clients
+ */
+int client_registry_capacity(void) {
+    return capacity;
+}
+
+/**
+ * @brief Returns the connected client at a dense index
+ *
+ * Indices run from 0 to client_registry_count() - 1. Releasing a client
+ * moves the last record into the freed index.
+ *
+ * @param index Dense index of the client
+ * @return The client record, or NULL if the index is out of range
+ */
+Client *client_registry_at(const int index) {
+    if (index < 0 || index >= active_count) {
+        return NULL;
+    }
+
+    return active[index];
+}
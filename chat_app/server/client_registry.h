@@ -0,0 +1,24 @@
+#ifndef CLIENT_REGISTRY_H
+#define CLIENT_REGISTRY_H
+
+#include "chat_handler.h"
+
+#define CLIENT_REGISTRY_SLOT_BITS 20
+#define CLIENT_REGISTRY_MAX_CAPACITY (1 << CLIENT_REGISTRY_SLOT_BITS)
+#define CLIENT_REGISTRY_CHUNK_SIZE 1024
+
+#ifndef CLIENT_REGISTRY_DEFAULT_CAPACITY
+#define CLIENT_REGISTRY_DEFAULT_CAPACITY 65536
+#endif
+
+int client_registry_init(int capacity);
+void client_registry_destroy(void);
+Client *client_registry_acquire(void);
+void client_registry_release(Client *client);
+Client *client_registry_lookup(int client_id);
+Client *client_registry_lookup_owned(int client_id);
+int client_registry_count(void);
+int client_registry_capacity(void);
+Client *client_registry_at(int index);
+
+#endif
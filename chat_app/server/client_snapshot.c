@@ -0,0 +1,344 @@
+/**
+ * @file client_snapshot.c
+ * @brief Read-copy-update snapshot of the connected clients
+ *
+ * Broadcasts read an immutable snapshot of the client list instead of
+ * walking the registry under clients_mutex. Whenever the set of clients
+ * or one of their nicknames changes, the writer builds a complete new
+ * snapshot and swaps it in with a single atomic exchange, so readers
+ * always see either the old list or the new one and never wait.
+ *
+ * Old snapshots are reclaimed with hazard pointers. Each event loop has
+ * its own reader slot, where it announces the snapshot it is reading;
+ * a retired snapshot is freed once no slot refers to it. Threads that
+ * are not event loops share one extra slot under a mutex.
+ *
+ * Writers must be serialized by the caller; the chat handler publishes
+ * with clients_mutex held.
+ *
+ * A snapshot stores its clients as parallel arrays rather than one
+ * record per client. Broadcasts only read the IDs, sockets, flags and
+ * nickname hashes, so a scan streams through a few dense arrays and the
+ * nicknames themselves are touched only to confirm a hash match.
+ *
+ * @author Jeremiah Hughes & Anthony Patton
+ * @date April 2025
+ */
+
+#include "client_snapshot.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../common/logger.h"
+
+#define CLIENT_SNAPSHOT_CACHE_LINE 64
+
+typedef struct {
+    _Alignas(CLIENT_SNAPSHOT_CACHE_LINE) _Atomic(ClientSnapshot *) hazard;
+} ReaderSlot;
+
+static _Atomic(ClientSnapshot *) current = NULL;
+
+static ReaderSlot *readers = NULL;
+static int slot_count = 0;
+static pthread_mutex_t shared_reader_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static ClientSnapshot **retired = NULL;
+static int retired_count = 0;
+static int retired_capacity = 0;
+
+/**
+ * @brief Rounds a size up to a whole number of cache lines
+ *
+ * @param size The size in bytes
+ * @return The rounded size
+ */
+static size_t align_up(const size_t size) {
+    return (size + CLIENT_SNAPSHOT_CACHE_LINE - 1) & ~(size_t) (CLIENT_SNAPSHOT_CACHE_LINE - 1);
+}
+
+/**
+ * @brief Checks whether any reader is still using a snapshot
+ *
+ * @param snapshot The snapshot
+ * @return 1 if a reader slot refers to it, 0 otherwise
+ */
+static int in_use(const ClientSnapshot *snapshot) {
+    for (int i = 0; i < slot_count; i++) {
+        if (atomic_load(&readers[i].hazard) == snapshot) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Frees every retired snapshot that no reader is using
+ */
+static void reclaim(void) {
+    int kept = 0;
+
+    for (int i = 0; i < retired_count; i++) {
+        if (in_use(retired[i])) {
+            retired[kept++] = retired[i];
+        } else {
+            free(retired[i]);
+        }
+    }
+
+    retired_count = kept;
+}
+
+/**
+ * @brief Initializes the snapshot with an empty client list
+ *
+ * @param reader_count Number of event loops that will read snapshots
+ * @return 0 on success, -1 on failure
+ */
+int client_snapshot_init(const int reader_count) {
+    readers = aligned_alloc(CLIENT_SNAPSHOT_CACHE_LINE, (reader_count + 1) * sizeof(ReaderSlot));
+    ClientSnapshot *empty = client_snapshot_alloc(0);
+    if (!readers || !empty) {
+        logger_log(LOG_ERROR, "Failed to allocate memory for client snapshot");
+        free(readers);
+        free(empty);
+        readers = NULL;
+        return -1;
+    }
+
+    slot_count = reader_count + 1;
+    for (int i = 0; i < slot_count; i++) {
+        atomic_init(&readers[i].hazard, NULL);
+    }
+
+    atomic_store(&current, empty);
+    return 0;
+}
+
+/**
+ * @brief Frees the current snapshot and every retired one
+ *
+ * No reader may be active.
+ */
+void client_snapshot_destroy(void) {
+    free(atomic_exchange(&current, NULL));
+
+    for (int i = 0; i < retired_count; i++) {
+        free(retired[i]);
+    }
+
+    free(retired);
+    free(readers);
+    retired = NULL;
+    retired_count = 0;
+    retired_capacity = 0;
+    readers = NULL;
+    slot_count = 0;
+}
+
+/**
+ * @brief Allocates an empty snapshot with room for a number of clients
+ *
+ * The header and every array share one allocation, each array starting
+ * on its own cache line, so the snapshot is still freed with free().
+ *
+ * @param capacity Number of entries to reserve
+ * @return The snapshot, or NULL on allocation failure
+ */
+ClientSnapshot *client_snapshot_alloc(const int capacity) {
+    const size_t count = capacity > 0 ? (size_t) capacity : 0;
+    const size_t sizes[] = {
+        count * sizeof(int),
+        count * sizeof(int),
+        count * sizeof(uint32_t),
+        count * sizeof(uint16_t),
+        count * sizeof(uint8_t),
+        count * sizeof(uint8_t),
+        count * MAX_USERNAME_LEN
+    };
+    const size_t array_count = sizeof(sizes) / sizeof(sizes[0]);
+
+    size_t offsets[sizeof(sizes) / sizeof(sizes[0])];
+    size_t total = align_up(sizeof(ClientSnapshot));
+    for (size_t i = 0; i < array_count; i++) {
+        offsets[i] = total;
+        total += align_up(sizes[i]);
+    }
+
+    uint8_t *block = aligned_alloc(CLIENT_SNAPSHOT_CACHE_LINE, total);
+    if (!block) {
+        return NULL;
+    }
+
+    ClientSnapshot *snapshot = (ClientSnapshot *) block;
+    snapshot->count = 0;
+    snapshot->ids = (int *) (block + offsets[0]);
+    snapshot->sockets = (int *) (block + offsets[1]);
+    snapshot->nickname_hashes = (uint32_t *) (block + offsets[2]);
+    snapshot->shards = (uint16_t *) (block + offsets[3]);
+    snapshot->protocol_versions = block + offsets[4];
+    snapshot->flags = block + offsets[5];
+    snapshot->nicknames = (char (*)[MAX_USERNAME_LEN]) (block + offsets[6]);
+
+    return snapshot;
+}
+
+/**
+ * @brief Hashes a nickname for the snapshot's hash array
+ *
+ * @param nickname The nickname
+ * @return FNV-1a hash of the nickname
+ */
+uint32_t client_snapshot_hash(const char *nickname) {
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < MAX_USERNAME_LEN && nickname[i] != '\0'; i++) {
+        hash ^= (uint8_t) nickname[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Appends a client to a snapshot that is being built
+ *
+ * The snapshot must have been allocated with room for the client.
+ *
+ * @param snapshot The snapshot
+ * @param id Client ID
+ * @param socket Client socket
+ * @param shard Index of the event loop that owns the client
+ * @param protocol_version Protocol version the client speaks
+ * @param flags CLIENT_SNAPSHOT_* flags
+ * @param nickname The client's nickname, used only with CLIENT_SNAPSHOT_NAMED
+ */
+void client_snapshot_add(ClientSnapshot *snapshot, const int id, const int socket, const int shard,
+                         const int protocol_version, const int flags, const char *nickname) {
+    const int i = snapshot->count++;
+
+    snapshot->ids[i] = id;
+    snapshot->sockets[i] = socket;
+    snapshot->shards[i] = (uint16_t) shard;
+    snapshot->protocol_versions[i] = (uint8_t) protocol_version;
+    snapshot->flags[i] = (uint8_t) flags;
+
+    if (flags & CLIENT_SNAPSHOT_NAMED) {
+        memcpy(snapshot->nicknames[i], nickname, MAX_USERNAME_LEN);
+        snapshot->nicknames[i][MAX_USERNAME_LEN - 1] = '\0';
+        snapshot->nickname_hashes[i] = client_snapshot_hash(snapshot->nicknames[i]);
+    } else {
+        snapshot->nicknames[i][0] = '\0';
+        snapshot->nickname_hashes[i] = 0;
+    }
+}
+
+/**
+ * @brief Finds the clients a broadcast should reach
+ *
+ * @param snapshot The snapshot to scan
+ * @param required CLIENT_SNAPSHOT_* flags a client must have
+ * @param rejected CLIENT_SNAPSHOT_* flags a client must not have
+ * @param exclude_nickname Nickname to leave out, or NULL
+ * @param exclude_socket Socket to leave out, or -1
+ * @param indices Receives the snapshot index of every match; must hold snapshot->count entries
+ * @return Number of matching clients
+ */
+int client_snapshot_select(const ClientSnapshot *snapshot, const int required, const int rejected,
+                           const char *exclude_nickname, const int exclude_socket, int *indices) {
+    const uint8_t *flags = snapshot->flags;
+    const int *sockets = snapshot->sockets;
+    const uint32_t *hashes = snapshot->nickname_hashes;
+    const uint32_t exclude_hash = exclude_nickname ? client_snapshot_hash(exclude_nickname) : 0;
+    int count = 0;
+
+    for (int i = 0; i < snapshot->count; i++) {
+        if ((flags[i] & required) != required || (flags[i] & rejected) || sockets[i] == exclude_socket) {
+            continue;
+        }
+        if (exclude_nickname && (flags[i] & CLIENT_SNAPSHOT_NAMED) && hashes[i] == exclude_hash &&
+            strncmp(snapshot->nicknames[i], exclude_nickname, MAX_USERNAME_LEN) == 0) {
+            continue;
+        }
+
+        indices[count++] = i;
+    }
+
+    return count;
+}
+
+/**
+ * @brief Replaces the current snapshot
+ *
+ * The previous snapshot is retired and freed once no reader holds it.
+ * Calls must be serialized by the caller.
+ *
+ * @param snapshot The new snapshot; ownership passes to this module on success
+ * @return 0 on success, -1 on failure, in which case the current snapshot is kept
+ */
+int client_snapshot_publish(ClientSnapshot *snapshot) {
+    if (retired_count == retired_capacity) {
+        const int new_capacity = retired_capacity ? retired_capacity * 2 : 16;
+        ClientSnapshot **list = realloc(retired, new_capacity * sizeof(ClientSnapshot *));
+        if (!list) {
+            logger_log(LOG_ERROR, "Failed to allocate memory to retire client snapshot");
+            return -1;
+        }
+        retired = list;
+        retired_capacity = new_capacity;
+    }
+
+    ClientSnapshot *previous = atomic_exchange(&current, snapshot);
+    if (previous) {
+        retired[retired_count++] = previous;
+        reclaim();
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Starts reading the current snapshot
+ *
+ * The snapshot stays valid until client_snapshot_release() is called
+ * with the same reader. Event loops pass their own index and never
+ * block; any other thread passes -1 and is serialized with the other
+ * non-loop readers.
+ *
+ * @param reader Index of the calling event loop, or -1
+ * @return The snapshot
+ */
+const ClientSnapshot *client_snapshot_acquire(const int reader) {
+    const int slot = reader >= 0 && reader < slot_count - 1 ? reader : slot_count - 1;
+    if (slot == slot_count - 1) {
+        pthread_mutex_lock(&shared_reader_mutex);
+    }
+
+    ClientSnapshot *snapshot = atomic_load(&current);
+    for (;;) {
+        atomic_store(&readers[slot].hazard, snapshot);
+
+        ClientSnapshot *latest = atomic_load(&current);
+        if (latest == snapshot) {
+            return snapshot;
+        }
+        snapshot = latest;
+    }
+}
+
+/**
+ * @brief Finishes reading a snapshot
+ *
+ * @param reader The reader passed to client_snapshot_acquire()
+ */
+void client_snapshot_release(const int reader) {
+    const int slot = reader >= 0 && reader < slot_count - 1 ? reader : slot_count - 1;
+    atomic_store_explicit(&readers[slot].hazard, NULL, memory_order_release);
+
+    if (slot == slot_count - 1) {
+        pthread_mutex_unlock(&shared_reader_mutex);
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef CLIENT_SNAPSHOT_H
+#define CLIENT_SNAPSHOT_H
+
+#include <stdint.h>
+#include "../common/protocol.h"
+
+#define CLIENT_SNAPSHOT_NAMED 0x01
+#define CLIENT_SNAPSHOT_SUBSCRIBED 0x02
+
+typedef struct {
+    int count;
+    int *ids;
+    int *sockets;
+    uint32_t *nickname_hashes;
+    uint16_t *shards;
+    uint8_t *protocol_versions;
+    uint8_t *flags;
+    char (*nicknames)[MAX_USERNAME_LEN];
+} ClientSnapshot;
+
+int client_snapshot_init(int reader_count);
+void client_snapshot_destroy(void);
+ClientSnapshot *client_snapshot_alloc(int capacity);
+void client_snapshot_add(ClientSnapshot *snapshot, int id, int socket, int shard, int protocol_version, int flags,
+                         const char *nickname);
+uint32_t client_snapshot_hash(const char *nickname);
+int client_snapshot_select(const ClientSnapshot *snapshot, int required, int rejected, const char *exclude_nickname,
+                           int exclude_socket, int *indices);
+int client_snapshot_publish(ClientSnapshot *snapshot);
+const ClientSnapshot *client_snapshot_acquire(int reader);
+void client_snapshot_release(int reader);
+
+#endif
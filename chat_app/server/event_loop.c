@@ -0,0 +1,1479 @@
+/**
+ * @file event_loop.c
+ * @brief epoll based event loops for the chat server
+ *
+ * This file implements a small pool of event-loop threads. Each loop owns
+ * an epoll instance and dispatches readiness events for the file
+ * descriptors registered with it, so client connections are multiplexed
+ * without a dedicated thread per connection. Other threads can hand work
+ * to a loop by posting notification tokens, which the loop delivers to
+ * the notify callback after each batch of events. A loop can also be
+ * signalled that its mailbox has work; the signal is a single atomic flag,
+ * so producers that keep their own lock-free queues never take a lock to
+ * wake the consumer.
+ *
+ * Listening sockets and connections are registered through a backend
+ * picked at startup. The epoll backend waits for readiness and does the
+ * accept(), recv() and sendmsg() calls itself. The io_uring backend
+ * keeps one multishot accept per listener and one multishot receive per
+ * connection outstanding, with received data landing in a pool of
+ * kernel-provided buffers, and sends each connection's outbound queue as
+ * a chain of linked sendmsg requests. Everything it queues during a pass
+ * is submitted by the same io_uring_enter() call that waits for the next
+ * completions, so a busy loop makes about one system call per pass
+ * however many messages it moves.
+ *
+ * @author Jeremiah Hughes & Anthony Patton
+ * @date April 2025
+ */
+
+#include "event_loop.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "io_ring.h"
+#include "../common/logger.h"
+
+#define EVENT_LOOP_MAX_EVENTS 64
+#define EVENT_LOOP_RING_ENTRIES 1024
+#define EVENT_LOOP_CQ_ENTRIES 8192
+#define EVENT_LOOP_RECV_BUFFERS 512
+#define EVENT_LOOP_RECV_BUFFER_SIZE 4096
+#define EVENT_LOOP_BUFFER_GROUP 0
+#define EVENT_LOOP_SEND_CHAIN 4
+
+/* Kind of request, kept in the low bits of a completion's user data
+ * next to a pointer to the object the request belongs to. */
+typedef enum {
+    IO_OP_IGNORE = 0,
+    IO_OP_WAKE,
+    IO_OP_ACCEPT,
+    IO_OP_RECV,
+    IO_OP_SEND
+} IoOp;
+
+#define IO_OP_MASK 7u
+
+/**
+ * @brief io_uring state of a connection
+ *
+ * A channel outlives its connection until every request it has in
+ * flight has completed, so completions never reach a client that has
+ * already been removed.
+ */
+struct IoChannel {
+    EventConnection *connection;
+    EventLoop *loop;
+    int pending;
+    int receiving;
+    int send_count;
+    int send_done;
+    int send_error;
+    OutboundSend *sends[EVENT_LOOP_SEND_CHAIN];
+    OutboundSend *notify_head;
+    OutboundSend *notify_tail;
+    IoChannel *prev;
+    IoChannel *next;
+    IoChannel *parked_next;
+};
+
+struct EventLoop {
+    int index;
+    int epoll_fd;
+    int wake_fd;
+    pthread_t thread;
+    int thread_started;
+    pthread_mutex_t notify_mutex;
+    int *pending;
+    int pending_count;
+    int pending_capacity;
+    EventListener **new_listeners;
+    int new_listener_count;
+    int new_listener_capacity;
+    atomic_int mailbox_signalled;
+    IoRing ring;
+    IoBufferRing buffers;
+    uint64_t wake_value;
+    int wake_armed;
+    IoChannel *channels;
+    IoChannel *parked;
+    unsigned buffers_returned;
+};
+
+static const char *const backend_names[] = {
+    [EVENT_LOOP_BACKEND_EPOLL] = "epoll",
+    [EVENT_LOOP_BACKEND_IO_URING] = "io_uring"
+};
+
+static EventLoopBackend backend = EVENT_LOOP_BACKEND_EPOLL;
+static EventLoop *loops = NULL;
+static int loop_count = 0;
+static atomic_int stopping = 0;
+static atomic_uint next_loop = 0;
+static EventNotifyCallback notify_callback = NULL;
+static EventMailboxCallback mailbox_callback = NULL;
+
+static __thread EventLoop *current_loop = NULL;
+
+/**
+ * @brief Delivers every notification posted to a loop
+ *
+ * The pending tokens are swapped out under the lock so the callbacks run
+ * without holding it and may post further notifications.
+ *
+ * @param loop The event loop running on the calling thread
+ * @return Number of notifications delivered
+ */
+static int event_loop_drain_notifications(EventLoop *loop) {
+    int *tokens = NULL;
+    int token_count = 0;
+
+    pthread_mutex_lock(&loop->notify_mutex);
+    if (loop->pending_count > 0) {
+        tokens = loop->pending;
+        token_count = loop->pending_count;
+        loop->pending = NULL;
+        loop->pending_count = 0;
+        loop->pending_capacity = 0;
+    }
+    pthread_mutex_unlock(&loop->notify_mutex);
+
+    for (int i = 0; i < token_count; i++) {
+        if (notify_callback) {
+            notify_callback(loop, tokens[i]);
+        }
+    }
+
+    free(tokens);
+    return token_count;
+}
+
+/**
+ * @brief Runs the mailbox callback if the loop has been signalled
+ *
+ * The flag is cleared before the callback runs, so a signal raised while
+ * the callback is draining is never lost.
+ *
+ * @param loop The event loop running on the calling thread
+ * @return 1 if the mailbox callback ran, 0 otherwise
+ */
+static int event_loop_drain_mailbox(EventLoop *loop) {
+    if (!atomic_exchange(&loop->mailbox_signalled, 0)) {
+        return 0;
+    }
+
+    if (mailbox_callback) {
+        mailbox_callback(loop);
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Runs an epoll event loop until the pool is stopped
+ *
+ * Waits for readiness events and hands each one to the watcher that was
+ * registered with the file descriptor. The loop exits once the pool is
+ * stopped and the wake descriptor is signalled.
+ *
+ * @param loop The event loop running on the calling thread
+ */
+static void event_loop_run_epoll(EventLoop *loop) {
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+
+    while (!atomic_load(&stopping)) {
+        const int count = epoll_wait(loop->epoll_fd, events, EVENT_LOOP_MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            logger_log(LOG_ERROR, "Event loop %d: epoll_wait() failed: %s", loop->index, strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            EventWatcher *watcher = events[i].data.ptr;
+            if (watcher == NULL) {
+                uint64_t value;
+                while (read(loop->wake_fd, &value, sizeof(value)) > 0) {
+                }
+                continue;
+            }
+
+            watcher->callback(watcher->ctx, events[i].events);
+        }
+
+        while (event_loop_drain_mailbox(loop) + event_loop_drain_notifications(loop) > 0) {
+        }
+    }
+}
+
+static void event_loop_run_uring(EventLoop *loop);
+static int io_loop_init(EventLoop *loop);
+static void io_loop_destroy(EventLoop *loop);
+
+/**
+ * @brief Main function of an event-loop thread
+ *
+ * @param arg Pointer to the EventLoop
+ * @return NULL
+ */
+static void *event_loop_thread(void *arg) {
+    EventLoop *loop = arg;
+
+    current_loop = loop;
+    logger_log(LOG_INFO, "Event loop %d started", loop->index);
+
+    if (backend == EVENT_LOOP_BACKEND_IO_URING) {
+        event_loop_run_uring(loop);
+    } else {
+        event_loop_run_epoll(loop);
+    }
+
+    logger_log(LOG_INFO, "Event loop %d stopped", loop->index);
+    return NULL;
+}
+
+/**
+ * @brief Starts the event-loop thread pool
+ *
+ * @param count Number of event-loop threads to start
+ * @return 0 on success, -1 on failure
+ */
+int event_loop_pool_start(const int count) {
+    if (count <= 0 || loops != NULL) {
+        return -1;
+    }
+
+    loops = calloc(count, sizeof(EventLoop));
+    if (!loops) {
+        logger_log(LOG_ERROR, "Failed to allocate memory for event loops");
+        return -1;
+    }
+
+    atomic_store(&stopping, 0);
+    loop_count = count;
+
+    for (int i = 0; i < count; i++) {
+        EventLoop *loop = &loops[i];
+        loop->index = i;
+        loop->epoll_fd = -1;
+        loop->wake_fd = -1;
+        loop->ring.fd = -1;
+        pthread_mutex_init(&loop->notify_mutex, NULL);
+        atomic_init(&loop->mailbox_signalled, 0);
+    }
+
+    for (int i = 0; i < count; i++) {
+        EventLoop *loop = &loops[i];
+
+        if (backend == EVENT_LOOP_BACKEND_IO_URING) {
+            /* The ring reads the wake descriptor itself, which only
+             * waits for a write if the descriptor is blocking. */
+            loop->wake_fd = eventfd(0, EFD_CLOEXEC);
+            if (loop->wake_fd < 0 || io_loop_init(loop) != 0) {
+                logger_log(LOG_ERROR, "Failed to set up io_uring for event loop %d", i);
+                event_loop_pool_stop();
+                return -1;
+            }
+        } else {
+            loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+            if (loop->epoll_fd < 0) {
+                logger_log(LOG_ERROR, "Failed to create epoll instance: %s", strerror(errno));
+                event_loop_pool_stop();
+                return -1;
+            }
+
+            loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (loop->wake_fd < 0) {
+                logger_log(LOG_ERROR, "Failed to create wake descriptor: %s", strerror(errno));
+                event_loop_pool_stop();
+                return -1;
+            }
+
+            struct epoll_event ev = {0};
+            ev.events = EPOLLIN;
+            ev.data.ptr = NULL;
+            if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &ev) < 0) {
+                logger_log(LOG_ERROR, "Failed to register wake descriptor: %s", strerror(errno));
+                event_loop_pool_stop();
+                return -1;
+            }
+        }
+
+        if (pthread_create(&loop->thread, NULL, event_loop_thread, loop) != 0) {
+            logger_log(LOG_ERROR, "Failed to create event loop thread");
+            event_loop_pool_stop();
+            return -1;
+        }
+        loop->thread_started = 1;
+    }
+
+    logger_log(LOG_INFO, "Started %d %s event loop thread%s", count, event_loop_backend_name(backend),
+               count == 1 ? "" : "s");
+    return 0;
+}
+
+/**
+ * @brief Stops all event-loop threads and releases their resources
+ */
+void event_loop_pool_stop(void) {
+    if (!loops) {
+        return;
+    }
+
+    atomic_store(&stopping, 1);
+
+    for (int i = 0; i < loop_count; i++) {
+        EventLoop *loop = &loops[i];
+        if (loop->wake_fd >= 0) {
+            const uint64_t one = 1;
+            if (write(loop->wake_fd, &one, sizeof(one)) < 0) {
+                logger_log(LOG_WARNING, "Failed to wake event loop %d: %s", i, strerror(errno));
+            }
+        }
+    }
+
+    for (int i = 0; i < loop_count; i++) {
+        EventLoop *loop = &loops[i];
+        if (loop->thread_started) {
+            pthread_join(loop->thread, NULL);
+        }
+        if (loop->wake_fd >= 0) {
+            close(loop->wake_fd);
+        }
+        if (loop->epoll_fd >= 0) {
+            close(loop->epoll_fd);
+        }
+        io_loop_destroy(loop);
+        free(loop->pending);
+        free(loop->new_listeners);
+        pthread_mutex_destroy(&loop->notify_mutex);
+    }
+
+    free(loops);
+    loops = NULL;
+    loop_count = 0;
+}
+
+/**
+ * @brief Picks the event loop that should own the next connection
+ *
+ * Connections are spread over the pool in round-robin order.
+ *
+ * @return The selected event loop, or NULL if the pool is not running
+ */
+EventLoop *event_loop_pool_next(void) {
+    if (!loops || loop_count == 0) {
+        return NULL;
+    }
+
+    const unsigned int index = atomic_fetch_add(&next_loop, 1) % (unsigned int) loop_count;
+    return &loops[index];
+}
+
+/**
+ * @brief Returns the number of event loops in the running pool
+ *
+ * @return The pool size, or 0 if the pool is not running
+ */
+int event_loop_pool_size(void) {
+    return loops ? loop_count : 0;
+}
+
+/**
+ * @brief Returns the event loop at the given index
+ *
+ * @param index Index of the loop, from 0 to event_loop_pool_size() - 1
+ * @return The event loop, or NULL if the index is out of range
+ */
+EventLoop *event_loop_pool_get(const int index) {
+    if (!loops || index < 0 || index >= loop_count) {
+        return NULL;
+    }
+
+    return &loops[index];
+}
+
+/**
+ * @brief Returns the index of an event loop within the pool
+ *
+ * @param loop The event loop
+ * @return The index of the loop
+ */
+int event_loop_index(const EventLoop *loop) {
+    return loop->index;
+}
+
+/**
+ * @brief Sets the callback that receives posted notifications
+ *
+ * Must be called before the pool is started.
+ *
+ * @param callback Function invoked on the loop thread for each token
+ */
+void event_loop_set_notify_callback(const EventNotifyCallback callback) {
+    notify_callback = callback;
+}
+
+/**
+ * @brief Posts a notification token to an event loop
+ *
+ * The token is delivered to the notify callback on the loop's own thread
+ * after its current batch of events. The loop is only woken up when it
+ * has no other notifications pending and is not the calling thread.
+ *
+ * @param loop The event loop to notify
+ * @param token Value passed to the notify callback
+ * @return 0 on success, -1 on failure
+ */
+int event_loop_notify(EventLoop *loop, const int token) {
+    if (!loop) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&loop->notify_mutex);
+
+    if (loop->pending_count == loop->pending_capacity) {
+        const int new_capacity = loop->pending_capacity ? loop->pending_capacity * 2 : 64;
+        int *pending = realloc(loop->pending, new_capacity * sizeof(int));
+        if (!pending) {
+            pthread_mutex_unlock(&loop->notify_mutex);
+            logger_log(LOG_ERROR, "Event loop %d: failed to allocate notification queue", loop->index);
+            return -1;
+        }
+        loop->pending = pending;
+        loop->pending_capacity = new_capacity;
+    }
+
+    const int was_empty = loop->pending_count == 0;
+    loop->pending[loop->pending_count++] = token;
+
+    pthread_mutex_unlock(&loop->notify_mutex);
+
+    if (was_empty && loop != current_loop) {
+        const uint64_t one = 1;
+        if (write(loop->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            logger_log(LOG_WARNING, "Failed to wake event loop %d: %s", loop->index, strerror(errno));
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Sets the callback that drains a loop's mailbox
+ *
+ * Must be called before the pool is started.
+ *
+ * @param callback Function invoked on the loop thread after it is signalled
+ */
+void event_loop_set_mailbox_callback(const EventMailboxCallback callback) {
+    mailbox_callback = callback;
+}
+
+/**
+ * @brief Tells an event loop that its mailbox has work
+ *
+ * The mailbox callback runs on the loop's own thread after its current
+ * batch of events. Signals raised before the callback runs are merged,
+ * and the loop is only woken up by the first of them. No lock is taken.
+ *
+ * @param loop The event loop to signal
+ * @return 0 on success, -1 on failure
+ */
+int event_loop_signal(EventLoop *loop) {
+    if (!loop) {
+        return -1;
+    }
+
+    if (atomic_exchange(&loop->mailbox_signalled, 1) || loop == current_loop) {
+        return 0;
+    }
+
+    const uint64_t one = 1;
+    if (write(loop->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        logger_log(LOG_WARNING, "Failed to wake event loop %d: %s", loop->index, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Returns the event loop running on the calling thread
+ *
+ * @return The current event loop, or NULL if called from another thread
+ */
+EventLoop *event_loop_current(void) {
+    return current_loop;
+}
+
+/**
+ * @brief Registers a file descriptor with an event loop
+ *
+ * @param loop The event loop
+ * @param fd The file descriptor to watch
+ * @param events epoll event mask (e.g. EPOLLIN | EPOLLET)
+ * @param watcher Callback invoked on the loop thread when the descriptor is ready
+ * @return 0 on success, -1 on failure
+ */
+static int event_loop_watch(EventLoop *loop, const int fd, const uint32_t events, EventWatcher *watcher) {
+    if (!loop || fd < 0 || !watcher) {
+        return -1;
+    }
+
+    struct epoll_event ev = {0};
+    ev.events = events;
+    ev.data.ptr = watcher;
+
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        logger_log(LOG_ERROR, "Event loop %d: failed to add fd %d: %s", loop->index, fd, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Unregisters a file descriptor from an event loop
+ *
+ * @param loop The event loop
+ * @param fd The file descriptor to stop watching
+ * @return 0 on success, -1 on failure
+ */
+static int event_loop_unwatch(EventLoop *loop, const int fd) {
+    if (!loop || fd < 0) {
+        return -1;
+    }
+
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL) < 0) {
+        logger_log(LOG_WARNING, "Event loop %d: failed to remove fd %d: %s", loop->index, fd, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief epoll callback for listening sockets
+ *
+ * Accepts until the backlog is drained, so a burst of reconnecting
+ * clients is absorbed by every worker in parallel.
+ *
+ * @param ctx Pointer to the EventListener
+ * @param events The epoll events that fired
+ */
+static void event_loop_accept_event(void *ctx, const uint32_t events) {
+    const EventListener *listener = ctx;
+    (void) events;
+
+    while (!atomic_load(&stopping)) {
+        struct sockaddr_storage addr;
+        socklen_t addr_len = sizeof(addr);
+
+        const int fd = accept4(listener->socket, (struct sockaddr *)&addr, &addr_len, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                logger_log(LOG_ERROR, "Failed to accept client connection: %s", strerror(errno));
+            }
+            break;
+        }
+
+        listener->on_accept(listener->ctx, fd, (const struct sockaddr *)&addr);
+    }
+}
+
+/**
+ * @brief epoll callback for connections
+ *
+ * Resumes a stalled outbound flush when the socket becomes writable,
+ * then reads everything currently available, since the socket is
+ * registered edge-triggered, and hands it to the receive callback. An
+ * error condition that only signals finished zero-copy sends is not
+ * treated as a failure. The connection must not be touched once its
+ * close callback has run.
+ *
+ * @param ctx Pointer to the EventConnection
+ * @param events The epoll events that fired
+ */
+static void event_loop_connection_event(void *ctx, uint32_t events) {
+    EventConnection *connection = ctx;
+
+    /* Zero-copy completions are reported as an error condition too. */
+    if ((events & EPOLLERR) && connection->tx->zerocopy &&
+        outbound_queue_reap_zerocopy(connection->tx, connection->socket) >= 0) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(connection->socket, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0) {
+            events &= ~(uint32_t) EPOLLERR;
+        }
+    }
+
+    if ((events & EPOLLOUT) && connection->on_writable(connection->ctx) != 0) {
+        connection->on_close(connection->ctx, EVENT_CLOSE_REQUESTED, 0);
+        return;
+    }
+
+    const int readable = (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0;
+
+    while (readable) {
+        const ssize_t received = frame_decoder_fill(connection->rx, connection->socket, MSG_DONTWAIT);
+
+        if (received == 0) {
+            connection->on_close(connection->ctx, EVENT_CLOSE_PEER, 0);
+            return;
+        }
+
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                connection->on_close(connection->ctx, EVENT_CLOSE_ERROR, errno);
+                return;
+            }
+            break;
+        }
+
+        if (connection->on_receive(connection->ctx) != 0) {
+            connection->on_close(connection->ctx, EVENT_CLOSE_REQUESTED, 0);
+            return;
+        }
+    }
+
+    if (events & (EPOLLHUP | EPOLLERR)) {
+        connection->on_close(connection->ctx, EVENT_CLOSE_HANGUP, 0);
+    }
+}
+
+/**
+ * @brief Tags a request with the object it belongs to
+ *
+ * @param ptr The listener, channel or loop the request belongs to
+ * @param op Kind of request
+ * @return Value for the submission's user data
+ */
+static uint64_t io_tag(const void *ptr, const IoOp op) {
+    return (uint64_t) (uintptr_t) ptr | op;
+}
+
+/**
+ * @brief Queues a read of the loop's wake descriptor
+ *
+ * io_ring_get_sqe() has already submitted a full ring to make room, so a
+ * failure means the kernel is not taking entries right now. The read is
+ * then retried on the next pass, after its completions have been reaped.
+ *
+ * @param loop The event loop running on the calling thread
+ * @return 0 on success, -1 if the submission ring is full
+ */
+static int io_arm_wake(EventLoop *loop) {
+    struct io_uring_sqe *sqe = io_ring_get_sqe(&loop->ring);
+    if (!sqe) {
+        logger_log(LOG_WARNING, "Event loop %d: no room to watch the wake descriptor, retrying", loop->index);
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = loop->wake_fd;
+    sqe->addr = (uint64_t) (uintptr_t) &loop->wake_value;
+    sqe->len = sizeof(loop->wake_value);
+    sqe->user_data = io_tag(loop, IO_OP_WAKE);
+    loop->wake_armed = 1;
+    return 0;
+}
+
+/**
+ * @brief Queues a listener to start accepting on the loop's next pass
+ *
+ * @param loop The event loop that will accept
+ * @param listener The listener
+ * @return 0 on success, -1 on allocation failure
+ */
+static int io_queue_listener(EventLoop *loop, EventListener *listener) {
+    pthread_mutex_lock(&loop->notify_mutex);
+    if (loop->new_listener_count == loop->new_listener_capacity) {
+        const int new_capacity = loop->new_listener_capacity ? loop->new_listener_capacity * 2 : 4;
+        EventListener **pending = realloc(loop->new_listeners, new_capacity * sizeof(EventListener *));
+        if (!pending) {
+            pthread_mutex_unlock(&loop->notify_mutex);
+            logger_log(LOG_ERROR, "Event loop %d: failed to allocate listener queue", loop->index);
+            return -1;
+        }
+        loop->new_listeners = pending;
+        loop->new_listener_capacity = new_capacity;
+    }
+    loop->new_listeners[loop->new_listener_count++] = listener;
+    pthread_mutex_unlock(&loop->notify_mutex);
+    return 0;
+}
+
+/**
+ * @brief Queues a multishot accept on a listening socket
+ *
+ * A listener that cannot be armed is put back on the loop's queue of new
+ * listeners, so the next pass tries again once completions have been
+ * reaped.
+ *
+ * @param loop The event loop running on the calling thread
+ * @param listener The listener
+ * @return 0 on success, -1 if the submission ring is full
+ */
+static int io_arm_accept(EventLoop *loop, EventListener *listener) {
+    struct io_uring_sqe *sqe = io_ring_get_sqe(&loop->ring);
+    if (!sqe) {
+        if (io_queue_listener(loop, listener) != 0) {
+            logger_log(LOG_ERROR, "Event loop %d: stopped accepting on socket %d", loop->index, listener->socket);
+        } else {
+            logger_log(LOG_WARNING, "Event loop %d: no room to accept on socket %d, retrying",
+                       loop->index, listener->socket);
+        }
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listener->socket;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = io_tag(listener, IO_OP_ACCEPT);
+    return 0;
+}
+
+/**
+ * @brief Queues a multishot receive into the loop's provided buffers
+ *
+ * @param loop The event loop running on the calling thread
+ * @param channel The connection's channel
+ * @return 0 on success, -1 if the submission ring is full
+ */
+static int io_arm_recv(EventLoop *loop, IoChannel *channel) {
+    struct io_uring_sqe *sqe = io_ring_get_sqe(&loop->ring);
+    if (!sqe) {
+        logger_log(LOG_ERROR, "Event loop %d: no room to receive on socket %d",
+                   loop->index, channel->connection->socket);
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = channel->connection->socket;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = loop->buffers.group;
+    sqe->user_data = io_tag(channel, IO_OP_RECV);
+    channel->receiving = 1;
+    channel->pending++;
+    return 0;
+}
+
+/**
+ * @brief Frees a channel and the sends it still holds
+ *
+ * @param channel The channel
+ */
+static void io_channel_free(IoChannel *channel) {
+    for (int i = channel->send_done; i < channel->send_count; i++) {
+        outbound_queue_free_send(channel->sends[i]);
+    }
+    while (channel->notify_head) {
+        OutboundSend *send = channel->notify_head;
+        channel->notify_head = send->next;
+        outbound_queue_free_send(send);
+    }
+    free(channel);
+}
+
+/**
+ * @brief Drops a hold on a channel
+ *
+ * A channel whose connection has been removed is freed when its last
+ * request completes.
+ *
+ * @param channel The channel
+ */
+static void io_channel_release(IoChannel *channel) {
+    channel->pending--;
+    if (!channel->connection && channel->pending == 0) {
+        io_channel_free(channel);
+    }
+}
+
+/**
+ * @brief Hands a receive buffer back to the kernel
+ *
+ * @param loop The event loop running on the calling thread
+ * @param buffer_id The buffer ID
+ */
+static void io_buffer_recycle(EventLoop *loop, const unsigned buffer_id) {
+    io_ring_buffer_recycle(&loop->buffers, buffer_id);
+    loop->buffers_returned++;
+}
+
+/**
+ * @brief Parks a channel whose receive ran out of provided buffers
+ *
+ * Re-arming right away would only fail again until buffers come back,
+ * so the channel waits on the loop's parked list, holding a reference,
+ * until io_rearm_parked() runs.
+ *
+ * @param loop The event loop running on the calling thread
+ * @param channel The connection's channel
+ */
+static void io_park_channel(EventLoop *loop, IoChannel *channel) {
+    channel->parked_next = loop->parked;
+    loop->parked = channel;
+    channel->pending++;
+}
+
+/**
+ * @brief Re-arms the parked channels once buffers have been returned
+ *
+ * Runs after each batch of completions, and does nothing unless one of
+ * them handed a buffer back. Channels whose connection was removed
+ * while parked are freed.
+ *
+ * @param loop The event loop running on the calling thread
+ */
+static void io_rearm_parked(EventLoop *loop) {
+    if (!loop->parked) {
+        loop->buffers_returned = 0;
+        return;
+    }
+    if (loop->buffers_returned == 0) {
+        return;
+    }
+
+    IoChannel *channel = loop->parked;
+    loop->parked = NULL;
+    loop->buffers_returned = 0;
+
+    while (channel) {
+        IoChannel *next = channel->parked_next;
+        channel->parked_next = NULL;
+
+        EventConnection *connection = channel->connection;
+        if (connection && !channel->receiving && io_arm_recv(loop, channel) != 0) {
+            connection->on_close(connection->ctx, EVENT_CLOSE_ERROR, EBUSY);
+        }
+        io_channel_release(channel);
+        channel = next;
+    }
+}
+
+/**
+ * @brief Handles a multishot accept completion
+ *
+ * @param loop The event loop running on the calling thread
+ * @param listener The listener
+ * @param res Accepted descriptor, or a negative errno
+ * @param flags Completion flags
+ */
+static void io_accept_complete(EventLoop *loop, EventListener *listener, const int res, const uint32_t flags) {
+    if (res >= 0) {
+        listener->on_accept(listener->ctx, res, NULL);
+    } else if (res != -ECANCELED) {
+        logger_log(LOG_ERROR, "Failed to accept client connection: %s", strerror(-res));
+    }
+
+    if (!(flags & IORING_CQE_F_MORE) && !atomic_load(&stopping)) {
+        io_arm_accept(loop, listener);
+    }
+}
+
+/**
+ * @brief Handles a multishot receive completion
+ *
+ * The received bytes are copied into the connection's frame decoder, in
+ * several steps if the decoder fills up, and the buffer is handed back
+ * to the kernel.
+ *
+ * @param loop The event loop running on the calling thread
+ * @param channel The connection's channel
+ * @param res Number of bytes received, or a negative errno
+ * @param flags Completion flags
+ */
+static void io_recv_complete(EventLoop *loop, IoChannel *channel, const int res, const uint32_t flags) {
+    const int has_buffer = (flags & IORING_CQE_F_BUFFER) != 0;
+    const unsigned buffer_id = flags >> IORING_CQE_BUFFER_SHIFT;
+
+    if (!(flags & IORING_CQE_F_MORE)) {
+        channel->receiving = 0;
+        channel->pending--;
+    }
+
+    EventConnection *connection = channel->connection;
+    if (!connection) {
+        if (has_buffer) {
+            io_buffer_recycle(loop, buffer_id);
+        }
+        if (channel->pending == 0) {
+            io_channel_free(channel);
+        }
+        return;
+    }
+
+    channel->pending++;
+
+    EventCloseReason reason = EVENT_CLOSE_PEER;
+    int error = 0;
+    int close_connection = 0;
+
+    if (res > 0 && has_buffer) {
+        const uint8_t *data = io_ring_buffer(&loop->buffers, buffer_id);
+        size_t remaining = (size_t) res;
+
+        while (remaining > 0 && !close_connection && channel->connection) {
+            const size_t pushed = frame_decoder_push(connection->rx, data, remaining);
+            data += pushed;
+            remaining -= pushed;
+
+            if (connection->on_receive(connection->ctx) != 0 || (pushed == 0 && remaining > 0)) {
+                reason = EVENT_CLOSE_REQUESTED;
+                close_connection = 1;
+            }
+        }
+    } else if (res == 0) {
+        close_connection = 1;
+    } else if (res != -ENOBUFS) {
+        reason = EVENT_CLOSE_ERROR;
+        error = -res;
+        close_connection = 1;
+    }
+
+    if (has_buffer) {
+        io_buffer_recycle(loop, buffer_id);
+    }
+
+    if (!channel->connection) {
+        /* Removed by one of its own callbacks. */
+    } else if (close_connection) {
+        connection->on_close(connection->ctx, reason, error);
+    } else if (channel->receiving) {
+        /* The multishot receive is still armed. */
+    } else if (res == -ENOBUFS) {
+        io_park_channel(loop, channel);
+    } else if (io_arm_recv(loop, channel) != 0) {
+        connection->on_close(connection->ctx, EVENT_CLOSE_ERROR, EBUSY);
+    }
+
+    io_channel_release(channel);
+}
+
+/**
+ * @brief Handles the notification that a zero-copy send's buffers are free
+ *
+ * Notifications for a socket arrive in the order the sends were made.
+ *
+ * @param channel The connection's channel
+ * @param res Notification result, with IORING_NOTIF_USAGE_ZC_COPIED set
+ *        if the kernel fell back to copying
+ */
+static void io_send_notified(IoChannel *channel, const int res) {
+    OutboundSend *send = channel->notify_head;
+    if (send) {
+        channel->notify_head = send->next;
+        if (!channel->notify_head) {
+            channel->notify_tail = NULL;
+        }
+        outbound_queue_zerocopy_done(send, ((uint32_t) res & IORING_NOTIF_USAGE_ZC_COPIED) != 0);
+        outbound_queue_free_send(send);
+    }
+
+    io_channel_release(channel);
+}
+
+/**
+ * @brief Handles the completion of one send in a connection's chain
+ *
+ * Linked sends complete in order. Once the whole chain is in, a failed
+ * connection is closed and one whose queue still holds frames is told it
+ * can write again. A zero-copy send keeps its frames, and a hold on the
+ * channel, until its notification arrives.
+ *
+ * @param channel The connection's channel
+ * @param res Number of bytes sent, or a negative errno
+ * @param flags Completion flags
+ */
+static void io_send_complete(IoChannel *channel, const int res, const uint32_t flags) {
+    if (flags & IORING_CQE_F_NOTIF) {
+        io_send_notified(channel, res);
+        return;
+    }
+
+    OutboundSend *send = channel->sends[channel->send_done];
+    channel->sends[channel->send_done++] = NULL;
+
+    EventConnection *connection = channel->connection;
+    int more = 0;
+    if (connection) {
+        more = outbound_queue_complete(connection->tx, res > 0 ? (size_t) res : 0, send->bytes);
+    }
+    if (res < 0 && res != -ECANCELED && !channel->send_error) {
+        channel->send_error = -res;
+    }
+
+    if (flags & IORING_CQE_F_MORE) {
+        send->bytes = res > 0 ? (size_t) res : 0;
+        send->next = NULL;
+        if (channel->notify_tail) {
+            channel->notify_tail->next = send;
+        } else {
+            channel->notify_head = send;
+        }
+        channel->notify_tail = send;
+        channel->pending++;
+    } else {
+        outbound_queue_free_send(send);
+    }
+
+    if (channel->send_done < channel->send_count) {
+        io_channel_release(channel);
+        return;
+    }
+
+    const int error = channel->send_error;
+    channel->send_count = 0;
+    channel->send_done = 0;
+    channel->send_error = 0;
+
+    if (connection) {
+        if (error) {
+            connection->on_close(connection->ctx, EVENT_CLOSE_ERROR, error);
+        } else if (more && connection->on_writable(connection->ctx) != 0) {
+            connection->on_close(connection->ctx, EVENT_CLOSE_REQUESTED, 0);
+        }
+    }
+
+    io_channel_release(channel);
+}
+
+/**
+ * @brief Dispatches one completion
+ *
+ * @param loop The event loop running on the calling thread
+ * @param cqe Copy of the completion
+ */
+static void io_dispatch(EventLoop *loop, const struct io_uring_cqe *cqe) {
+    void *ptr = (void *) (uintptr_t) (cqe->user_data & ~(uint64_t) IO_OP_MASK);
+
+    switch ((IoOp) (cqe->user_data & IO_OP_MASK)) {
+        case IO_OP_WAKE:
+            loop->wake_armed = 0;
+            if (!atomic_load(&stopping)) {
+                io_arm_wake(loop);
+            }
+            break;
+        case IO_OP_ACCEPT:
+            io_accept_complete(loop, ptr, cqe->res, cqe->flags);
+            break;
+        case IO_OP_RECV:
+            io_recv_complete(loop, ptr, cqe->res, cqe->flags);
+            break;
+        case IO_OP_SEND:
+            io_send_complete(ptr, cqe->res, cqe->flags);
+            break;
+        case IO_OP_IGNORE:
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Starts accepting on the listeners added from other threads
+ *
+ * @param loop The event loop running on the calling thread
+ */
+static void io_arm_new_listeners(EventLoop *loop) {
+    EventListener **pending = NULL;
+    int count = 0;
+
+    pthread_mutex_lock(&loop->notify_mutex);
+    if (loop->new_listener_count > 0) {
+        pending = loop->new_listeners;
+        count = loop->new_listener_count;
+        loop->new_listeners = NULL;
+        loop->new_listener_count = 0;
+        loop->new_listener_capacity = 0;
+    }
+    pthread_mutex_unlock(&loop->notify_mutex);
+
+    for (int i = 0; i < count; i++) {
+        io_arm_accept(loop, pending[i]);
+    }
+
+    free(pending);
+}
+
+/**
+ * @brief Runs an io_uring event loop until the pool is stopped
+ *
+ * Each pass submits everything queued by the previous one, waits for at
+ * least one completion, dispatches all that are ready and then drains
+ * the mailbox and notifications.
+ *
+ * @param loop The event loop running on the calling thread
+ */
+static void event_loop_run_uring(EventLoop *loop) {
+    while (!atomic_load(&stopping)) {
+        if (!loop->wake_armed) {
+            io_arm_wake(loop);
+        }
+        io_arm_new_listeners(loop);
+
+        if (io_ring_submit(&loop->ring, 1) < 0 && errno != EINTR && errno != EBUSY) {
+            logger_log(LOG_ERROR, "Event loop %d: io_uring_enter() failed: %s", loop->index, strerror(errno));
+            break;
+        }
+
+        const struct io_uring_cqe *next;
+        while ((next = io_ring_peek(&loop->ring)) != NULL) {
+            const struct io_uring_cqe cqe = *next;
+            io_ring_advance(&loop->ring);
+            io_dispatch(loop, &cqe);
+        }
+        io_rearm_parked(loop);
+
+        while (event_loop_drain_mailbox(loop) + event_loop_drain_notifications(loop) > 0) {
+        }
+    }
+}
+
+/**
+ * @brief Creates the io_uring state of an event loop
+ *
+ * @param loop The event loop
+ * @return 0 on success, -1 on failure
+ */
+static int io_loop_init(EventLoop *loop) {
+    if (io_ring_init(&loop->ring, EVENT_LOOP_RING_ENTRIES, EVENT_LOOP_CQ_ENTRIES) != 0) {
+        return -1;
+    }
+
+    if (io_ring_buffers_init(&loop->ring, &loop->buffers, EVENT_LOOP_RECV_BUFFERS,
+                             EVENT_LOOP_RECV_BUFFER_SIZE, EVENT_LOOP_BUFFER_GROUP) != 0) {
+        io_ring_destroy(&loop->ring);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Releases the io_uring state of a stopped event loop
+ *
+ * @param loop The event loop
+ */
+static void io_loop_destroy(EventLoop *loop) {
+    IoChannel *channel = loop->parked;
+    while (channel) {
+        IoChannel *next = channel->parked_next;
+        if (!channel->connection) {
+            io_channel_free(channel);
+        }
+        channel = next;
+    }
+    loop->parked = NULL;
+
+    channel = loop->channels;
+    while (channel) {
+        IoChannel *next = channel->next;
+        if (channel->connection) {
+            channel->connection->channel = NULL;
+        }
+        io_channel_free(channel);
+        channel = next;
+    }
+    loop->channels = NULL;
+
+    if (loop->ring.fd >= 0) {
+        io_ring_buffers_destroy(&loop->ring, &loop->buffers);
+        io_ring_destroy(&loop->ring);
+    }
+}
+
+/**
+ * @brief Selects the backend used by event loops started afterwards
+ *
+ * @param selected The backend
+ */
+void event_loop_set_backend(const EventLoopBackend selected) {
+    backend = selected;
+}
+
+/**
+ * @brief Parses a backend name
+ *
+ * @param name "epoll" or "io_uring"
+ * @param selected Receives the parsed backend
+ * @return 0 on success, -1 if the name is unknown
+ */
+int event_loop_parse_backend(const char *name, EventLoopBackend *selected) {
+    for (size_t i = 0; i < sizeof(backend_names) / sizeof(backend_names[0]); i++) {
+        if (strcmp(name, backend_names[i]) == 0) {
+            *selected = (EventLoopBackend) i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Returns the name of a backend
+ *
+ * @param selected The backend
+ * @return The backend's name
+ */
+const char *event_loop_backend_name(const EventLoopBackend selected) {
+    return selected == EVENT_LOOP_BACKEND_IO_URING ? backend_names[EVENT_LOOP_BACKEND_IO_URING]
+                                                   : backend_names[EVENT_LOOP_BACKEND_EPOLL];
+}
+
+/**
+ * @brief Starts accepting connections on a listening socket
+ *
+ * May be called from any thread. The accept callback runs on the loop's
+ * own thread for each new connection; the address is NULL when the
+ * backend does not report it.
+ *
+ * @param loop The event loop that will accept
+ * @param listener The listener, which must stay valid while the pool runs
+ * @return 0 on success, -1 on failure
+ */
+int event_loop_add_listener(EventLoop *loop, EventListener *listener) {
+    if (!loop || !listener || listener->socket < 0 || !listener->on_accept) {
+        return -1;
+    }
+
+    if (backend == EVENT_LOOP_BACKEND_EPOLL) {
+        listener->watcher.callback = event_loop_accept_event;
+        listener->watcher.ctx = listener;
+        return event_loop_watch(loop, listener->socket, EPOLLIN, &listener->watcher);
+    }
+
+    /* A non-blocking socket would fail the multishot accept with EAGAIN
+     * instead of letting the ring wait for connections. */
+    const int flags = fcntl(listener->socket, F_GETFL);
+    if (flags < 0 || fcntl(listener->socket, F_SETFL, flags & ~O_NONBLOCK) < 0) {
+        logger_log(LOG_ERROR, "Event loop %d: failed to make listener blocking: %s", loop->index, strerror(errno));
+        return -1;
+    }
+
+    if (io_queue_listener(loop, listener) != 0) {
+        return -1;
+    }
+
+    if (loop != current_loop) {
+        const uint64_t one = 1;
+        if (write(loop->wake_fd, &one, sizeof(one)) < 0) {
+            logger_log(LOG_WARNING, "Failed to wake event loop %d: %s", loop->index, strerror(errno));
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Starts serving a connection
+ *
+ * The receive callback runs after new data has been added to the
+ * connection's frame decoder, the writable callback when a flush that
+ * did not finish can be resumed, and the close callback once when the
+ * connection fails or a callback returns -1. Must be called on the
+ * loop's own thread under the io_uring backend.
+ *
+ * @param loop The event loop that will own the connection
+ * @param connection The connection, which must stay valid until removed
+ * @return 0 on success, -1 on failure
+ */
+int event_loop_add_connection(EventLoop *loop, EventConnection *connection) {
+    if (!loop || !connection || connection->socket < 0) {
+        return -1;
+    }
+
+    connection->channel = NULL;
+
+    if (backend == EVENT_LOOP_BACKEND_EPOLL) {
+        connection->watcher.callback = event_loop_connection_event;
+        connection->watcher.ctx = connection;
+        return event_loop_watch(loop, connection->socket, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+                                &connection->watcher);
+    }
+
+    if (loop != current_loop) {
+        logger_log(LOG_ERROR, "Event loop %d: connections must be added on the loop's own thread", loop->index);
+        return -1;
+    }
+
+    IoChannel *channel = calloc(1, sizeof(IoChannel));
+    if (!channel) {
+        logger_log(LOG_ERROR, "Event loop %d: failed to allocate connection state", loop->index);
+        return -1;
+    }
+
+    channel->connection = connection;
+    channel->loop = loop;
+    channel->next = loop->channels;
+    if (loop->channels) {
+        loop->channels->prev = channel;
+    }
+    loop->channels = channel;
+    connection->channel = channel;
+
+    if (io_arm_recv(loop, channel) != 0) {
+        loop->channels = channel->next;
+        if (channel->next) {
+            channel->next->prev = NULL;
+        }
+        connection->channel = NULL;
+        free(channel);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Stops serving a connection
+ *
+ * Must be called on the loop that owns the connection. No callback runs
+ * for the connection afterwards, and buffers of sends still in flight
+ * stay referenced until the kernel is done with them, so the caller may
+ * close the socket and free the connection right away.
+ *
+ * @param loop The event loop that owns the connection
+ * @param connection The connection
+ */
+void event_loop_remove_connection(EventLoop *loop, EventConnection *connection) {
+    if (!loop || !connection) {
+        return;
+    }
+
+    if (backend == EVENT_LOOP_BACKEND_EPOLL) {
+        event_loop_unwatch(loop, connection->socket);
+        return;
+    }
+
+    IoChannel *channel = connection->channel;
+    if (!channel) {
+        return;
+    }
+
+    connection->channel = NULL;
+    channel->connection = NULL;
+    if (channel->prev) {
+        channel->prev->next = channel->next;
+    } else {
+        loop->channels = channel->next;
+    }
+    if (channel->next) {
+        channel->next->prev = channel->prev;
+    }
+
+    if (channel->pending == 0) {
+        io_channel_free(channel);
+        return;
+    }
+
+    const IoOp ops[] = {IO_OP_RECV, IO_OP_SEND};
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        struct io_uring_sqe *sqe = io_ring_get_sqe(&loop->ring);
+        if (!sqe) {
+            break;
+        }
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = io_tag(channel, ops[i]);
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL;
+        sqe->user_data = io_tag(NULL, IO_OP_IGNORE);
+    }
+}
+
+/**
+ * @brief Writes as much of a connection's outbound queue as possible
+ *
+ * Under epoll the queue is written until the socket fills up. Under
+ * io_uring up to EVENT_LOOP_SEND_CHAIN batches are queued as linked
+ * sendmsg requests, zero-copy ones for batches above the threshold, and
+ * BLOCKED is returned while they are in flight; the writable callback
+ * runs when they finish with frames left over.
+ * Must be called on the loop that owns the connection.
+ *
+ * @param loop The event loop that owns the connection
+ * @param connection The connection
+ * @return The result of the flush
+ */
+OutboundFlushResult event_loop_flush_connection(EventLoop *loop, EventConnection *connection) {
+    if (backend == EVENT_LOOP_BACKEND_EPOLL) {
+        return outbound_queue_flush(connection->tx, connection->socket);
+    }
+
+    IoChannel *channel = connection->channel;
+    if (!channel) {
+        return OUTBOUND_FLUSH_ERROR;
+    }
+
+    if (channel->send_count > 0) {
+        return OUTBOUND_FLUSH_BLOCKED;
+    }
+
+    if (io_ring_reserve(&loop->ring, EVENT_LOOP_SEND_CHAIN) != 0) {
+        logger_log(LOG_ERROR, "Event loop %d: io_uring submission ring is full", loop->index);
+        return OUTBOUND_FLUSH_ERROR;
+    }
+
+    OutboundFlushResult result = OUTBOUND_FLUSH_DONE;
+    struct io_uring_sqe *previous = NULL;
+
+    while (channel->send_count < EVENT_LOOP_SEND_CHAIN) {
+        OutboundSend *send = outbound_queue_alloc_send();
+        if (!send) {
+            logger_log(LOG_ERROR, "Event loop %d: failed to allocate send", loop->index);
+            break;
+        }
+
+        const OutboundFlushResult prepared = outbound_queue_prepare(connection->tx, send);
+        if (prepared != OUTBOUND_FLUSH_BLOCKED) {
+            outbound_queue_free_send(send);
+            if (prepared == OUTBOUND_FLUSH_OVERFLOW) {
+                result = OUTBOUND_FLUSH_OVERFLOW;
+            }
+            break;
+        }
+
+        struct io_uring_sqe *sqe = io_ring_get_sqe(&loop->ring);
+        if (connection->tx->zerocopy && send->bytes >= outbound_queue_zerocopy_threshold()) {
+            sqe->opcode = IORING_OP_SENDMSG_ZC;
+            sqe->ioprio = IORING_SEND_ZC_REPORT_USAGE;
+        } else {
+            sqe->opcode = IORING_OP_SENDMSG;
+        }
+        sqe->fd = connection->socket;
+        sqe->addr = (uint64_t) (uintptr_t) &send->msg;
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        sqe->user_data = io_tag(channel, IO_OP_SEND);
+        if (previous) {
+            previous->flags |= IOSQE_IO_LINK;
+        }
+        previous = sqe;
+
+        channel->sends[channel->send_count++] = send;
+        channel->pending++;
+    }
+
+    if (channel->send_count > 0 && result == OUTBOUND_FLUSH_DONE) {
+        result = OUTBOUND_FLUSH_BLOCKED;
+    }
+
+    return result;
+}
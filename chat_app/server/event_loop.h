@@ -0,0 +1,75 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "outbound_queue.h"
+#include "../common/frame_decoder.h"
+
+typedef struct EventLoop EventLoop;
+typedef struct IoChannel IoChannel;
+
+typedef enum {
+    EVENT_LOOP_BACKEND_EPOLL = 0,
+    EVENT_LOOP_BACKEND_IO_URING
+} EventLoopBackend;
+
+typedef enum {
+    EVENT_CLOSE_PEER = 0,
+    EVENT_CLOSE_HANGUP,
+    EVENT_CLOSE_ERROR,
+    EVENT_CLOSE_REQUESTED
+} EventCloseReason;
+
+typedef void (*EventCallback)(void *ctx, uint32_t events);
+typedef void (*EventNotifyCallback)(EventLoop *loop, int token);
+typedef void (*EventMailboxCallback)(EventLoop *loop);
+typedef void (*EventAcceptCallback)(void *ctx, int fd, const struct sockaddr *addr);
+typedef int (*EventConnectionCallback)(void *ctx);
+typedef void (*EventCloseCallback)(void *ctx, EventCloseReason reason, int error);
+
+typedef struct {
+    EventCallback callback;
+    void *ctx;
+} EventWatcher;
+
+typedef struct {
+    int socket;
+    EventAcceptCallback on_accept;
+    void *ctx;
+    EventWatcher watcher;
+} EventListener;
+
+typedef struct {
+    int socket;
+    FrameDecoder *rx;
+    OutboundQueue *tx;
+    EventConnectionCallback on_receive;
+    EventConnectionCallback on_writable;
+    EventCloseCallback on_close;
+    void *ctx;
+    EventWatcher watcher;
+    IoChannel *channel;
+} EventConnection;
+
+void event_loop_set_backend(EventLoopBackend backend);
+int event_loop_parse_backend(const char *name, EventLoopBackend *backend);
+const char *event_loop_backend_name(EventLoopBackend backend);
+int event_loop_pool_start(int loop_count);
+void event_loop_pool_stop(void);
+EventLoop *event_loop_pool_next(void);
+int event_loop_pool_size(void);
+EventLoop *event_loop_pool_get(int index);
+int event_loop_index(const EventLoop *loop);
+void event_loop_set_notify_callback(EventNotifyCallback callback);
+int event_loop_notify(EventLoop *loop, int token);
+void event_loop_set_mailbox_callback(EventMailboxCallback callback);
+int event_loop_signal(EventLoop *loop);
+EventLoop *event_loop_current(void);
+int event_loop_add_listener(EventLoop *loop, EventListener *listener);
+int event_loop_add_connection(EventLoop *loop, EventConnection *connection);
+void event_loop_remove_connection(EventLoop *loop, EventConnection *connection);
+OutboundFlushResult event_loop_flush_connection(EventLoop *loop, EventConnection *connection);
+
+#endif
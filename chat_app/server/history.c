@@ -0,0 +1,82 @@
+/**
+ * @file history.c
+ * @brief Fixed-capacity rings of recently sent messages
+ *
+ * A ring keeps the last HISTORY_CAPACITY messages as the frames they were
+ * sent in, one per protocol version, so replaying history to a new member
+ * only takes references and never encodes anything. The newest message
+ * overwrites the oldest once the ring is full. Rings do no locking; each
+ * one is guarded by whoever owns it.
+ *
+ * @author Jeremiah Hughes & Anthony Patton
+ * @date April 2025
+ */
+
+#include "history.h"
+
+#include <string.h>
+
+/**
+ * @brief Initializes an empty ring
+ *
+ * @param ring The ring
+ */
+void history_init(HistoryRing *ring) {
+    memset(ring, 0, sizeof(*ring));
+}
+
+/**
+ * @brief Drops every message in a ring
+ *
+ * @param ring The ring
+ */
+void history_clear(HistoryRing *ring) {
+    for (int i = 0; i < HISTORY_CAPACITY; i++) {
+        for (int version = 0; version <= PROTOCOL_VERSION_MAX; version++) {
+            frame_unref(ring->frames[i][version]);
+        }
+    }
+
+    history_init(ring);
+}
+
+/**
+ * @brief Adds a message to a ring, evicting the oldest if it is full
+ *
+ * @param ring The ring
+ * @param frames The message encoded in each protocol version, indexed by
+ *        version; the ring takes its own references
+ */
+void history_append(HistoryRing *ring, Frame *const *frames) {
+    Frame **slot = ring->frames[ring->appended % HISTORY_CAPACITY];
+
+    for (int version = 0; version <= PROTOCOL_VERSION_MAX; version++) {
+        frame_unref(slot[version]);
+        slot[version] = frames[version] ? frame_ref(frames[version]) : NULL;
+    }
+
+    ring->appended++;
+}
+
+/**
+ * @brief Collects the messages in a ring for one protocol version
+ *
+ * @param ring The ring
+ * @param version The protocol version
+ * @param out Receives up to HISTORY_CAPACITY frames, oldest first, each
+ *        with a reference the caller must drop
+ * @return Number of frames collected
+ */
+int history_collect(const HistoryRing *ring, const int version, Frame **out) {
+    const uint32_t count = ring->appended < HISTORY_CAPACITY ? ring->appended : HISTORY_CAPACITY;
+    int collected = 0;
+
+    for (uint32_t i = ring->appended - count; i != ring->appended; i++) {
+        Frame *frame = ring->frames[i % HISTORY_CAPACITY][version];
+        if (frame) {
+            out[collected++] = frame_ref(frame);
+        }
+    }
+
+    return collected;
+}
@@ -0,0 +1,21 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+#include "../common/frame.h"
+
+#ifndef HISTORY_CAPACITY
+#define HISTORY_CAPACITY 32
+#endif
+
+typedef struct {
+    Frame *frames[HISTORY_CAPACITY][PROTOCOL_VERSION_MAX + 1];
+    uint32_t appended;
+} HistoryRing;
+
+void history_init(HistoryRing *ring);
+void history_clear(HistoryRing *ring);
+void history_append(HistoryRing *ring, Frame *const *frames);
+int history_collect(const HistoryRing *ring, int version, Frame **out);
+
+#endif
@@ -0,0 +1,333 @@
+/**
+ * @file io_ring.c
+ * @brief Minimal io_uring wrapper over the raw system calls
+ *
+ * Sets up a submission and completion ring shared with the kernel and
+ * hands out submission entries to fill in; nothing reaches the kernel
+ * until io_ring_submit(), so everything queued during one pass of an
+ * event loop goes out with the single io_uring_enter() that also waits
+ * for the next completions. A ring belongs to one thread and does no
+ * locking.
+ *
+ * Provided buffer rings give the kernel a pool of receive buffers to
+ * pick from, so multishot receives need no buffer per connection.
+ *
+ * @author Jeremiah Hughes & Anthony Patton
+ * @date April 2025
+ */
+
+#include "io_ring.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "../common/logger.h"
+
+/**
+ * @brief Unmaps a ring's shared memory and closes it
+ *
+ * @param ring The ring
+ */
+void io_ring_destroy(IoRing *ring) {
+    if (ring->sqes) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_map && ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    if (ring->sq_map) {
+        munmap(ring->sq_map, ring->sq_map_size);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+/**
+ * @brief Creates a ring
+ *
+ * Task work is run cooperatively when the owning thread enters the
+ * kernel, if the kernel supports it, instead of interrupting it.
+ *
+ * @param ring Receives the ring
+ * @param entries Number of submission entries, a power of two
+ * @param cq_entries Number of completion entries, a power of two
+ * @return 0 on success, -1 on failure
+ */
+int io_ring_init(IoRing *ring, const unsigned entries, const unsigned cq_entries) {
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = cq_entries;
+
+    ring->fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0 && errno == EINVAL) {
+        params.flags = IORING_SETUP_CQSIZE;
+        ring->fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    }
+    if (ring->fd < 0) {
+        logger_log(LOG_ERROR, "io_uring_setup() failed: %s", strerror(errno));
+        return -1;
+    }
+
+    if (!(params.features & IORING_FEAT_NODROP)) {
+        logger_log(LOG_ERROR, "io_uring is too old: completions may be dropped");
+        io_ring_destroy(ring);
+        return -1;
+    }
+
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) && ring->cq_map_size > ring->sq_map_size) {
+        ring->sq_map_size = ring->cq_map_size;
+    }
+
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) {
+        ring->sq_map = NULL;
+        logger_log(LOG_ERROR, "Failed to map io_uring submission ring: %s", strerror(errno));
+        io_ring_destroy(ring);
+        return -1;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_map = ring->sq_map;
+    } else {
+        ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                            IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED) {
+            ring->cq_map = NULL;
+            logger_log(LOG_ERROR, "Failed to map io_uring completion ring: %s", strerror(errno));
+            io_ring_destroy(ring);
+            return -1;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                      IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        logger_log(LOG_ERROR, "Failed to map io_uring submission entries: %s", strerror(errno));
+        io_ring_destroy(ring);
+        return -1;
+    }
+
+    uint8_t *sq = ring->sq_map;
+    uint8_t *cq = ring->cq_map;
+    ring->sq_head = (unsigned *) (sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    unsigned *array = (unsigned *) (sq + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++) {
+        array[i] = i;
+    }
+    ring->sqe_tail = *ring->sq_tail;
+
+    return 0;
+}
+
+/**
+ * @brief Makes sure a number of submission entries can be taken in a row
+ *
+ * Entries that must be linked have to reach the kernel in the same
+ * submission, so a chain is reserved up front.
+ *
+ * @param ring The ring
+ * @param count Number of entries needed
+ * @return 0 on success, -1 if the ring could not be drained
+ */
+int io_ring_reserve(IoRing *ring, const unsigned count) {
+    const unsigned used = ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_entries - used >= count) {
+        return 0;
+    }
+
+    if (io_ring_submit(ring, 0) < 0) {
+        return -1;
+    }
+
+    return ring->sq_entries - (ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE)) >= count ? 0 : -1;
+}
+
+/**
+ * @brief Takes the next free submission entry
+ *
+ * A full ring is submitted first to make room.
+ *
+ * @param ring The ring
+ * @return A zeroed entry, or NULL if the ring could not be drained
+ */
+struct io_uring_sqe *io_ring_get_sqe(IoRing *ring) {
+    if (io_ring_reserve(ring, 1) != 0) {
+        logger_log(LOG_ERROR, "io_uring submission ring is full");
+        return NULL;
+    }
+
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+    ring->sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/**
+ * @brief Hands every filled-in entry to the kernel and optionally waits
+ *
+ * @param ring The ring
+ * @param wait_nr Number of completions to wait for
+ * @return Number of entries submitted, or -1 with errno set
+ */
+int io_ring_submit(IoRing *ring, const unsigned wait_nr) {
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+
+    const unsigned pending = ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (pending == 0 && wait_nr == 0) {
+        return 0;
+    }
+
+    const long result = syscall(__NR_io_uring_enter, ring->fd, pending, wait_nr,
+                                wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    return result < 0 ? -1 : (int) result;
+}
+
+/**
+ * @brief Returns the oldest unread completion
+ *
+ * @param ring The ring
+ * @return The completion, or NULL if there is none
+ */
+const struct io_uring_cqe *io_ring_peek(const IoRing *ring) {
+    const unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+/**
+ * @brief Releases the completion returned by io_ring_peek()
+ *
+ * @param ring The ring
+ */
+void io_ring_advance(IoRing *ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Registers a pool of receive buffers with the kernel
+ *
+ * @param ring The ring
+ * @param buffers Receives the pool
+ * @param entries Number of buffers, a power of two
+ * @param buffer_size Size of each buffer
+ * @param group Buffer group ID that receives select the pool by
+ * @return 0 on success, -1 on failure
+ */
+int io_ring_buffers_init(IoRing *ring, IoBufferRing *buffers, const unsigned entries, const unsigned buffer_size,
+                         const uint16_t group) {
+    memset(buffers, 0, sizeof(*buffers));
+
+    void *memory = mmap(NULL, entries * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    void *data = mmap(NULL, (size_t) entries * buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                      -1, 0);
+    if (memory == MAP_FAILED || data == MAP_FAILED) {
+        logger_log(LOG_ERROR, "Failed to allocate io_uring receive buffers");
+        if (memory != MAP_FAILED) {
+            munmap(memory, entries * sizeof(struct io_uring_buf));
+        }
+        if (data != MAP_FAILED) {
+            munmap(data, (size_t) entries * buffer_size);
+        }
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) memory;
+    reg.ring_entries = entries;
+    reg.bgid = group;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        logger_log(LOG_ERROR, "Failed to register io_uring receive buffers: %s", strerror(errno));
+        munmap(memory, entries * sizeof(struct io_uring_buf));
+        munmap(data, (size_t) entries * buffer_size);
+        return -1;
+    }
+
+    buffers->ring = memory;
+    buffers->buffers = data;
+    buffers->entries = entries;
+    buffers->buffer_size = buffer_size;
+    buffers->group = group;
+
+    for (unsigned i = 0; i < entries; i++) {
+        io_ring_buffer_recycle(buffers, i);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Unregisters and frees a pool of receive buffers
+ *
+ * @param ring The ring the pool was registered with
+ * @param buffers The pool
+ */
+void io_ring_buffers_destroy(IoRing *ring, IoBufferRing *buffers) {
+    if (!buffers->ring) {
+        return;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = buffers->group;
+    if (ring->fd >= 0) {
+        syscall(__NR_io_uring_register, ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    }
+
+    munmap(buffers->ring, buffers->entries * sizeof(struct io_uring_buf));
+    munmap(buffers->buffers, (size_t) buffers->entries * buffers->buffer_size);
+    memset(buffers, 0, sizeof(*buffers));
+}
+
+/**
+ * @brief Returns the memory of a buffer picked by the kernel
+ *
+ * @param buffers The pool
+ * @param id Buffer ID from the completion flags
+ * @return The buffer
+ */
+const uint8_t *io_ring_buffer(const IoBufferRing *buffers, const unsigned id) {
+    return buffers->buffers + (size_t) id * buffers->buffer_size;
+}
+
+/**
+ * @brief Gives a buffer back to the kernel
+ *
+ * @param buffers The pool
+ * @param id The buffer ID
+ */
+void io_ring_buffer_recycle(IoBufferRing *buffers, const unsigned id) {
+    const uint16_t tail = buffers->ring->tail;
+    struct io_uring_buf *buf = &buffers->ring->bufs[tail & (buffers->entries - 1)];
+
+    buf->addr = (uint64_t) (uintptr_t) io_ring_buffer(buffers, id);
+    buf->len = buffers->buffer_size;
+    buf->bid = (uint16_t) id;
+    __atomic_store_n(&buffers->ring->tail, (uint16_t) (tail + 1), __ATOMIC_RELEASE);
+}
@@ -0,0 +1,47 @@
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+typedef struct {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sqe_tail;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    size_t sqes_size;
+} IoRing;
+
+typedef struct {
+    struct io_uring_buf_ring *ring;
+    uint8_t *buffers;
+    unsigned entries;
+    unsigned buffer_size;
+    uint16_t group;
+} IoBufferRing;
+
+int io_ring_init(IoRing *ring, unsigned entries, unsigned cq_entries);
+void io_ring_destroy(IoRing *ring);
+int io_ring_reserve(IoRing *ring, unsigned count);
+struct io_uring_sqe *io_ring_get_sqe(IoRing *ring);
+int io_ring_submit(IoRing *ring, unsigned wait_nr);
+const struct io_uring_cqe *io_ring_peek(const IoRing *ring);
+void io_ring_advance(IoRing *ring);
+int io_ring_buffers_init(IoRing *ring, IoBufferRing *buffers, unsigned entries, unsigned buffer_size, uint16_t group);
+void io_ring_buffers_destroy(IoRing *ring, IoBufferRing *buffers);
+const uint8_t *io_ring_buffer(const IoBufferRing *buffers, unsigned id);
+void io_ring_buffer_recycle(IoBufferRing *buffers, unsigned id);
+
+#endif
@@ -0,0 +1,838 @@
+/**
+ * @file message_log.c
+ * @brief Append-only durable log of chat messages
+ *
+ * The log is a directory of fixed-size segment files named after the
+ * offset of their first record. Segments are preallocated and mapped
+ * into memory, so appending a record is a copy into the mapping and
+ * never a system call. A sparse index next to each segment maps every
+ * MESSAGE_LOG_INDEX_INTERVAL bytes of log to the record that starts
+ * there, so recovery and replay can skip straight to the records they
+ * need and read forward sequentially from there.
+ *
+ * Records are written to disk by a flusher thread according to the fsync
+ * policy: "batch" commits everything appended since the previous commit
+ * as soon as that commit has finished, "interval" commits once every
+ * MESSAGE_LOG_DEFAULT_INTERVAL_MS and "never" leaves write-back to the
+ * kernel. Every record carries a checksum, so a record torn by a crash
+ * marks the end of the log.
+ *
+ * @author Jeremiah Hughes & Anthony Patton
+ * @date April 2025
+ */
+
+#include "message_log.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "../common/logger.h"
+
+#define MESSAGE_LOG_MAX_SEGMENT_SIZE (1024 * 1024 * 1024)
+#define MESSAGE_LOG_ALIGN 8
+
+/**
+ * @brief Header in front of every record
+ *
+ * The checksum covers the header, with the checksum field zeroed, and
+ * the payload.
+ */
+typedef struct {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t type;
+    uint32_t checksum;
+    uint32_t reserved;
+} RecordHeader;
+
+/**
+ * @brief Entry of a segment's sparse index
+ *
+ * Entry k points at the first record that starts at or after byte
+ * k * MESSAGE_LOG_INDEX_INTERVAL. Entry 0 is always the first record, so
+ * any later entry with a zero position is unused.
+ */
+typedef struct {
+    uint32_t relative_offset;
+    uint32_t position;
+} IndexEntry;
+
+typedef struct {
+    uint64_t base;
+    int log_fd;
+    int index_fd;
+    uint8_t *log;
+    size_t size;
+    IndexEntry *index;
+    size_t index_capacity;
+    size_t index_count;
+    size_t position;
+} Segment;
+
+static const char *const fsync_names[] = {"batch", "interval", "never"};
+
+static char log_directory[PATH_MAX];
+static MessageLogFsync fsync_policy = MESSAGE_LOG_FSYNC_BATCH;
+static size_t segment_size = MESSAGE_LOG_DEFAULT_SEGMENT_SIZE;
+
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flush_cond = PTHREAD_COND_INITIALIZER;
+static int log_open = 0;
+static Segment active = {.log_fd = -1, .index_fd = -1};
+static uint64_t next_offset = 0;
+static uint64_t *bases = NULL;
+static int base_count = 0;
+static int base_capacity = 0;
+static uint64_t appended_records = 0;
+
+/* Held while a mapping is being synced, so it cannot be unmapped under
+ * the flusher. Always taken after log_mutex. */
+static pthread_mutex_t flush_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t flush_thread;
+static int flush_thread_started = 0;
+static int flush_requested = 0;
+static int stopping = 0;
+static size_t flushed_position = 0;
+static uint64_t flush_count = 0;
+
+/**
+ * @brief Sets where and how the log is kept
+ *
+ * Must be called before message_log_open().
+ *
+ * @param directory Directory holding the segment files, or NULL to disable the log
+ * @param policy When appended records are written to disk
+ * @param size Size of each segment file in bytes
+ */
+void message_log_configure(const char *directory, const MessageLogFsync policy, const size_t size) {
+    log_directory[0] = '\0';
+    if (directory) {
+        snprintf(log_directory, sizeof(log_directory), "%s", directory);
+    }
+
+    fsync_policy = policy;
+    segment_size = size < MESSAGE_LOG_MIN_SEGMENT_SIZE ? MESSAGE_LOG_MIN_SEGMENT_SIZE
+                   : size > MESSAGE_LOG_MAX_SEGMENT_SIZE ? MESSAGE_LOG_MAX_SEGMENT_SIZE
+                   : size & ~(size_t) (MESSAGE_LOG_ALIGN - 1);
+}
+
+/**
+ * @brief Parses an fsync policy name
+ *
+ * @param name One of "batch", "interval" or "never"
+ * @param policy Receives the parsed policy
+ * @return 0 on success, -1 if the name is not recognised
+ */
+int message_log_parse_fsync(const char *name, MessageLogFsync *policy) {
+    for (size_t i = 0; i < sizeof(fsync_names) / sizeof(fsync_names[0]); i++) {
+        if (strcmp(name, fsync_names[i]) == 0) {
+            *policy = (MessageLogFsync) i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Returns the name of an fsync policy
+ *
+ * @param policy The policy
+ * @return The policy name
+ */
+const char *message_log_fsync_name(const MessageLogFsync policy) {
+    return fsync_names[policy];
+}
+
+/**
+ * @brief Returns the space a record takes up in a segment
+ *
+ * @param length Length of the payload
+ * @return Size of header and payload, rounded up to MESSAGE_LOG_ALIGN
+ */
+static size_t record_size(const uint32_t length) {
+    return (sizeof(RecordHeader) + length + MESSAGE_LOG_ALIGN - 1) & ~(size_t) (MESSAGE_LOG_ALIGN - 1);
+}
+
+/**
+ * @brief Computes the checksum of a record with 32-bit FNV-1a
+ *
+ * @param header The record header
+ * @param data The payload
+ * @return The checksum
+ */
+static uint32_t record_checksum(const RecordHeader *header, const void *data) {
+    RecordHeader copy = *header;
+    uint32_t hash = 2166136261u;
+
+    copy.checksum = 0;
+    for (size_t i = 0; i < sizeof(copy); i++) {
+        hash ^= ((const uint8_t *) &copy)[i];
+        hash *= 16777619u;
+    }
+    for (uint32_t i = 0; i < header->length; i++) {
+        hash ^= ((const uint8_t *) data)[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Validates the record at a position in a segment
+ *
+ * @param log The segment mapping
+ * @param size Size of the segment
+ * @param position Position of the record
+ * @param offset Offset the record must have
+ * @return The record's size in the segment, or 0 if there is no valid record there
+ */
+static size_t read_record(const uint8_t *log, const size_t size, const size_t position, const uint64_t offset) {
+    if (position + sizeof(RecordHeader) > size) {
+        return 0;
+    }
+
+    const RecordHeader *header = (const RecordHeader *) (log + position);
+    if (header->offset != offset || header->length > size - position - sizeof(RecordHeader)) {
+        return 0;
+    }
+
+    if (record_checksum(header, header + 1) != header->checksum) {
+        return 0;
+    }
+
+    return record_size(header->length);
+}
+
+/**
+ * @brief Reads a segment from the closest indexed record at or before an offset
+ *
+ * @param segment The segment; index may be NULL
+ * @param from First offset to hand to the visitor
+ * @param visit Called for every record from the offset on, or NULL
+ * @param ctx Passed to the visitor
+ * @param end_offset Receives the offset after the last valid record
+ * @return Position after the last valid record
+ */
+static size_t scan_segment(const Segment *segment, const uint64_t from, const MessageLogVisitor visit, void *ctx,
+                           uint64_t *end_offset) {
+    size_t entry = 0;
+    for (size_t i = 1; segment->index && i < segment->index_capacity && segment->index[i].position != 0; i++) {
+        if (segment->base + segment->index[i].relative_offset > from) {
+            break;
+        }
+        entry = i;
+    }
+
+    while (entry > 0 && read_record(segment->log, segment->size, segment->index[entry].position,
+                                    segment->base + segment->index[entry].relative_offset) == 0) {
+        entry--;
+    }
+
+    size_t position = entry ? segment->index[entry].position : 0;
+    uint64_t offset = segment->base + (entry ? segment->index[entry].relative_offset : 0);
+
+    for (;;) {
+        const size_t length = read_record(segment->log, segment->size, position, offset);
+        if (length == 0) {
+            break;
+        }
+
+        if (visit && offset >= from) {
+            const RecordHeader *header = (const RecordHeader *) (segment->log + position);
+            visit(offset, header->type, header + 1, header->length, ctx);
+        }
+
+        position += length;
+        offset++;
+    }
+
+    *end_offset = offset;
+    return position;
+}
+
+/**
+ * @brief Maps a file into memory
+ *
+ * A writable file shorter than size is extended and preallocated first;
+ * otherwise the file is mapped at its current size.
+ *
+ * @param path Path of the file
+ * @param size Size the file should have
+ * @param writable Nonzero to create the file if needed and map it writable
+ * @param fd Receives the file descriptor
+ * @param mapped_size Receives the size of the mapping
+ * @return The mapping, or NULL on failure
+ */
+static void *map_file(const char *path, const size_t size, const int writable, int *fd, size_t *mapped_size) {
+    *fd = open(path, writable ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0644);
+    if (*fd < 0) {
+        if (writable || errno != ENOENT) {
+            logger_log(LOG_ERROR, "Failed to open message log file %s: %s", path, strerror(errno));
+        }
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(*fd, &st) != 0) {
+        logger_log(LOG_ERROR, "Failed to stat message log file %s: %s", path, strerror(errno));
+        close(*fd);
+        *fd = -1;
+        return NULL;
+    }
+
+    *mapped_size = (size_t) st.st_size;
+    if (writable && *mapped_size < size) {
+        if (posix_fallocate(*fd, 0, (off_t) size) != 0 && ftruncate(*fd, (off_t) size) != 0) {
+            logger_log(LOG_ERROR, "Failed to preallocate message log file %s: %s", path, strerror(errno));
+            close(*fd);
+            *fd = -1;
+            return NULL;
+        }
+        *mapped_size = size;
+    }
+
+    if (*mapped_size == 0) {
+        close(*fd);
+        *fd = -1;
+        return NULL;
+    }
+
+    void *map = mmap(NULL, *mapped_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, *fd, 0);
+    if (map == MAP_FAILED) {
+        logger_log(LOG_ERROR, "Failed to map message log file %s: %s", path, strerror(errno));
+        close(*fd);
+        *fd = -1;
+        return NULL;
+    }
+
+    return map;
+}
+
+/**
+ * @brief Makes newly created segment files durable
+ */
+static void sync_directory(void) {
+    const int fd = open(log_directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+
+    if (fsync(fd) != 0) {
+        logger_log(LOG_WARNING, "Failed to sync message log directory: %s", strerror(errno));
+    }
+    close(fd);
+}
+
+/**
+ * @brief Unmaps a segment and closes its files
+ *
+ * @param segment The segment
+ */
+static void close_segment(Segment *segment) {
+    if (segment->log) {
+        munmap(segment->log, segment->size);
+    }
+    if (segment->index) {
+        munmap(segment->index, segment->index_capacity * sizeof(IndexEntry));
+    }
+    if (segment->log_fd >= 0) {
+        close(segment->log_fd);
+    }
+    if (segment->index_fd >= 0) {
+        close(segment->index_fd);
+    }
+
+    memset(segment, 0, sizeof(*segment));
+    segment->log_fd = -1;
+    segment->index_fd = -1;
+}
+
+/**
+ * @brief Maps a segment and its index
+ *
+ * A writable segment is created if it does not exist yet. A missing
+ * index only costs a longer scan, so a read-only segment can do without.
+ *
+ * @param segment Receives the segment
+ * @param base Offset of the segment's first record
+ * @param writable Nonzero for the segment being appended to
+ * @return 0 on success, -1 on failure
+ */
+static int open_segment(Segment *segment, const uint64_t base, const int writable) {
+    char path[PATH_MAX + 32];
+    size_t index_size = 0;
+
+    memset(segment, 0, sizeof(*segment));
+    segment->base = base;
+    segment->log_fd = -1;
+    segment->index_fd = -1;
+
+    snprintf(path, sizeof(path), "%s/%020" PRIu64 ".log", log_directory, base);
+    segment->log = map_file(path, segment_size, writable, &segment->log_fd, &segment->size);
+    if (!segment->log) {
+        close_segment(segment);
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s/%020" PRIu64 ".index", log_directory, base);
+    segment->index = map_file(path, (segment->size / MESSAGE_LOG_INDEX_INTERVAL + 1) * sizeof(IndexEntry), writable,
+                              &segment->index_fd, &index_size);
+    segment->index_capacity = index_size / sizeof(IndexEntry);
+    if (!segment->index && writable) {
+        close_segment(segment);
+        return -1;
+    }
+
+    if (writable && fsync_policy != MESSAGE_LOG_FSYNC_NEVER) {
+        sync_directory();
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Finds the end of the segment being appended to
+ *
+ * The segment is read from its first record, not from the last index
+ * entry: write-back does not keep the order of pages, so a crash can
+ * tear a record while later ones reach the disk. The log ends at the
+ * first record that does not check out. Whatever lies beyond it is
+ * zeroed, so records that outlived the tear can never line up with the
+ * offsets of new ones, and index entries past the end are cleared.
+ *
+ * @param segment The segment
+ */
+static void recover_segment(Segment *segment) {
+    segment->position = scan_segment(segment, 0, NULL, NULL, &next_offset);
+
+    size_t end = segment->size & ~(size_t) (MESSAGE_LOG_ALIGN - 1);
+    while (end > segment->position) {
+        uint64_t word;
+        memcpy(&word, segment->log + end - MESSAGE_LOG_ALIGN, sizeof(word));
+        if (word != 0) {
+            break;
+        }
+        end -= MESSAGE_LOG_ALIGN;
+    }
+    if (end > segment->position) {
+        logger_log(LOG_WARNING, "Message log: discarding %zu bytes after offset %" PRIu64, end - segment->position,
+                   next_offset);
+        memset(segment->log + segment->position, 0, end - segment->position);
+        if (fsync_policy != MESSAGE_LOG_FSYNC_NEVER &&
+            msync(segment->log, segment->size, MS_SYNC) != 0) {
+            logger_log(LOG_ERROR, "Failed to sync message log: %s", strerror(errno));
+        }
+    }
+
+    segment->index_count = 1;
+    for (size_t i = 1; i < segment->index_capacity; i++) {
+        if (segment->index[i].position == 0) {
+            break;
+        }
+        if (segment->index[i].position >= segment->position) {
+            memset(&segment->index[i], 0, (segment->index_capacity - i) * sizeof(IndexEntry));
+            break;
+        }
+        segment->index_count = i + 1;
+    }
+}
+
+/**
+ * @brief Records the base offset of a new segment
+ *
+ * @param base The base offset
+ * @return 0 on success, -1 on failure
+ */
+static int push_base(const uint64_t base) {
+    if (base_count == base_capacity) {
+        const int new_capacity = base_capacity ? base_capacity * 2 : 16;
+        uint64_t *grown = realloc(bases, new_capacity * sizeof(uint64_t));
+        if (!grown) {
+            logger_log(LOG_ERROR, "Failed to allocate memory for message log segments");
+            return -1;
+        }
+        bases = grown;
+        base_capacity = new_capacity;
+    }
+
+    bases[base_count++] = base;
+    return 0;
+}
+
+/**
+ * @brief Orders base offsets for qsort()
+ *
+ * @param a The first offset
+ * @param b The second offset
+ * @return Negative, zero or positive as a is below, equal to or above b
+ */
+static int compare_bases(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *) a;
+    const uint64_t y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Collects the base offsets of the segments in the log directory
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int list_segments(void) {
+    DIR *dir = opendir(log_directory);
+    if (!dir) {
+        logger_log(LOG_ERROR, "Failed to open message log directory %s: %s", log_directory, strerror(errno));
+        return -1;
+    }
+
+    const struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char *end;
+        const uint64_t base = strtoull(entry->d_name, &end, 10);
+        if (end != entry->d_name + 20 || strcmp(end, ".log") != 0) {
+            continue;
+        }
+        if (push_base(base) != 0) {
+            closedir(dir);
+            return -1;
+        }
+    }
+
+    closedir(dir);
+    qsort(bases, base_count, sizeof(uint64_t), compare_bases);
+    return 0;
+}
+
+/**
+ * @brief Writes the records appended to the active segment since the last commit
+ *
+ * Must be called with log_mutex and flush_mutex held.
+ */
+static void sync_tail(void) {
+    if (!active.log || fsync_policy == MESSAGE_LOG_FSYNC_NEVER || flushed_position == active.position) {
+        return;
+    }
+
+    const size_t start = flushed_position & ~(size_t) (sysconf(_SC_PAGESIZE) - 1);
+    if (msync(active.log + start, active.position - start, MS_SYNC) != 0) {
+        logger_log(LOG_ERROR, "Failed to sync message log: %s", strerror(errno));
+    }
+    flushed_position = active.position;
+    flush_count++;
+}
+
+/**
+ * @brief Closes the full active segment and starts a new one
+ *
+ * Must be called with log_mutex held. Waits for a commit in progress.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int roll_segment(void) {
+    if (active.log) {
+        pthread_mutex_lock(&flush_mutex);
+        sync_tail();
+        close_segment(&active);
+        pthread_mutex_unlock(&flush_mutex);
+    }
+
+    flushed_position = 0;
+    if (open_segment(&active, next_offset, 1) != 0) {
+        return -1;
+    }
+
+    active.index_count = 1;
+    if (push_base(next_offset) != 0) {
+        close_segment(&active);
+        return -1;
+    }
+
+    logger_log(LOG_INFO, "Started message log segment at offset %" PRIu64, next_offset);
+    return 0;
+}
+
+/**
+ * @brief Main function of the flusher thread
+ *
+ * Commits run without log_mutex, so appends continue while the disk
+ * catches up; everything they add goes out with the next commit.
+ *
+ * @param arg Unused
+ * @return NULL
+ */
+static void *flush_thread_main(void *arg) {
+    (void) arg;
+
+    pthread_mutex_lock(&log_mutex);
+    while (!stopping) {
+        if (fsync_policy == MESSAGE_LOG_FSYNC_BATCH) {
+            while (!stopping && !flush_requested) {
+                pthread_cond_wait(&flush_cond, &log_mutex);
+            }
+        } else {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += MESSAGE_LOG_DEFAULT_INTERVAL_MS / 1000;
+            deadline.tv_nsec += (MESSAGE_LOG_DEFAULT_INTERVAL_MS % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            while (!stopping && pthread_cond_timedwait(&flush_cond, &log_mutex, &deadline) != ETIMEDOUT) {
+            }
+        }
+
+        flush_requested = 0;
+        if (stopping || !active.log || flushed_position == active.position) {
+            continue;
+        }
+
+        uint8_t *log = active.log;
+        const size_t start = flushed_position & ~(size_t) (sysconf(_SC_PAGESIZE) - 1);
+        const size_t end = active.position;
+        flushed_position = end;
+
+        pthread_mutex_lock(&flush_mutex);
+        pthread_mutex_unlock(&log_mutex);
+        if (msync(log + start, end - start, MS_SYNC) != 0) {
+            logger_log(LOG_ERROR, "Failed to sync message log: %s", strerror(errno));
+        }
+        flush_count++;
+        pthread_mutex_unlock(&flush_mutex);
+        pthread_mutex_lock(&log_mutex);
+    }
+    pthread_mutex_unlock(&log_mutex);
+
+    return NULL;
+}
+
+/**
+ * @brief Opens the log and finds where the last run left off
+ *
+ * Does nothing if no directory was configured.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int message_log_open(void) {
+    if (log_directory[0] == '\0') {
+        return 0;
+    }
+
+    if (mkdir(log_directory, 0755) != 0 && errno != EEXIST) {
+        logger_log(LOG_ERROR, "Failed to create message log directory %s: %s", log_directory, strerror(errno));
+        return -1;
+    }
+
+    pthread_mutex_lock(&log_mutex);
+    next_offset = 0;
+    if (list_segments() != 0) {
+        pthread_mutex_unlock(&log_mutex);
+        return -1;
+    }
+
+    if (base_count == 0) {
+        if (roll_segment() != 0) {
+            pthread_mutex_unlock(&log_mutex);
+            return -1;
+        }
+    } else {
+        if (open_segment(&active, bases[base_count - 1], 1) != 0) {
+            pthread_mutex_unlock(&log_mutex);
+            return -1;
+        }
+        recover_segment(&active);
+    }
+
+    flushed_position = active.position;
+    stopping = 0;
+    flush_requested = 0;
+    log_open = 1;
+
+    if (fsync_policy != MESSAGE_LOG_FSYNC_NEVER) {
+        if (pthread_create(&flush_thread, NULL, flush_thread_main, NULL) != 0) {
+            logger_log(LOG_ERROR, "Failed to start message log flusher");
+            pthread_mutex_unlock(&log_mutex);
+            message_log_close();
+            return -1;
+        }
+        flush_thread_started = 1;
+    }
+
+    logger_log(LOG_INFO, "Message log opened in %s with %d segment%s, next offset %" PRIu64 ", fsync policy: %s",
+               log_directory, base_count, base_count == 1 ? "" : "s", next_offset, fsync_names[fsync_policy]);
+    pthread_mutex_unlock(&log_mutex);
+    return 0;
+}
+
+/**
+ * @brief Commits outstanding records and closes the log
+ */
+void message_log_close(void) {
+    pthread_mutex_lock(&log_mutex);
+    stopping = 1;
+    pthread_cond_signal(&flush_cond);
+    pthread_mutex_unlock(&log_mutex);
+
+    if (flush_thread_started) {
+        pthread_join(flush_thread, NULL);
+        flush_thread_started = 0;
+    }
+
+    pthread_mutex_lock(&log_mutex);
+    if (log_open) {
+        pthread_mutex_lock(&flush_mutex);
+        sync_tail();
+        close_segment(&active);
+        pthread_mutex_unlock(&flush_mutex);
+
+        logger_log(LOG_INFO, "Message log closed at offset %" PRIu64 ": %" PRIu64 " records appended in %" PRIu64
+                   " commits", next_offset, appended_records, flush_count);
+    }
+
+    free(bases);
+    bases = NULL;
+    base_count = 0;
+    base_capacity = 0;
+    appended_records = 0;
+    flush_count = 0;
+    log_open = 0;
+    pthread_mutex_unlock(&log_mutex);
+}
+
+/**
+ * @brief Checks whether the log is open
+ *
+ * @return 1 if records are being logged, 0 otherwise
+ */
+int message_log_enabled(void) {
+    pthread_mutex_lock(&log_mutex);
+    const int enabled = log_open;
+    pthread_mutex_unlock(&log_mutex);
+    return enabled;
+}
+
+/**
+ * @brief Returns the offset the next record will get
+ *
+ * @return The offset
+ */
+uint64_t message_log_next_offset(void) {
+    pthread_mutex_lock(&log_mutex);
+    const uint64_t offset = next_offset;
+    pthread_mutex_unlock(&log_mutex);
+    return offset;
+}
+
+/**
+ * @brief Appends a record to the log
+ *
+ * The record is copied into the mapped segment; it is written to disk
+ * later according to the fsync policy. Does nothing if the log is not
+ * open.
+ *
+ * @param type Message type of the payload
+ * @param data The payload
+ * @param length Length of the payload
+ * @return 0 on success, -1 on failure
+ */
+int message_log_append(const uint32_t type, const void *data, const uint32_t length) {
+    const size_t size = record_size(length);
+
+    pthread_mutex_lock(&log_mutex);
+    if (!log_open) {
+        pthread_mutex_unlock(&log_mutex);
+        return 0;
+    }
+
+    if (size > segment_size) {
+        logger_log(LOG_ERROR, "Message log record of %u bytes does not fit in a segment", length);
+        pthread_mutex_unlock(&log_mutex);
+        return -1;
+    }
+
+    if ((!active.log || active.position + size > active.size) && roll_segment() != 0) {
+        pthread_mutex_unlock(&log_mutex);
+        return -1;
+    }
+
+    RecordHeader *header = (RecordHeader *) (active.log + active.position);
+    header->offset = next_offset;
+    header->length = length;
+    header->type = type;
+    header->reserved = 0;
+    memcpy(header + 1, data, length);
+    header->checksum = record_checksum(header, data);
+
+    if (active.index_count < active.index_capacity &&
+        active.position >= active.index_count * MESSAGE_LOG_INDEX_INTERVAL) {
+        active.index[active.index_count].relative_offset = (uint32_t) (next_offset - active.base);
+        active.index[active.index_count].position = (uint32_t) active.position;
+        active.index_count++;
+    }
+
+    active.position += size;
+    next_offset++;
+    appended_records++;
+
+    if (fsync_policy == MESSAGE_LOG_FSYNC_BATCH && !flush_requested) {
+        flush_requested = 1;
+        pthread_cond_signal(&flush_cond);
+    }
+
+    pthread_mutex_unlock(&log_mutex);
+    return 0;
+}
+
+/**
+ * @brief Reads every record from an offset on, oldest first
+ *
+ * The visitor runs with the log locked and must not append.
+ *
+ * @param from Offset of the first record to visit
+ * @param visit Called for every record
+ * @param ctx Passed to the visitor
+ * @return 0 on success, -1 on failure
+ */
+int message_log_replay(const uint64_t from, const MessageLogVisitor visit, void *ctx) {
+    pthread_mutex_lock(&log_mutex);
+    if (!log_open) {
+        pthread_mutex_unlock(&log_mutex);
+        return 0;
+    }
+
+    int first = 0;
+    for (int i = 1; i < base_count && bases[i] <= from; i++) {
+        first = i;
+    }
+
+    int result = 0;
+    for (int i = first; i < base_count; i++) {
+        uint64_t end;
+        if (bases[i] == active.base && active.log) {
+            scan_segment(&active, from, visit, ctx, &end);
+            continue;
+        }
+
+        Segment segment;
+        if (open_segment(&segment, bases[i], 0) != 0) {
+            result = -1;
+            continue;
+        }
+        madvise(segment.log, segment.size, MADV_SEQUENTIAL);
+        scan_segment(&segment, from, visit, ctx, &end);
+        close_segment(&segment);
+    }
+
+    pthread_mutex_unlock(&log_mutex);
+    return result;
+}
@@ -0,0 +1,36 @@
+#ifndef MESSAGE_LOG_H
+#define MESSAGE_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef MESSAGE_LOG_DEFAULT_SEGMENT_SIZE
+#define MESSAGE_LOG_DEFAULT_SEGMENT_SIZE (16 * 1024 * 1024)
+#endif
+
+#ifndef MESSAGE_LOG_DEFAULT_INTERVAL_MS
+#define MESSAGE_LOG_DEFAULT_INTERVAL_MS 1000
+#endif
+
+#define MESSAGE_LOG_MIN_SEGMENT_SIZE (64 * 1024)
+#define MESSAGE_LOG_INDEX_INTERVAL 4096
+
+typedef enum {
+    MESSAGE_LOG_FSYNC_BATCH = 0,
+    MESSAGE_LOG_FSYNC_INTERVAL,
+    MESSAGE_LOG_FSYNC_NEVER
+} MessageLogFsync;
+
+typedef void (*MessageLogVisitor)(uint64_t offset, uint32_t type, const void *data, uint32_t length, void *ctx);
+
+void message_log_configure(const char *directory, MessageLogFsync fsync_policy, size_t segment_size);
+int message_log_parse_fsync(const char *name, MessageLogFsync *fsync_policy);
+const char *message_log_fsync_name(MessageLogFsync fsync_policy);
+int message_log_open(void);
+void message_log_close(void);
+int message_log_enabled(void);
+uint64_t message_log_next_offset(void);
+int message_log_append(uint32_t type, const void *data, uint32_t length);
+int message_log_replay(uint64_t from, MessageLogVisitor visit, void *ctx);
+
+#endif
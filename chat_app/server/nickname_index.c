@@ -0,0 +1,284 @@
+/**
+ * @file nickname_index.c
+ * @brief Hash index of claimed nicknames
+ *
+ * This file implements an open-addressing hash table that maps each
+ * nickname in use to the ID of the client holding it. Claiming a
+ * nickname checks and reserves it in one step, so two clients can never
+ * both be granted the same name. The table has its own short-lived lock
+ * and never touches clients_mutex, so logins do not stall broadcasts.
+ *
+ * @author Jeremiah Hughes & Anthony Patton
+ * @date April 2025
+ */
+
+#include "nickname_index.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../common/logger.h"
+
+#define NICKNAME_INDEX_MIN_CAPACITY 1024
+
+typedef enum {
+    SLOT_EMPTY = 0,
+    SLOT_USED,
+    SLOT_DELETED
+} SlotState;
+
+typedef struct {
+    uint32_t hash;
+    int client_id;
+    uint8_t state;
+    char nickname[MAX_USERNAME_LEN];
+} IndexEntry;
+
+static IndexEntry *entries = NULL;
+static uint32_t capacity = 0;
+static uint32_t used_count = 0;
+static uint32_t deleted_count = 0;
+
+static pthread_mutex_t index_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Hashes a nickname with 32-bit FNV-1a
+ *
+ * @param nickname The nickname to hash
+ * @return The hash value
+ */
+static uint32_t hash_nickname(const char *nickname) {
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < MAX_USERNAME_LEN && nickname[i] != '\0'; i++) {
+        hash ^= (uint8_t) nickname[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Finds the slot holding a nickname
+ *
+ * The index_mutex must be locked before calling this function.
+ *
+ * @param nickname The nickname to find
+ * @param hash Hash of the nickname
+ * @return The matching entry, or NULL if the nickname is not claimed
+ */
+static IndexEntry *find_entry(const char *nickname, const uint32_t hash) {
+    const uint32_t mask = capacity - 1;
+
+    for (uint32_t i = hash & mask, probes = 0; probes < capacity; i = (i + 1) & mask, probes++) {
+        IndexEntry *entry = &entries[i];
+        if (entry->state == SLOT_EMPTY) {
+            return NULL;
+        }
+        if (entry->state == SLOT_USED && entry->hash == hash &&
+            strncmp(entry->nickname, nickname, MAX_USERNAME_LEN) == 0) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Rebuilds the table with a new capacity, dropping deleted slots
+ *
+ * The index_mutex must be locked before calling this function.
+ *
+ * @param new_capacity New number of slots, a power of two
+ * @return 0 on success, -1 on allocation failure
+ */
+static int rehash(const uint32_t new_capacity) {
+    IndexEntry *new_entries = calloc(new_capacity, sizeof(IndexEntry));
+    if (!new_entries) {
+        logger_log(LOG_ERROR, "Failed to allocate memory for nickname index");
+        return -1;
+    }
+
+    const uint32_t mask = new_capacity - 1;
+    for (uint32_t i = 0; i < capacity; i++) {
+        const IndexEntry *entry = &entries[i];
+        if (entry->state != SLOT_USED) {
+            continue;
+        }
+
+        uint32_t slot = entry->hash & mask;
+        while (new_entries[slot].state != SLOT_EMPTY) {
+            slot = (slot + 1) & mask;
+        }
+        new_entries[slot] = *entry;
+    }
+
+    free(entries);
+    entries = new_entries;
+    capacity = new_capacity;
+    deleted_count = 0;
+
+    return 0;
+}
+
+/**
+ * @brief Initializes the nickname index
+ *
+ * @param expected_clients Expected number of clients, used to size the table
+ * @return 0 on success, -1 on failure
+ */
+int nickname_index_init(const int expected_clients) {
+    uint32_t initial = NICKNAME_INDEX_MIN_CAPACITY;
+    while (initial < 4096 && (int) initial < expected_clients * 2) {
+        initial <<= 1;
+    }
+
+    pthread_mutex_lock(&index_mutex);
+
+    free(entries);
+    entries = calloc(initial, sizeof(IndexEntry));
+    capacity = entries ? initial : 0;
+    used_count = 0;
+    deleted_count = 0;
+
+    pthread_mutex_unlock(&index_mutex);
+
+    if (!entries) {
+        logger_log(LOG_ERROR, "Failed to allocate memory for nickname index");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Releases all memory held by the nickname index
+ */
+void nickname_index_destroy(void) {
+    pthread_mutex_lock(&index_mutex);
+
+    free(entries);
+    entries = NULL;
+    capacity = 0;
+    used_count = 0;
+    deleted_count = 0;
+
+    pthread_mutex_unlock(&index_mutex);
+}
+
+/**
+ * @brief Atomically checks and reserves a nickname for a client
+ *
+ * @param nickname The nickname to claim
+ * @param client_id ID of the client claiming it
+ * @return 0 if claimed, 1 if the nickname is already held, -1 on failure
+ */
+int nickname_index_claim(const char *nickname, const int client_id) {
+    const uint32_t hash = hash_nickname(nickname);
+
+    pthread_mutex_lock(&index_mutex);
+
+    if (!entries) {
+        pthread_mutex_unlock(&index_mutex);
+        return -1;
+    }
+
+    if (find_entry(nickname, hash)) {
+        pthread_mutex_unlock(&index_mutex);
+        return 1;
+    }
+
+    if ((used_count + deleted_count + 1) * 2 > capacity) {
+        const uint32_t new_capacity = (used_count + 1) * 4 > capacity ? capacity * 2 : capacity;
+        if (rehash(new_capacity) != 0) {
+            pthread_mutex_unlock(&index_mutex);
+            return -1;
+        }
+    }
+
+    const uint32_t mask = capacity - 1;
+    uint32_t slot = hash & mask;
+    while (entries[slot].state == SLOT_USED) {
+        slot = (slot + 1) & mask;
+    }
+
+    IndexEntry *entry = &entries[slot];
+    if (entry->state == SLOT_DELETED) {
+        deleted_count--;
+    }
+
+    entry->hash = hash;
+    entry->client_id = client_id;
+    entry->state = SLOT_USED;
+    strncpy(entry->nickname, nickname, MAX_USERNAME_LEN - 1);
+    entry->nickname[MAX_USERNAME_LEN - 1] = '\0';
+    used_count++;
+
+    pthread_mutex_unlock(&index_mutex);
+    return 0;
+}
+
+/**
+ * @brief Releases a nickname held by a client
+ *
+ * Nothing happens if the nickname is held by a different client.
+ *
+ * @param nickname The nickname to release
+ * @param client_id ID of the client releasing it
+ * @return 0 if released, -1 if the client did not hold the nickname
+ */
+int nickname_index_release(const char *nickname, const int client_id) {
+    const uint32_t hash = hash_nickname(nickname);
+    int result = -1;
+
+    pthread_mutex_lock(&index_mutex);
+
+    if (entries) {
+        IndexEntry *entry = find_entry(nickname, hash);
+        if (entry && entry->client_id == client_id) {
+            entry->state = SLOT_DELETED;
+            used_count--;
+            deleted_count++;
+            result = 0;
+        }
+    }
+
+    pthread_mutex_unlock(&index_mutex);
+    return result;
+}
+
+/**
+ * @brief Looks up the client holding a nickname
+ *
+ * @param nickname The nickname to look up
+ * @return ID of the client holding the nickname, or -1 if it is free
+ */
+int nickname_index_lookup(const char *nickname) {
+    const uint32_t hash = hash_nickname(nickname);
+    int client_id = -1;
+
+    pthread_mutex_lock(&index_mutex);
+
+    if (entries) {
+        const IndexEntry *entry = find_entry(nickname, hash);
+        if (entry) {
+            client_id = entry->client_id;
+        }
+    }
+
+    pthread_mutex_unlock(&index_mutex);
+    return client_id;
+}
+
+/**
+ * @brief Returns the number of claimed nicknames
+ *
+ * @return The number of nicknames in the index
+ */
+int nickname_index_count(void) {
+    pthread_mutex_lock(&index_mutex);
+    const int count = (int) used_count;
+    pthread_mutex_unlock(&index_mutex);
+    return count;
+}
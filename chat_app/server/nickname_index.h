@@ -0,0 +1,13 @@
+#ifndef NICKNAME_INDEX_H
+#define NICKNAME_INDEX_H
+
+#include "../common/protocol.h"
+
+int nickname_index_init(int expected_clients);
+void nickname_index_destroy(void);
+int nickname_index_claim(const char *nickname, int client_id);
+int nickname_index_release(const char *nickname, int client_id);
+int nickname_index_lookup(const char *nickname);
+int nickname_index_count(void);
+
+#endif
@@ -0,0 +1,1019 @@
+/**
+ * @file outbound_queue.c
+ * @brief Per-connection queue of frames waiting to be sent
+ *
+ * Any thread may push frames onto a client's queue; only the event loop
+ * that owns the client writes them to the socket, using non-blocking
+ * sends and resuming from where it left off when the socket becomes
+ * writable again. Everything queued for a socket is gathered into one
+ * sendmsg() call, up to a configurable batch size, so a burst of replies
+ * and broadcasts costs a single syscall. The queue holds a reference to every frame, so one
+ * encoded broadcast frame can sit in many queues at once.
+ *
+ * An event loop that sends asynchronously instead prepares the same
+ * batches as sends that carry their own frame references, and reports
+ * each one back when it completes. Frames that are being sent are never
+ * dropped or coalesced.
+ *
+ * Batches of at least the zero-copy threshold can be sent with
+ * MSG_ZEROCOPY, so the kernel transmits straight from the shared frame
+ * buffers instead of copying them once per recipient. Such a send keeps
+ * its frame references until the kernel reports on the socket's error
+ * queue that it no longer needs the pages; notifications are expected in
+ * send order, as TCP delivers them.
+ *
+ * Each queue is bounded by a high-water mark on its unsent bytes. When a
+ * push would cross it, the configured slow-consumer policy decides
+ * whether the client is disconnected or its oldest frames are dropped.
+ *
+ * User lists and rosters are snapshots sent as a set of pages, tagged
+ * with the snapshot they belong to and their place in it. Their pages
+ * are exempt from the high-water mark and are never dropped one by one;
+ * instead, a new snapshot replaces the whole sets of older ones still
+ * waiting in the queue, and a new roster also replaces the roster deltas
+ * queued before it. This happens under either policy.
+ *
+ * @author Jeremiah Hughes & Anthony Patton
+ * @date April 2025
+ */
+
+#include "outbound_queue.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "../common/logger.h"
+
+#define OUTBOUND_QUEUE_INITIAL_CAPACITY 8
+
+typedef struct {
+    OutboundSend *free_list;
+    uint32_t cached;
+    int registered;
+} SendCache;
+
+static size_t high_water_bytes = OUTBOUND_QUEUE_DEFAULT_HIGH_WATER;
+static OutboundPolicy overflow_policy = OUTBOUND_POLICY_DISCONNECT;
+static size_t max_batch_bytes = OUTBOUND_QUEUE_DEFAULT_MAX_BATCH;
+static size_t zerocopy_threshold = 0;
+static atomic_size_t total_backlog = 0;
+static atomic_uint_fast64_t stat_syscalls = 0;
+static atomic_uint_fast64_t stat_frames = 0;
+static atomic_uint_fast64_t stat_bytes = 0;
+static atomic_uint_fast64_t stat_zerocopy_sends = 0;
+static atomic_uint_fast64_t stat_zerocopy_bytes = 0;
+static atomic_uint_fast64_t stat_zerocopy_copied = 0;
+static atomic_uint_fast64_t stat_send_allocations = 0;
+static _Thread_local SendCache send_cache;
+static pthread_key_t send_cache_key;
+static pthread_once_t send_cache_once = PTHREAD_ONCE_INIT;
+
+static const char *policy_names[] = {
+    [OUTBOUND_POLICY_DISCONNECT] = "disconnect",
+    [OUTBOUND_POLICY_DROP_OLDEST] = "drop-oldest"
+};
+
+/**
+ * @brief Sets the high-water mark, slow-consumer policy and batch size
+ *
+ * Must be called before any client connects.
+ *
+ * @param high_water Maximum number of unsent bytes a queue may hold
+ * @param policy What to do when a push would exceed the high-water mark
+ * @param max_batch Maximum number of bytes handed to a single sendmsg()
+ */
+void outbound_queue_configure(const size_t high_water, const OutboundPolicy policy, const size_t max_batch) {
+    high_water_bytes = high_water;
+    overflow_policy = policy;
+    max_batch_bytes = max_batch;
+}
+
+/**
+ * @brief Sets the smallest batch that is sent without copying
+ *
+ * Must be called before any client connects.
+ *
+ * @param threshold Minimum batch size in bytes, or 0 to always copy
+ */
+void outbound_queue_configure_zerocopy(const size_t threshold) {
+    zerocopy_threshold = threshold;
+}
+
+/**
+ * @brief Returns the smallest batch that is sent without copying
+ *
+ * @return The threshold in bytes, or 0 if zero-copy sends are disabled
+ */
+size_t outbound_queue_zerocopy_threshold(void) {
+    return zerocopy_threshold;
+}
+
+/**
+ * @brief Parses a slow-consumer policy name
+ *
+ * @param name Either "disconnect" or "drop-oldest"
+ * @param policy Receives the parsed policy
+ * @return 0 on success, -1 if the name is not recognised
+ */
+int outbound_queue_parse_policy(const char *name, OutboundPolicy *policy) {
+    for (size_t i = 0; i < sizeof(policy_names) / sizeof(policy_names[0]); i++) {
+        if (strcmp(name, policy_names[i]) == 0) {
+            *policy = (OutboundPolicy) i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Returns the name of a slow-consumer policy
+ *
+ * @param policy The policy
+ * @return The policy name
+ */
+const char *outbound_queue_policy_name(const OutboundPolicy policy) {
+    return policy_names[policy];
+}
+
+/**
+ * @brief Initializes an empty outbound queue
+ *
+ * @param queue The queue to initialize
+ * @return 0 on success, -1 on failure
+ */
+int outbound_queue_init(OutboundQueue *queue) {
+    memset(queue, 0, sizeof(*queue));
+
+    if (pthread_mutex_init(&queue->lock, NULL) != 0) {
+        logger_log(LOG_ERROR, "Failed to initialize outbound queue lock");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Lets a queue send large batches without copying them
+ *
+ * Does nothing while zero-copy sends are disabled. A socket that does
+ * not support them keeps using ordinary sends.
+ *
+ * @param queue The queue
+ * @param socket The client socket
+ * @return 0 on success, -1 if the socket refused zero-copy sends
+ */
+int outbound_queue_enable_zerocopy(OutboundQueue *queue, const int socket) {
+    if (zerocopy_threshold == 0) {
+        return 0;
+    }
+
+    const int one = 1;
+    if (setsockopt(socket, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) != 0) {
+        logger_log(LOG_WARNING, "Outbound queue: failed to enable zero-copy sends: %s", strerror(errno));
+        return -1;
+    }
+
+    queue->zerocopy = 1;
+    return 0;
+}
+
+/**
+ * @brief Drops all queued frames and releases the queue's memory
+ *
+ * Zero-copy sends still waiting for their notification are released
+ * too; the socket is about to be closed, so their data no longer matters.
+ *
+ * @param queue The queue to destroy
+ */
+void outbound_queue_destroy(OutboundQueue *queue) {
+    outbound_queue_clear(queue);
+    while (queue->zerocopy_head) {
+        OutboundSend *send = queue->zerocopy_head;
+        queue->zerocopy_head = send->next;
+        outbound_queue_free_send(send);
+    }
+    queue->zerocopy_tail = NULL;
+    free(queue->frames);
+    queue->frames = NULL;
+    queue->capacity = 0;
+    pthread_mutex_destroy(&queue->lock);
+}
+
+/**
+ * @brief Grows the frame ring, keeping queued frames in order
+ *
+ * The queue lock must be held by the caller.
+ *
+ * @param queue The queue to grow
+ * @return 0 on success, -1 on allocation failure
+ */
+static int grow(OutboundQueue *queue) {
+    const uint32_t new_capacity = queue->capacity ? queue->capacity * 2 : OUTBOUND_QUEUE_INITIAL_CAPACITY;
+    Frame **frames = malloc(new_capacity * sizeof(Frame *));
+    if (!frames) {
+        logger_log(LOG_ERROR, "Failed to allocate memory for outbound queue");
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < queue->count; i++) {
+        frames[i] = queue->frames[(queue->head + i) % queue->capacity];
+    }
+
+    free(queue->frames);
+    queue->frames = frames;
+    queue->capacity = new_capacity;
+    queue->head = 0;
+
+    return 0;
+}
+
+/**
+ * @brief Adjusts a queue's backlog and the server-wide total
+ *
+ * The queue lock must be held by the caller.
+ *
+ * @param queue The queue
+ * @param added Bytes added to the backlog
+ * @param removed Bytes removed from the backlog
+ */
+static void account_backlog(OutboundQueue *queue, const size_t added, const size_t removed) {
+    queue->bytes = queue->bytes + added - removed;
+    if (added) {
+        atomic_fetch_add_explicit(&total_backlog, added, memory_order_relaxed);
+    }
+    if (removed) {
+        atomic_fetch_sub_explicit(&total_backlog, removed, memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Returns the position of the first frame that may be dropped
+ *
+ * A frame that has been partly written, or is being sent, must be
+ * finished, or the stream would be corrupted.
+ *
+ * @param queue The queue
+ * @return Number of frames at the head that are partly written or being sent
+ */
+static uint32_t first_droppable(const OutboundQueue *queue) {
+    uint32_t kept = queue->head_offset > 0 ? 1 : 0;
+    size_t covered = queue->in_flight;
+
+    for (uint32_t i = 0; covered > 0 && i < queue->count; i++) {
+        const Frame *frame = queue->frames[(queue->head + i) % queue->capacity];
+        const size_t remaining = frame->length - (i == 0 ? queue->head_offset : 0);
+        covered = covered > remaining ? covered - remaining : 0;
+        kept = i + 1;
+    }
+
+    return kept;
+}
+
+/**
+ * @brief Removes a queued frame and accounts for its bytes
+ *
+ * The queue lock must be held by the caller, and the frame must not be
+ * partly written or being sent.
+ *
+ * @param queue The queue
+ * @param frame The frame
+ */
+static void drop_frame(OutboundQueue *queue, Frame *frame) {
+    account_backlog(queue, 0, frame->length);
+    if (frame->snapshot) {
+        queue->snapshot_bytes -= frame->length;
+    }
+    queue->dropped_frames++;
+    frame_unref(frame);
+}
+
+/**
+ * @brief Checks whether a queued frame is made obsolete by a new snapshot
+ *
+ * Called for the first page of a snapshot. Every user list queued before
+ * it is older, as is every roster and roster delta queued before a new
+ * roster.
+ *
+ * @param queued The frame already in the queue
+ * @param frame The first page of the new snapshot
+ * @return 1 if the queued frame can be dropped, 0 otherwise
+ */
+static int is_superseded(const Frame *queued, const Frame *frame) {
+    if (frame->type == MSG_ROSTER && queued->type == MSG_ROSTER_DELTA) {
+        return 1;
+    }
+
+    return queued->type == frame->type && queued->snapshot != 0;
+}
+
+/**
+ * @brief Checks whether part of a snapshot must still be sent
+ *
+ * @param queue The queue
+ * @param kept Number of frames at the head that cannot be dropped
+ * @param frame A page of the snapshot
+ * @return 1 if one of the snapshot's pages is among the kept frames
+ */
+static int is_pinned(const OutboundQueue *queue, const uint32_t kept, const Frame *frame) {
+    for (uint32_t i = 0; i < kept; i++) {
+        const Frame *queued = queue->frames[(queue->head + i) % queue->capacity];
+        if (queued->snapshot == frame->snapshot && queued->type == frame->type) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Removes the queued snapshots a new snapshot supersedes
+ *
+ * Snapshots are removed as whole sets of pages: one that has started
+ * going out is kept in full, so the client never sees a torn list. The
+ * queue lock must be held by the caller.
+ *
+ * @param queue The queue
+ * @param frame The first page of the new snapshot
+ */
+static void coalesce_snapshots(OutboundQueue *queue, const Frame *frame) {
+    const uint32_t start = first_droppable(queue);
+    uint32_t kept = start;
+
+    for (uint32_t i = start; i < queue->count; i++) {
+        Frame *queued = queue->frames[(queue->head + i) % queue->capacity];
+        if (is_superseded(queued, frame) && !(queued->snapshot && is_pinned(queue, start, queued))) {
+            drop_frame(queue, queued);
+            continue;
+        }
+        queue->frames[(queue->head + kept) % queue->capacity] = queued;
+        kept++;
+    }
+
+    queue->count = kept;
+}
+
+/**
+ * @brief Returns the backlog that counts against the high-water mark
+ *
+ * The queue lock must be held by the caller.
+ *
+ * @param queue The queue
+ * @return Unsent bytes outside snapshot pages
+ */
+static size_t limited_bytes(const OutboundQueue *queue) {
+    return queue->bytes > queue->snapshot_bytes ? queue->bytes - queue->snapshot_bytes : 0;
+}
+
+/**
+ * @brief Drops the oldest unsent frames until an incoming frame fits
+ *
+ * Snapshot pages are left in place; they do not count against the
+ * high-water mark, and dropping one would tear its snapshot. The queue
+ * lock must be held by the caller.
+ *
+ * @param queue The queue
+ * @param incoming Size of the frame about to be pushed
+ */
+static void drop_oldest(OutboundQueue *queue, const size_t incoming) {
+    const uint32_t start = first_droppable(queue);
+    uint32_t kept = start;
+
+    for (uint32_t i = start; i < queue->count; i++) {
+        Frame *queued = queue->frames[(queue->head + i) % queue->capacity];
+        if (!queued->snapshot && limited_bytes(queue) + incoming > high_water_bytes) {
+            drop_frame(queue, queued);
+            continue;
+        }
+        queue->frames[(queue->head + kept) % queue->capacity] = queued;
+        kept++;
+    }
+
+    queue->count = kept;
+}
+
+/**
+ * @brief Appends a frame to the queue
+ *
+ * The queue takes its own reference to the frame. If the frame would
+ * push the backlog past the high-water mark, the slow-consumer policy is
+ * applied first. An empty queue always accepts one frame.
+ *
+ * Snapshot pages are always accepted and do not count against the mark,
+ * so a snapshot larger than the mark still reaches a client that keeps
+ * up. The first page of a snapshot replaces the older snapshots still
+ * queued, whatever the policy, which bounds what a client can hold.
+ *
+ * @param queue The queue to append to
+ * @param frame The frame to send
+ * @return 1 if the caller must schedule a flush, 0 if one is already
+ *         scheduled, -1 on failure
+ */
+int outbound_queue_push(OutboundQueue *queue, Frame *frame) {
+    pthread_mutex_lock(&queue->lock);
+
+    if (queue->overflowed) {
+        queue->dropped_frames++;
+        pthread_mutex_unlock(&queue->lock);
+        return 0;
+    }
+
+    if (frame->snapshot) {
+        if (frame->page == 0) {
+            coalesce_snapshots(queue, frame);
+        }
+    } else if (limited_bytes(queue) > 0 && limited_bytes(queue) + frame->length > high_water_bytes) {
+        switch (overflow_policy) {
+            case OUTBOUND_POLICY_DISCONNECT: {
+                queue->overflowed = 1;
+                queue->dropped_frames++;
+
+                const int schedule = !queue->flush_scheduled;
+                queue->flush_scheduled = 1;
+
+                pthread_mutex_unlock(&queue->lock);
+                return schedule;
+            }
+            case OUTBOUND_POLICY_DROP_OLDEST:
+                drop_oldest(queue, frame->length);
+                break;
+        }
+    }
+
+    if (queue->count == queue->capacity && grow(queue) != 0) {
+        pthread_mutex_unlock(&queue->lock);
+        return -1;
+    }
+
+    queue->frames[(queue->head + queue->count) % queue->capacity] = frame_ref(frame);
+    queue->count++;
+    account_backlog(queue, frame->length, 0);
+    if (frame->snapshot) {
+        queue->snapshot_bytes += frame->length;
+    }
+
+    const int schedule = !queue->flush_scheduled;
+    queue->flush_scheduled = 1;
+
+    pthread_mutex_unlock(&queue->lock);
+    return schedule;
+}
+
+/**
+ * @brief Gathers the unsent part of the queue into an I/O vector
+ *
+ * Takes frames from the given position on until the vector is full or
+ * the next frame would exceed the batch size. The first frame is always
+ * taken, however large. The queue lock must be held by the caller.
+ *
+ * @param queue The queue
+ * @param skip Number of unsent bytes to leave out at the head
+ * @param iov Array of OUTBOUND_QUEUE_MAX_IOV entries to fill
+ * @param frames Array of OUTBOUND_QUEUE_MAX_IOV entries that receive a
+ *        reference to each frame gathered, or NULL
+ * @return The number of entries used
+ */
+static size_t gather(const OutboundQueue *queue, size_t skip, struct iovec *iov, Frame **frames) {
+    size_t used = 0;
+    size_t bytes = 0;
+
+    for (uint32_t i = 0; i < queue->count && used < OUTBOUND_QUEUE_MAX_IOV; i++) {
+        Frame *frame = queue->frames[(queue->head + i) % queue->capacity];
+        uint32_t offset = i == 0 ? queue->head_offset : 0;
+        size_t length = frame->length - offset;
+
+        if (skip >= length) {
+            skip -= length;
+            continue;
+        }
+        offset += (uint32_t) skip;
+        length -= skip;
+        skip = 0;
+
+        if (used > 0 && bytes + length > max_batch_bytes) {
+            break;
+        }
+
+        iov[used].iov_base = frame->data + offset;
+        iov[used].iov_len = length;
+        if (frames) {
+            frames[used] = frame_ref(frame);
+        }
+        used++;
+        bytes += length;
+    }
+
+    return used;
+}
+
+/**
+ * @brief Releases the frames covered by a completed write
+ *
+ * A frame that was only partly written stays at the head of the queue
+ * and the write resumes from the recorded offset. The queue lock must be
+ * held by the caller.
+ *
+ * @param queue The queue
+ * @param sent Number of bytes the socket accepted
+ * @return The number of frames written in full
+ */
+static uint32_t consume(OutboundQueue *queue, size_t sent) {
+    uint32_t completed = 0;
+
+    while (sent > 0) {
+        Frame *frame = queue->frames[queue->head];
+        const size_t remaining = frame->length - queue->head_offset;
+
+        if (sent < remaining) {
+            queue->head_offset += (uint32_t) sent;
+            break;
+        }
+
+        sent -= remaining;
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        queue->head_offset = 0;
+        if (frame->snapshot) {
+            queue->snapshot_bytes -= frame->length;
+        }
+        frame_unref(frame);
+        completed++;
+    }
+
+    return completed;
+}
+
+/**
+ * @brief Sends the head of the queue with MSG_ZEROCOPY
+ *
+ * The batch keeps references to its frames until the kernel's
+ * notification for it is reaped. If the socket is out of memory for
+ * notifications, the batch is sent with an ordinary copy instead. The
+ * queue lock must be held by the caller.
+ *
+ * @param queue The queue
+ * @param socket The client socket
+ * @param iov The batch as gathered by the caller
+ * @param entries Number of entries in the batch
+ * @return Number of bytes sent, or -1 with errno set
+ */
+static ssize_t send_zerocopy(OutboundQueue *queue, const int socket, struct iovec *iov, const size_t entries) {
+    struct msghdr msg = {0};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = entries;
+
+    OutboundSend *send = outbound_queue_alloc_send();
+    if (!send) {
+        return sendmsg(socket, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+
+    send->count = (uint32_t) gather(queue, 0, send->iov, send->frames);
+
+    const ssize_t sent = sendmsg(socket, &msg, MSG_DONTWAIT | MSG_NOSIGNAL | MSG_ZEROCOPY);
+    if (sent < 0) {
+        outbound_queue_free_send(send);
+        if (errno == ENOBUFS) {
+            return sendmsg(socket, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        }
+        return -1;
+    }
+
+    send->bytes = (size_t) sent;
+    send->sequence = queue->zerocopy_next++;
+    if (queue->zerocopy_tail) {
+        queue->zerocopy_tail->next = send;
+    } else {
+        queue->zerocopy_head = send;
+    }
+    queue->zerocopy_tail = send;
+
+    return sent;
+}
+
+/**
+ * @brief Writes as much of the queue to a socket as it will accept
+ *
+ * Queued frames are written with as few sendmsg() calls as the batch
+ * size allows, and sends never block. If the socket fills up, the flush stays scheduled
+ * and must be resumed once the socket is writable again; pushes made in
+ * the meantime do not schedule another flush. Only the event loop that
+ * owns the connection may call this.
+ *
+ * @param queue The queue to flush
+ * @param socket The client socket
+ * @return OUTBOUND_FLUSH_DONE when the queue is empty,
+ *         OUTBOUND_FLUSH_BLOCKED when the socket is full,
+ *         OUTBOUND_FLUSH_OVERFLOW when the client exceeded the high-water
+ *         mark under the disconnect policy, or OUTBOUND_FLUSH_ERROR
+ */
+OutboundFlushResult outbound_queue_flush(OutboundQueue *queue, const int socket) {
+    OutboundFlushResult result = OUTBOUND_FLUSH_DONE;
+
+    pthread_mutex_lock(&queue->lock);
+
+    if (queue->overflowed) {
+        pthread_mutex_unlock(&queue->lock);
+        return OUTBOUND_FLUSH_OVERFLOW;
+    }
+
+    while (queue->count > 0) {
+        struct iovec iov[OUTBOUND_QUEUE_MAX_IOV];
+        const size_t entries = gather(queue, 0, iov, NULL);
+        size_t batch = 0;
+        for (size_t i = 0; i < entries; i++) {
+            batch += iov[i].iov_len;
+        }
+
+        ssize_t sent;
+        if (queue->zerocopy && batch >= zerocopy_threshold) {
+            sent = send_zerocopy(queue, socket, iov, entries);
+        } else {
+            struct msghdr msg = {0};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = entries;
+            sent = sendmsg(socket, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        }
+
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                result = OUTBOUND_FLUSH_BLOCKED;
+            } else {
+                logger_log(LOG_WARNING, "Outbound queue: sendmsg() failed: %s", strerror(errno));
+                result = OUTBOUND_FLUSH_ERROR;
+            }
+            break;
+        }
+
+        account_backlog(queue, 0, (size_t) sent);
+        const uint32_t completed = consume(queue, (size_t) sent);
+
+        atomic_fetch_add_explicit(&stat_syscalls, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stat_frames, completed, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stat_bytes, (uint64_t) sent, memory_order_relaxed);
+    }
+
+    if (queue->count == 0) {
+        queue->flush_scheduled = 0;
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+    return result;
+}
+
+/**
+ * @brief Prepares the next batch of the queue for an asynchronous send
+ *
+ * The batch starts after everything already being sent and holds its
+ * own references to its frames, so it stays valid if the queue is
+ * cleared before the send completes. Only the event loop that owns the
+ * connection may call this.
+ *
+ * @param queue The queue
+ * @param send Receives the batch, ready to be passed to sendmsg()
+ * @return OUTBOUND_FLUSH_BLOCKED when a batch was prepared,
+ *         OUTBOUND_FLUSH_DONE when everything queued is already being sent,
+ *         or OUTBOUND_FLUSH_OVERFLOW when the client exceeded the
+ *         high-water mark under the disconnect policy
+ */
+OutboundFlushResult outbound_queue_prepare(OutboundQueue *queue, OutboundSend *send) {
+    pthread_mutex_lock(&queue->lock);
+
+    if (queue->overflowed) {
+        pthread_mutex_unlock(&queue->lock);
+        return OUTBOUND_FLUSH_OVERFLOW;
+    }
+
+    send->count = (uint32_t) gather(queue, queue->in_flight, send->iov, send->frames);
+    send->bytes = 0;
+    for (uint32_t i = 0; i < send->count; i++) {
+        send->bytes += send->iov[i].iov_len;
+    }
+
+    if (send->count == 0) {
+        if (queue->in_flight == 0) {
+            queue->flush_scheduled = 0;
+        }
+        pthread_mutex_unlock(&queue->lock);
+        return OUTBOUND_FLUSH_DONE;
+    }
+
+    queue->in_flight += send->bytes;
+    pthread_mutex_unlock(&queue->lock);
+
+    memset(&send->msg, 0, sizeof(send->msg));
+    send->msg.msg_iov = send->iov;
+    send->msg.msg_iovlen = send->count;
+    return OUTBOUND_FLUSH_BLOCKED;
+}
+
+/**
+ * @brief Records the result of a send prepared by outbound_queue_prepare()
+ *
+ * Sends must be completed in the order they were prepared. A send that
+ * was cut short leaves the rest of its batch at the head of the queue.
+ *
+ * @param queue The queue
+ * @param sent Number of bytes the socket accepted
+ * @param prepared Size of the prepared batch
+ * @return 1 if the queue still holds unsent frames, 0 otherwise
+ */
+int outbound_queue_complete(OutboundQueue *queue, const size_t sent, const size_t prepared) {
+    pthread_mutex_lock(&queue->lock);
+
+    account_backlog(queue, 0, sent);
+    const uint32_t completed = consume(queue, sent);
+    queue->in_flight -= prepared;
+
+    atomic_fetch_add_explicit(&stat_syscalls, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stat_frames, completed, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stat_bytes, (uint64_t) sent, memory_order_relaxed);
+
+    const int more = queue->count > 0;
+    if (!more && queue->in_flight == 0) {
+        queue->flush_scheduled = 0;
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+    return more;
+}
+
+/**
+ * @brief Drops the frame references held by a prepared send
+ *
+ * @param send The send
+ */
+void outbound_queue_release_send(OutboundSend *send) {
+    for (uint32_t i = 0; i < send->count; i++) {
+        frame_unref(send->frames[i]);
+    }
+    send->count = 0;
+}
+
+/**
+ * @brief Frees the sends in a thread's cache
+ *
+ * Runs when a thread that cached sends exits.
+ *
+ * @param arg The thread's SendCache
+ */
+static void send_cache_release(void *arg) {
+    SendCache *cache = arg;
+
+    while (cache->free_list) {
+        OutboundSend *send = cache->free_list;
+        cache->free_list = send->next;
+        free(send);
+    }
+    cache->cached = 0;
+}
+
+/**
+ * @brief Creates the key whose destructor empties a thread's send cache
+ */
+static void send_cache_key_create(void) {
+    pthread_key_create(&send_cache_key, send_cache_release);
+}
+
+/**
+ * @brief Takes an empty send from the calling thread's cache
+ *
+ * A send is only allocated when the cache is empty, so an event loop
+ * that keeps a steady number of sends in flight stops allocating once
+ * it has warmed up.
+ *
+ * @return The send, or NULL on allocation failure
+ */
+OutboundSend *outbound_queue_alloc_send(void) {
+    OutboundSend *send = send_cache.free_list;
+
+    if (send) {
+        send_cache.free_list = send->next;
+        send_cache.cached--;
+    } else {
+        send = malloc(sizeof(OutboundSend));
+        if (!send) {
+            return NULL;
+        }
+        atomic_fetch_add_explicit(&stat_send_allocations, 1, memory_order_relaxed);
+    }
+
+    send->count = 0;
+    send->next = NULL;
+    return send;
+}
+
+/**
+ * @brief Releases a send's frames and returns it to the calling thread's cache
+ *
+ * Sends beyond OUTBOUND_QUEUE_SEND_CACHE are freed.
+ *
+ * @param send The send
+ */
+void outbound_queue_free_send(OutboundSend *send) {
+    outbound_queue_release_send(send);
+
+    if (send_cache.cached >= OUTBOUND_QUEUE_SEND_CACHE) {
+        free(send);
+        return;
+    }
+
+    if (!send_cache.registered) {
+        pthread_once(&send_cache_once, send_cache_key_create);
+        pthread_setspecific(send_cache_key, &send_cache);
+        send_cache.registered = 1;
+    }
+
+    send->next = send_cache.free_list;
+    send_cache.free_list = send;
+    send_cache.cached++;
+}
+
+/**
+ * @brief Frees the sends cached by the calling thread
+ *
+ * For the main thread at shutdown; other threads empty their caches
+ * when they exit.
+ */
+void outbound_queue_shutdown(void) {
+    send_cache_release(&send_cache);
+}
+
+/**
+ * @brief Counts a zero-copy send whose buffers the kernel released
+ *
+ * @param send The send
+ * @param copied Non-zero if the kernel fell back to copying the data
+ */
+void outbound_queue_zerocopy_done(const OutboundSend *send, const int copied) {
+    atomic_fetch_add_explicit(&stat_zerocopy_sends, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(copied ? &stat_zerocopy_copied : &stat_zerocopy_bytes, (uint64_t) send->bytes,
+                              memory_order_relaxed);
+}
+
+/**
+ * @brief Releases the zero-copy sends the kernel reported as finished
+ *
+ * Only the event loop that owns the connection may call this, normally
+ * when epoll reports an error condition on the socket.
+ *
+ * @param queue The queue
+ * @param socket The client socket
+ * @return Number of notifications reaped, or -1 if the error queue held
+ *         a real socket error
+ */
+int outbound_queue_reap_zerocopy(OutboundQueue *queue, const int socket) {
+    int reaped = 0;
+
+    for (;;) {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+        struct msghdr msg = {0};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(socket, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? reaped : -1;
+        }
+
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+                !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+
+            struct sock_extended_err err;
+            memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+            if (err.ee_origin != SO_EE_ORIGIN_ZEROCOPY || err.ee_errno != 0) {
+                return -1;
+            }
+
+            const int copied = (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0;
+
+            pthread_mutex_lock(&queue->lock);
+            while (queue->zerocopy_head && (int32_t) (queue->zerocopy_head->sequence - err.ee_data) <= 0) {
+                OutboundSend *send = queue->zerocopy_head;
+                queue->zerocopy_head = send->next;
+                outbound_queue_zerocopy_done(send, copied);
+                outbound_queue_free_send(send);
+            }
+            if (!queue->zerocopy_head) {
+                queue->zerocopy_tail = NULL;
+            }
+            pthread_mutex_unlock(&queue->lock);
+
+            reaped++;
+        }
+    }
+}
+
+/**
+ * @brief Drops every queued frame
+ *
+ * @param queue The queue to clear
+ */
+void outbound_queue_clear(OutboundQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+
+    while (queue->count > 0) {
+        frame_unref(queue->frames[queue->head]);
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+    }
+
+    account_backlog(queue, 0, queue->bytes);
+    queue->snapshot_bytes = 0;
+    queue->head = 0;
+    queue->head_offset = 0;
+    queue->in_flight = 0;
+    queue->flush_scheduled = 0;
+    queue->overflowed = 0;
+
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * @brief Frees the frame ring of a queue that has nothing left to send
+ *
+ * The ring is allocated again by the next push.
+ *
+ * @param queue The queue
+ * @return Number of bytes released
+ */
+size_t outbound_queue_trim(OutboundQueue *queue) {
+    size_t released = 0;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count == 0 && queue->in_flight == 0 && queue->frames) {
+        released = queue->capacity * sizeof(Frame *);
+        free(queue->frames);
+        queue->frames = NULL;
+        queue->capacity = 0;
+        queue->head = 0;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return released;
+}
+
+/**
+ * @brief Returns the memory a queue holds besides its queued frames
+ *
+ * @param queue The queue
+ * @return Size of the frame ring in bytes
+ */
+size_t outbound_queue_footprint(OutboundQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    const size_t bytes = queue->capacity * sizeof(Frame *);
+    pthread_mutex_unlock(&queue->lock);
+    return bytes;
+}
+
+/**
+ * @brief Returns the number of unsent bytes in a queue
+ *
+ * @param queue The queue
+ * @return The queue's backlog in bytes
+ */
+size_t outbound_queue_backlog_bytes(OutboundQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    const size_t bytes = queue->bytes;
+    pthread_mutex_unlock(&queue->lock);
+    return bytes;
+}
+
+/**
+ * @brief Returns the number of unsent bytes across all queues
+ *
+ * @return The server-wide backlog in bytes
+ */
+size_t outbound_queue_total_backlog_bytes(void) {
+    return atomic_load_explicit(&total_backlog, memory_order_relaxed);
+}
+
+/**
+ * @brief Reports how well outbound writes have been batched
+ *
+ * @param stats Receives the number of sendmsg() calls made, the frames
+ *        they completed and the bytes they wrote, across all queues, how
+ *        many bytes zero-copy sends moved without and with a copy, and
+ *        how many sends had to be allocated rather than reused
+ */
+void outbound_queue_stats(OutboundStats *stats) {
+    stats->syscalls = atomic_load_explicit(&stat_syscalls, memory_order_relaxed);
+    stats->frames = atomic_load_explicit(&stat_frames, memory_order_relaxed);
+    stats->bytes = atomic_load_explicit(&stat_bytes, memory_order_relaxed);
+    stats->zerocopy_sends = atomic_load_explicit(&stat_zerocopy_sends, memory_order_relaxed);
+    stats->zerocopy_bytes = atomic_load_explicit(&stat_zerocopy_bytes, memory_order_relaxed);
+    stats->zerocopy_copied_bytes = atomic_load_explicit(&stat_zerocopy_copied, memory_order_relaxed);
+    stats->send_allocations = atomic_load_explicit(&stat_send_allocations, memory_order_relaxed);
+}
@@ -0,0 +1,103 @@
+#ifndef OUTBOUND_QUEUE_H
+#define OUTBOUND_QUEUE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "../common/frame.h"
+
+#ifndef OUTBOUND_QUEUE_DEFAULT_HIGH_WATER
+#define OUTBOUND_QUEUE_DEFAULT_HIGH_WATER (256 * 1024)
+#endif
+
+#ifndef OUTBOUND_QUEUE_DEFAULT_MAX_BATCH
+#define OUTBOUND_QUEUE_DEFAULT_MAX_BATCH (64 * 1024)
+#endif
+
+#ifndef OUTBOUND_QUEUE_SEND_CACHE
+#define OUTBOUND_QUEUE_SEND_CACHE 256
+#endif
+
+#define OUTBOUND_QUEUE_MAX_IOV 64
+
+typedef enum {
+    OUTBOUND_POLICY_DISCONNECT = 0,
+    OUTBOUND_POLICY_DROP_OLDEST
+} OutboundPolicy;
+
+typedef enum {
+    OUTBOUND_FLUSH_DONE = 0,
+    OUTBOUND_FLUSH_BLOCKED = 1,
+    OUTBOUND_FLUSH_ERROR = -1,
+    OUTBOUND_FLUSH_OVERFLOW = -2
+} OutboundFlushResult;
+
+typedef struct OutboundSend OutboundSend;
+
+typedef struct {
+    pthread_mutex_t lock;
+    Frame **frames;
+    uint32_t capacity;
+    uint32_t head;
+    uint32_t count;
+    uint32_t head_offset;
+    size_t bytes;
+    size_t snapshot_bytes;
+    size_t in_flight;
+    uint64_t dropped_frames;
+    int flush_scheduled;
+    int overflowed;
+    int zerocopy;
+    uint32_t zerocopy_next;
+    OutboundSend *zerocopy_head;
+    OutboundSend *zerocopy_tail;
+} OutboundQueue;
+
+struct OutboundSend {
+    struct msghdr msg;
+    struct iovec iov[OUTBOUND_QUEUE_MAX_IOV];
+    Frame *frames[OUTBOUND_QUEUE_MAX_IOV];
+    uint32_t count;
+    size_t bytes;
+    uint32_t sequence;
+    OutboundSend *next;
+};
+
+typedef struct {
+    uint64_t syscalls;
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t zerocopy_sends;
+    uint64_t zerocopy_bytes;
+    uint64_t zerocopy_copied_bytes;
+    uint64_t send_allocations;
+} OutboundStats;
+
+void outbound_queue_configure(size_t high_water, OutboundPolicy policy, size_t max_batch);
+int outbound_queue_parse_policy(const char *name, OutboundPolicy *policy);
+const char *outbound_queue_policy_name(OutboundPolicy policy);
+void outbound_queue_configure_zerocopy(size_t threshold);
+size_t outbound_queue_zerocopy_threshold(void);
+int outbound_queue_init(OutboundQueue *queue);
+int outbound_queue_enable_zerocopy(OutboundQueue *queue, int socket);
+void outbound_queue_destroy(OutboundQueue *queue);
+int outbound_queue_push(OutboundQueue *queue, Frame *frame);
+OutboundFlushResult outbound_queue_flush(OutboundQueue *queue, int socket);
+OutboundFlushResult outbound_queue_prepare(OutboundQueue *queue, OutboundSend *send);
+int outbound_queue_complete(OutboundQueue *queue, size_t sent, size_t prepared);
+void outbound_queue_release_send(OutboundSend *send);
+OutboundSend *outbound_queue_alloc_send(void);
+void outbound_queue_free_send(OutboundSend *send);
+void outbound_queue_shutdown(void);
+int outbound_queue_reap_zerocopy(OutboundQueue *queue, int socket);
+void outbound_queue_zerocopy_done(const OutboundSend *send, int copied);
+void outbound_queue_clear(OutboundQueue *queue);
+size_t outbound_queue_trim(OutboundQueue *queue);
+size_t outbound_queue_footprint(OutboundQueue *queue);
+size_t outbound_queue_backlog_bytes(OutboundQueue *queue);
+size_t outbound_queue_total_backlog_bytes(void);
+void outbound_queue_stats(OutboundStats *stats);
+
+#endif
@@ -0,0 +1,416 @@
+/**
+ * @file presence.c
+ * @brief Versioned roster of online users
+ *
+ * The roster is owned by a single shard and only touched by that shard's
+ * event loop, so nothing here locks. Every join or leave bumps the roster
+ * version and is recorded as a delta in a fixed-size history ring, so a
+ * subscriber that fell behind can be brought up to date with the deltas
+ * it missed instead of a full roster, as long as they are still in the
+ * ring.
+ *
+ * Names are kept in a dense array, for listing the full roster, indexed
+ * by an open-addressing hash table, so joins and leaves cost O(1) and a
+ * mass disconnect stays linear. Subscribers are kept the same way,
+ * indexed by client slot.
+ *
+ * @author Jeremiah Hughes & Anthony Patton
+ * @date April 2025
+ */
+
+#include "presence.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "client_registry.h"
+#include "../common/logger.h"
+
+#define PRESENCE_MIN_CAPACITY 64
+#define PRESENCE_SLOT_EMPTY 0
+#define PRESENCE_SLOT_DELETED -1
+
+typedef struct {
+    char name[MAX_USERNAME_LEN];
+    uint32_t hash;
+} RosterEntry;
+
+static RosterEntry *entries = NULL;
+static int entry_count = 0;
+static int entry_capacity = 0;
+
+/* Each slot holds an index into entries plus one, or one of the
+ * PRESENCE_SLOT_* markers. */
+static int *slots = NULL;
+static uint32_t slot_capacity = 0;
+static uint32_t deleted_count = 0;
+
+static uint32_t roster_version = 0;
+static RosterDelta history[PRESENCE_HISTORY];
+
+static RoomMember *subscribers = NULL;
+static int subscriber_count = 0;
+static int subscriber_capacity = 0;
+static int *subscriber_positions = NULL;
+static int position_capacity = 0;
+
+/**
+ * @brief Hashes a username with 32-bit FNV-1a
+ *
+ * @param name The username to hash
+ * @return The hash value
+ */
+static uint32_t hash_name(const char *name) {
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < MAX_USERNAME_LEN && name[i] != '\0'; i++) {
+        hash ^= (uint8_t) name[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Finds the slot that refers to a name
+ *
+ * @param name The username
+ * @param hash Hash of the name
+ * @return Index of the slot, or -1 if the name is not in the roster
+ */
+static int find_slot(const char *name, const uint32_t hash) {
+    const uint32_t mask = slot_capacity - 1;
+
+    for (uint32_t i = hash & mask, probes = 0; probes < slot_capacity; i = (i + 1) & mask, probes++) {
+        if (slots[i] == PRESENCE_SLOT_EMPTY) {
+            return -1;
+        }
+        if (slots[i] > 0) {
+            const RosterEntry *entry = &entries[slots[i] - 1];
+            if (entry->hash == hash && strncmp(entry->name, name, MAX_USERNAME_LEN) == 0) {
+                return (int) i;
+            }
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Stores an entry index in the first free slot for its hash
+ *
+ * @param hash Hash of the entry's name
+ * @param index Index of the entry
+ */
+static void insert_slot(const uint32_t hash, const int index) {
+    const uint32_t mask = slot_capacity - 1;
+    uint32_t i = hash & mask;
+
+    while (slots[i] > 0) {
+        i = (i + 1) & mask;
+    }
+
+    if (slots[i] == PRESENCE_SLOT_DELETED) {
+        deleted_count--;
+    }
+    slots[i] = index + 1;
+}
+
+/**
+ * @brief Rebuilds the hash table with a new capacity, dropping deleted slots
+ *
+ * @param new_capacity New number of slots, a power of two
+ * @return 0 on success, -1 on allocation failure
+ */
+static int rehash(const uint32_t new_capacity) {
+    int *new_slots = calloc(new_capacity, sizeof(int));
+    if (!new_slots) {
+        logger_log(LOG_ERROR, "Failed to allocate memory for presence roster");
+        return -1;
+    }
+
+    free(slots);
+    slots = new_slots;
+    slot_capacity = new_capacity;
+    deleted_count = 0;
+
+    for (int i = 0; i < entry_count; i++) {
+        insert_slot(entries[i].hash, i);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Bumps the roster version and records the change in the history
+ *
+ * @param action ROSTER_DELTA_JOIN or ROSTER_DELTA_LEAVE
+ * @param name The username
+ * @param delta Receives the recorded change
+ */
+static void record_delta(const uint8_t action, const char *name, RosterDelta *delta) {
+    RosterDelta *slot = &history[++roster_version % PRESENCE_HISTORY];
+
+    memset(slot, 0, sizeof(*slot));
+    slot->version = roster_version;
+    slot->action = action;
+    strncpy(slot->username, name, MAX_USERNAME_LEN - 1);
+
+    if (delta) {
+        *delta = *slot;
+    }
+}
+
+/**
+ * @brief Initializes an empty roster at version 0
+ *
+ * @param client_capacity Maximum number of simultaneously connected clients
+ * @return 0 on success, -1 on failure
+ */
+int presence_init(const int client_capacity) {
+    entries = malloc(PRESENCE_MIN_CAPACITY * sizeof(RosterEntry));
+    slots = calloc(PRESENCE_MIN_CAPACITY * 2, sizeof(int));
+    subscriber_positions = malloc(client_capacity * sizeof(int));
+    if (!entries || !slots || !subscriber_positions) {
+        logger_log(LOG_ERROR, "Failed to allocate memory for presence roster");
+        presence_destroy();
+        return -1;
+    }
+
+    entry_capacity = PRESENCE_MIN_CAPACITY;
+    slot_capacity = PRESENCE_MIN_CAPACITY * 2;
+    position_capacity = client_capacity;
+    for (int i = 0; i < client_capacity; i++) {
+        subscriber_positions[i] = -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Frees the roster, its history and the subscriber list
+ *
+ * The event loops must already be stopped.
+ */
+void presence_destroy(void) {
+    free(entries);
+    free(slots);
+    free(subscribers);
+    free(subscriber_positions);
+
+    entries = NULL;
+    entry_count = 0;
+    entry_capacity = 0;
+    slots = NULL;
+    slot_capacity = 0;
+    deleted_count = 0;
+    subscribers = NULL;
+    subscriber_count = 0;
+    subscriber_capacity = 0;
+    subscriber_positions = NULL;
+    position_capacity = 0;
+    roster_version = 0;
+    memset(history, 0, sizeof(history));
+}
+
+/**
+ * @brief Returns the current roster version
+ *
+ * @return The version, 0 before the first change
+ */
+uint32_t presence_version(void) {
+    return roster_version;
+}
+
+/**
+ * @brief Adds a user to the roster
+ *
+ * @param name The username
+ * @param delta Receives the change to send to subscribers, or NULL
+ * @return 0 on success, 1 if the user is already in the roster, -1 on failure
+ */
+int presence_add(const char *name, RosterDelta *delta) {
+    const uint32_t hash = hash_name(name);
+    if (find_slot(name, hash) >= 0) {
+        return 1;
+    }
+
+    if (entry_count == entry_capacity) {
+        RosterEntry *grown = realloc(entries, entry_capacity * 2 * sizeof(RosterEntry));
+        if (!grown) {
+            logger_log(LOG_ERROR, "Failed to allocate memory for presence roster");
+            return -1;
+        }
+        entries = grown;
+        entry_capacity *= 2;
+    }
+
+    if ((uint32_t) (entry_count + deleted_count + 1) * 2 > slot_capacity) {
+        const uint32_t new_capacity = (uint32_t) (entry_count + 1) * 4 > slot_capacity
+                                          ? slot_capacity * 2
+                                          : slot_capacity;
+        if (rehash(new_capacity) != 0) {
+            return -1;
+        }
+    }
+
+    RosterEntry *entry = &entries[entry_count];
+    memset(entry->name, 0, sizeof(entry->name));
+    strncpy(entry->name, name, MAX_USERNAME_LEN - 1);
+    entry->hash = hash;
+    insert_slot(hash, entry_count);
+    entry_count++;
+
+    record_delta(ROSTER_DELTA_JOIN, name, delta);
+    return 0;
+}
+
+/**
+ * @brief Removes a user from the roster
+ *
+ * The last entry is moved into the hole, so the roster order is not
+ * preserved.
+ *
+ * @param name The username
+ * @param delta Receives the change to send to subscribers, or NULL
+ * @return 0 on success, 1 if the user is not in the roster
+ */
+int presence_remove(const char *name, RosterDelta *delta) {
+    const int slot = find_slot(name, hash_name(name));
+    if (slot < 0) {
+        return 1;
+    }
+
+    const int index = slots[slot] - 1;
+    slots[slot] = PRESENCE_SLOT_DELETED;
+    deleted_count++;
+    entry_count--;
+
+    if (index != entry_count) {
+        entries[index] = entries[entry_count];
+        slots[find_slot(entries[index].name, entries[index].hash)] = index + 1;
+    }
+
+    record_delta(ROSTER_DELTA_LEAVE, name, delta);
+    return 0;
+}
+
+/**
+ * @brief Looks up a change in the history ring
+ *
+ * @param version Version the change produced
+ * @return The change, or NULL if it is in the future or no longer retained
+ */
+const RosterDelta *presence_delta(const uint32_t version) {
+    if (version == 0 || version > roster_version || roster_version - version >= PRESENCE_HISTORY) {
+        return NULL;
+    }
+
+    return &history[version % PRESENCE_HISTORY];
+}
+
+/**
+ * @brief Returns the number of users in the roster
+ *
+ * @return The number of users
+ */
+int presence_count(void) {
+    return entry_count;
+}
+
+/**
+ * @brief Returns a user in the roster
+ *
+ * Indexes are invalidated by the next add or remove.
+ *
+ * @param index Index of the user, from 0 to presence_count() - 1
+ * @return The username
+ */
+const char *presence_name(const int index) {
+    return entries[index].name;
+}
+
+/**
+ * @brief Returns the position slot of a client
+ *
+ * @param client_id ID of the client
+ * @return Index into subscriber_positions, or -1 if out of range
+ */
+static int position_index(const int client_id) {
+    const int slot = client_id & (CLIENT_REGISTRY_MAX_CAPACITY - 1);
+    return slot < position_capacity ? slot : -1;
+}
+
+/**
+ * @brief Subscribes a client to roster deltas
+ *
+ * @param member The subscriber
+ * @return 0 on success, 1 if the client is already subscribed, -1 on failure
+ */
+int presence_subscribe(const RoomMember *member) {
+    const int position = position_index(member->client_id);
+    if (position < 0) {
+        return -1;
+    }
+
+    const int index = subscriber_positions[position];
+    if (index >= 0 && index < subscriber_count && subscribers[index].client_id == member->client_id) {
+        return 1;
+    }
+
+    if (subscriber_count == subscriber_capacity) {
+        const int new_capacity = subscriber_capacity ? subscriber_capacity * 2 : PRESENCE_MIN_CAPACITY;
+        RoomMember *grown = realloc(subscribers, new_capacity * sizeof(RoomMember));
+        if (!grown) {
+            logger_log(LOG_ERROR, "Failed to allocate memory for presence subscribers");
+            return -1;
+        }
+        subscribers = grown;
+        subscriber_capacity = new_capacity;
+    }
+
+    subscribers[subscriber_count] = *member;
+    subscriber_positions[position] = subscriber_count;
+    subscriber_count++;
+    return 0;
+}
+
+/**
+ * @brief Unsubscribes a client from roster deltas
+ *
+ * @param client_id ID of the client
+ * @return 0 on success, 1 if the client was not subscribed
+ */
+int presence_unsubscribe(const int client_id) {
+    const int position = position_index(client_id);
+    if (position < 0) {
+        return 1;
+    }
+
+    const int index = subscriber_positions[position];
+    if (index < 0 || index >= subscriber_count || subscribers[index].client_id != client_id) {
+        return 1;
+    }
+
+    subscriber_positions[position] = -1;
+    subscriber_count--;
+
+    if (index != subscriber_count) {
+        subscribers[index] = subscribers[subscriber_count];
+        subscriber_positions[position_index(subscribers[index].client_id)] = index;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Returns the clients subscribed to roster deltas
+ *
+ * The array is invalidated by the next subscribe or unsubscribe.
+ *
+ * @param count Receives the number of subscribers
+ * @return The subscribers
+ */
+const RoomMember *presence_subscribers(int *count) {
+    *count = subscriber_count;
+    return subscribers;
+}
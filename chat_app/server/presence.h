@@ -0,0 +1,22 @@
+#ifndef PRESENCE_H
+#define PRESENCE_H
+
+#include <stdint.h>
+#include "room_registry.h"
+#include "../common/protocol.h"
+
+#define PRESENCE_HISTORY 256
+
+int presence_init(int client_capacity);
+void presence_destroy(void);
+uint32_t presence_version(void);
+int presence_add(const char *name, RosterDelta *delta);
+int presence_remove(const char *name, RosterDelta *delta);
+const RosterDelta *presence_delta(uint32_t version);
+int presence_count(void);
+const char *presence_name(int index);
+int presence_subscribe(const RoomMember *member);
+int presence_unsubscribe(int client_id);
+const RoomMember *presence_subscribers(int *count);
+
+#endif
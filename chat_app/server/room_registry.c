@@ -0,0 +1,373 @@
+/**
+ * @file room_registry.c
+ * @brief Per-shard registries of chat rooms and their members
+ *
+ * Every room is owned by exactly one shard, and each shard keeps the rooms
+ * it owns in its own open-addressing hash table keyed by name. A shard's
+ * table is only touched by that shard's event loop, so nothing here
+ * locks. Rooms are created when their first member joins and destroyed
+ * when the last member leaves, together with their message history.
+ *
+ * Members are stored by client ID together with the shard that owns the
+ * client, rather than as client pointers, because a member's client
+ * record belongs to another event loop and may be released at any time.
+ *
+ * @author Jeremiah Hughes & Anthony Patton
+ * @date April 2025
+ */
+
+#include "room_registry.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../common/logger.h"
+
+#define ROOM_REGISTRY_MIN_CAPACITY 64
+#define ROOM_INITIAL_MEMBERS 8
+
+typedef enum {
+    SLOT_EMPTY = 0,
+    SLOT_USED,
+    SLOT_DELETED
+} SlotState;
+
+typedef struct {
+    uint32_t hash;
+    uint8_t state;
+    Room *room;
+} RoomSlot;
+
+typedef struct {
+    RoomSlot *slots;
+    uint32_t capacity;
+    uint32_t used_count;
+    uint32_t deleted_count;
+} RoomTable;
+
+static RoomTable *tables = NULL;
+static int table_count = 0;
+
+/**
+ * @brief Hashes a room name with 32-bit FNV-1a
+ *
+ * @param name The room name to hash
+ * @return The hash value
+ */
+static uint32_t hash_name(const char *name) {
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < MAX_ROOM_NAME_LEN && name[i] != '\0'; i++) {
+        hash ^= (uint8_t) name[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Finds the slot holding a room
+ *
+ * @param table The shard's room table
+ * @param name The room name
+ * @param hash Hash of the name
+ * @return The matching slot, or NULL if no such room exists
+ */
+static RoomSlot *find_slot(const RoomTable *table, const char *name, const uint32_t hash) {
+    const uint32_t mask = table->capacity - 1;
+
+    for (uint32_t i = hash & mask, probes = 0; probes < table->capacity; i = (i + 1) & mask, probes++) {
+        RoomSlot *slot = &table->slots[i];
+        if (slot->state == SLOT_EMPTY) {
+            return NULL;
+        }
+        if (slot->state == SLOT_USED && slot->hash == hash &&
+            strncmp(slot->room->name, name, MAX_ROOM_NAME_LEN) == 0) {
+            return slot;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Rebuilds a table with a new capacity, dropping deleted slots
+ *
+ * @param table The shard's room table
+ * @param new_capacity New number of slots, a power of two
+ * @return 0 on success, -1 on allocation failure
+ */
+static int rehash(RoomTable *table, const uint32_t new_capacity) {
+    RoomSlot *new_slots = calloc(new_capacity, sizeof(RoomSlot));
+    if (!new_slots) {
+        logger_log(LOG_ERROR, "Failed to allocate memory for room registry");
+        return -1;
+    }
+
+    const uint32_t mask = new_capacity - 1;
+    for (uint32_t i = 0; i < table->capacity; i++) {
+        if (table->slots[i].state != SLOT_USED) {
+            continue;
+        }
+
+        uint32_t index = table->slots[i].hash & mask;
+        while (new_slots[index].state != SLOT_EMPTY) {
+            index = (index + 1) & mask;
+        }
+        new_slots[index] = table->slots[i];
+    }
+
+    free(table->slots);
+    table->slots = new_slots;
+    table->capacity = new_capacity;
+    table->deleted_count = 0;
+
+    return 0;
+}
+
+/**
+ * @brief Creates an empty room and adds it to a table
+ *
+ * @param table The shard's room table
+ * @param name The room name
+ * @param hash Hash of the name
+ * @return The new room, or NULL on failure
+ */
+static Room *create_room(RoomTable *table, const char *name, const uint32_t hash) {
+    if ((table->used_count + table->deleted_count + 1) * 2 > table->capacity) {
+        const uint32_t new_capacity = (table->used_count + 1) * 4 > table->capacity
+                                          ? table->capacity * 2
+                                          : table->capacity;
+        if (rehash(table, new_capacity) != 0) {
+            return NULL;
+        }
+    }
+
+    Room *room = calloc(1, sizeof(Room));
+    if (!room) {
+        logger_log(LOG_ERROR, "Failed to allocate memory for room %s", name);
+        return NULL;
+    }
+
+    strncpy(room->name, name, MAX_ROOM_NAME_LEN - 1);
+    room->hash = hash;
+
+    const uint32_t mask = table->capacity - 1;
+    uint32_t index = hash & mask;
+    while (table->slots[index].state == SLOT_USED) {
+        index = (index + 1) & mask;
+    }
+
+    if (table->slots[index].state == SLOT_DELETED) {
+        table->deleted_count--;
+    }
+    table->slots[index].hash = hash;
+    table->slots[index].state = SLOT_USED;
+    table->slots[index].room = room;
+    table->used_count++;
+
+    logger_log(LOG_INFO, "Created room %s", room->name);
+    return room;
+}
+
+/**
+ * @brief Frees a room that is no longer in its table
+ *
+ * @param room The room to free
+ */
+static void free_room(Room *room) {
+    if (room->history) {
+        history_clear(room->history);
+        free(room->history);
+    }
+    free(room->members);
+    free(room);
+}
+
+/**
+ * @brief Returns the table of a shard
+ *
+ * @param shard The shard index
+ * @return The table, or NULL if the shard is out of range
+ */
+static RoomTable *table_for(const int shard) {
+    if (!tables || shard < 0 || shard >= table_count) {
+        return NULL;
+    }
+
+    return &tables[shard];
+}
+
+/**
+ * @brief Initializes one empty room table per shard
+ *
+ * @param shard_count Number of shards
+ * @return 0 on success, -1 on failure
+ */
+int room_registry_init(const int shard_count) {
+    tables = calloc(shard_count, sizeof(RoomTable));
+    if (!tables) {
+        logger_log(LOG_ERROR, "Failed to allocate memory for room registry");
+        return -1;
+    }
+
+    table_count = shard_count;
+
+    for (int i = 0; i < shard_count; i++) {
+        tables[i].slots = calloc(ROOM_REGISTRY_MIN_CAPACITY, sizeof(RoomSlot));
+        if (!tables[i].slots) {
+            logger_log(LOG_ERROR, "Failed to allocate memory for room registry");
+            room_registry_destroy();
+            return -1;
+        }
+        tables[i].capacity = ROOM_REGISTRY_MIN_CAPACITY;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Frees every room and every table
+ *
+ * The event loops must already be stopped.
+ */
+void room_registry_destroy(void) {
+    for (int i = 0; tables && i < table_count; i++) {
+        RoomTable *table = &tables[i];
+        for (uint32_t j = 0; j < table->capacity; j++) {
+            if (table->slots[j].state == SLOT_USED) {
+                free_room(table->slots[j].room);
+            }
+        }
+        free(table->slots);
+    }
+
+    free(tables);
+    tables = NULL;
+    table_count = 0;
+}
+
+/**
+ * @brief Finds a room owned by a shard
+ *
+ * Must be called on the shard's own event loop.
+ *
+ * @param shard The owning shard
+ * @param name The room name
+ * @return The room, or NULL if it does not exist
+ */
+Room *room_registry_find(const int shard, const char *name) {
+    const RoomTable *table = table_for(shard);
+    if (!table) {
+        return NULL;
+    }
+
+    const RoomSlot *slot = find_slot(table, name, hash_name(name));
+    return slot ? slot->room : NULL;
+}
+
+/**
+ * @brief Adds a member to a room, creating the room if needed
+ *
+ * Must be called on the owning shard's event loop.
+ *
+ * @param shard The owning shard
+ * @param name The room name
+ * @param member The joining member
+ * @return 0 on success, 1 if the client is already a member, -1 on failure
+ */
+int room_registry_join(const int shard, const char *name, const RoomMember *member) {
+    RoomTable *table = table_for(shard);
+    if (!table) {
+        return -1;
+    }
+
+    const uint32_t hash = hash_name(name);
+    const RoomSlot *slot = find_slot(table, name, hash);
+    Room *room = slot ? slot->room : create_room(table, name, hash);
+    if (!room) {
+        return -1;
+    }
+
+    if (room_registry_is_member(room, member->client_id)) {
+        return 1;
+    }
+
+    if (room->member_count == room->member_capacity) {
+        const int new_capacity = room->member_capacity ? room->member_capacity * 2 : ROOM_INITIAL_MEMBERS;
+        RoomMember *members = realloc(room->members, new_capacity * sizeof(RoomMember));
+        if (!members) {
+            logger_log(LOG_ERROR, "Failed to allocate memory for members of room %s", room->name);
+            return -1;
+        }
+        room->members = members;
+        room->member_capacity = new_capacity;
+    }
+
+    room->members[room->member_count++] = *member;
+    return 0;
+}
+
+/**
+ * @brief Removes a member from a room, destroying the room if it empties
+ *
+ * Must be called on the owning shard's event loop.
+ *
+ * @param shard The owning shard
+ * @param name The room name
+ * @param client_id ID of the leaving client
+ * @return 0 on success, 1 if the client is not a member
+ */
+int room_registry_leave(const int shard, const char *name, const int client_id) {
+    RoomTable *table = table_for(shard);
+    if (!table) {
+        return 1;
+    }
+
+    RoomSlot *slot = find_slot(table, name, hash_name(name));
+    if (!slot) {
+        return 1;
+    }
+
+    Room *room = slot->room;
+    int found = 0;
+    for (int i = 0; i < room->member_count; i++) {
+        if (room->members[i].client_id == client_id) {
+            room->members[i] = room->members[--room->member_count];
+            found = 1;
+            break;
+        }
+    }
+
+    if (!found) {
+        return 1;
+    }
+
+    if (room->member_count == 0) {
+        slot->state = SLOT_DELETED;
+        slot->room = NULL;
+        table->used_count--;
+        table->deleted_count++;
+        logger_log(LOG_INFO, "Destroyed empty room %s", room->name);
+        free_room(room);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Checks whether a client is a member of a room
+ *
+ * @param room The room
+ * @param client_id ID of the client
+ * @return 1 if the client is a member, 0 otherwise
+ */
+int room_registry_is_member(const Room *room, const int client_id) {
+    for (int i = 0; i < room->member_count; i++) {
+        if (room->members[i].client_id == client_id) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
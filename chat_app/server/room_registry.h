@@ -0,0 +1,30 @@
+#ifndef ROOM_REGISTRY_H
+#define ROOM_REGISTRY_H
+
+#include <stdint.h>
+#include "history.h"
+#include "../common/protocol.h"
+
+typedef struct {
+    int client_id;
+    int shard;
+    int protocol_version;
+} RoomMember;
+
+typedef struct {
+    char name[MAX_ROOM_NAME_LEN];
+    uint32_t hash;
+    RoomMember *members;
+    int member_count;
+    int member_capacity;
+    HistoryRing *history;
+} Room;
+
+int room_registry_init(int shard_count);
+void room_registry_destroy(void);
+Room *room_registry_find(int shard, const char *name);
+int room_registry_join(int shard, const char *name, const RoomMember *member);
+int room_registry_leave(int shard, const char *name, int client_id);
+int room_registry_is_member(const Room *room, int client_id);
+
+#endif
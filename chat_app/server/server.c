@@ -9,6 +9,8 @@
  * @date April 2025
  */
 
+#include <errno.h>
+#include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,23 +19,40 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <pthread.h>
+#include "buffer_pool.h"
 #include "chat_handler.h"
+#include "client_registry.h"
+#include "event_loop.h"
+#include "message_log.h"
+#include "outbound_queue.h"
+#include "server_socket.h"
+#include "../common/frame.h"
 #include "../common/logger.h"
 #include "../common/protocol.h"
 
 #define LOG_FILE "server.log"
+#define BINARY_LOG_FILE "server.blog"
 #define CHAT_BUFFER_SIZE 8192
 #define SERVER_PORT 54321
 
-static int server_socket = -1;
-static int running = 1;
+/**
+ * @brief A per-worker listening socket
+ *
+ * Every event loop owns one SO_REUSEPORT listener bound to the server
+ * port and adds the connections it accepts to itself.
+ */
+typedef struct {
+    EventLoop *loop;
+    EventListener listener;
+} Listener;
+
+static Listener *listeners = NULL;
+static int listener_count = 0;
+static volatile sig_atomic_t running = 1;
 static int active_users = 0;
 
 static pthread_mutex_t active_users_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-extern pthread_mutex_t clients_mutex;
-extern Client *clients[MAX_CLIENTS];
-
 int handle_client_connection(int client_socket);
 int process_message(int client_id, const char *message);
 int process_command(int client_id, const char *command);
@@ -43,72 +62,141 @@ int chat_handler_send_message(int client_id, const char *message);
 void chat_handler_get_online_users(char *buffer, size_t buffer_size);
 
 void broadcast_message(MessageType type, const void *data, uint32_t data_length, int exclude_socket);
-void send_user_list(int client_socket);
+void send_user_list(int client_id);
 
 void handle_signal(const int sig) {
     if (sig == SIGINT || sig == SIGTERM) {
         logger_log(LOG_INFO, "Received signal %d, shutting down...", sig);
         running = 0;
+    }
+}
+
+/**
+ * @brief Adds a connection accepted on a worker's listening socket
+ *
+ * Runs on the event loop that owns the listener, which also becomes the
+ * owner of the connection.
+ *
+ * @param ctx Pointer to the Listener
+ * @param client_socket The accepted socket
+ * @param addr Peer address, or NULL if the event loop did not report it
+ */
+static void server_accept(void *ctx, const int client_socket, const struct sockaddr *addr) {
+    const Listener *listener = ctx;
+    struct sockaddr_in client_addr = {0};
+
+    if (addr) {
+        memcpy(&client_addr, addr, sizeof(client_addr));
+    } else {
+        socklen_t client_len = sizeof(client_addr);
+        getpeername(client_socket, (struct sockaddr *)&client_addr, &client_len);
+    }
+
+    char client_ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, sizeof(client_ip));
+    logger_log(LOG_INFO, "New client connection from %s:%d on worker %d",
+             client_ip, ntohs(client_addr.sin_port), event_loop_index(listener->loop));
 
-        if (server_socket != -1) {
-            close(server_socket);
-            server_socket = -1;
+    const int client_id = chat_handler_add_client(listener->loop, client_socket);
+    if (client_id < 0) {
+        logger_log(LOG_ERROR, "Failed to add client to chat handler");
+        close(client_socket);
+        return;
+    }
+
+    pthread_mutex_lock(&active_users_mutex);
+    const int users = ++active_users;
+    pthread_mutex_unlock(&active_users_mutex);
+
+    logger_log(LOG_INFO, "Client %d added successfully. Active clients: %d",
+             client_id, users);
+}
+
+/**
+ * @brief Close every worker listening socket
+ */
+static void server_close_listeners(void) {
+    for (int i = 0; i < listener_count; i++) {
+        if (listeners[i].listener.socket != -1) {
+            close(listeners[i].listener.socket);
         }
     }
+
+    free(listeners);
+    listeners = NULL;
+    listener_count = 0;
 }
 
 /**
  * @brief Initialize the server
  *
- * Sets up the server by initializing the logger and network components.
+ * Sets up the server by initializing the logger, starting one event loop
+ * per worker and giving each worker its own SO_REUSEPORT listening socket.
+ * SIGINT and SIGTERM are blocked first, so that every thread started
+ * here leaves them to the main thread's sigwait.
  *
  * @param port The port number to listen on
+ * @param workers Number of worker event loops
+ * @param max_clients Maximum number of simultaneously connected clients
  * @return 0 on success, non-zero on failure
  */
-int server_init(const int port) {
-        if (logger_init(LOG_FILE) != 0) {
-            fprintf(stderr, "Failed to initialize logger\n");
+int server_init(const int port, const int workers, const int max_clients) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (logger_init(logger_format() == LOGGER_FORMAT_BINARY ? BINARY_LOG_FILE : LOG_FILE) != 0) {
+        fprintf(stderr, "Failed to initialize logger\n");
         return -1;
     }
-    
+
     logger_log(LOG_INFO, "Chat server starting up");
 
-        if (chat_handler_init() != 0) {
-            logger_log(LOG_ERROR, "Failed to initialize chat handler");
+    if (chat_handler_init(max_clients) != 0) {
+        logger_log(LOG_ERROR, "Failed to initialize chat handler");
         return -1;
     }
-    
-        server_socket = socket(AF_INET, SOCK_STREAM, 0);
-        if (server_socket < 0) {
-        logger_log(LOG_ERROR, "Failed to create server socket");
+
+    if (event_loop_pool_start(workers) != 0) {
+        logger_log(LOG_ERROR, "Failed to start %d worker event loops", workers);
         return -1;
     }
 
-        const int opt = 1;
-        if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        logger_log(LOG_ERROR, "Failed to set socket options");
-        close(server_socket);
+    if (chat_handler_start_shards() != 0) {
+        logger_log(LOG_ERROR, "Failed to set up room shards");
+        event_loop_pool_stop();
         return -1;
     }
 
-        struct sockaddr_in server_addr = {0};
-        server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(port);
-    
-    if (bind(server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        logger_log(LOG_ERROR, "Failed to bind server socket");
-        close(server_socket);
+    listeners = calloc(workers, sizeof(Listener));
+    if (!listeners) {
+        logger_log(LOG_ERROR, "Failed to allocate memory for listeners");
+        event_loop_pool_stop();
         return -1;
     }
 
-        if (listen(server_socket, 10) < 0) {
-            logger_log(LOG_ERROR, "Failed to listen on server socket");
-        close(server_socket);
-        return -1;
+    for (int i = 0; i < workers; i++) {
+        Listener *listener = &listeners[i];
+        listener->loop = event_loop_pool_get(i);
+        listener->listener.socket = create_reuseport_socket(port);
+        listener->listener.on_accept = server_accept;
+        listener->listener.ctx = listener;
+        listener_count++;
+
+        if (listener->listener.socket < 0 ||
+            event_loop_add_listener(listener->loop, &listener->listener) != 0) {
+            logger_log(LOG_ERROR, "Failed to set up listening socket for worker %d", i);
+            event_loop_pool_stop();
+            server_close_listeners();
+            return -1;
+        }
     }
-    
-    logger_log(LOG_INFO, "Server initialized and listening on port %d", port);
+
+    logger_log(LOG_INFO, "Server initialized and listening on port %d with %d worker%s",
+               port, workers, workers == 1 ? "" : "s");
     return 0;
 }
 
@@ -118,63 +206,118 @@ int server_init(const int port) {
  * Releases all resources and properly terminates the server.
  */
 void server_shutdown(void) {
-        if (server_socket != -1) {
-            close(server_socket);
-        server_socket = -1;
+    event_loop_pool_stop();
+    server_close_listeners();
+
+    size_t connections = 0;
+    size_t footprint = 0;
+    chat_handler_footprint(&connections, &footprint);
+    BufferPoolStats buffers;
+    buffer_pool_stats(&buffers);
+    logger_log(LOG_INFO, "Connection memory: %zu connections holding %zu bytes (%zu per connection), "
+               "%zu receive buffers of %zu bytes in use, %zu cached",
+               connections, footprint, connections ? footprint / connections : 0,
+               buffers.in_use, buffers.buffer_size, buffers.cached);
+
+    chat_handler_cleanup();
+
+    OutboundStats stats;
+    outbound_queue_stats(&stats);
+    logger_log(LOG_INFO, "Outbound writes: %llu frames, %llu bytes in %llu sendmsg() calls (%.2f frames per call)",
+               (unsigned long long) stats.frames, (unsigned long long) stats.bytes,
+               (unsigned long long) stats.syscalls,
+               stats.syscalls ? (double) stats.frames / (double) stats.syscalls : 0.0);
+    if (stats.zerocopy_sends > 0) {
+        logger_log(LOG_INFO, "Zero-copy sends: %llu, %llu bytes sent without a copy, %llu bytes copied by the kernel",
+                   (unsigned long long) stats.zerocopy_sends, (unsigned long long) stats.zerocopy_bytes,
+                   (unsigned long long) stats.zerocopy_copied_bytes);
     }
+    logger_log(LOG_INFO, "Outbound sends: %llu allocated, the rest reused from the per-loop caches",
+               (unsigned long long) stats.send_allocations);
+    outbound_queue_shutdown();
+
+    FramePoolStats pool;
+    frame_pool_stats(&pool);
+    logger_log(LOG_INFO, "Frame pool: %llu hits, %llu misses, %llu frames outstanding",
+               (unsigned long long) pool.hits, (unsigned long long) pool.misses,
+               (unsigned long long) pool.outstanding);
+    frame_pool_shutdown();
 
-        chat_handler_cleanup();
-        logger_log(LOG_INFO, "Server shutdown complete");
+    logger_log(LOG_INFO, "Server shutdown complete");
     logger_close();
 }
 
 /**
  * @brief Start the server main loop
  *
- * Starts listening for client connections and handles them accordingly.
+ * The workers accept and serve connections on their own; the main
+ * thread waits for a termination signal and, every half idle period,
+ * asks the workers to trim the buffers of their idle clients.
  * This function blocks until the server is shut down.
  *
+ * @param idle_ms Idle time before a client's buffers are trimmed, or 0 to never trim
  * @return 0 on successful shutdown, non-zero on error
  */
-int server_run(void) {
-    signal(SIGINT, handle_signal);
-    signal(SIGTERM, handle_signal);
+int server_run(const int idle_ms) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
 
-    while (running) {
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
+    const int interval_ms = idle_ms > 1 ? idle_ms / 2 : 1;
+    const struct timespec interval = {
+        .tv_sec = interval_ms / 1000,
+        .tv_nsec = (long) (interval_ms % 1000) * 1000000
+    };
 
-        const int client_socket = accept(server_socket, (struct sockaddr *)&client_addr, &client_len);
-        if (client_socket < 0) {
-            if (running) {
-                logger_log(LOG_ERROR, "Failed to accept client connection");
+    while (running) {
+        if (idle_ms == 0) {
+            int sig = 0;
+            if (sigwait(&signals, &sig) != 0) {
+                logger_log(LOG_ERROR, "Failed to wait for signals");
+                return -1;
             }
+
+            handle_signal(sig);
             continue;
         }
-        
-                char client_ip[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, sizeof(client_ip));
-        logger_log(LOG_INFO, "New client connection from %s:%d", 
-                 client_ip, ntohs(client_addr.sin_port));
-        
-                const int client_id = chat_handler_add_client(client_socket);
-        if (client_id < 0) {
-            logger_log(LOG_ERROR, "Failed to add client to chat handler");
-            close(client_socket);
-            continue;
+
+        const int sig = sigtimedwait(&signals, NULL, &interval);
+        if (sig > 0) {
+            handle_signal(sig);
+        } else if (errno == EAGAIN) {
+            chat_handler_trim_idle();
+        } else if (errno != EINTR) {
+            logger_log(LOG_ERROR, "Failed to wait for signals: %s", strerror(errno));
+            return -1;
         }
-        
-                pthread_mutex_lock(&active_users_mutex);
-        active_users++;
-        pthread_mutex_unlock(&active_users_mutex);
-        
-        logger_log(LOG_INFO, "Client %d added successfully. Active clients: %d", 
-                 client_id, active_users);
     }
 
     return 0;
 }
 
+/**
+ * @brief Returns the default number of worker event loops
+ *
+ * @return The number of online CPU cores, or 1 if it cannot be determined
+ */
+static int default_worker_count(void) {
+    const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int) cores : 1;
+}
+
+/**
+ * @brief Prints the command-line usage
+ *
+ * @param program Name of the executable
+ */
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-w workers] [-c max_clients] [-q high_water_bytes] "
+            "[-p disconnect|drop-oldest] [-b max_batch_bytes] [-l debug|info|warning|error] [-B] "
+            "[-d log_dir] [-f batch|interval|never] [-s segment_bytes] [-e epoll|io_uring] "
+            "[-z zerocopy_bytes] [-i idle_ms] [port]\n", program);
+}
+
 /**
  * @brief Main function
  *
@@ -186,24 +329,153 @@ int server_run(void) {
  */
 int main(const int argc, char *argv[]) {
     int port = SERVER_PORT;
-    
-        if (argc > 1) {
-        port = atoi(argv[1]);
+    int workers = default_worker_count();
+    int max_clients = CLIENT_REGISTRY_DEFAULT_CAPACITY;
+    long high_water = OUTBOUND_QUEUE_DEFAULT_HIGH_WATER;
+    OutboundPolicy policy = OUTBOUND_POLICY_DISCONNECT;
+    long max_batch = OUTBOUND_QUEUE_DEFAULT_MAX_BATCH;
+    LogType log_level;
+    const char *message_log_dir = NULL;
+    MessageLogFsync fsync_policy = MESSAGE_LOG_FSYNC_BATCH;
+    long segment_bytes = MESSAGE_LOG_DEFAULT_SEGMENT_SIZE;
+    EventLoopBackend backend = EVENT_LOOP_BACKEND_EPOLL;
+    long zerocopy_bytes = 0;
+    int idle_ms = CHAT_HANDLER_DEFAULT_IDLE_MS;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:c:q:p:b:l:Bd:f:s:e:z:i:")) != -1) {
+        switch (opt) {
+            case 'w':
+                workers = atoi(optarg);
+                if (workers <= 0) {
+                    fprintf(stderr, "Invalid worker count: %s\n", optarg);
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'c':
+                max_clients = atoi(optarg);
+                if (max_clients <= 0 || max_clients > CLIENT_REGISTRY_MAX_CAPACITY) {
+                    fprintf(stderr, "Invalid client capacity: %s (must be 1-%d)\n", optarg,
+                            CLIENT_REGISTRY_MAX_CAPACITY);
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'q':
+                high_water = atol(optarg);
+                if (high_water <= 0) {
+                    fprintf(stderr, "Invalid outbound high-water mark: %s\n", optarg);
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'p':
+                if (outbound_queue_parse_policy(optarg, &policy) != 0) {
+                    fprintf(stderr, "Invalid slow-consumer policy: %s\n", optarg);
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'b':
+                max_batch = atol(optarg);
+                if (max_batch <= 0) {
+                    fprintf(stderr, "Invalid outbound batch size: %s\n", optarg);
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'l':
+                if (logger_parse_level(optarg, &log_level) != 0) {
+                    fprintf(stderr, "Invalid log level: %s\n", optarg);
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                logger_set_level(log_level);
+                break;
+            case 'B':
+                logger_set_format(LOGGER_FORMAT_BINARY);
+                break;
+            case 'd':
+                message_log_dir = optarg;
+                break;
+            case 'f':
+                if (message_log_parse_fsync(optarg, &fsync_policy) != 0) {
+                    fprintf(stderr, "Invalid fsync policy: %s\n", optarg);
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 's':
+                segment_bytes = atol(optarg);
+                if (segment_bytes < MESSAGE_LOG_MIN_SEGMENT_SIZE) {
+                    fprintf(stderr, "Invalid segment size: %s (must be at least %d)\n", optarg,
+                            MESSAGE_LOG_MIN_SEGMENT_SIZE);
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'e':
+                if (event_loop_parse_backend(optarg, &backend) != 0) {
+                    fprintf(stderr, "Invalid event loop backend: %s\n", optarg);
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'z':
+                zerocopy_bytes = atol(optarg);
+                if (zerocopy_bytes < 0) {
+                    fprintf(stderr, "Invalid zero-copy threshold: %s\n", optarg);
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'i':
+                idle_ms = atoi(optarg);
+                if (idle_ms < 0) {
+                    fprintf(stderr, "Invalid idle time: %s\n", optarg);
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind < argc) {
+        port = atoi(argv[optind]);
         if (port <= 0 || port > 65535) {
-            fprintf(stderr, "Invalid port number: %s\n", argv[1]);
-            fprintf(stderr, "Usage: %s [port]\n", argv[0]);
+            fprintf(stderr, "Invalid port number: %s\n", argv[optind]);
+            usage(argv[0]);
             return EXIT_FAILURE;
         }
     }
-    
-        if (server_init(port) != 0) {
+
+    outbound_queue_configure((size_t) high_water, policy, (size_t) max_batch);
+    outbound_queue_configure_zerocopy((size_t) zerocopy_bytes);
+    message_log_configure(message_log_dir, fsync_policy, (size_t) segment_bytes);
+    event_loop_set_backend(backend);
+    chat_handler_set_idle_timeout(idle_ms);
+
+    if (server_init(port, workers, max_clients) != 0) {
         fprintf(stderr, "Failed to initialize server\n");
         return EXIT_FAILURE;
     }
-    
-        const int result = server_run();
-    
-        server_shutdown();
+
+    logger_log(LOG_INFO, "Outbound queues limited to %ld bytes per client, slow-consumer policy: %s, "
+               "batches of up to %ld bytes", high_water, outbound_queue_policy_name(policy), max_batch);
+    if (zerocopy_bytes > 0) {
+        logger_log(LOG_INFO, "Batches of %ld bytes or more are sent without copying", zerocopy_bytes);
+    }
+    if (idle_ms > 0) {
+        logger_log(LOG_INFO, "Buffers of clients idle for %d ms are trimmed", idle_ms);
+    }
+
+    const int result = server_run(idle_ms);
+
+    server_shutdown();
 
     return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -14,6 +14,7 @@
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -22,15 +23,13 @@
 #include <unistd.h>
 
 /**
- * @brief Creates and initializes a server socket
- *
- * This function creates a socket, sets socket options, binds the socket
- * to the specified port, and starts listening for connections.
+ * @brief Creates, binds and starts listening on a TCP socket
  *
  * @param port The port number to listen on
+ * @param reuse_port Whether to set SO_REUSEPORT so several sockets can share the port
  * @return The socket file descriptor on success, -1 on failure
  */
-int create_server_socket(const int port) {
+static int open_listening_socket(const int port, const int reuse_port) {
     struct sockaddr_in server_addr;
     const int opt = 1;
     
@@ -45,6 +44,12 @@ int create_server_socket(const int port) {
         close(server_socket);
         return -1;
     }
+
+    if (reuse_port && setsockopt(server_socket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        logger_log(LOG_ERROR, "Failed to set SO_REUSEPORT: %s", strerror(errno));
+        close(server_socket);
+        return -1;
+    }
     
         memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
@@ -57,16 +62,60 @@ int create_server_socket(const int port) {
         return -1;
     }
     
-        if (listen(server_socket, 10) < 0) {
+        if (listen(server_socket, SERVER_LISTEN_BACKLOG) < 0) {
         logger_log(LOG_ERROR, "Failed to listen on socket: %s", strerror(errno));
         close(server_socket);
         return -1;
     }
     
+    return server_socket;
+}
+
+/**
+ * @brief Creates and initializes a server socket
+ *
+ * This function creates a socket, sets socket options, binds the socket
+ * to the specified port, and starts listening for connections.
+ *
+ * @param port The port number to listen on
+ * @return The socket file descriptor on success, -1 on failure
+ */
+int create_server_socket(const int port) {
+    const int server_socket = open_listening_socket(port, 0);
+    if (server_socket < 0) {
+        return -1;
+    }
+
     logger_log(LOG_INFO, "Server socket created and listening on port %d", port);
     return server_socket;
 }
 
+/**
+ * @brief Creates a non-blocking SO_REUSEPORT listening socket
+ *
+ * Several of these sockets can be bound to the same port; the kernel
+ * spreads incoming connections across them, so each event loop can
+ * accept on its own socket.
+ *
+ * @param port The port number to listen on
+ * @return The socket file descriptor on success, -1 on failure
+ */
+int create_reuseport_socket(const int port) {
+    const int server_socket = open_listening_socket(port, 1);
+    if (server_socket < 0) {
+        return -1;
+    }
+
+    const int flags = fcntl(server_socket, F_GETFL, 0);
+    if (flags < 0 || fcntl(server_socket, F_SETFL, flags | O_NONBLOCK) < 0) {
+        logger_log(LOG_ERROR, "Failed to make listening socket non-blocking: %s", strerror(errno));
+        close(server_socket);
+        return -1;
+    }
+
+    return server_socket;
+}
+
 /**
  * @brief Accepts a client connection
  *
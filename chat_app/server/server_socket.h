@@ -2,8 +2,14 @@
 #define SERVER_SOCKET_H
 
 #include <stddef.h>
+#include <sys/socket.h>
+
+#ifndef SERVER_LISTEN_BACKLOG
+#define SERVER_LISTEN_BACKLOG SOMAXCONN
+#endif
 
 int create_server_socket(int port);
+int create_reuseport_socket(int port);
 int accept_client_connection(int server_socket, char *client_ip, size_t client_ip_size, int *client_port);
 void close_socket(int socket);
 
@@ -0,0 +1,325 @@
+/**
+ * @file shard.c
+ * @brief Message passing between event-loop shards
+ *
+ * Every event loop is a shard that exclusively owns part of the server's
+ * state, such as a set of rooms. Shards never touch each other's state;
+ * they exchange messages through a mesh of lock-free single-producer
+ * single-consumer queues, one per ordered pair of shards, so messages
+ * from one shard to another arrive in the order they were sent.
+ *
+ * A producer that finds a queue full parks the message in a private
+ * overflow list and marks the queue. The consumer signals the producer
+ * again once it has drained a marked queue, and the producer moves its
+ * overflow into the queue from its own mailbox callback.
+ *
+ * @author Jeremiah Hughes & Anthony Patton
+ * @date April 2025
+ */
+
+#include "shard.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "event_loop.h"
+#include "spsc_queue.h"
+#include "../common/logger.h"
+
+typedef struct {
+    SpscQueue queue;
+    atomic_int producer_waiting;
+    void **overflow;
+    int overflow_head;
+    int overflow_count;
+    int overflow_capacity;
+} ShardChannel;
+
+static ShardChannel *channels = NULL;
+static int count = 0;
+static ShardHandler handler = NULL;
+static ShardRelease release = NULL;
+
+/**
+ * @brief Returns the channel carrying messages from one shard to another
+ *
+ * @param source The producing shard
+ * @param target The consuming shard
+ * @return The channel
+ */
+static ShardChannel *channel_between(const int source, const int target) {
+    return &channels[source * count + target];
+}
+
+/**
+ * @brief Moves parked messages into a channel's queue
+ *
+ * Runs on the producing shard, and signals the consuming shard if any
+ * message was moved. When the queue fills up the channel is marked
+ * before one last retry, so a consumer that drained the queue in the
+ * meantime is guaranteed to either make room for the retry or see the
+ * mark and signal the producer.
+ *
+ * @param channel The channel to flush
+ * @param target The consuming shard
+ * @return 1 if messages are still parked, 0 otherwise
+ */
+static int flush_overflow(ShardChannel *channel, const int target) {
+    int moved = 0;
+
+    while (channel->overflow_count > 0) {
+        void *message = channel->overflow[channel->overflow_head];
+
+        if (spsc_queue_push(&channel->queue, message) != 0) {
+            atomic_store(&channel->producer_waiting, 1);
+            atomic_thread_fence(memory_order_seq_cst);
+            if (spsc_queue_push(&channel->queue, message) != 0) {
+                break;
+            }
+        }
+
+        channel->overflow_head++;
+        channel->overflow_count--;
+        moved++;
+    }
+
+    if (moved > 0) {
+        event_loop_signal(event_loop_pool_get(target));
+    }
+
+    if (channel->overflow_count > 0) {
+        return 1;
+    }
+
+    channel->overflow_head = 0;
+    return 0;
+}
+
+/**
+ * @brief Parks a message that did not fit in a channel's queue
+ *
+ * @param channel The channel
+ * @param message The message to park
+ * @return 0 on success, -1 on allocation failure
+ */
+static int park_message(ShardChannel *channel, void *message) {
+    const int end = channel->overflow_head + channel->overflow_count;
+
+    if (end == channel->overflow_capacity) {
+        if (channel->overflow_head > 0) {
+            for (int i = 0; i < channel->overflow_count; i++) {
+                channel->overflow[i] = channel->overflow[channel->overflow_head + i];
+            }
+            channel->overflow_head = 0;
+        } else {
+            const int new_capacity = channel->overflow_capacity ? channel->overflow_capacity * 2 : 64;
+            void **overflow = realloc(channel->overflow, new_capacity * sizeof(void *));
+            if (!overflow) {
+                logger_log(LOG_ERROR, "Failed to allocate memory for shard overflow");
+                return -1;
+            }
+            channel->overflow = overflow;
+            channel->overflow_capacity = new_capacity;
+        }
+    }
+
+    channel->overflow[channel->overflow_head + channel->overflow_count++] = message;
+    return 0;
+}
+
+/**
+ * @brief Mailbox callback of the event loops
+ *
+ * Retries the shard's parked outgoing messages, then delivers the
+ * messages waiting in each of its incoming queues. At most one queue's
+ * worth is taken from each queue per call so a busy producer cannot
+ * starve the loop's sockets; the loop signals itself if more remain.
+ *
+ * @param loop The event loop being signalled
+ */
+static void shard_mailbox(EventLoop *loop) {
+    const int shard = event_loop_index(loop);
+    int pending = 0;
+
+    for (int target = 0; target < count; target++) {
+        flush_overflow(channel_between(shard, target), target);
+    }
+
+    for (int source = 0; source < count; source++) {
+        ShardChannel *channel = channel_between(source, shard);
+        int delivered = 0;
+        void *message;
+
+        while (delivered < SHARD_QUEUE_CAPACITY && (message = spsc_queue_pop(&channel->queue)) != NULL) {
+            handler(shard, message);
+            delivered++;
+        }
+
+        if (delivered == SHARD_QUEUE_CAPACITY) {
+            pending = 1;
+        }
+
+        if (delivered > 0) {
+            atomic_thread_fence(memory_order_seq_cst);
+            if (atomic_exchange(&channel->producer_waiting, 0)) {
+                event_loop_signal(event_loop_pool_get(source));
+            }
+        }
+    }
+
+    if (pending) {
+        event_loop_signal(loop);
+    }
+}
+
+/**
+ * @brief Sets up the queues between every pair of shards
+ *
+ * The event-loop pool must be running with one loop per shard, and no
+ * messages may be sent before this returns.
+ *
+ * @param shard_count Number of shards, equal to the number of event loops
+ * @param message_handler Function that handles a message on its target shard
+ * @param message_release Function that frees a message that was never delivered
+ * @return 0 on success, -1 on failure
+ */
+int shard_init(const int shard_count, const ShardHandler message_handler, const ShardRelease message_release) {
+    if (shard_count <= 0 || shard_count != event_loop_pool_size() || !message_handler) {
+        logger_log(LOG_ERROR, "Invalid shard configuration (%d shards, %d event loops)",
+                   shard_count, event_loop_pool_size());
+        return -1;
+    }
+
+    channels = calloc((size_t) shard_count * shard_count, sizeof(ShardChannel));
+    if (!channels) {
+        logger_log(LOG_ERROR, "Failed to allocate memory for shard channels");
+        return -1;
+    }
+
+    count = shard_count;
+    handler = message_handler;
+    release = message_release;
+
+    for (int i = 0; i < count * count; i++) {
+        atomic_init(&channels[i].producer_waiting, 0);
+        if (spsc_queue_init(&channels[i].queue, SHARD_QUEUE_CAPACITY) != 0) {
+            shard_destroy();
+            return -1;
+        }
+    }
+
+    event_loop_set_mailbox_callback(shard_mailbox);
+
+    logger_log(LOG_INFO, "Initialized %d shard%s", count, count == 1 ? "" : "s");
+    return 0;
+}
+
+/**
+ * @brief Frees the shard queues and every message still in them
+ *
+ * The event loops must already be stopped.
+ */
+void shard_destroy(void) {
+    if (!channels) {
+        return;
+    }
+
+    for (int i = 0; i < count * count; i++) {
+        ShardChannel *channel = &channels[i];
+        void *message;
+
+        if (channel->queue.slots) {
+            while ((message = spsc_queue_pop(&channel->queue)) != NULL) {
+                if (release) {
+                    release(message);
+                }
+            }
+            spsc_queue_destroy(&channel->queue);
+        }
+
+        for (int j = 0; j < channel->overflow_count; j++) {
+            if (release) {
+                release(channel->overflow[channel->overflow_head + j]);
+            }
+        }
+        free(channel->overflow);
+    }
+
+    event_loop_set_mailbox_callback(NULL);
+    free(channels);
+    channels = NULL;
+    count = 0;
+    handler = NULL;
+    release = NULL;
+}
+
+/**
+ * @brief Returns the number of shards
+ *
+ * @return The shard count, or 0 if sharding is not initialized
+ */
+int shard_count(void) {
+    return count;
+}
+
+/**
+ * @brief Returns the shard running on the calling thread
+ *
+ * @return The shard index, or -1 if not called from an event loop
+ */
+int shard_current(void) {
+    const EventLoop *loop = event_loop_current();
+    return loop ? event_loop_index(loop) : -1;
+}
+
+/**
+ * @brief Maps a key to the shard that owns it
+ *
+ * The key is hashed with 32-bit FNV-1a, so every shard computes the
+ * same owner without coordination.
+ *
+ * @param key The key, typically a room name
+ * @param max_length Maximum number of bytes of the key to hash
+ * @return The owning shard
+ */
+int shard_for_key(const char *key, const size_t max_length) {
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < max_length && key[i] != '\0'; i++) {
+        hash ^= (uint8_t) key[i];
+        hash *= 16777619u;
+    }
+
+    return count > 0 ? (int) (hash % (uint32_t) count) : 0;
+}
+
+/**
+ * @brief Sends a message to a shard
+ *
+ * Must be called from an event loop. The message is handed to the target
+ * shard's handler on its own thread after the target's current batch of
+ * events, and messages from one shard to another keep their order. A
+ * shard may send messages to itself.
+ *
+ * @param shard The target shard
+ * @param message The message; ownership passes to the shard module
+ * @return 0 on success, -1 on failure, in which case the caller keeps the message
+ */
+int shard_send(const int shard, void *message) {
+    const int source = shard_current();
+    if (!channels || source < 0 || shard < 0 || shard >= count || !message) {
+        return -1;
+    }
+
+    ShardChannel *channel = channel_between(source, shard);
+
+    if (channel->overflow_count > 0 || spsc_queue_push(&channel->queue, message) != 0) {
+        if (park_message(channel, message) != 0) {
+            return -1;
+        }
+        flush_overflow(channel, shard);
+        return 0;
+    }
+
+    return event_loop_signal(event_loop_pool_get(shard));
+}
@@ -0,0 +1,18 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stddef.h>
+
+#define SHARD_QUEUE_CAPACITY 1024
+
+typedef void (*ShardHandler)(int shard, void *message);
+typedef void (*ShardRelease)(void *message);
+
+int shard_init(int count, ShardHandler handler, ShardRelease release);
+void shard_destroy(void);
+int shard_count(void);
+int shard_current(void);
+int shard_for_key(const char *key, size_t max_length);
+int shard_send(int shard, void *message);
+
+#endif
@@ -0,0 +1,101 @@
+/**
+ * @file spsc_queue.c
+ * @brief Bounded lock-free single-producer single-consumer queue
+ *
+ * A power-of-two ring of pointers with the producer and consumer indices
+ * on separate cache lines. Each side keeps a cached copy of the other
+ * side's index and only reloads it when the ring looks full or empty,
+ * so in the steady state a push or pop touches no shared cache line
+ * other than the slot itself.
+ *
+ * @author Jeremiah Hughes & Anthony Patton
+ * @date April 2025
+ */
+
+#include "spsc_queue.h"
+
+#include <stdlib.h>
+#include "../common/logger.h"
+
+/**
+ * @brief Initializes an empty queue
+ *
+ * @param queue The queue to initialize
+ * @param capacity Number of slots, rounded up to a power of two
+ * @return 0 on success, -1 on allocation failure
+ */
+int spsc_queue_init(SpscQueue *queue, const size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    queue->slots = calloc(size, sizeof(void *));
+    if (!queue->slots) {
+        logger_log(LOG_ERROR, "Failed to allocate memory for SPSC queue");
+        return -1;
+    }
+
+    queue->mask = size - 1;
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    queue->cached_head = 0;
+    queue->cached_tail = 0;
+
+    return 0;
+}
+
+/**
+ * @brief Releases the queue's slots
+ *
+ * Items still in the queue are not freed.
+ *
+ * @param queue The queue to destroy
+ */
+void spsc_queue_destroy(SpscQueue *queue) {
+    free(queue->slots);
+    queue->slots = NULL;
+}
+
+/**
+ * @brief Appends an item; only the producer thread may call this
+ *
+ * @param queue The queue
+ * @param item The item to append, not NULL
+ * @return 0 on success, -1 if the queue is full
+ */
+int spsc_queue_push(SpscQueue *queue, void *item) {
+    const size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+
+    if (tail - queue->cached_head > queue->mask) {
+        queue->cached_head = atomic_load_explicit(&queue->head, memory_order_acquire);
+        if (tail - queue->cached_head > queue->mask) {
+            return -1;
+        }
+    }
+
+    queue->slots[tail & queue->mask] = item;
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+/**
+ * @brief Removes the oldest item; only the consumer thread may call this
+ *
+ * @param queue The queue
+ * @return The item, or NULL if the queue is empty
+ */
+void *spsc_queue_pop(SpscQueue *queue) {
+    const size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+
+    if (head == queue->cached_tail) {
+        queue->cached_tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+        if (head == queue->cached_tail) {
+            return NULL;
+        }
+    }
+
+    void *item = queue->slots[head & queue->mask];
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return item;
+}
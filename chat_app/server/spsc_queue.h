@@ -0,0 +1,23 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define SPSC_QUEUE_CACHE_LINE 64
+
+typedef struct {
+    void **slots;
+    size_t mask;
+    _Alignas(SPSC_QUEUE_CACHE_LINE) atomic_size_t head;
+    size_t cached_tail;
+    _Alignas(SPSC_QUEUE_CACHE_LINE) atomic_size_t tail;
+    size_t cached_head;
+} SpscQueue;
+
+int spsc_queue_init(SpscQueue *queue, size_t capacity);
+void spsc_queue_destroy(SpscQueue *queue);
+int spsc_queue_push(SpscQueue *queue, void *item);
+void *spsc_queue_pop(SpscQueue *queue);
+
+#endif
@@ -0,0 +1,122 @@
+/**
+ * @file user_list.c
+ * @brief Splits a list of user names into MSG_USER_LIST pages
+ *
+ * A page holds a header followed by user names, each NUL-terminated, and
+ * is at most USER_LIST_PAGE_SIZE bytes. A list that fits in one page gets
+ * the plain "Users" header older clients expect; longer lists are split
+ * into pages headed "Users <page>/<pages>", numbered from 1, which the
+ * client puts back together. An empty list is sent as the single name
+ * "No users".
+ *
+ * @author Jeremiah Hughes & Anthony Patton
+ * @date April 2025
+ */
+
+#include "user_list.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../common/logger.h"
+#include "../common/protocol.h"
+
+#define USER_LIST_HEADER_BUDGET 24
+#define USER_LIST_EMPTY "No users"
+
+/**
+ * @brief Splits names into pages
+ *
+ * Each page starts with reserve bytes left for the caller to fill in,
+ * and lengths include them.
+ *
+ * @param names The names, each NUL-terminated and shorter than MAX_USERNAME_LEN
+ * @param name_count Number of names
+ * @param reserve Bytes to leave free at the start of each page
+ * @param pages Receives the pages; free with user_list_free()
+ * @return 0 on success, -1 on failure
+ */
+int user_list_paginate(const char *const *names, const int name_count, const uint32_t reserve,
+                       UserListPages *pages) {
+    static const char *const empty[] = {USER_LIST_EMPTY};
+    const uint32_t capacity = reserve + USER_LIST_PAGE_SIZE;
+
+    memset(pages, 0, sizeof(*pages));
+
+    if (name_count == 0) {
+        return user_list_paginate(empty, 1, reserve, pages);
+    }
+
+    int *first_name = malloc((name_count + 1) * sizeof(int));
+    if (!first_name) {
+        logger_log(LOG_ERROR, "Failed to allocate memory for user list pages");
+        return -1;
+    }
+
+    int count = 0;
+    uint32_t used = capacity;
+    for (int i = 0; i < name_count; i++) {
+        const uint32_t length = (uint32_t) strnlen(names[i], MAX_USERNAME_LEN - 1) + 1;
+        if (used + length > capacity) {
+            first_name[count++] = i;
+            used = reserve + USER_LIST_HEADER_BUDGET;
+        }
+        used += length;
+    }
+    first_name[count] = name_count;
+
+    pages->pages = calloc(count, sizeof(uint8_t *));
+    pages->lengths = calloc(count, sizeof(uint32_t));
+    if (!pages->pages || !pages->lengths) {
+        logger_log(LOG_ERROR, "Failed to allocate memory for user list pages");
+        free(first_name);
+        user_list_free(pages);
+        return -1;
+    }
+    pages->count = count;
+
+    for (int page = 0; page < count; page++) {
+        uint8_t *out = calloc(1, capacity);
+        if (!out) {
+            logger_log(LOG_ERROR, "Failed to allocate memory for user list pages");
+            free(first_name);
+            user_list_free(pages);
+            return -1;
+        }
+        pages->pages[page] = out;
+
+        uint32_t offset = reserve;
+        if (count == 1) {
+            offset += (uint32_t) snprintf((char *) out + offset, USER_LIST_HEADER_BUDGET, "%s", USER_LIST_HEADER) + 1;
+        } else {
+            offset += (uint32_t) snprintf((char *) out + offset, USER_LIST_HEADER_BUDGET, "%s %d/%d",
+                                          USER_LIST_HEADER, page + 1, count) + 1;
+        }
+
+        for (int i = first_name[page]; i < first_name[page + 1]; i++) {
+            const size_t length = strnlen(names[i], MAX_USERNAME_LEN - 1);
+            memcpy(out + offset, names[i], length);
+            offset += (uint32_t) length + 1;
+        }
+
+        pages->lengths[page] = offset;
+    }
+
+    free(first_name);
+    return 0;
+}
+
+/**
+ * @brief Frees pages built by user_list_paginate()
+ *
+ * @param pages The pages
+ */
+void user_list_free(UserListPages *pages) {
+    for (int i = 0; pages->pages && i < pages->count; i++) {
+        free(pages->pages[i]);
+    }
+
+    free(pages->pages);
+    free(pages->lengths);
+    memset(pages, 0, sizeof(*pages));
+}
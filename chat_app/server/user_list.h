@@ -0,0 +1,15 @@
+#ifndef USER_LIST_H
+#define USER_LIST_H
+
+#include <stdint.h>
+
+typedef struct {
+    int count;
+    uint8_t **pages;
+    uint32_t *lengths;
+} UserListPages;
+
+int user_list_paginate(const char *const *names, int name_count, uint32_t reserve, UserListPages *pages);
+void user_list_free(UserListPages *pages);
+
+#endif
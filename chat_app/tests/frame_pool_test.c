@@ -0,0 +1,165 @@
+/**
+ * @file frame_pool_test.c
+ * @brief Tests for the frame pool's size classes and accounting
+ *
+ * Encodes one frame for every size class, and one too large for any,
+ * then frees them on the encoding thread and on a second thread the
+ * way event loops free frames other loops encoded. Every frame must land
+ * in the class its size calls for, a freed frame must be reused, and
+ * the pool must end up with no frame outstanding.
+ *
+ * @author Jeremiah Hughes & Anthony Patton
+ * @date April 2025
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "common/frame.h"
+
+#define CHECK(condition)                                                              \
+    do {                                                                              \
+        if (!(condition)) {                                                           \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                               \
+        }                                                                             \
+    } while (0)
+
+#define TEST_CASES (FRAME_POOL_CLASSES + 1)
+#define TEST_UNPOOLED 0xFF
+
+static int failures = 0;
+
+static uint8_t payload[128 * 1024];
+
+/* Payload sizes that fill each size class, and one that fits none. */
+static const uint32_t payload_sizes[TEST_CASES] = {
+    32,
+    sizeof(NicknameResponse),
+    sizeof(ChatMessage),
+    sizeof(Roster),
+    32 * 1024,
+    sizeof(payload)
+};
+
+/**
+ * @brief Encodes a legacy frame with a payload of the given size
+ *
+ * @param length Length of the payload
+ * @return The frame
+ */
+static Frame *encode(const uint32_t length) {
+    return frame_encode(PROTOCOL_VERSION_LEGACY, MSG_USER_LIST, payload, length);
+}
+
+/**
+ * @brief Encodes one frame per test case and checks its size class
+ *
+ * @param frames Receives the frames
+ */
+static void encode_all(Frame **frames) {
+    for (int i = 0; i < TEST_CASES; i++) {
+        frames[i] = encode(payload_sizes[i]);
+        CHECK(frames[i] != NULL);
+        if (frames[i]) {
+            CHECK(frames[i]->length == PROTOCOL_HEADER_SIZE + payload_sizes[i]);
+            CHECK(frames[i]->size_class == (i < FRAME_POOL_CLASSES ? i : TEST_UNPOOLED));
+        }
+    }
+}
+
+/**
+ * @brief Drops the last reference to each frame it is given
+ *
+ * @param arg Array of TEST_CASES frames
+ * @return NULL
+ */
+static void *release_frames(void *arg) {
+    Frame **frames = arg;
+
+    for (int i = 0; i < TEST_CASES; i++) {
+        frame_unref(frames[i]);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Checks that frames freed on the encoding thread are reused
+ */
+static void test_same_thread(void) {
+    Frame *frames[TEST_CASES];
+    FramePoolStats stats;
+
+    encode_all(frames);
+    frame_pool_stats(&stats);
+    CHECK(stats.outstanding == TEST_CASES);
+
+    for (int i = 0; i < TEST_CASES; i++) {
+        frame_unref(frames[i]);
+    }
+    frame_pool_stats(&stats);
+    CHECK(stats.outstanding == 0);
+
+    const uint64_t hits = stats.hits;
+    encode_all(frames);
+    frame_pool_stats(&stats);
+    CHECK(stats.hits - hits == FRAME_POOL_CLASSES);
+
+    release_frames(frames);
+    frame_pool_stats(&stats);
+    CHECK(stats.outstanding == 0);
+}
+
+/**
+ * @brief Checks the accounting of frames freed by another thread
+ */
+static void test_other_thread(void) {
+    Frame *frames[TEST_CASES];
+    FramePoolStats stats;
+
+    encode_all(frames);
+    for (int i = 0; i < TEST_CASES; i++) {
+        frame_ref(frames[i]);
+    }
+
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, release_frames, frames) == 0);
+    pthread_join(thread, NULL);
+
+    frame_pool_stats(&stats);
+    CHECK(stats.outstanding == TEST_CASES);
+
+    pthread_create(&thread, NULL, release_frames, frames);
+    pthread_join(thread, NULL);
+
+    frame_pool_stats(&stats);
+    CHECK(stats.outstanding == 0);
+}
+
+/**
+ * @brief Runs the frame pool tests
+ *
+ * @return 0 if every check passed, 1 otherwise
+ */
+int main(void) {
+    memset(payload, 0x5A, sizeof(payload));
+
+    test_same_thread();
+    test_other_thread();
+    frame_pool_shutdown();
+
+    FramePoolStats stats;
+    frame_pool_stats(&stats);
+    CHECK(stats.outstanding == 0);
+    CHECK(stats.hits + stats.misses == 3 * TEST_CASES);
+
+    if (failures > 0) {
+        fprintf(stderr, "%d frame pool check%s failed\n", failures, failures == 1 ? "" : "s");
+        return 1;
+    }
+
+    printf("All frame pool checks passed\n");
+    return 0;
+}
@@ -0,0 +1,229 @@
+/**
+ * @file message_log_test.c
+ * @brief Tests for recovery of the durable message log
+ *
+ * Fills more than one segment, tears a record in the last segment by
+ * corrupting its checksum, as a crash in the middle of a write would,
+ * and reopens the log. Recovery must end the log at the torn record:
+ * the next offset is the torn record's, replay stops in front of it and
+ * the next append takes its place, for good.
+ *
+ * @author Jeremiah Hughes & Anthony Patton
+ * @date April 2025
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "server/message_log.h"
+
+#define CHECK(condition)                                                              \
+    do {                                                                              \
+        if (!(condition)) {                                                           \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                               \
+        }                                                                             \
+    } while (0)
+
+/* A record header is an 8-byte offset followed by 32-bit length, type,
+ * checksum and reserved fields; with this payload a record takes 1 KB. */
+#define TEST_HEADER_SIZE 24
+#define TEST_CHECKSUM_OFFSET 16
+#define TEST_PAYLOAD (1024 - TEST_HEADER_SIZE)
+#define TEST_RECORD_SIZE 1024
+#define TEST_PER_SEGMENT (MESSAGE_LOG_MIN_SEGMENT_SIZE / TEST_RECORD_SIZE)
+#define TEST_RECORDS (TEST_PER_SEGMENT + TEST_PER_SEGMENT / 2)
+#define TEST_TORN (TEST_PER_SEGMENT + 10)
+#define TEST_TYPE 3
+
+static int failures = 0;
+
+/**
+ * @brief What a replay saw
+ */
+typedef struct {
+    uint64_t first;
+    uint64_t next;
+    int count;
+    int in_order;
+} Replayed;
+
+/**
+ * @brief Fills a payload with bytes derived from its record's number
+ *
+ * @param payload Receives the payload
+ * @param number Number of the record
+ */
+static void fill_payload(uint8_t *payload, const uint64_t number) {
+    for (size_t i = 0; i < TEST_PAYLOAD; i++) {
+        payload[i] = (uint8_t) (number * 31 + i);
+    }
+}
+
+/**
+ * @brief Checks a replayed record against what was appended
+ *
+ * @param offset Offset of the record
+ * @param type Message type of the record
+ * @param data The payload
+ * @param length Length of the payload
+ * @param ctx The Replayed being filled in
+ */
+static void visit(const uint64_t offset, const uint32_t type, const void *data, const uint32_t length, void *ctx) {
+    Replayed *replayed = ctx;
+    uint8_t expected[TEST_PAYLOAD];
+
+    fill_payload(expected, offset);
+    if (replayed->count == 0) {
+        replayed->first = offset;
+    } else if (offset != replayed->next) {
+        replayed->in_order = 0;
+    }
+    replayed->next = offset + 1;
+    replayed->count++;
+
+    CHECK(type == TEST_TYPE);
+    CHECK(length == TEST_PAYLOAD);
+    CHECK(length != TEST_PAYLOAD || memcmp(data, expected, TEST_PAYLOAD) == 0);
+}
+
+/**
+ * @brief Replays the log from an offset
+ *
+ * @param from Offset of the first record to visit
+ * @return What the replay saw
+ */
+static Replayed replay(const uint64_t from) {
+    Replayed replayed = {0, 0, 0, 1};
+    CHECK(message_log_replay(from, visit, &replayed) == 0);
+    return replayed;
+}
+
+/**
+ * @brief Appends a numbered record
+ *
+ * @param number Number of the record, which is also its expected offset
+ */
+static void append(const uint64_t number) {
+    uint8_t payload[TEST_PAYLOAD];
+    fill_payload(payload, number);
+    CHECK(message_log_next_offset() == number);
+    CHECK(message_log_append(TEST_TYPE, payload, TEST_PAYLOAD) == 0);
+}
+
+/**
+ * @brief Flips the checksum of a record in a segment file
+ *
+ * @param directory The log directory
+ * @param base Offset of the segment's first record
+ * @param offset Offset of the record
+ */
+static void tear_record(const char *directory, const uint64_t base, const uint64_t offset) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%020" PRIu64 ".log", directory, base);
+
+    const int fd = open(path, O_RDWR);
+    CHECK(fd >= 0);
+    if (fd < 0) {
+        return;
+    }
+
+    const off_t position = (off_t) ((offset - base) * TEST_RECORD_SIZE + TEST_CHECKSUM_OFFSET);
+    uint8_t byte = 0;
+    CHECK(pread(fd, &byte, 1, position) == 1);
+    byte ^= 0xFF;
+    CHECK(pwrite(fd, &byte, 1, position) == 1);
+    close(fd);
+}
+
+/**
+ * @brief Removes one entry of the log directory
+ *
+ * @param path Path of the entry
+ * @param status Unused
+ * @param flag Unused
+ * @param ftw Unused
+ * @return 0 to keep walking
+ */
+static int remove_entry(const char *path, const struct stat *status, const int flag, struct FTW *ftw) {
+    (void) status;
+    (void) flag;
+    (void) ftw;
+    remove(path);
+    return 0;
+}
+
+/**
+ * @brief Writes across a segment boundary, tears a record and recovers
+ *
+ * @param directory An empty directory for the log
+ */
+static void test_torn_record(const char *directory) {
+    message_log_configure(directory, MESSAGE_LOG_FSYNC_NEVER, MESSAGE_LOG_MIN_SEGMENT_SIZE);
+    CHECK(message_log_open() == 0);
+
+    for (uint64_t i = 0; i < TEST_RECORDS; i++) {
+        append(i);
+    }
+    CHECK(message_log_next_offset() == TEST_RECORDS);
+
+    Replayed all = replay(0);
+    CHECK(all.count == TEST_RECORDS && all.first == 0 && all.in_order);
+    Replayed tail = replay(TEST_PER_SEGMENT + 1);
+    CHECK(tail.count == TEST_RECORDS - TEST_PER_SEGMENT - 1 && tail.first == TEST_PER_SEGMENT + 1);
+
+    message_log_close();
+    tear_record(directory, TEST_PER_SEGMENT, TEST_TORN);
+
+    CHECK(message_log_open() == 0);
+    CHECK(message_log_next_offset() == TEST_TORN);
+
+    Replayed recovered = replay(0);
+    CHECK(recovered.count == TEST_TORN && recovered.first == 0 && recovered.in_order);
+    CHECK(recovered.next == TEST_TORN);
+
+    append(TEST_TORN);
+    append(TEST_TORN + 1);
+    Replayed resumed = replay(TEST_TORN - 1);
+    CHECK(resumed.count == 3 && resumed.first == TEST_TORN - 1 && resumed.next == TEST_TORN + 2);
+    message_log_close();
+
+    /* The records written after the torn one before the crash must not
+     * come back behind the new ones. */
+    CHECK(message_log_open() == 0);
+    CHECK(message_log_next_offset() == TEST_TORN + 2);
+    Replayed reopened = replay(0);
+    CHECK(reopened.count == TEST_TORN + 2 && reopened.in_order);
+    message_log_close();
+}
+
+/**
+ * @brief Runs the message log tests
+ *
+ * @return 0 if every check passed, 1 otherwise
+ */
+int main(void) {
+    char directory[] = "/tmp/message-log-test-XXXXXX";
+    if (!mkdtemp(directory)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    test_torn_record(directory);
+    nftw(directory, remove_entry, 8, FTW_DEPTH | FTW_PHYS);
+
+    if (failures > 0) {
+        fprintf(stderr, "%d message log check%s failed\n", failures, failures == 1 ? "" : "s");
+        return 1;
+    }
+
+    printf("All message log checks passed\n");
+    return 0;
+}
@@ -0,0 +1,337 @@
+/**
+ * @file outbound_queue_test.c
+ * @brief Tests for paged snapshots in the outbound queue
+ *
+ * A client that joins a busy server is sent its nickname response, the
+ * welcome messages, a user list of several pages and the joins that
+ * follow, all before its event loop first flushes. The queue must hand
+ * the whole burst over under every slow-consumer policy, and must only
+ * ever replace snapshots as complete sets of pages. Sends prepared once
+ * the loop has warmed up must come from its cache, not the heap.
+ *
+ * @author Jeremiah Hughes & Anthony Patton
+ * @date April 2025
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "common/frame.h"
+#include "server/outbound_queue.h"
+#include "server/user_list.h"
+
+#define CHECK(condition)                                                              \
+    do {                                                                              \
+        if (!(condition)) {                                                           \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                               \
+        }                                                                             \
+    } while (0)
+
+#define TEST_HIGH_WATER 12000
+#define TEST_USERS 400
+#define TEST_JOINS 50
+#define TEST_SENDS 4
+
+static int failures = 0;
+
+/**
+ * @brief Encodes a message as a legacy frame
+ *
+ * @param type The message type
+ * @param data The message data
+ * @param data_length The length of the message data
+ * @return The frame
+ */
+static Frame *encode(const MessageType type, const void *data, const uint32_t data_length) {
+    return frame_encode(PROTOCOL_VERSION_LEGACY, type, data, data_length);
+}
+
+/**
+ * @brief Encodes a snapshot as the chat handler does
+ *
+ * @param type MSG_USER_LIST or MSG_ROSTER
+ * @param snapshot Identifier shared by the pages
+ * @param users Number of users listed
+ * @param frames Receives the pages, at most 16
+ * @return Number of pages
+ */
+static int encode_snapshot(const MessageType type, const uint32_t snapshot, const int users, Frame **frames) {
+    static char storage[TEST_USERS][MAX_USERNAME_LEN];
+    const char *names[TEST_USERS];
+    const uint32_t reserve = type == MSG_ROSTER ? sizeof(uint32_t) : 0;
+
+    for (int i = 0; i < users; i++) {
+        snprintf(storage[i], sizeof(storage[i]), "a_user_with_a_long_nickname%04d", i);
+        names[i] = storage[i];
+    }
+
+    UserListPages pages;
+    if (user_list_paginate(names, users, reserve, &pages) != 0) {
+        return 0;
+    }
+
+    const int count = pages.count < 16 ? pages.count : 16;
+    for (int i = 0; i < count; i++) {
+        if (reserve) {
+            memcpy(pages.pages[i], &snapshot, sizeof(snapshot));
+        }
+        frames[i] = encode(type, pages.pages[i], pages.lengths[i]);
+        frames[i]->snapshot = snapshot;
+        frames[i]->page = (uint16_t) i;
+    }
+
+    user_list_free(&pages);
+    return count;
+}
+
+/**
+ * @brief Pushes a frame and drops the caller's reference
+ *
+ * @param queue The queue
+ * @param frame The frame
+ */
+static void push(OutboundQueue *queue, Frame *frame) {
+    CHECK(outbound_queue_push(queue, frame) >= 0);
+    frame_unref(frame);
+}
+
+/**
+ * @brief Returns a queued frame
+ *
+ * @param queue The queue
+ * @param index Position from the head
+ * @return The frame
+ */
+static const Frame *queued(const OutboundQueue *queue, const uint32_t index) {
+    return queue->frames[(queue->head + index) % queue->capacity];
+}
+
+/**
+ * @brief Checks that a whole snapshot is queued in order from a position
+ *
+ * @param queue The queue
+ * @param index Position of the first page
+ * @param snapshot Identifier of the snapshot
+ * @param pages Number of pages
+ */
+static void check_snapshot(const OutboundQueue *queue, const uint32_t index, const uint32_t snapshot,
+                           const int pages) {
+    CHECK(index + pages <= queue->count);
+    for (int i = 0; i < pages && index + i < queue->count; i++) {
+        CHECK(queued(queue, index + i)->snapshot == snapshot);
+        CHECK(queued(queue, index + i)->page == i);
+    }
+}
+
+/**
+ * @brief Queues the burst a client gets when it joins, under one policy
+ *
+ * @param policy The slow-consumer policy
+ */
+static void test_join_burst(const OutboundPolicy policy) {
+    outbound_queue_configure(TEST_HIGH_WATER, policy, OUTBOUND_QUEUE_DEFAULT_MAX_BATCH);
+
+    OutboundQueue queue;
+    CHECK(outbound_queue_init(&queue) == 0);
+
+    NicknameResponse response;
+    memset(&response, 0, sizeof(response));
+    response.status = STATUS_SUCCESS;
+    ChatMessage welcome;
+    memset(&welcome, 0, sizeof(welcome));
+    strcpy(welcome.username, "Server");
+    strcpy(welcome.message, "Welcome to the chat server");
+
+    push(&queue, encode(MSG_NICKNAME_RESPONSE, &response, sizeof(response)));
+    push(&queue, encode(MSG_CHAT, &welcome, sizeof(welcome)));
+    push(&queue, encode(MSG_CHAT, &welcome, sizeof(welcome)));
+
+    Frame *pages[16];
+    const int page_count = encode_snapshot(MSG_USER_LIST, 1, TEST_USERS, pages);
+    CHECK(page_count >= 3);
+    size_t list_bytes = 0;
+    for (int i = 0; i < page_count; i++) {
+        list_bytes += pages[i]->length;
+        push(&queue, pages[i]);
+    }
+    CHECK(list_bytes > TEST_HIGH_WATER);
+
+    UserNotification join;
+    memset(&join, 0, sizeof(join));
+    for (int i = 0; i < TEST_JOINS; i++) {
+        snprintf(join.username, sizeof(join.username), "late_%d", i);
+        push(&queue, encode(MSG_USER_JOIN, &join, sizeof(join)));
+    }
+
+    CHECK(!queue.overflowed);
+    CHECK(queue.dropped_frames == 0);
+    CHECK(queue.count == (uint32_t) (3 + page_count + TEST_JOINS));
+    CHECK(queue.count > 0 && queued(&queue, 0)->type == MSG_NICKNAME_RESPONSE);
+    check_snapshot(&queue, 3, 1, page_count);
+
+    outbound_queue_destroy(&queue);
+}
+
+/**
+ * @brief Checks that a newer snapshot replaces older ones as whole sets
+ *
+ * @param policy The slow-consumer policy
+ */
+static void test_superseded_lists(const OutboundPolicy policy) {
+    outbound_queue_configure(TEST_HIGH_WATER, policy, 1);
+
+    OutboundQueue queue;
+    CHECK(outbound_queue_init(&queue) == 0);
+
+    Frame *older[16];
+    Frame *newer[16];
+    Frame *newest[16];
+    const int page_count = encode_snapshot(MSG_USER_LIST, 1, TEST_USERS, older);
+    encode_snapshot(MSG_USER_LIST, 2, TEST_USERS, newer);
+    encode_snapshot(MSG_USER_LIST, 3, TEST_USERS, newest);
+
+    for (int i = 0; i < page_count; i++) {
+        push(&queue, older[i]);
+    }
+    for (int i = 0; i < page_count; i++) {
+        push(&queue, newer[i]);
+    }
+
+    CHECK(queue.count == (uint32_t) page_count);
+    check_snapshot(&queue, 0, 2, page_count);
+
+    /* With the first page of a list on the wire, that list must go out whole. */
+    OutboundSend send;
+    CHECK(outbound_queue_prepare(&queue, &send) == OUTBOUND_FLUSH_BLOCKED);
+    CHECK(send.count == 1);
+
+    for (int i = 0; i < page_count; i++) {
+        push(&queue, newest[i]);
+    }
+
+    CHECK(queue.count == (uint32_t) (2 * page_count));
+    check_snapshot(&queue, 0, 2, page_count);
+    check_snapshot(&queue, page_count, 3, page_count);
+
+    outbound_queue_complete(&queue, send.bytes, send.bytes);
+    outbound_queue_release_send(&send);
+    CHECK(queue.snapshot_bytes == queue.bytes);
+
+    outbound_queue_destroy(&queue);
+}
+
+/**
+ * @brief Checks that a roster replaces the deltas queued before it only
+ */
+static void test_superseded_deltas(void) {
+    outbound_queue_configure(TEST_HIGH_WATER, OUTBOUND_POLICY_DISCONNECT, OUTBOUND_QUEUE_DEFAULT_MAX_BATCH);
+
+    OutboundQueue queue;
+    CHECK(outbound_queue_init(&queue) == 0);
+
+    RosterDelta delta;
+    memset(&delta, 0, sizeof(delta));
+    strcpy(delta.username, "someone");
+
+    delta.version = 1;
+    push(&queue, encode(MSG_ROSTER_DELTA, &delta, sizeof(delta)));
+    delta.version = 2;
+    push(&queue, encode(MSG_ROSTER_DELTA, &delta, sizeof(delta)));
+
+    Frame *roster[16];
+    const int page_count = encode_snapshot(MSG_ROSTER, 7, TEST_USERS, roster);
+    for (int i = 0; i < page_count; i++) {
+        push(&queue, roster[i]);
+    }
+
+    delta.version = 3;
+    push(&queue, encode(MSG_ROSTER_DELTA, &delta, sizeof(delta)));
+
+    CHECK(queue.count == (uint32_t) (page_count + 1));
+    check_snapshot(&queue, 0, 7, page_count);
+    CHECK(queue.count > (uint32_t) page_count && queued(&queue, page_count)->type == MSG_ROSTER_DELTA);
+    CHECK(queue.dropped_frames == 2);
+
+    outbound_queue_destroy(&queue);
+}
+
+/**
+ * @brief Checks that steady-state sends reuse cached sends
+ */
+static void test_send_cache(void) {
+    outbound_queue_configure(TEST_HIGH_WATER, OUTBOUND_POLICY_DISCONNECT, OUTBOUND_QUEUE_DEFAULT_MAX_BATCH);
+
+    OutboundQueue queue;
+    CHECK(outbound_queue_init(&queue) == 0);
+
+    ChatMessage message;
+    memset(&message, 0, sizeof(message));
+    strcpy(message.username, "sender");
+
+    OutboundSend *warm[TEST_SENDS];
+    for (int i = 0; i < TEST_SENDS; i++) {
+        warm[i] = outbound_queue_alloc_send();
+        CHECK(warm[i] != NULL);
+    }
+    for (int i = 0; i < TEST_SENDS; i++) {
+        if (warm[i]) {
+            outbound_queue_free_send(warm[i]);
+        }
+    }
+
+    OutboundStats before;
+    outbound_queue_stats(&before);
+
+    for (int round = 0; round < 1000; round++) {
+        OutboundSend *sends[TEST_SENDS];
+        for (int i = 0; i < TEST_SENDS; i++) {
+            push(&queue, encode(MSG_CHAT, &message, sizeof(message)));
+            sends[i] = outbound_queue_alloc_send();
+            CHECK(sends[i] != NULL);
+            if (sends[i]) {
+                CHECK(outbound_queue_prepare(&queue, sends[i]) == OUTBOUND_FLUSH_BLOCKED);
+            }
+        }
+        for (int i = 0; i < TEST_SENDS; i++) {
+            if (sends[i]) {
+                outbound_queue_complete(&queue, sends[i]->bytes, sends[i]->bytes);
+                outbound_queue_free_send(sends[i]);
+            }
+        }
+    }
+
+    OutboundStats after;
+    outbound_queue_stats(&after);
+    CHECK(after.send_allocations == before.send_allocations);
+    CHECK(queue.count == 0);
+
+    outbound_queue_destroy(&queue);
+    outbound_queue_shutdown();
+}
+
+/**
+ * @brief Runs the outbound queue tests
+ *
+ * @return 0 if every check passed, 1 otherwise
+ */
+int main(void) {
+    const OutboundPolicy policies[] = {
+        OUTBOUND_POLICY_DISCONNECT, OUTBOUND_POLICY_DROP_OLDEST
+    };
+
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        test_join_burst(policies[i]);
+        test_superseded_lists(policies[i]);
+    }
+    test_superseded_deltas();
+    test_send_cache();
+
+    if (failures > 0) {
+        fprintf(stderr, "%d outbound queue check%s failed\n", failures, failures == 1 ? "" : "s");
+        return 1;
+    }
+
+    printf("All outbound queue checks passed\n");
+    return 0;
+}
@@ -0,0 +1,222 @@
+/**
+ * @file protocol_test.c
+ * @brief Wire-format tests for the roster messages
+ *
+ * Encodes MSG_ROSTER_SYNC, MSG_ROSTER and MSG_ROSTER_DELTA in both
+ * protocol versions, compares the frames with the exact bytes the
+ * protocol specifies and decodes them back. Every multi-byte field must
+ * be big-endian and no struct padding may reach the wire.
+ *
+ * @author Jeremiah Hughes & Anthony Patton
+ * @date April 2025
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "common/protocol.h"
+
+#define CHECK(condition)                                                              \
+    do {                                                                              \
+        if (!(condition)) {                                                           \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                               \
+        }                                                                             \
+    } while (0)
+
+static int failures = 0;
+
+/**
+ * @brief Encodes a message and compares the frame with the expected bytes
+ *
+ * Also checks that protocol_encoded_size() predicted the frame length.
+ *
+ * @param name Name of the case, for failure messages
+ * @param version Protocol version
+ * @param type Message type
+ * @param data Message data
+ * @param data_length Length of the message data
+ * @param expected Expected frame, header included
+ * @param expected_length Length of the expected frame
+ */
+static void check_encoding(const char *name, const int version, const MessageType type, const void *data,
+                           const uint32_t data_length, const uint8_t *expected, const size_t expected_length) {
+    uint8_t frame[PROTOCOL_HEADER_SIZE + sizeof(Roster)];
+    memset(frame, 0xAA, sizeof(frame));
+
+    const int size = protocol_encoded_size(version, type, data, data_length);
+    const int length = protocol_encode(version, frame, type, data, data_length);
+
+    if (size != (int) expected_length || length != (int) expected_length ||
+        memcmp(frame, expected, expected_length) != 0) {
+        fprintf(stderr, "%s: expected %zu bytes, predicted %d, encoded %d\n", name, expected_length, size, length);
+        for (int i = 0; i < length && i < (int) sizeof(frame); i++) {
+            fprintf(stderr, "%02X%s", frame[i], i + 1 == length ? "\n" : " ");
+        }
+        failures++;
+    }
+}
+
+/**
+ * @brief Checks both encodings of MSG_ROSTER_SYNC
+ */
+static void test_roster_sync(void) {
+    const RosterSync sync = {0x01020304};
+    const uint8_t legacy[] = {MSG_ROSTER_SYNC, 0, 0, 0, 0, 0, 0, 4, 0x01, 0x02, 0x03, 0x04};
+    const uint8_t compact[] = {PROTOCOL_MAGIC, PROTOCOL_VERSION_COMPACT, MSG_ROSTER_SYNC, 0, 0, 0, 0, 4,
+                               0x01, 0x02, 0x03, 0x04};
+
+    check_encoding("legacy sync", PROTOCOL_VERSION_LEGACY, MSG_ROSTER_SYNC, &sync, sizeof(sync),
+                   legacy, sizeof(legacy));
+    check_encoding("compact sync", PROTOCOL_VERSION_COMPACT, MSG_ROSTER_SYNC, &sync, sizeof(sync),
+                   compact, sizeof(compact));
+
+    for (int version = PROTOCOL_VERSION_LEGACY; version <= PROTOCOL_VERSION_COMPACT; version++) {
+        const uint8_t *payload = (version == PROTOCOL_VERSION_LEGACY ? legacy : compact) + PROTOCOL_HEADER_SIZE;
+        RosterSync decoded = {0};
+        uint32_t length = 0;
+
+        CHECK(protocol_decode_payload(version, MSG_ROSTER_SYNC, payload, 4, &decoded, sizeof(decoded),
+                                      &length) == 0);
+        CHECK(length == sizeof(RosterSync));
+        CHECK(decoded.version == 0x01020304);
+    }
+}
+
+/**
+ * @brief Checks both encodings of MSG_ROSTER
+ */
+static void test_roster(void) {
+    Roster roster;
+    memset(&roster, 0, sizeof(roster));
+    roster.version = 0x00000107;
+    memcpy(roster.users, "Users\0bob\0", 10);
+    const uint32_t data_length = sizeof(roster.version) + 10;
+
+    const uint8_t payload[] = {0x00, 0x00, 0x01, 0x07, 'U', 's', 'e', 'r', 's', 0, 'b', 'o', 'b', 0};
+    uint8_t legacy[PROTOCOL_HEADER_SIZE + sizeof(payload)] = {MSG_ROSTER, 0, 0, 0, 0, 0, 0, sizeof(payload)};
+    uint8_t compact[PROTOCOL_HEADER_SIZE + sizeof(payload)] = {PROTOCOL_MAGIC, PROTOCOL_VERSION_COMPACT, MSG_ROSTER,
+                                                                0, 0, 0, 0, sizeof(payload)};
+    memcpy(legacy + PROTOCOL_HEADER_SIZE, payload, sizeof(payload));
+    memcpy(compact + PROTOCOL_HEADER_SIZE, payload, sizeof(payload));
+
+    check_encoding("legacy roster", PROTOCOL_VERSION_LEGACY, MSG_ROSTER, &roster, data_length,
+                   legacy, sizeof(legacy));
+    check_encoding("compact roster", PROTOCOL_VERSION_COMPACT, MSG_ROSTER, &roster, data_length,
+                   compact, sizeof(compact));
+
+    for (int version = PROTOCOL_VERSION_LEGACY; version <= PROTOCOL_VERSION_COMPACT; version++) {
+        Roster decoded;
+        uint32_t length = 0;
+
+        CHECK(protocol_decode_payload(version, MSG_ROSTER, payload, sizeof(payload), &decoded, sizeof(decoded),
+                                      &length) == 0);
+        CHECK(length == data_length);
+        CHECK(decoded.version == 0x00000107);
+        CHECK(memcmp(decoded.users, "Users\0bob\0", 10) == 0);
+    }
+}
+
+/**
+ * @brief Checks both encodings of MSG_ROSTER_DELTA
+ */
+static void test_roster_delta(void) {
+    RosterDelta delta;
+    memset(&delta, 0x55, sizeof(delta));
+    delta.version = 0x0A0B0C0D;
+    delta.action = ROSTER_DELTA_LEAVE;
+    memset(delta.username, 0, sizeof(delta.username));
+    strcpy(delta.username, "alice");
+
+    uint8_t legacy[PROTOCOL_HEADER_SIZE + 4 + 1 + MAX_USERNAME_LEN] = {
+        MSG_ROSTER_DELTA, 0, 0, 0, 0, 0, 0, 4 + 1 + MAX_USERNAME_LEN,
+        0x0A, 0x0B, 0x0C, 0x0D, ROSTER_DELTA_LEAVE, 'a', 'l', 'i', 'c', 'e'
+    };
+    const uint8_t compact[] = {PROTOCOL_MAGIC, PROTOCOL_VERSION_COMPACT, MSG_ROSTER_DELTA, 0, 0, 0, 0, 11,
+                               0x0A, 0x0B, 0x0C, 0x0D, ROSTER_DELTA_LEAVE, 5, 'a', 'l', 'i', 'c', 'e'};
+
+    check_encoding("legacy delta", PROTOCOL_VERSION_LEGACY, MSG_ROSTER_DELTA, &delta, sizeof(delta),
+                   legacy, sizeof(legacy));
+    check_encoding("compact delta", PROTOCOL_VERSION_COMPACT, MSG_ROSTER_DELTA, &delta, sizeof(delta),
+                   compact, sizeof(compact));
+
+    for (int version = PROTOCOL_VERSION_LEGACY; version <= PROTOCOL_VERSION_COMPACT; version++) {
+        const uint8_t *frame = version == PROTOCOL_VERSION_LEGACY ? legacy : compact;
+        const uint32_t payload_length = (uint32_t) (version == PROTOCOL_VERSION_LEGACY ? sizeof(legacy)
+                                                                                         : sizeof(compact)) -
+                                        PROTOCOL_HEADER_SIZE;
+        RosterDelta decoded;
+        uint32_t length = 0;
+
+        CHECK(protocol_decode_payload(version, MSG_ROSTER_DELTA, frame + PROTOCOL_HEADER_SIZE, payload_length,
+                                      &decoded, sizeof(decoded), &length) == 0);
+        CHECK(length == sizeof(RosterDelta));
+        CHECK(decoded.version == 0x0A0B0C0D);
+        CHECK(decoded.action == ROSTER_DELTA_LEAVE);
+        CHECK(strcmp(decoded.username, "alice") == 0);
+
+        CHECK(protocol_decode_payload(version, MSG_ROSTER_DELTA, frame + PROTOCOL_HEADER_SIZE, payload_length - 1,
+                                      &decoded, sizeof(decoded), &length) != 0);
+    }
+
+    const uint8_t trailing[] = {0x0A, 0x0B, 0x0C, 0x0D, ROSTER_DELTA_LEAVE, 5, 'a', 'l', 'i', 'c', 'e', 0};
+    RosterDelta decoded;
+    uint32_t length = 0;
+    CHECK(protocol_decode_payload(PROTOCOL_VERSION_COMPACT, MSG_ROSTER_DELTA, trailing, sizeof(trailing),
+                                  &decoded, sizeof(decoded), &length) != 0);
+}
+
+/**
+ * @brief Sends a legacy roster delta over a socket pair and receives it
+ */
+static void test_legacy_receive(void) {
+    int sockets[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+
+    RosterDelta delta;
+    memset(&delta, 0, sizeof(delta));
+    delta.version = 0x11223344;
+    delta.action = ROSTER_DELTA_JOIN;
+    strcpy(delta.username, "bob");
+
+    CHECK(protocol_send(sockets[0], PROTOCOL_VERSION_LEGACY, MSG_ROSTER_DELTA, &delta, sizeof(delta)) ==
+          PROTOCOL_HEADER_SIZE + 4 + 1 + MAX_USERNAME_LEN);
+
+    uint8_t buffer[COMPACT_MAX_PAYLOAD];
+    MessageType type = 0;
+    uint32_t length = 0;
+    CHECK(protocol_receive(sockets[1], PROTOCOL_VERSION_LEGACY, &type, buffer, &length) ==
+          PROTOCOL_HEADER_SIZE + 4 + 1 + MAX_USERNAME_LEN);
+
+    const RosterDelta *received = (const RosterDelta *) buffer;
+    CHECK(type == MSG_ROSTER_DELTA);
+    CHECK(length == sizeof(RosterDelta));
+    CHECK(received->version == 0x11223344);
+    CHECK(received->action == ROSTER_DELTA_JOIN);
+    CHECK(strcmp(received->username, "bob") == 0);
+
+    close(sockets[0]);
+    close(sockets[1]);
+}
+
+/**
+ * @brief Runs the protocol tests
+ *
+ * @return 0 if every check passed, 1 otherwise
+ */
+int main(void) {
+    test_roster_sync();
+    test_roster();
+    test_roster_delta();
+    test_legacy_receive();
+
+    if (failures > 0) {
+        fprintf(stderr, "%d protocol check%s failed\n", failures, failures == 1 ? "" : "s");
+        return 1;
+    }
+
+    printf("All protocol checks passed\n");
+    return 0;
+}
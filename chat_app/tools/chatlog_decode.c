@@ -0,0 +1,334 @@
+/**
+ * @file chatlog_decode.c
+ * @brief Renders a binary chat log back to text
+ *
+ * A binary log is a sequence of sessions, each starting with the file
+ * magic. Within a session, definition records map a format id to its
+ * format string and event records carry a format id, level, timestamp
+ * and the raw arguments. Each event is printed in the same layout the
+ * text logger uses.
+ *
+ * Usage: chatlog-decode [file]   (reads standard input when no file is given)
+ *
+ * @author Jeremiah Hughes & Anthony Patton
+ * @date April 2025
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../common/log_format.h"
+#include "../common/logger.h"
+
+#define DECODE_LINE_SIZE 8192
+
+/**
+ * @brief A format string seen in the current session
+ */
+typedef struct {
+    char *format;
+    int spec_count;
+    LogFormatSpec specs[LOG_FORMAT_MAX_SPECS];
+} DecodedFormat;
+
+static DecodedFormat formats[LOG_FORMAT_MAX_IDS];
+
+/**
+ * @brief Forgets every format string, as at the start of a new session
+ */
+static void reset_formats(void) {
+    for (int i = 0; i < LOG_FORMAT_MAX_IDS; i++) {
+        free(formats[i].format);
+        formats[i].format = NULL;
+        formats[i].spec_count = 0;
+    }
+
+    formats[LOG_FORMAT_TEXT_ID].format = strdup("%s");
+    formats[LOG_FORMAT_TEXT_ID].spec_count = log_format_parse("%s", formats[LOG_FORMAT_TEXT_ID].specs,
+                                                              LOG_FORMAT_MAX_SPECS);
+}
+
+/**
+ * @brief Records the format string for an id
+ *
+ * @param body The definition record body
+ * @param length Length of the body
+ * @return 0 on success, -1 if the record is malformed
+ */
+static int define_format(const unsigned char *body, const size_t length) {
+    uint32_t id;
+    if (length < sizeof(id)) {
+        return -1;
+    }
+    memcpy(&id, body, sizeof(id));
+    if (id >= LOG_FORMAT_MAX_IDS) {
+        return -1;
+    }
+
+    DecodedFormat *format = &formats[id];
+    free(format->format);
+    format->format = strndup((const char *) body + sizeof(id), length - sizeof(id));
+    if (format->format == NULL) {
+        return -1;
+    }
+
+    format->spec_count = log_format_parse(format->format, format->specs, LOG_FORMAT_MAX_SPECS);
+    return format->spec_count < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Copies a fixed-size argument out of an event body
+ *
+ * @param dest Where to store the value
+ * @param size Size of the value
+ * @param args Cursor into the argument bytes, advanced past the value
+ * @param end End of the argument bytes
+ * @return 0 on success, -1 if the record is truncated
+ */
+static int take(void *dest, const size_t size, const unsigned char **args, const unsigned char *end) {
+    if ((size_t) (end - *args) < size) {
+        return -1;
+    }
+    memcpy(dest, *args, size);
+    *args += size;
+    return 0;
+}
+
+/**
+ * @brief Appends one conversion to the output line
+ *
+ * @param line Output buffer
+ * @param used Bytes already used in the buffer
+ * @param spec The conversion specification, NUL-terminated
+ * @param stars Number of '*' width/precision arguments
+ * @param star_values The '*' arguments
+ * @param type The argument type
+ * @param args Cursor into the argument bytes
+ * @param end End of the argument bytes
+ * @return The new number of bytes used, or -1 if the record is truncated
+ */
+static int render_spec(char *line, int used, const char *spec, const int stars, const int *star_values,
+                       const LogArgType type, const unsigned char **args, const unsigned char *end) {
+    char *out = line + used;
+    const size_t room = DECODE_LINE_SIZE - (size_t) used;
+    int written = 0;
+
+#define RENDER(value) \
+    do { \
+        if (stars == 0) { \
+            written = snprintf(out, room, spec, value); \
+        } else if (stars == 1) { \
+            written = snprintf(out, room, spec, star_values[0], value); \
+        } else { \
+            written = snprintf(out, room, spec, star_values[0], star_values[1], value); \
+        } \
+    } while (0)
+
+    switch (type) {
+        case LOG_ARG_INT: {
+            int value;
+            if (take(&value, sizeof(value), args, end) != 0) {
+                return -1;
+            }
+            RENDER(value);
+            break;
+        }
+        case LOG_ARG_LONG: {
+            long long value;
+            if (take(&value, sizeof(value), args, end) != 0) {
+                return -1;
+            }
+            RENDER(value);
+            break;
+        }
+        case LOG_ARG_DOUBLE: {
+            double value;
+            if (take(&value, sizeof(value), args, end) != 0) {
+                return -1;
+            }
+            RENDER(value);
+            break;
+        }
+        case LOG_ARG_POINTER: {
+            uint64_t value;
+            if (take(&value, sizeof(value), args, end) != 0) {
+                return -1;
+            }
+            RENDER((void *) (uintptr_t) value);
+            break;
+        }
+        case LOG_ARG_STRING: {
+            uint16_t length;
+            if (take(&length, sizeof(length), args, end) != 0 || (size_t) (end - *args) < length) {
+                return -1;
+            }
+            char *value = strndup((const char *) *args, length);
+            if (value == NULL) {
+                return -1;
+            }
+            *args += length;
+            RENDER(value);
+            free(value);
+            break;
+        }
+        default:
+            written = snprintf(out, room, "%%");
+            break;
+    }
+
+#undef RENDER
+
+    if (written < 0) {
+        return used;
+    }
+    return (size_t) written >= room ? DECODE_LINE_SIZE - 1 : used + written;
+}
+
+/**
+ * @brief Prints one event record
+ *
+ * @param body The event record body
+ * @param length Length of the body
+ * @return 0 on success, -1 if the record is malformed
+ */
+static int print_event(const unsigned char *body, const size_t length) {
+    const size_t header = LOG_EVENT_HEADER_SIZE - LOG_RECORD_HEADER_SIZE;
+    if (length < header) {
+        return -1;
+    }
+
+    uint32_t id;
+    uint8_t level;
+    uint64_t timestamp;
+    memcpy(&id, body, sizeof(id));
+    memcpy(&level, body + 4, sizeof(level));
+    memcpy(&timestamp, body + 5, sizeof(timestamp));
+
+    if (id >= LOG_FORMAT_MAX_IDS || formats[id].format == NULL) {
+        fprintf(stderr, "chatlog-decode: event refers to undefined format %u\n", id);
+        return -1;
+    }
+
+    const DecodedFormat *format = &formats[id];
+    const unsigned char *args = body + header;
+    const unsigned char *end = body + length;
+
+    char line[DECODE_LINE_SIZE] = "";
+    int used = 0;
+    size_t literal = 0;
+
+    for (int i = 0; i < format->spec_count; i++) {
+        const LogFormatSpec *spec = &format->specs[i];
+
+        used += snprintf(line + used, DECODE_LINE_SIZE - used, "%.*s",
+                         (int) (spec->start - literal), format->format + literal);
+        if (used >= DECODE_LINE_SIZE) {
+            used = DECODE_LINE_SIZE - 1;
+        }
+
+        int star_values[2] = {0, 0};
+        for (int star = 0; star < spec->stars; star++) {
+            if (take(&star_values[star], sizeof(int), &args, end) != 0) {
+                return -1;
+            }
+        }
+
+        char text[64];
+        snprintf(text, sizeof(text), "%.*s", (int) (spec->end - spec->start), format->format + spec->start);
+
+        used = render_spec(line, used, text, spec->stars, star_values, (LogArgType) spec->type, &args, end);
+        if (used < 0) {
+            return -1;
+        }
+        literal = spec->end;
+    }
+
+    const time_t seconds = (time_t) (timestamp / 1000000000ULL);
+    struct tm tm_info;
+    char time_str[20];
+    localtime_r(&seconds, &tm_info);
+    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &tm_info);
+
+    printf("[%s] [%s] %s%s\n", time_str, log_type_str((LogType) level), line, format->format + literal);
+    return 0;
+}
+
+/**
+ * @brief Main function
+ *
+ * @param argc Number of command line arguments
+ * @param argv Command line arguments
+ * @return 0 if the whole log was decoded, non-zero otherwise
+ */
+int main(const int argc, char *argv[]) {
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [binary_log_file]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *input = argc == 2 ? fopen(argv[1], "rb") : stdin;
+    if (input == NULL) {
+        perror("Failed to open log file");
+        return EXIT_FAILURE;
+    }
+
+    int status = EXIT_SUCCESS;
+    int in_session = 0;
+    unsigned char header[LOG_RECORD_HEADER_SIZE];
+    unsigned char body[UINT16_MAX];
+
+    while (fread(header, 1, 1, input) == 1) {
+        if (header[0] == (unsigned char) LOG_FILE_MAGIC[0]) {
+            char magic[LOG_FILE_MAGIC_SIZE];
+            magic[0] = (char) header[0];
+            if (fread(magic + 1, 1, LOG_FILE_MAGIC_SIZE - 1, input) != LOG_FILE_MAGIC_SIZE - 1 ||
+                memcmp(magic, LOG_FILE_MAGIC, LOG_FILE_MAGIC_SIZE) != 0) {
+                fprintf(stderr, "chatlog-decode: not a binary chat log\n");
+                status = EXIT_FAILURE;
+                break;
+            }
+            reset_formats();
+            in_session = 1;
+            continue;
+        }
+
+        uint16_t length;
+        if (!in_session || fread(header + 1, 1, sizeof(length), input) != sizeof(length)) {
+            fprintf(stderr, "chatlog-decode: %s\n", in_session ? "truncated record" : "not a binary chat log");
+            status = EXIT_FAILURE;
+            break;
+        }
+        memcpy(&length, header + 1, sizeof(length));
+
+        if (fread(body, 1, length, input) != length) {
+            fprintf(stderr, "chatlog-decode: truncated record\n");
+            status = EXIT_FAILURE;
+            break;
+        }
+
+        int result;
+        switch (header[0]) {
+            case LOG_RECORD_DEFINITION:
+                result = define_format(body, length);
+                break;
+            case LOG_RECORD_EVENT:
+                result = print_event(body, length);
+                break;
+            default:
+                result = -1;
+                break;
+        }
+
+        if (result != 0) {
+            fprintf(stderr, "chatlog-decode: skipping malformed record (kind %u)\n", header[0]);
+            status = EXIT_FAILURE;
+        }
+    }
+
+    if (input != stdin) {
+        fclose(input);
+    }
+    reset_formats();
+    return status;
+}